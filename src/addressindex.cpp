@@ -0,0 +1,191 @@
+// Copyright (c) 2017 The Bitcoin Core developers
+// Distributed under the MIT software license, see the accompanying
+// file COPYING or http://www.opensource.org/licenses/mit-license.php.
+
+#include "addressindex.h"
+
+#include "crypto/sha256.h"
+#include "primitives/block.h"
+#include "script/script.h"
+#include "undo.h"
+#include "util.h"
+#include "validation.h"
+
+#include <boost/foreach.hpp>
+#include <boost/scoped_ptr.hpp>
+
+static const char DB_ADDRESS = 'a';
+static const char DB_BALANCE = 'b';
+static const char DB_BEST_BLOCK = 'B';
+
+CAddressIndex* paddressindex = NULL;
+
+uint256 GetScriptHash(const CScript& scriptPubKey)
+{
+    uint256 hash;
+    CSHA256().Write(scriptPubKey.data(), scriptPubKey.size()).Finalize(hash.begin());
+    return hash;
+}
+
+namespace {
+
+/** Add or remove a history entry, and update the balance of its script */
+void UpdateEntry(CDBBatch& batch, const CDBWrapper& db, std::map<uint256, CAddressBalance>& mapBalances,
+                 const CAddressIndexKey& key, const CAddressIndexValue& value, bool fUndo)
+{
+    std::map<uint256, CAddressBalance>::iterator it = mapBalances.find(key.scriptHash);
+    if (it == mapBalances.end()) {
+        it = mapBalances.insert(std::make_pair(key.scriptHash, CAddressBalance())).first;
+        db.Read(std::make_pair(DB_BALANCE, key.scriptHash), it->second);
+    }
+    CAddressBalance& balance = it->second;
+
+    if (!fUndo) {
+        batch.Write(std::make_pair(DB_ADDRESS, key), value);
+        balance.nBalance += value.nValue;
+        if (!key.fSpend)
+            balance.nReceived += value.nValue;
+        balance.nEntries++;
+    } else {
+        batch.Erase(std::make_pair(DB_ADDRESS, key));
+        balance.nBalance -= value.nValue;
+        if (!key.fSpend)
+            balance.nReceived -= value.nValue;
+        balance.nEntries--;
+    }
+}
+
+} // anon namespace
+
+CAddressIndex::CAddressIndex(size_t nCacheSize, bool fMemory, bool fWipe)
+    : CBackgroundIndex("address index", ADDRESSINDEX_BATCH_SIZE), db(GetDataDir() / "addresses", nCacheSize, fMemory, fWipe)
+{
+}
+
+bool CAddressIndex::ReadBestBlock(CBlockLocator& locator) const
+{
+    return db.Read(DB_BEST_BLOCK, locator);
+}
+
+bool CAddressIndex::IndexBlock(CDBBatch& batch, std::map<uint256, CAddressBalance>& mapBalances, const CIndexedBlock& indexedBlock, bool fUndo) const
+{
+    CBlock block;
+    CBlockUndo blockUndo;
+    if (!ReadBlock(indexedBlock, block) || !ReadUndo(indexedBlock, blockUndo))
+        return false;
+    if (indexedBlock.nHeight > 0 && blockUndo.vtxundo.size() + 1 != block.vtx.size())
+        return error("%s: undo data of block %s does not match the block", __func__, indexedBlock.hash.ToString());
+
+    for (unsigned int i = 0; i < block.vtx.size(); i++) {
+        const CTransaction& tx = *block.vtx[i];
+        const uint256& txid = tx.GetHash();
+
+        for (unsigned int n = 0; n < tx.vout.size(); n++) {
+            const CTxOut& txout = tx.vout[n];
+            if (txout.scriptPubKey.IsUnspendable())
+                continue;
+            CAddressIndexKey key(GetScriptHash(txout.scriptPubKey), indexedBlock.nHeight, i, txid, n, false);
+            UpdateEntry(batch, db, mapBalances, key, CAddressIndexValue(txout.nValue, COutPoint()), fUndo);
+        }
+
+        if (tx.IsCoinBase())
+            continue;
+        const CTxUndo& txundo = blockUndo.vtxundo[i - 1];
+        if (txundo.vprevout.size() != tx.vin.size())
+            return error("%s: undo data of transaction %s does not match it", __func__, txid.ToString());
+        for (unsigned int n = 0; n < tx.vin.size(); n++) {
+            const CTxOut& prevout = txundo.vprevout[n].out;
+            CAddressIndexKey key(GetScriptHash(prevout.scriptPubKey), indexedBlock.nHeight, i, txid, n, true);
+            UpdateEntry(batch, db, mapBalances, key, CAddressIndexValue(-prevout.nValue, tx.vin[n].prevout), fUndo);
+        }
+    }
+    return true;
+}
+
+bool CAddressIndex::WriteBatch(CDBBatch& batch, const std::map<uint256, CAddressBalance>& mapBalances, const CBlockLocator& locator)
+{
+    for (std::map<uint256, CAddressBalance>::const_iterator it = mapBalances.begin(); it != mapBalances.end(); ++it) {
+        if (it->second.nEntries == 0)
+            batch.Erase(std::make_pair(DB_BALANCE, it->first));
+        else
+            batch.Write(std::make_pair(DB_BALANCE, it->first), it->second);
+    }
+    // Balances are not idempotent: the blocks and the locator must be written at once
+    batch.Write(DB_BEST_BLOCK, locator);
+    return db.WriteBatch(batch);
+}
+
+bool CAddressIndex::WriteBlocks(const std::vector<CIndexedBlock>& vBlocks, const CBlockLocator& locator)
+{
+    CDBBatch batch(db);
+    std::map<uint256, CAddressBalance> mapBalances;
+    BOOST_FOREACH(const CIndexedBlock& indexedBlock, vBlocks) {
+        if (!IndexBlock(batch, mapBalances, indexedBlock, false))
+            return false;
+    }
+    return WriteBatch(batch, mapBalances, locator);
+}
+
+bool CAddressIndex::RewindBlocks(const std::vector<CIndexedBlock>& vBlocks, const CBlockLocator& locator)
+{
+    CDBBatch batch(db);
+    std::map<uint256, CAddressBalance> mapBalances;
+    BOOST_FOREACH(const CIndexedBlock& indexedBlock, vBlocks) {
+        if (!IndexBlock(batch, mapBalances, indexedBlock, true))
+            return false;
+    }
+    return WriteBatch(batch, mapBalances, locator);
+}
+
+void CAddressIndex::ReadBalance(const CDBSnapshot& snapshot, const uint256& scriptHash, CAddressBalance& balance, const CBlockIndex*& pindexBest) const
+{
+    pindexBest = NULL;
+    CBlockLocator locator;
+    if (snapshot.Read(DB_BEST_BLOCK, locator) && !locator.IsNull()) {
+        LOCK(cs_main);
+        BlockMap::const_iterator it = mapBlockIndex.find(locator.vHave[0]);
+        if (it != mapBlockIndex.end())
+            pindexBest = it->second;
+    }
+
+    balance = CAddressBalance();
+    snapshot.Read(std::make_pair(DB_BALANCE, scriptHash), balance);
+}
+
+bool CAddressIndex::GetBalance(const uint256& scriptHash, CAddressBalance& balance, const CBlockIndex*& pindexBest) const
+{
+    // Blocks may be written meanwhile; the totals must be those of pindexBest
+    CDBSnapshot snapshot(db);
+    ReadBalance(snapshot, scriptHash, balance, pindexBest);
+    return true;
+}
+
+bool CAddressIndex::GetHistory(const uint256& scriptHash, uint64_t nSkip, unsigned int nCount, CAddressBalance& balance,
+                               std::vector<CAddressHistoryEntry>& vEntries, const CBlockIndex*& pindexBest) const
+{
+    vEntries.clear();
+    CDBSnapshot snapshot(db);
+    ReadBalance(snapshot, scriptHash, balance, pindexBest);
+    if (nCount == 0)
+        return true;
+
+    // Skipped entries are still walked over; only their keys are decoded
+    boost::scoped_ptr<CDBIterator> pcursor(snapshot.NewIterator());
+    pcursor->Seek(std::make_pair(DB_ADDRESS, CAddressIndexKey(scriptHash, 0, 0, uint256(), 0, false)));
+    for (; pcursor->Valid(); pcursor->Next()) {
+        std::pair<char, CAddressIndexKey> key;
+        if (!pcursor->GetKey(key) || key.first != DB_ADDRESS || key.second.scriptHash != scriptHash)
+            break;
+        if (nSkip > 0) {
+            nSkip--;
+            continue;
+        }
+        CAddressIndexValue value;
+        if (!pcursor->GetValue(value))
+            return error("%s: failed to read address index entry", __func__);
+        vEntries.push_back(std::make_pair(key.second, value));
+        if (vEntries.size() >= nCount)
+            break;
+    }
+    return true;
+}
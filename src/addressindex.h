@@ -0,0 +1,158 @@
+// Copyright (c) 2017 The Bitcoin Core developers
+// Distributed under the MIT software license, see the accompanying
+// file COPYING or http://www.opensource.org/licenses/mit-license.php.
+
+#ifndef BITCOIN_ADDRESSINDEX_H
+#define BITCOIN_ADDRESSINDEX_H
+
+#include "amount.h"
+#include "backgroundindex.h"
+#include "crypto/common.h"
+#include "dbwrapper.h"
+#include "primitives/transaction.h"
+#include "serialize.h"
+#include "uint256.h"
+
+#include <map>
+#include <vector>
+
+class CScript;
+
+/** Default for -addressindex */
+static const bool DEFAULT_ADDRESSINDEX = false;
+/** Number of blocks the address index writes at once */
+static const unsigned int ADDRESSINDEX_BATCH_SIZE = 20;
+/** Maximum number of entries returned by one history query */
+static const unsigned int MAX_ADDRESS_HISTORY_COUNT = 1000;
+
+/** SHA256 of a scriptPubKey, which the address index is keyed by */
+uint256 GetScriptHash(const CScript& scriptPubKey);
+
+/**
+ * One output paying to a script, or one input spending such an output.
+ * Keys sort by script hash, then by height and by the position of the
+ * transaction in its block, so that the history of a script is a range of
+ * the database in chain order, with spends after the outputs they spend.
+ */
+struct CAddressIndexKey
+{
+    uint256 scriptHash;
+    int nHeight;
+    uint32_t nTxIndex;  //!< Position of the transaction in its block
+    uint256 txid;
+    uint32_t n;         //!< Output index, or input index of a spend
+    bool fSpend;
+
+    CAddressIndexKey() : nHeight(0), nTxIndex(0), n(0), fSpend(false) {}
+    CAddressIndexKey(const uint256& scriptHashIn, int nHeightIn, uint32_t nTxIndexIn, const uint256& txidIn, uint32_t nIn, bool fSpendIn)
+        : scriptHash(scriptHashIn), nHeight(nHeightIn), nTxIndex(nTxIndexIn), txid(txidIn), n(nIn), fSpend(fSpendIn) {}
+
+    template <typename Stream>
+    void Serialize(Stream& s) const {
+        s << scriptHash;
+        // Big endian, so that keys sort by height and position
+        unsigned char buf[8];
+        WriteBE32(buf, nHeight);
+        WriteBE32(buf + 4, nTxIndex);
+        s.write((char*)buf, 8);
+        s << txid << n << fSpend;
+    }
+
+    template <typename Stream>
+    void Unserialize(Stream& s) {
+        s >> scriptHash;
+        unsigned char buf[8];
+        s.read((char*)buf, 8);
+        nHeight = ReadBE32(buf);
+        nTxIndex = ReadBE32(buf + 4);
+        s >> txid >> n >> fSpend;
+    }
+};
+
+struct CAddressIndexValue
+{
+    //! Value received, or minus the value spent
+    CAmount nValue;
+    //! Output spent, for spends
+    COutPoint prevout;
+
+    CAddressIndexValue() : nValue(0) {}
+    CAddressIndexValue(CAmount nValueIn, const COutPoint& prevoutIn) : nValue(nValueIn), prevout(prevoutIn) {}
+
+    ADD_SERIALIZE_METHODS;
+
+    template <typename Stream, typename Operation>
+    inline void SerializationOp(Stream& s, Operation ser_action) {
+        READWRITE(nValue);
+        READWRITE(prevout);
+    }
+};
+
+/** Running totals of a script, as of the last block indexed */
+struct CAddressBalance
+{
+    CAmount nBalance;
+    CAmount nReceived;
+    //! Number of history entries
+    uint64_t nEntries;
+
+    CAddressBalance() : nBalance(0), nReceived(0), nEntries(0) {}
+
+    ADD_SERIALIZE_METHODS;
+
+    template <typename Stream, typename Operation>
+    inline void SerializationOp(Stream& s, Operation ser_action) {
+        READWRITE(nBalance);
+        READWRITE(nReceived);
+        READWRITE(VARINT(nEntries));
+    }
+};
+
+typedef std::pair<CAddressIndexKey, CAddressIndexValue> CAddressHistoryEntry;
+
+/**
+ * Index of the outputs of the active chain by the hash of their
+ * scriptPubKey, with the inputs that spend them and the balance of each
+ * script (-addressindex), in its own database under <datadir>/addresses.
+ * Blocks that are disconnected from the active chain are removed from it
+ * again, balances included.
+ */
+class CAddressIndex : public CBackgroundIndex
+{
+private:
+    CDBWrapper db;
+
+    /** Add (or with fUndo, remove) the entries of a block, and update balances */
+    bool IndexBlock(CDBBatch& batch, std::map<uint256, CAddressBalance>& mapBalances, const CIndexedBlock& indexedBlock, bool fUndo) const;
+    bool WriteBatch(CDBBatch& batch, const std::map<uint256, CAddressBalance>& mapBalances, const CBlockLocator& locator);
+
+    /** The last block indexed, and the totals of a script, as of a snapshot */
+    void ReadBalance(const CDBSnapshot& snapshot, const uint256& scriptHash, CAddressBalance& balance, const CBlockIndex*& pindexBest) const;
+
+protected:
+    bool ReadBestBlock(CBlockLocator& locator) const;
+    bool WriteBlocks(const std::vector<CIndexedBlock>& vBlocks, const CBlockLocator& locator);
+    bool RewindBlocks(const std::vector<CIndexedBlock>& vBlocks, const CBlockLocator& locator);
+
+public:
+    CAddressIndex(size_t nCacheSize, bool fMemory = false, bool fWipe = false);
+
+    /**
+     * Totals of a script; all zero if it was never paid to. pindexBest is set
+     * to the last block indexed as of the same read, or NULL if none was.
+     */
+    bool GetBalance(const uint256& scriptHash, CAddressBalance& balance, const CBlockIndex*& pindexBest) const;
+
+    /**
+     * Up to nCount history entries of a script in chain order, skipping the
+     * first nSkip, with the totals and the last block indexed as of the same
+     * read.
+     */
+    bool GetHistory(const uint256& scriptHash, uint64_t nSkip, unsigned int nCount, CAddressBalance& balance,
+                    std::vector<CAddressHistoryEntry>& vEntries, const CBlockIndex*& pindexBest) const;
+};
+
+/** The address index, if -addressindex is set */
+extern CAddressIndex* paddressindex;
+
+#endif // BITCOIN_ADDRESSINDEX_H
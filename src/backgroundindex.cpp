@@ -0,0 +1,151 @@
+// Copyright (c) 2017 The Bitcoin Core developers
+// Distributed under the MIT software license, see the accompanying
+// file COPYING or http://www.opensource.org/licenses/mit-license.php.
+
+#include "backgroundindex.h"
+
+#include "chainparams.h"
+#include "primitives/block.h"
+#include "undo.h"
+#include "util.h"
+#include "utiltime.h"
+#include "validation.h"
+
+#include <boost/thread.hpp>
+
+CIndexedBlock::CIndexedBlock(const CBlockIndex* pindexIn)
+    : pindex(pindexIn), hash(pindexIn->GetBlockHash()), nHeight(pindexIn->nHeight),
+      pos(pindexIn->GetBlockPos()), undoPos(pindexIn->GetUndoPos())
+{
+    if (pindexIn->pprev)
+        hashPrev = pindexIn->pprev->GetBlockHash();
+}
+
+CBackgroundIndex::CBackgroundIndex(const std::string& strNameIn, unsigned int nBatchSizeIn)
+    : strName(strNameIn), nBatchSize(nBatchSizeIn), pindexBest(NULL), fNewTip(false)
+{
+}
+
+bool CBackgroundIndex::Init()
+{
+    AssertLockHeld(cs_main);
+
+    const CBlockIndex* pindex = NULL;
+    CBlockLocator locator;
+    if (ReadBestBlock(locator) && !locator.IsNull()) {
+        // Continue from the last block indexed, even if it was reorganized
+        // away since, so that SyncStep rewinds it.
+        BlockMap::const_iterator mi = mapBlockIndex.find(locator.vHave[0]);
+        if (mi != mapBlockIndex.end()) {
+            pindex = mi->second;
+        } else {
+            pindex = FindForkInGlobalIndex(chainActive, locator);
+            LogPrintf("%s: last block of the %s is unknown, continuing from height %d\n", __func__, strName, pindex ? pindex->nHeight : -1);
+        }
+    }
+
+    LOCK(cs);
+    pindexBest = pindex;
+    if (pindex)
+        LogPrintf("%s: %s at height %d\n", __func__, strName, pindex->nHeight);
+    return true;
+}
+
+void CBackgroundIndex::UpdatedBlockTip(const CBlockIndex *pindexNew, const CBlockIndex *pindexFork, bool fInitialDownload)
+{
+    boost::unique_lock<boost::mutex> lock(mutexTip);
+    fNewTip = true;
+    condTip.notify_one();
+}
+
+bool CBackgroundIndex::ReadBlock(const CIndexedBlock& block, CBlock& blockOut)
+{
+    if (!ReadBlockFromDisk(blockOut, block.pos, Params().GetConsensus()) || blockOut.GetHash() != block.hash)
+        return error("%s: failed to read block %s", __func__, block.hash.ToString());
+    return true;
+}
+
+bool CBackgroundIndex::ReadUndo(const CIndexedBlock& block, CBlockUndo& blockUndo)
+{
+    blockUndo.vtxundo.clear();
+    if (block.nHeight == 0)
+        return true;
+    if (!UndoReadFromDisk(blockUndo, block.undoPos, block.hashPrev))
+        return error("%s: failed to read undo data of block %s", __func__, block.hash.ToString());
+    return true;
+}
+
+bool CBackgroundIndex::SyncStep()
+{
+    std::vector<CIndexedBlock> vBlocks;
+    CBlockLocator locator;
+    const CBlockIndex* pindexNewBest = NULL;
+    bool fRewind = false;
+    {
+        LOCK(cs_main);
+        const CBlockIndex* pindex = GetBest();
+        if (pindex && !chainActive.Contains(pindex)) {
+            // Reorganized away: take the blocks back down to the fork
+            fRewind = true;
+            const CBlockIndex* pindexFork = chainActive.FindFork(pindex);
+            for (; pindex != pindexFork && vBlocks.size() < nBatchSize; pindex = pindex->pprev) {
+                if (!(pindex->nStatus & BLOCK_HAVE_DATA) || (pindex->pprev && !(pindex->nStatus & BLOCK_HAVE_UNDO)))
+                    return error("%s: %s: block %s at height %d is not available", __func__, strName, pindex->GetBlockHash().ToString(), pindex->nHeight);
+                vBlocks.push_back(CIndexedBlock(pindex));
+            }
+            pindexNewBest = pindex;
+        } else {
+            const CBlockIndex* pindexNext = pindex ? chainActive.Next(pindex) : chainActive.Genesis();
+            for (; pindexNext && vBlocks.size() < nBatchSize; pindexNext = chainActive.Next(pindexNext)) {
+                if (!(pindexNext->nStatus & BLOCK_HAVE_DATA) || (pindexNext->pprev && !(pindexNext->nStatus & BLOCK_HAVE_UNDO)))
+                    return error("%s: %s: block %s at height %d is not available", __func__, strName, pindexNext->GetBlockHash().ToString(), pindexNext->nHeight);
+                vBlocks.push_back(CIndexedBlock(pindexNext));
+            }
+            if (vBlocks.empty())
+                return false;
+            pindexNewBest = vBlocks.back().pindex;
+        }
+        if (pindexNewBest)
+            locator = chainActive.GetLocator(pindexNewBest);
+    }
+
+    // Read and write the blocks without holding cs_main
+    if (fRewind) {
+        if (!RewindBlocks(vBlocks, locator))
+            return error("%s: failed to rewind the %s", __func__, strName);
+    } else {
+        if (!WriteBlocks(vBlocks, locator))
+            return error("%s: failed to write to the %s", __func__, strName);
+    }
+
+    LOCK(cs);
+    pindexBest = pindexNewBest;
+    return true;
+}
+
+void CBackgroundIndex::ThreadSync()
+{
+    int64_t nLastLog = GetTime();
+    while (true) {
+        boost::this_thread::interruption_point();
+        if (SyncStep()) {
+            if (GetTime() >= nLastLog + 60) {
+                nLastLog = GetTime();
+                const CBlockIndex* pindex = GetBest();
+                LogPrintf("Building the %s, at height %d\n", strName, pindex ? pindex->nHeight : -1);
+            }
+            continue;
+        }
+
+        boost::unique_lock<boost::mutex> lock(mutexTip);
+        while (!fNewTip)
+            condTip.wait(lock);
+        fNewTip = false;
+    }
+}
+
+const CBlockIndex* CBackgroundIndex::GetBest() const
+{
+    LOCK(cs);
+    return pindexBest;
+}
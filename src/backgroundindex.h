@@ -0,0 +1,115 @@
+// Copyright (c) 2017 The Bitcoin Core developers
+// Distributed under the MIT software license, see the accompanying
+// file COPYING or http://www.opensource.org/licenses/mit-license.php.
+
+#ifndef BITCOIN_BACKGROUNDINDEX_H
+#define BITCOIN_BACKGROUNDINDEX_H
+
+#include "chain.h"
+#include "sync.h"
+#include "uint256.h"
+#include "validationinterface.h"
+
+#include <string>
+#include <vector>
+
+#include <boost/thread/condition_variable.hpp>
+#include <boost/thread/mutex.hpp>
+
+class CBlock;
+class CBlockUndo;
+
+/** Default number of blocks an index reads between two acquisitions of cs_main */
+static const unsigned int BACKGROUND_INDEX_BATCH_SIZE = 100;
+
+/** Where to find a block that is being indexed, as taken from its CBlockIndex under cs_main */
+struct CIndexedBlock
+{
+    const CBlockIndex* pindex;
+    uint256 hash;
+    uint256 hashPrev;
+    int nHeight;
+    CDiskBlockPos pos;
+    CDiskBlockPos undoPos;
+
+    explicit CIndexedBlock(const CBlockIndex* pindexIn);
+};
+
+/**
+ * An optional index of the blocks of the active chain, built by a thread of
+ * its own from the block and undo files. The thread works its way up from
+ * the last block it indexed to the tip of the active chain, a batch at a
+ * time, and then waits for UpdatedBlockTip to tell it about new ones; cs_main
+ * is only held to find the next blocks, never while reading or writing, so
+ * validation does not wait for the index and the index can be built while
+ * the node keeps running. After a reorganization it rewinds the blocks that
+ * were disconnected and continues from the fork.
+ *
+ * Subclasses store the index, along with a locator of the last block
+ * indexed, which they write atomically with the blocks.
+ */
+class CBackgroundIndex : public CValidationInterface
+{
+private:
+    const std::string strName;
+    const unsigned int nBatchSize;
+
+    /** Protects pindexBest */
+    mutable CCriticalSection cs;
+    //! Last block indexed, NULL if none
+    const CBlockIndex* pindexBest;
+
+    boost::mutex mutexTip;
+    boost::condition_variable condTip;
+    bool fNewTip;
+
+    CBackgroundIndex(const CBackgroundIndex&);
+    void operator=(const CBackgroundIndex&);
+
+protected:
+    void UpdatedBlockTip(const CBlockIndex *pindexNew, const CBlockIndex *pindexFork, bool fInitialDownload);
+
+    /** Read the locator written with the last blocks indexed; false if there is none */
+    virtual bool ReadBestBlock(CBlockLocator& locator) const = 0;
+
+    /**
+     * Index the blocks, which follow the last block indexed on the active
+     * chain in this order, and write locator, which describes the last of
+     * them.
+     */
+    virtual bool WriteBlocks(const std::vector<CIndexedBlock>& vBlocks, const CBlockLocator& locator) = 0;
+
+    /**
+     * Remove the blocks, the last blocks indexed from the highest down, which
+     * are no longer on the active chain, and write locator, which describes
+     * the parent of the last of them. By default nothing is removed, for
+     * indexes whose entries of stale blocks do no harm.
+     */
+    virtual bool RewindBlocks(const std::vector<CIndexedBlock>& vBlocks, const CBlockLocator& locator) { return true; }
+
+    static bool ReadBlock(const CIndexedBlock& block, CBlock& blockOut);
+    //! The undo data of a block; empty for the genesis block
+    static bool ReadUndo(const CIndexedBlock& block, CBlockUndo& blockUndo);
+
+public:
+    CBackgroundIndex(const std::string& strNameIn, unsigned int nBatchSizeIn = BACKGROUND_INDEX_BATCH_SIZE);
+    virtual ~CBackgroundIndex() {}
+
+    /** Continue from where the index left off. Call once the block index is loaded, holding cs_main. */
+    bool Init();
+
+    /**
+     * Index the next batch of blocks of the active chain, or rewind the
+     * blocks that were disconnected from it. Returns false if the index is
+     * caught up with the tip, or it cannot read or write a block.
+     */
+    bool SyncStep();
+
+    /** Keep the index in sync with the active chain, until interrupted */
+    void ThreadSync();
+
+    /** Last block indexed, NULL if none */
+    const CBlockIndex* GetBest() const;
+};
+
+#endif // BITCOIN_BACKGROUNDINDEX_H
@@ -0,0 +1,78 @@
+// Copyright (c) 2017 The Bitcoin Core developers
+// Distributed under the MIT software license, see the accompanying
+// file COPYING or http://www.opensource.org/licenses/mit-license.php.
+
+#include "bench.h"
+#include "chain_setup.h"
+
+#include "arith_uint256.h"
+#include "chainparams.h"
+#include "coins.h"
+#include "miner.h"
+#include "txmempool.h"
+#include "validation.h"
+
+// Number of unrelated transactions in the mempool; each has one child.
+static const int ASSEMBLE_PARENTS = 2000;
+
+// A mempool of OP_TRUE spends. The coins they spend only exist in pcoinsTip,
+// which is all block validity checks look at.
+class AssembleSetup : public ChainSetup
+{
+public:
+    AssembleSetup()
+    {
+        CScript scriptTrue = CScript() << OP_TRUE;
+        LockPoints lp;
+        for (int i = 0; i < ASSEMBLE_PARENTS; i++) {
+            COutPoint prevout(ArithToUint256(arith_uint256(i + 1)), 0);
+            pcoinsTip->AddCoin(prevout, Coin(CTxOut(COIN, scriptTrue), 1, false), false);
+
+            CMutableTransaction tx;
+            tx.vin.resize(1);
+            tx.vin[0].prevout = prevout;
+            tx.vout.resize(1);
+            tx.vout[0].scriptPubKey = scriptTrue;
+            CAmount nFee = 1000 + (i % 97) * 100;
+            tx.vout[0].nValue = COIN - nFee;
+            mempool.addUnchecked(tx.GetHash(), CTxMemPoolEntry(CTransaction(tx), nFee, 0, 0.0, 1, false, tx.vout[0].nValue, false, 4, lp));
+
+            CMutableTransaction child;
+            child.vin.resize(1);
+            child.vin[0].prevout = COutPoint(tx.GetHash(), 0);
+            child.vout.resize(1);
+            child.vout[0].scriptPubKey = scriptTrue;
+            CAmount nChildFee = 1000 + (i % 89) * 200;
+            child.vout[0].nValue = tx.vout[0].nValue - nChildFee;
+            mempool.addUnchecked(child.GetHash(), CTxMemPoolEntry(CTransaction(child), nChildFee, 0, 0.0, 1, false, child.vout[0].nValue, false, 4, lp));
+        }
+    }
+};
+
+// Select the template's transactions from scratch, as every getblocktemplate
+// did before the template was kept up to date.
+static void AssembleBlock(benchmark::State& state)
+{
+    AssembleSetup setup;
+    CScript scriptPubKey = CScript() << OP_TRUE;
+    while (state.KeepRunning()) {
+        std::unique_ptr<CBlockTemplate> pblocktemplate = BlockAssembler(Params()).CreateNewBlock(scriptPubKey);
+        assert(pblocktemplate->block.vtx.size() == 2 * ASSEMBLE_PARENTS + 1);
+    }
+}
+
+// Serve the template from the selection kept since the last rebuild.
+static void AssembleBlockIncremental(benchmark::State& state)
+{
+    AssembleSetup setup;
+    CScript scriptPubKey = CScript() << OP_TRUE;
+    IncrementalBlockAssembler assembler(Params());
+    assembler.CreateNewBlock(scriptPubKey);
+    while (state.KeepRunning()) {
+        std::unique_ptr<CBlockTemplate> pblocktemplate = assembler.CreateNewBlock(scriptPubKey);
+        assert(pblocktemplate->block.vtx.size() == 2 * ASSEMBLE_PARENTS + 1);
+    }
+}
+
+BENCHMARK(AssembleBlock);
+BENCHMARK(AssembleBlockIncremental);
@@ -0,0 +1,24 @@
+// Copyright (c) 2017 The Bitcoin Core developers
+// Distributed under the MIT software license, see the accompanying
+// file COPYING or http://www.opensource.org/licenses/mit-license.php.
+
+#ifndef BITCOIN_BENCH_CHAIN_SETUP_H
+#define BITCOIN_BENCH_CHAIN_SETUP_H
+
+#include <boost/filesystem/path.hpp>
+
+/**
+ * A regtest chain at its genesis block, with the block index and coins
+ * databases in memory and block files in a temporary data directory, for
+ * benchmarks of code that needs chainActive and pcoinsTip.
+ */
+class ChainSetup
+{
+    boost::filesystem::path pathTemp;
+
+public:
+    ChainSetup();
+    ~ChainSetup();
+};
+
+#endif // BITCOIN_BENCH_CHAIN_SETUP_H
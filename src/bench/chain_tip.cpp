@@ -0,0 +1,63 @@
+// Copyright (c) 2017 The Bitcoin Core developers
+// Distributed under the MIT software license, see the accompanying
+// file COPYING or http://www.opensource.org/licenses/mit-license.php.
+
+#include "bench.h"
+
+#include "chain.h"
+#include "sync.h"
+#include "utiltime.h"
+
+#include <atomic>
+
+#include <boost/thread/thread.hpp>
+
+// Reading the height of the active chain while another thread keeps the
+// chain lock busy, like getblockcount does while blocks are being connected.
+
+static void ReadHeight(benchmark::State& state, bool fLock)
+{
+    std::vector<CBlockIndex> vBlocks(1000);
+    for (size_t i = 0; i < vBlocks.size(); i++) {
+        vBlocks[i].nHeight = i;
+        vBlocks[i].pprev = i ? &vBlocks[i - 1] : NULL;
+    }
+    CChain chain;
+    chain.SetTip(&vBlocks.back());
+
+    CCriticalSection cs;
+    std::atomic<bool> fStop(false);
+    boost::thread busy([&] {
+        while (!fStop) {
+            LOCK(cs);
+            int64_t nUntil = GetTimeMicros() + 200;
+            while (GetTimeMicros() < nUntil) {}
+        }
+    });
+
+    int64_t nSum = 0;
+    while (state.KeepRunning()) {
+        if (fLock) {
+            LOCK(cs);
+            nSum += chain.Height();
+        } else {
+            nSum += chain.HeightUnlocked();
+        }
+    }
+    fStop = true;
+    busy.join();
+    assert(nSum > 0);
+}
+
+static void ChainHeightLocked(benchmark::State& state)
+{
+    ReadHeight(state, true);
+}
+
+static void ChainHeightUnlocked(benchmark::State& state)
+{
+    ReadHeight(state, false);
+}
+
+BENCHMARK(ChainHeightLocked);
+BENCHMARK(ChainHeightUnlocked);
@@ -0,0 +1,90 @@
+// Copyright (c) 2017 The Bitcoin Core developers
+// Distributed under the MIT software license, see the accompanying
+// file COPYING or http://www.opensource.org/licenses/mit-license.php.
+
+#include "bench.h"
+#include "checkqueue.h"
+#include "crypto/sha256.h"
+
+#include <algorithm>
+#include <vector>
+
+#include <string.h>
+
+#include <boost/bind.hpp>
+#include <boost/thread/thread.hpp>
+
+// Checks per simulated block, and per Add call (about the inputs of one transaction).
+static const int BLOCK_CHECKS = 2000;
+static const int CHECKS_PER_TX = 2;
+
+// Verification that takes no time at all: measures the queue itself.
+struct CheapCheck
+{
+    bool operator()() { return true; }
+    void swap(CheapCheck& x) {}
+};
+
+// Verification that takes a couple of microseconds, closer to a signature check.
+struct ExpensiveCheck
+{
+    unsigned char data[32];
+    ExpensiveCheck() { memset(data, 0, sizeof(data)); }
+    bool operator()()
+    {
+        for (int i = 0; i < 16; i++)
+            CSHA256().Write(data, sizeof(data)).Finalize(data);
+        return true;
+    }
+    void swap(ExpensiveCheck& x) { std::swap_ranges(data, data + sizeof(data), x.data); }
+};
+
+// Time to verify one block worth of checks with nThreads threads, counting
+// the master, as ConnectBlock does with -par=nThreads.
+template <typename T>
+static void CheckQueueBlock(benchmark::State& state, int nThreads)
+{
+    CCheckQueue<T> queue(128);
+    boost::thread_group threadGroup;
+    for (int i = 0; i < nThreads - 1; i++)
+        threadGroup.create_thread(boost::bind(&CCheckQueue<T>::Thread, boost::ref(queue)));
+
+    while (state.KeepRunning()) {
+        CCheckQueueControl<T> control(&queue);
+        for (int i = 0; i < BLOCK_CHECKS / CHECKS_PER_TX; i++) {
+            std::vector<T> vChecks(CHECKS_PER_TX);
+            control.Add(vChecks);
+        }
+        bool fOk = control.Wait();
+        assert(fOk);
+    }
+
+    threadGroup.interrupt_all();
+    threadGroup.join_all();
+}
+
+static void CheckQueueCheap_1(benchmark::State& state) { CheckQueueBlock<CheapCheck>(state, 1); }
+static void CheckQueueCheap_2(benchmark::State& state) { CheckQueueBlock<CheapCheck>(state, 2); }
+static void CheckQueueCheap_4(benchmark::State& state) { CheckQueueBlock<CheapCheck>(state, 4); }
+static void CheckQueueCheap_8(benchmark::State& state) { CheckQueueBlock<CheapCheck>(state, 8); }
+static void CheckQueueCheap_16(benchmark::State& state) { CheckQueueBlock<CheapCheck>(state, 16); }
+static void CheckQueueCheap_32(benchmark::State& state) { CheckQueueBlock<CheapCheck>(state, 32); }
+static void CheckQueueExpensive_1(benchmark::State& state) { CheckQueueBlock<ExpensiveCheck>(state, 1); }
+static void CheckQueueExpensive_2(benchmark::State& state) { CheckQueueBlock<ExpensiveCheck>(state, 2); }
+static void CheckQueueExpensive_4(benchmark::State& state) { CheckQueueBlock<ExpensiveCheck>(state, 4); }
+static void CheckQueueExpensive_8(benchmark::State& state) { CheckQueueBlock<ExpensiveCheck>(state, 8); }
+static void CheckQueueExpensive_16(benchmark::State& state) { CheckQueueBlock<ExpensiveCheck>(state, 16); }
+static void CheckQueueExpensive_32(benchmark::State& state) { CheckQueueBlock<ExpensiveCheck>(state, 32); }
+
+BENCHMARK(CheckQueueCheap_1);
+BENCHMARK(CheckQueueCheap_2);
+BENCHMARK(CheckQueueCheap_4);
+BENCHMARK(CheckQueueCheap_8);
+BENCHMARK(CheckQueueCheap_16);
+BENCHMARK(CheckQueueCheap_32);
+BENCHMARK(CheckQueueExpensive_1);
+BENCHMARK(CheckQueueExpensive_2);
+BENCHMARK(CheckQueueExpensive_4);
+BENCHMARK(CheckQueueExpensive_8);
+BENCHMARK(CheckQueueExpensive_16);
+BENCHMARK(CheckQueueExpensive_32);
@@ -0,0 +1,65 @@
+// Copyright (c) 2017 The Bitcoin Core developers
+// Distributed under the MIT software license, see the accompanying
+// file COPYING or http://www.opensource.org/licenses/mit-license.php.
+
+#include "bench.h"
+
+#include "blockencodings.h"
+#include "random.h"
+#include "streams.h"
+#include "txmempool.h"
+
+namespace block_bench {
+#include "bench/data/block413567.raw.h"
+}
+
+// Replays the reconstruction of block 413567 from a compact block, the way a
+// node with all of its transactions at hand would do it: most of them in a
+// mempool that also holds many transactions that are not in the block, and
+// every tenth one only among the extra transactions.
+
+static const size_t FILLER_TXN = 50000;
+
+static void AddTx(const CTransactionRef& tx, CTxMemPool& pool)
+{
+    LockPoints lp;
+    pool.addUnchecked(tx->GetHash(), CTxMemPoolEntry(*tx, 1000, 0, 10.0, 1, false, tx->GetValueOut(), false, 4, lp));
+}
+
+static void CompactBlockReconstruct(benchmark::State& state)
+{
+    CDataStream stream((const char*)block_bench::block413567,
+            (const char*)&block_bench::block413567[sizeof(block_bench::block413567)],
+            SER_NETWORK, PROTOCOL_VERSION);
+    CBlock block;
+    stream >> block;
+
+    CTxMemPool pool(CFeeRate(0));
+    CBlockReconstructionIndex reconstruction;
+    CMutableTransaction filler;
+    filler.vin.resize(1);
+    filler.vout.resize(1);
+    filler.vout[0].scriptPubKey = CScript() << OP_TRUE;
+    filler.vout[0].nValue = 1;
+    for (size_t i = 0; i < FILLER_TXN; i++) {
+        filler.vin[0].prevout = COutPoint(GetRandHash(), 0);
+        AddTx(MakeTransactionRef(filler), pool);
+    }
+    for (size_t i = 1; i < block.vtx.size(); i++) {
+        if (i % 10 == 0)
+            reconstruction.AddExtraTransaction(block.vtx[i], block.vtx.size());
+        else
+            AddTx(block.vtx[i], pool);
+    }
+
+    CBlockHeaderAndShortTxIDs cmpctblock(block, true);
+    while (state.KeepRunning()) {
+        PartiallyDownloadedBlock partialBlock(&pool, &reconstruction);
+        bool fOk = partialBlock.InitData(cmpctblock) == READ_STATUS_OK;
+        assert(fOk);
+        for (size_t i = 0; i < block.vtx.size(); i++)
+            assert(partialBlock.IsTxAvailable(i));
+    }
+}
+
+BENCHMARK(CompactBlockReconstruct);
@@ -51,6 +51,14 @@ static void SHA256_32b(benchmark::State& state)
     }
 }
 
+static void SHA256D64_1024(benchmark::State& state)
+{
+    std::vector<uint8_t> in(64 * 1024, 0);
+    while (state.KeepRunning()) {
+        SHA256D64(in.data(), in.data(), 1024);
+    }
+}
+
 static void SHA512(benchmark::State& state)
 {
     uint8_t hash[CSHA512::OUTPUT_SIZE];
@@ -69,10 +77,66 @@ static void SipHash_32b(benchmark::State& state)
     }
 }
 
+// Hashing many independent values, as when filling a hash table
+static void SipHash_32b_1024(benchmark::State& state)
+{
+    std::vector<uint256> in(1024);
+    std::vector<uint64_t> out(1024);
+    for (size_t i = 0; i < in.size(); i++)
+        *((uint64_t*)in[i].begin()) = i;
+    while (state.KeepRunning()) {
+        for (size_t i = 0; i < in.size(); i++)
+            out[i] = SipHashUint256(0, 1, in[i]);
+    }
+}
+
+static void SipHashBatch_32b_1024(benchmark::State& state)
+{
+    std::vector<uint256> in(1024);
+    std::vector<uint64_t> out(1024);
+    for (size_t i = 0; i < in.size(); i++)
+        *((uint64_t*)in[i].begin()) = i;
+    while (state.KeepRunning())
+        SipHashUint256Batch(0, 1, in.data(), in.size(), out.data());
+}
+
+static void SipHashExtra_36b_1024(benchmark::State& state)
+{
+    std::vector<uint256> in(1024);
+    std::vector<uint32_t> extras(1024);
+    std::vector<uint64_t> out(1024);
+    for (size_t i = 0; i < in.size(); i++) {
+        *((uint64_t*)in[i].begin()) = i;
+        extras[i] = i;
+    }
+    while (state.KeepRunning()) {
+        for (size_t i = 0; i < in.size(); i++)
+            out[i] = SipHashUint256Extra(0, 1, in[i], extras[i]);
+    }
+}
+
+static void SipHashExtraBatch_36b_1024(benchmark::State& state)
+{
+    std::vector<uint256> in(1024);
+    std::vector<uint32_t> extras(1024);
+    std::vector<uint64_t> out(1024);
+    for (size_t i = 0; i < in.size(); i++) {
+        *((uint64_t*)in[i].begin()) = i;
+        extras[i] = i;
+    }
+    while (state.KeepRunning())
+        SipHashUint256ExtraBatch(0, 1, in.data(), extras.data(), in.size(), out.data());
+}
+
 BENCHMARK(RIPEMD160);
 BENCHMARK(SHA1);
 BENCHMARK(SHA256);
 BENCHMARK(SHA512);
 
 BENCHMARK(SHA256_32b);
+BENCHMARK(SHA256D64_1024);
 BENCHMARK(SipHash_32b);
+BENCHMARK(SipHash_32b_1024);
+BENCHMARK(SipHashBatch_32b_1024);
+BENCHMARK(SipHashExtra_36b_1024);
+BENCHMARK(SipHashExtraBatch_36b_1024);
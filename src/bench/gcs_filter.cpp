@@ -0,0 +1,53 @@
+// Copyright (c) 2017 The Bitcoin Core developers
+// Distributed under the MIT software license, see the accompanying
+// file COPYING or http://www.opensource.org/licenses/mit-license.php.
+
+#include "bench.h"
+#include "blockfilter.h"
+
+/* A filter about the size of that of a full block */
+static const int FILTER_ELEMENTS = 10000;
+
+static GCSFilter::ElementSet MakeElements(int nCount, unsigned char nTag)
+{
+    GCSFilter::ElementSet elements;
+    for (int i = 0; i < nCount; i++) {
+        GCSFilter::Element element(32, nTag);
+        element[0] = i & 0xff;
+        element[1] = (i >> 8) & 0xff;
+        element[2] = (i >> 16) & 0xff;
+        elements.insert(element);
+    }
+    return elements;
+}
+
+static void GCSFilterConstruct(benchmark::State& state)
+{
+    GCSFilter::ElementSet elements = MakeElements(FILTER_ELEMENTS, 0);
+    while (state.KeepRunning()) {
+        GCSFilter filter(0, 0, BASIC_FILTER_P, BASIC_FILTER_M, elements);
+    }
+}
+
+static void GCSFilterDecode(benchmark::State& state)
+{
+    GCSFilter filter(0, 0, BASIC_FILTER_P, BASIC_FILTER_M, MakeElements(FILTER_ELEMENTS, 0));
+    const std::vector<unsigned char>& vEncoded = filter.GetEncoded();
+    while (state.KeepRunning()) {
+        GCSFilter decoded(0, 0, BASIC_FILTER_P, BASIC_FILTER_M, vEncoded);
+    }
+}
+
+/* Matching the scripts of a wallet against a block: one pass over the filter */
+static void GCSFilterMatchAny(benchmark::State& state)
+{
+    GCSFilter filter(0, 0, BASIC_FILTER_P, BASIC_FILTER_M, MakeElements(FILTER_ELEMENTS, 0));
+    GCSFilter::ElementSet query = MakeElements(1000, 1);
+    while (state.KeepRunning()) {
+        filter.MatchAny(query);
+    }
+}
+
+BENCHMARK(GCSFilterConstruct);
+BENCHMARK(GCSFilterDecode);
+BENCHMARK(GCSFilterMatchAny);
@@ -0,0 +1,116 @@
+// Copyright (c) 2017 The Bitcoin Core developers
+// Distributed under the MIT software license, see the accompanying
+// file COPYING or http://www.opensource.org/licenses/mit-license.php.
+
+#include "bench.h"
+#include "chain_setup.h"
+
+#include "arith_uint256.h"
+#include "coins.h"
+#include "consensus/validation.h"
+#include "key.h"
+#include "keystore.h"
+#include "script/sigcache.h"
+#include "script/sign.h"
+#include "script/standard.h"
+#include "txmempool.h"
+#include "util.h"
+#include "validation.h"
+
+#include <boost/thread.hpp>
+
+// Transactions relayed to us in one burst, and the message handler threads
+// they arrive on
+static const int FLOOD_SIZE = 200;
+static const int FLOOD_THREADS = 4;
+
+// Signed P2PKH spends of coins that only exist in pcoinsTip
+class FloodSetup : public ChainSetup
+{
+public:
+    std::vector<CTransaction> vTxs;
+
+    FloodSetup()
+    {
+        CBasicKeyStore keystore;
+        CKey key;
+        key.MakeNewKey(true);
+        keystore.AddKey(key);
+        CScript scriptPubKey = GetScriptForDestination(key.GetPubKey().GetID());
+
+        for (int i = 0; i < FLOOD_SIZE; i++) {
+            COutPoint prevout(ArithToUint256(arith_uint256(i + 1)), 0);
+            pcoinsTip->AddCoin(prevout, Coin(CTxOut(COIN, scriptPubKey), 1, false), false);
+
+            CMutableTransaction tx;
+            tx.vin.resize(1);
+            tx.vin[0].prevout = prevout;
+            tx.vout.resize(1);
+            tx.vout[0].scriptPubKey = scriptPubKey;
+            tx.vout[0].nValue = COIN - 10000;
+            bool fSigned = SignSignature(keystore, scriptPubKey, tx, 0, COIN, SIGHASH_ALL);
+            assert(fSigned);
+            vTxs.push_back(tx);
+        }
+
+        // The flood must not find its signatures cached from a previous round,
+        // so keep the cache small enough to clear quickly.
+        ForceSetArg("-maxsigcachesize", "1");
+    }
+
+    void Accept()
+    {
+        LOCK(cs_main);
+        for (size_t i = 0; i < vTxs.size(); i++) {
+            CValidationState state;
+            bool fAccepted = AcceptToMemoryPool(mempool, state, vTxs[i], true, NULL);
+            assert(fAccepted);
+        }
+    }
+
+    void Reset()
+    {
+        mempool.clear();
+        InitSignatureCache();
+    }
+};
+
+static void PreVerifySlice(FloodSetup* setup, int nSlice)
+{
+    for (size_t i = nSlice; i < setup->vTxs.size(); i += FLOOD_THREADS) {
+        CValidationState state;
+        bool fVerified = PreVerifyTransactionScripts(mempool, setup->vTxs[i], state);
+        assert(fVerified);
+    }
+}
+
+// Every flood of FLOOD_SIZE transactions has its scripts verified under cs_main
+static void MempoolAcceptFlood(benchmark::State& state)
+{
+    FloodSetup setup;
+    setup.Reset();
+    while (state.KeepRunning()) {
+        setup.Accept();
+        setup.Reset();
+    }
+}
+
+// Scripts are verified by the threads the transactions arrive on, leaving
+// AcceptToMemoryPool to find their signatures cached
+static void MempoolAcceptFloodPreVerified(benchmark::State& state)
+{
+    FloodSetup setup;
+    setup.Reset();
+    while (state.KeepRunning()) {
+        boost::thread_group threads;
+        for (int i = 0; i < FLOOD_THREADS; i++) {
+            threads.create_thread(boost::bind(&PreVerifySlice, &setup, i));
+        }
+        threads.join_all();
+        setup.Accept();
+        setup.Reset();
+    }
+}
+
+BENCHMARK(MempoolAcceptFlood);
+BENCHMARK(MempoolAcceptFloodPreVerified);
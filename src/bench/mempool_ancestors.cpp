@@ -0,0 +1,62 @@
+// Copyright (c) 2017 The Bitcoin Core developers
+// Distributed under the MIT software license, see the accompanying
+// file COPYING or http://www.opensource.org/licenses/mit-license.php.
+
+#include "bench.h"
+#include "mempool_packages.h"
+#include "policy/policy.h"
+#include "txmempool.h"
+#include "validation.h"
+
+#include <vector>
+
+static CTxMemPoolEntry MakeEntry(const CMutableTransaction& mtx)
+{
+    CTransaction tx(mtx);
+    LockPoints lp;
+    return CTxMemPoolEntry(tx, 1000, 0, 10.0, 1, false, tx.GetValueOut(), false, 4, lp);
+}
+
+// Add the entries the way AcceptToMemoryPool does, within the default package
+// limits, then evict all of them.
+static void AddAndEvict(benchmark::State& state, const std::vector<CTxMemPoolEntry>& vEntries)
+{
+    CTxMemPool pool(CFeeRate(1000));
+    std::string errString;
+
+    while (state.KeepRunning()) {
+        LOCK(pool.cs);
+        for (size_t i = 0; i < vEntries.size(); i++) {
+            CTxMemPool::setEntries setAncestors;
+            bool fAccepted = pool.CalculateMemPoolAncestors(vEntries[i], setAncestors,
+                DEFAULT_ANCESTOR_LIMIT, DEFAULT_ANCESTOR_SIZE_LIMIT * 1000,
+                DEFAULT_DESCENDANT_LIMIT, DEFAULT_DESCENDANT_SIZE_LIMIT * 1000, errString);
+            assert(fAccepted);
+            pool.addUnchecked(vEntries[i].GetTx().GetHash(), vEntries[i], setAncestors);
+        }
+        pool.TrimToSize(0);
+    }
+}
+
+static std::vector<CTxMemPoolEntry> MakeEntries(const std::vector<CMutableTransaction>& vTxs)
+{
+    std::vector<CTxMemPoolEntry> vEntries;
+    for (size_t i = 0; i < vTxs.size(); i++)
+        vEntries.push_back(MakeEntry(vTxs[i]));
+    return vEntries;
+}
+
+// Chains as long as the default ancestor limit allows
+static void MempoolAncestorsChain(benchmark::State& state)
+{
+    AddAndEvict(state, MakeEntries(MakeTxChains(40, DEFAULT_ANCESTOR_LIMIT)));
+}
+
+// Parents with as many children as the default descendant limit allows
+static void MempoolAncestorsFanOut(benchmark::State& state)
+{
+    AddAndEvict(state, MakeEntries(MakeTxFanOuts(40, DEFAULT_DESCENDANT_LIMIT - 1)));
+}
+
+BENCHMARK(MempoolAncestorsChain);
+BENCHMARK(MempoolAncestorsFanOut);
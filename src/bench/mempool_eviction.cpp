@@ -3,6 +3,7 @@
 // file COPYING or http://www.opensource.org/licenses/mit-license.php.
 
 #include "bench.h"
+#include "mempool_packages.h"
 #include "policy/policy.h"
 #include "txmempool.h"
 
@@ -112,4 +113,24 @@ static void MempoolEviction(benchmark::State& state)
     }
 }
 
+// Chains and fan-outs of transactions, so that adding and evicting them walks
+// and updates the links between mempool entries.
+static void MempoolEvictionLinked(benchmark::State& state)
+{
+    std::vector<CMutableTransaction> vTxs = MakeTxChains(40, 10);
+    std::vector<CMutableTransaction> vFanOuts = MakeTxFanOuts(40, 10);
+    vTxs.insert(vTxs.end(), vFanOuts.begin(), vFanOuts.end());
+
+    CTxMemPool pool(CFeeRate(1000));
+
+    while (state.KeepRunning()) {
+        for (size_t i = 0; i < vTxs.size(); i++) {
+            AddTx(vTxs[i], 1000LL + (i % 13) * 500, pool);
+        }
+        pool.TrimToSize(pool.DynamicMemoryUsage() * 3 / 4);
+        pool.TrimToSize(0);
+    }
+}
+
 BENCHMARK(MempoolEviction);
+BENCHMARK(MempoolEvictionLinked);
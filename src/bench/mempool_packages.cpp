@@ -0,0 +1,52 @@
+// Copyright (c) 2017 The Bitcoin Core developers
+// Distributed under the MIT software license, see the accompanying
+// file COPYING or http://www.opensource.org/licenses/mit-license.php.
+
+#include "mempool_packages.h"
+
+#include "amount.h"
+#include "script/script.h"
+
+std::vector<CMutableTransaction> MakeTxChains(int nChains, int nDepth)
+{
+    std::vector<CMutableTransaction> vTxs;
+    for (int nChain = 0; nChain < nChains; nChain++) {
+        CMutableTransaction tx;
+        tx.vin.resize(1);
+        tx.vin[0].scriptSig = CScript() << OP_1 << nChain;
+        tx.vout.resize(1);
+        tx.vout[0].scriptPubKey = CScript() << OP_1 << OP_EQUAL;
+        tx.vout[0].nValue = 10 * COIN;
+        for (int nTx = 0; nTx < nDepth; nTx++) {
+            vTxs.push_back(tx);
+            tx.vin[0].prevout = COutPoint(tx.GetHash(), 0);
+        }
+    }
+    return vTxs;
+}
+
+std::vector<CMutableTransaction> MakeTxFanOuts(int nFans, int nChildren)
+{
+    std::vector<CMutableTransaction> vTxs;
+    for (int nFan = 0; nFan < nFans; nFan++) {
+        CMutableTransaction parent;
+        parent.vin.resize(1);
+        parent.vin[0].scriptSig = CScript() << OP_2 << nFan;
+        parent.vout.resize(nChildren);
+        for (int i = 0; i < nChildren; i++) {
+            parent.vout[i].scriptPubKey = CScript() << OP_2 << OP_EQUAL;
+            parent.vout[i].nValue = COIN;
+        }
+        vTxs.push_back(parent);
+        for (int i = 0; i < nChildren; i++) {
+            CMutableTransaction child;
+            child.vin.resize(1);
+            child.vin[0].prevout = COutPoint(parent.GetHash(), i);
+            child.vout.resize(1);
+            child.vout[0].scriptPubKey = CScript() << OP_3 << OP_EQUAL;
+            child.vout[0].nValue = COIN;
+            vTxs.push_back(child);
+        }
+    }
+    return vTxs;
+}
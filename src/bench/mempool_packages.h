@@ -0,0 +1,24 @@
+// Copyright (c) 2017 The Bitcoin Core developers
+// Distributed under the MIT software license, see the accompanying
+// file COPYING or http://www.opensource.org/licenses/mit-license.php.
+
+#ifndef BITCOIN_BENCH_MEMPOOL_PACKAGES_H
+#define BITCOIN_BENCH_MEMPOOL_PACKAGES_H
+
+#include "primitives/transaction.h"
+
+#include <vector>
+
+/**
+ * Packages of dependent transactions for mempool benchmarks, in an order
+ * they can be added to the mempool in. Chains and fan-outs never share a
+ * transaction, so both can go into the same pool.
+ */
+
+/** nChains chains of nDepth transactions, each spending the one before */
+std::vector<CMutableTransaction> MakeTxChains(int nChains, int nDepth);
+
+/** nFans parents, each followed by nChildren children spending one output of it each */
+std::vector<CMutableTransaction> MakeTxFanOuts(int nFans, int nChildren);
+
+#endif // BITCOIN_BENCH_MEMPOOL_PACKAGES_H
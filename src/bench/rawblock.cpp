@@ -0,0 +1,83 @@
+// Copyright (c) 2017 The Bitcoin Core developers
+// Distributed under the MIT software license, see the accompanying
+// file COPYING or http://www.opensource.org/licenses/mit-license.php.
+
+#include "bench.h"
+
+#include "blockmap.h"
+#include "netmessagemaker.h"
+#include "primitives/block.h"
+#include "streams.h"
+#include "version.h"
+
+namespace block_bench {
+#include "bench/data/block413567.raw.h"
+}
+
+// What it costs to answer a getdata for a stored block, from the moment its
+// bytes are available until the message is ready to be sent. Divide the
+// block size (sizeof(block413567)) by the time per iteration for bytes/sec.
+
+// Deserialize into a CBlock and serialize that again, as for non-witness peers
+static void ServeBlockReserialize(benchmark::State& state)
+{
+    CNetMsgMaker msgMaker(PROTOCOL_VERSION);
+    while (state.KeepRunning()) {
+        CSpanReader reader(SER_DISK, PROTOCOL_VERSION, block_bench::block413567, block_bench::block413567 + sizeof(block_bench::block413567));
+        CBlock block;
+        reader >> block;
+        CSerializedNetMsg msg = msgMaker.Make(SERIALIZE_TRANSACTION_NO_WITNESS, NetMsgType::BLOCK, block);
+        assert(msg.data.size() == sizeof(block_bench::block413567));
+    }
+}
+
+// Copy the stored bytes, as for witness peers
+static void ServeBlockRaw(benchmark::State& state)
+{
+    CNetMsgMaker msgMaker(PROTOCOL_VERSION);
+    while (state.KeepRunning()) {
+        CSerializedNetMsg msg = msgMaker.Make(NetMsgType::BLOCK, CFlatData((void*)block_bench::block413567, (void*)(block_bench::block413567 + sizeof(block_bench::block413567))));
+        assert(msg.data.size() == sizeof(block_bench::block413567));
+    }
+}
+
+// block413567 predates segwit, so give every input a witness shaped like a
+// P2WPKH spend (and the coinbase its witness nonce) to have something to strip
+static std::vector<unsigned char> MakeWitnessBlock()
+{
+    CSpanReader reader(SER_DISK, PROTOCOL_VERSION, block_bench::block413567, block_bench::block413567 + sizeof(block_bench::block413567));
+    CBlock block;
+    reader >> block;
+    for (size_t i = 0; i < block.vtx.size(); i++) {
+        CMutableTransaction mtx(*block.vtx[i]);
+        for (size_t j = 0; j < mtx.vin.size(); j++) {
+            if (i == 0) {
+                mtx.vin[j].scriptWitness.stack.push_back(std::vector<unsigned char>(32, 0));
+            } else {
+                mtx.vin[j].scriptWitness.stack.push_back(std::vector<unsigned char>(72, 0x30));
+                mtx.vin[j].scriptWitness.stack.push_back(std::vector<unsigned char>(33, 0x02));
+            }
+        }
+        block.vtx[i] = MakeTransactionRef(std::move(mtx));
+    }
+    std::vector<unsigned char> vch;
+    CVectorWriter(SER_NETWORK, PROTOCOL_VERSION, vch, 0, block);
+    return vch;
+}
+
+// Strip witness data from the stored bytes, as for non-witness peers
+static void ServeBlockRawStripped(benchmark::State& state)
+{
+    const std::vector<unsigned char> vchBlock = MakeWitnessBlock();
+    assert(vchBlock.size() > sizeof(block_bench::block413567));
+    while (state.KeepRunning()) {
+        CSerializedNetMsg msg;
+        msg.command = NetMsgType::BLOCK;
+        bool fOk = StripBlockWitness(vchBlock.data(), vchBlock.data() + vchBlock.size(), msg.data);
+        assert(fOk && msg.data.size() == sizeof(block_bench::block413567) && msg.data.size() < vchBlock.size());
+    }
+}
+
+BENCHMARK(ServeBlockReserialize);
+BENCHMARK(ServeBlockRaw);
+BENCHMARK(ServeBlockRawStripped);
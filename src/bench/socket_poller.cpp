@@ -0,0 +1,116 @@
+// Copyright (c) 2017 The Bitcoin Core developers
+// Distributed under the MIT software license, see the accompanying
+// file COPYING or http://www.opensource.org/licenses/mit-license.php.
+
+#include "bench.h"
+#include "netbase.h"
+#include "netpoller.h"
+#include "util.h"
+
+#include <assert.h>
+#include <vector>
+
+#ifndef WIN32
+
+// Wake up one of many idle peers per iteration, as ThreadSocketHandler sees
+// it: every peer is waited on for receiving, one of them has a byte pending.
+// The time per iteration is the wakeup latency of the backend at that peer
+// count. Peers are local socket pairs, so no network stack is involved.
+static void SocketPollerWakeup(benchmark::State& state, const std::string& mode, size_t nPeers)
+{
+    std::unique_ptr<CSocketPoller> poller = CreateSocketPoller(mode);
+    if (!poller || RaiseFileDescriptorLimit(nPeers * 2 + 64) < (int)(nPeers * 2 + 64))
+        return;
+
+    std::vector<SOCKET> vLocal, vRemote;
+    for (size_t i = 0; i < nPeers; i++) {
+        int fds[2];
+        if (socketpair(AF_UNIX, SOCK_STREAM, 0, fds) != 0 || !poller->IsSelectable(fds[0]))
+            break;
+        vLocal.push_back(fds[0]);
+        vRemote.push_back(fds[1]);
+    }
+
+    if (vLocal.size() == nPeers) {
+        std::vector<PolledSocket> vSockets;
+        size_t nPeer = 0;
+        char ch = 0;
+        while (state.KeepRunning()) {
+            vSockets.clear();
+            for (size_t i = 0; i < vLocal.size(); i++)
+                vSockets.push_back(PolledSocket(vLocal[i], i, SOCKET_EVENT_RECV | SOCKET_EVENT_ERR));
+            send(vRemote[nPeer], &ch, 1, MSG_NOSIGNAL);
+            poller->Wait(vSockets, 50);
+            assert(vSockets[nPeer].ready & SOCKET_EVENT_RECV);
+            recv(vLocal[nPeer], &ch, 1, MSG_DONTWAIT);
+            nPeer = (nPeer + 1) % vLocal.size();
+        }
+    }
+
+    for (size_t i = 0; i < vLocal.size(); i++) {
+        CloseSocket(vLocal[i]);
+        CloseSocket(vRemote[i]);
+    }
+}
+
+// The same with the sockets registered once, the way ThreadSocketHandler
+// drives backends that can register.
+static void SocketPollerRegisteredWakeup(benchmark::State& state, const std::string& mode, size_t nPeers)
+{
+    std::unique_ptr<CSocketPoller> poller = CreateSocketPoller(mode);
+    if (!poller || !poller->CanRegister() || RaiseFileDescriptorLimit(nPeers * 2 + 64) < (int)(nPeers * 2 + 64))
+        return;
+
+    std::vector<SOCKET> vLocal, vRemote;
+    for (size_t i = 0; i < nPeers; i++) {
+        int fds[2];
+        if (socketpair(AF_UNIX, SOCK_STREAM, 0, fds) != 0 || !poller->Register(fds[0], i, SOCKET_EVENT_RECV, true))
+            break;
+        vLocal.push_back(fds[0]);
+        vRemote.push_back(fds[1]);
+    }
+
+    if (vLocal.size() == nPeers) {
+        std::vector<SocketEvent> vEvents;
+        size_t nPeer = 0;
+        char ch = 0;
+        while (state.KeepRunning()) {
+            send(vRemote[nPeer], &ch, 1, MSG_NOSIGNAL);
+            poller->WaitEvents(vEvents, 50);
+            assert(vEvents.size() == 1 && vEvents[0].owner == (int64_t)nPeer);
+            recv(vLocal[nPeer], &ch, 1, MSG_DONTWAIT);
+            nPeer = (nPeer + 1) % vLocal.size();
+        }
+    }
+
+    for (size_t i = 0; i < vLocal.size(); i++) {
+        CloseSocket(vLocal[i]);
+        CloseSocket(vRemote[i]);
+    }
+}
+
+// select() can only handle descriptors below FD_SETSIZE (usually 1024), and
+// each peer takes two here.
+static void SocketPollerSelect_100(benchmark::State& state) { SocketPollerWakeup(state, "select", 100); }
+static void SocketPollerSelect_500(benchmark::State& state) { SocketPollerWakeup(state, "select", 500); }
+
+BENCHMARK(SocketPollerSelect_100);
+BENCHMARK(SocketPollerSelect_500);
+
+#ifdef HAVE_EPOLL
+static void SocketPollerEpoll_100(benchmark::State& state) { SocketPollerWakeup(state, "epoll", 100); }
+static void SocketPollerEpoll_1000(benchmark::State& state) { SocketPollerWakeup(state, "epoll", 1000); }
+static void SocketPollerEpoll_5000(benchmark::State& state) { SocketPollerWakeup(state, "epoll", 5000); }
+
+BENCHMARK(SocketPollerEpoll_100);
+BENCHMARK(SocketPollerEpoll_1000);
+BENCHMARK(SocketPollerEpoll_5000);
+
+static void SocketPollerEpollRegistered_100(benchmark::State& state) { SocketPollerRegisteredWakeup(state, "epoll", 100); }
+static void SocketPollerEpollRegistered_5000(benchmark::State& state) { SocketPollerRegisteredWakeup(state, "epoll", 5000); }
+
+BENCHMARK(SocketPollerEpollRegistered_100);
+BENCHMARK(SocketPollerEpollRegistered_5000);
+#endif
+
+#endif // WIN32
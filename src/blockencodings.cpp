@@ -17,16 +17,24 @@
 
 #define MIN_TRANSACTION_BASE_SIZE (::GetSerializeSize(CTransaction(), SER_NETWORK, PROTOCOL_VERSION | SERIALIZE_TRANSACTION_NO_WITNESS))
 
+//! Number of mempool wtxids whose short IDs are computed at a time
+static const size_t SHORTID_BATCH = 64;
+
 CBlockHeaderAndShortTxIDs::CBlockHeaderAndShortTxIDs(const CBlock& block, bool fUseWTXID) :
         nonce(GetRand(std::numeric_limits<uint64_t>::max())),
         shorttxids(block.vtx.size() - 1), prefilledtxn(1), header(block) {
     FillShortTxIDSelector();
     //TODO: Use our mempool prior to block acceptance to predictively fill more than just the coinbase
     prefilledtxn[0] = {0, block.vtx[0]};
+    std::vector<uint256> vTxHashes(block.vtx.size() - 1);
     for (size_t i = 1; i < block.vtx.size(); i++) {
         const CTransaction& tx = *block.vtx[i];
-        shorttxids[i - 1] = GetShortID(fUseWTXID ? tx.GetWitnessHash() : tx.GetHash());
+        vTxHashes[i - 1] = fUseWTXID ? tx.GetWitnessHash() : tx.GetHash();
     }
+    static_assert(SHORTTXIDS_LENGTH == 6, "shorttxids calculation assumes 6-byte shorttxids");
+    SipHashUint256Batch(shorttxidk0, shorttxidk1, vTxHashes.data(), vTxHashes.size(), shorttxids.data());
+    for (uint64_t& shortid : shorttxids)
+        shortid &= 0xffffffffffffL;
 }
 
 void CBlockHeaderAndShortTxIDs::FillShortTxIDSelector() const {
@@ -41,8 +49,35 @@ void CBlockHeaderAndShortTxIDs::FillShortTxIDSelector() const {
 }
 
 uint64_t CBlockHeaderAndShortTxIDs::GetShortID(const uint256& txhash) const {
+    return GetShortID(shorttxidk0, shorttxidk1, txhash);
+}
+
+uint64_t CBlockHeaderAndShortTxIDs::GetShortID(uint64_t k0, uint64_t k1, const uint256& txhash) {
     static_assert(SHORTTXIDS_LENGTH == 6, "shorttxids calculation assumes 6-byte shorttxids");
-    return SipHashUint256(shorttxidk0, shorttxidk1, txhash) & 0xffffffffffffL;
+    return SipHashUint256(k0, k1, txhash) & 0xffffffffffffL;
+}
+
+
+
+void CBlockReconstructionIndex::AddExtraTransaction(const CTransactionRef& tx, size_t nMax) {
+    if (nMax == 0)
+        return;
+    LOCK(cs);
+    if (vExtraTxn.size() > nMax) {
+        vExtraTxn.resize(nMax);
+        nExtraTxnPos = 0;
+    }
+    if (vExtraTxn.size() < nMax) {
+        vExtraTxn.emplace_back(tx->GetWitnessHash(), tx);
+    } else {
+        vExtraTxn[nExtraTxnPos] = std::make_pair(tx->GetWitnessHash(), tx);
+        nExtraTxnPos = (nExtraTxnPos + 1) % nMax;
+    }
+}
+
+size_t CBlockReconstructionIndex::ExtraTransactionCount() {
+    LOCK(cs);
+    return vExtraTxn.size();
 }
 
 
@@ -104,10 +139,22 @@ ReadStatus PartiallyDownloadedBlock::InitData(const CBlockHeaderAndShortTxIDs& c
         return READ_STATUS_FAILED; // Short ID collision
 
     std::vector<bool> have_txn(txn_available.size());
-    LOCK(pool->cs);
+    CBlockReconstructionIndex localReconstruction;
+    CBlockReconstructionIndex& recon = reconstruction ? *reconstruction : localReconstruction;
+    LOCK2(pool->cs, recon.cs);
     const std::vector<std::pair<uint256, CTxMemPool::txiter> >& vTxHashes = pool->vTxHashes;
+    // The short IDs are keyed by the sender's nonce, so they are computed
+    // afresh for every announcement, a batch of wtxids at a time
+    uint256 vChunk[SHORTID_BATCH];
+    uint64_t vChunkIDs[SHORTID_BATCH];
     for (size_t i = 0; i < vTxHashes.size(); i++) {
-        uint64_t shortid = cmpctblock.GetShortID(vTxHashes[i].first);
+        if (i % SHORTID_BATCH == 0) {
+            size_t nChunk = std::min(SHORTID_BATCH, vTxHashes.size() - i);
+            for (size_t j = 0; j < nChunk; j++)
+                vChunk[j] = vTxHashes[i + j].first;
+            SipHashUint256Batch(cmpctblock.shorttxidk0, cmpctblock.shorttxidk1, vChunk, nChunk, vChunkIDs);
+        }
+        uint64_t shortid = vChunkIDs[i % SHORTID_BATCH] & 0xffffffffffffL;
         std::unordered_map<uint64_t, uint16_t>::iterator idit = shorttxids.find(shortid);
         if (idit != shorttxids.end()) {
             if (!have_txn[idit->second]) {
@@ -131,6 +178,32 @@ ReadStatus PartiallyDownloadedBlock::InitData(const CBlockHeaderAndShortTxIDs& c
             break;
     }
 
+    const std::vector<std::pair<uint256, CTransactionRef> >& vExtraTxn = recon.vExtraTxn;
+    std::vector<bool> from_extra(vExtraTxn.empty() ? 0 : txn_available.size());
+    for (size_t i = 0; i < vExtraTxn.size() && mempool_count < shorttxids.size(); i++) {
+        uint64_t shortid = cmpctblock.GetShortID(vExtraTxn[i].first);
+        std::unordered_map<uint64_t, uint16_t>::iterator idit = shorttxids.find(shortid);
+        if (idit != shorttxids.end()) {
+            if (!have_txn[idit->second]) {
+                txn_available[idit->second] = vExtraTxn[i].second;
+                have_txn[idit->second]  = true;
+                from_extra[idit->second] = true;
+                mempool_count++;
+                extra_count++;
+            } else {
+                // As above, but a transaction that is both in the mempool and
+                // among the extra transactions is not a collision
+                if (txn_available[idit->second] &&
+                        txn_available[idit->second]->GetWitnessHash() != vExtraTxn[i].second->GetWitnessHash()) {
+                    txn_available[idit->second].reset();
+                    mempool_count--;
+                    if (from_extra[idit->second])
+                        extra_count--;
+                }
+            }
+        }
+    }
+
     LogPrint("cmpctblock", "Initialized PartiallyDownloadedBlock for block %s using a cmpctblock of size %lu\n", cmpctblock.header.GetHash().ToString(), GetSerializeSize(cmpctblock, SER_NETWORK, PROTOCOL_VERSION));
 
     return READ_STATUS_OK;
@@ -170,7 +243,7 @@ ReadStatus PartiallyDownloadedBlock::FillBlock(CBlock& block, const std::vector<
         return READ_STATUS_CHECKBLOCK_FAILED;
     }
 
-    LogPrint("cmpctblock", "Successfully reconstructed block %s with %lu txn prefilled, %lu txn from mempool and %lu txn requested\n", header.GetHash().ToString(), prefilled_count, mempool_count, vtx_missing.size());
+    LogPrint("cmpctblock", "Successfully reconstructed block %s with %lu txn prefilled, %lu txn from mempool (including %lu from extra pool) and %lu txn requested\n", header.GetHash().ToString(), prefilled_count, mempool_count, extra_count, vtx_missing.size());
     if (vtx_missing.size() < 5) {
         for (const auto& tx : vtx_missing)
             LogPrint("cmpctblock", "Reconstructed block %s required tx %s\n", header.GetHash().ToString(), tx->GetHash().ToString());
@@ -6,6 +6,7 @@
 #define BITCOIN_BLOCK_ENCODINGS_H
 
 #include "primitives/block.h"
+#include "sync.h"
 
 #include <memory>
 
@@ -151,6 +152,7 @@ public:
     CBlockHeaderAndShortTxIDs(const CBlock& block, bool fUseWTXID);
 
     uint64_t GetShortID(const uint256& txhash) const;
+    static uint64_t GetShortID(uint64_t k0, uint64_t k1, const uint256& txhash);
 
     size_t BlockTxCount() const { return shorttxids.size() + prefilledtxn.size(); }
 
@@ -191,14 +193,38 @@ public:
     }
 };
 
+/**
+ * What compact blocks are reconstructed from, besides the mempool: a small
+ * pool of transactions that are not in the mempool (orphans, rejected and
+ * replaced transactions) but may well be mined.
+ *
+ * Lock order is pool->cs before cs.
+ */
+class CBlockReconstructionIndex {
+private:
+    CCriticalSection cs;
+    std::vector<std::pair<uint256, CTransactionRef> > vExtraTxn;
+    size_t nExtraTxnPos;
+
+    friend class PartiallyDownloadedBlock;
+
+public:
+    CBlockReconstructionIndex() : nExtraTxnPos(0) {}
+
+    /** Remember a transaction that is not in the mempool, keeping at most nMax of them */
+    void AddExtraTransaction(const CTransactionRef& tx, size_t nMax);
+    size_t ExtraTransactionCount();
+};
+
 class PartiallyDownloadedBlock {
 protected:
     std::vector<CTransactionRef> txn_available;
-    size_t prefilled_count = 0, mempool_count = 0;
+    size_t prefilled_count = 0, mempool_count = 0, extra_count = 0;
     CTxMemPool* pool;
+    CBlockReconstructionIndex* reconstruction;
 public:
     CBlockHeader header;
-    PartiallyDownloadedBlock(CTxMemPool* poolIn) : pool(poolIn) {}
+    PartiallyDownloadedBlock(CTxMemPool* poolIn, CBlockReconstructionIndex* reconstructionIn = NULL) : pool(poolIn), reconstruction(reconstructionIn) {}
 
     ReadStatus InitData(const CBlockHeaderAndShortTxIDs& cmpctblock);
     bool IsTxAvailable(size_t index) const;
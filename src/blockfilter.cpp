@@ -0,0 +1,313 @@
+// Copyright (c) 2017 The Bitcoin Core developers
+// Distributed under the MIT software license, see the accompanying
+// file COPYING or http://www.opensource.org/licenses/mit-license.php.
+
+#include "blockfilter.h"
+
+#include "hash.h"
+#include "script/script.h"
+#include "streams.h"
+#include "version.h"
+
+#include <algorithm>
+#include <limits>
+#include <stdexcept>
+
+#include <boost/foreach.hpp>
+
+namespace {
+
+/** Appends bits to a byte vector, most significant bit first */
+class BitWriter
+{
+private:
+    std::vector<unsigned char>& vch;
+    uint8_t nBuffer;
+    int nOffset; //!< Bits used in nBuffer
+
+public:
+    BitWriter(std::vector<unsigned char>& vchIn) : vch(vchIn), nBuffer(0), nOffset(0) {}
+
+    /** Write the nBits (at most 64) least significant bits of data */
+    void Write(uint64_t data, int nBits)
+    {
+        while (nBits > 0) {
+            int nNow = std::min(8 - nOffset, nBits);
+            nBuffer |= (uint8_t)((data << (64 - nBits)) >> (64 - 8 + nOffset));
+            nOffset += nNow;
+            nBits -= nNow;
+            if (nOffset == 8)
+                Flush();
+        }
+    }
+
+    /** Write out the last, partial byte, padded with zero bits */
+    void Flush()
+    {
+        if (nOffset == 0)
+            return;
+        vch.push_back(nBuffer);
+        nBuffer = 0;
+        nOffset = 0;
+    }
+};
+
+/** Reads bits from a byte range, most significant bit first */
+class BitReader
+{
+private:
+    const unsigned char* pcur;
+    const unsigned char* pend;
+    uint8_t nBuffer;
+    int nOffset; //!< Bits of nBuffer already read
+
+public:
+    BitReader(const unsigned char* pbegin, const unsigned char* pendIn) : pcur(pbegin), pend(pendIn), nBuffer(0), nOffset(8) {}
+
+    /** Read nBits (at most 64) into the least significant bits of the result */
+    uint64_t Read(int nBits)
+    {
+        uint64_t data = 0;
+        while (nBits > 0) {
+            if (nOffset == 8) {
+                if (pcur == pend)
+                    throw std::ios_base::failure("BitReader::Read(): end of data");
+                nBuffer = *pcur++;
+                nOffset = 0;
+            }
+            int nNow = std::min(8 - nOffset, nBits);
+            data <<= nNow;
+            data |= (uint8_t)(nBuffer << nOffset) >> (8 - nNow);
+            nOffset += nNow;
+            nBits -= nNow;
+        }
+        return data;
+    }
+};
+
+void GolombRiceEncode(BitWriter& writer, uint8_t nP, uint64_t x)
+{
+    // Quotient in unary, as that many 1 bits and a 0
+    uint64_t q = x >> nP;
+    while (q > 0) {
+        int nBits = q <= 64 ? (int)q : 64;
+        writer.Write(~0ULL, nBits);
+        q -= nBits;
+    }
+    writer.Write(0, 1);
+
+    // Remainder in nP bits
+    writer.Write(x, nP);
+}
+
+uint64_t GolombRiceDecode(BitReader& reader, uint8_t nP)
+{
+    uint64_t q = 0;
+    while (reader.Read(1) == 1)
+        q++;
+    uint64_t r = reader.Read(nP);
+    return (q << nP) + r;
+}
+
+/** The upper 64 bits of x * n: maps a uniform 64-bit x into [0, n) without a division */
+uint64_t MapIntoRange(uint64_t x, uint64_t n)
+{
+#ifdef __SIZEOF_INT128__
+    return (uint64_t)(((unsigned __int128)x * (unsigned __int128)n) >> 64);
+#else
+    uint64_t x_hi = x >> 32, x_lo = x & 0xFFFFFFFF;
+    uint64_t n_hi = n >> 32, n_lo = n & 0xFFFFFFFF;
+    uint64_t ac = x_hi * n_hi;
+    uint64_t ad = x_hi * n_lo;
+    uint64_t bc = x_lo * n_hi;
+    uint64_t bd = x_lo * n_lo;
+    uint64_t mid = (bd >> 32) + (ad & 0xFFFFFFFF) + (bc & 0xFFFFFFFF);
+    return ac + (ad >> 32) + (bc >> 32) + (mid >> 32);
+#endif
+}
+
+} // anon namespace
+
+GCSFilter::GCSFilter(uint64_t nSipHashK0In, uint64_t nSipHashK1In, uint8_t nPIn, uint32_t nMIn)
+    : nSipHashK0(nSipHashK0In), nSipHashK1(nSipHashK1In), nP(nPIn), nM(nMIn), nN(0), nF(0)
+{
+    CVectorWriter stream(SER_NETWORK, PROTOCOL_VERSION, vEncoded, 0);
+    WriteCompactSize(stream, 0);
+}
+
+GCSFilter::GCSFilter(uint64_t nSipHashK0In, uint64_t nSipHashK1In, uint8_t nPIn, uint32_t nMIn,
+                     const std::vector<unsigned char>& vEncodedIn)
+    : nSipHashK0(nSipHashK0In), nSipHashK1(nSipHashK1In), nP(nPIn), nM(nMIn), vEncoded(vEncodedIn)
+{
+    if (nP > 32)
+        throw std::ios_base::failure("GCSFilter: P must be at most 32");
+
+    CSpanReader stream(SER_NETWORK, PROTOCOL_VERSION, vEncoded.data(), vEncoded.data() + vEncoded.size());
+    uint64_t nElements = ReadCompactSize(stream);
+    if (nElements > std::numeric_limits<uint32_t>::max())
+        throw std::ios_base::failure("GCSFilter: N must be less than 2^32");
+    nN = (uint32_t)nElements;
+    nF = (uint64_t)nN * nM;
+
+    // Decode once, so that a filter with fewer elements than it claims is
+    // rejected here rather than when it is matched
+    BitReader reader(vEncoded.data() + vEncoded.size() - stream.size(), vEncoded.data() + vEncoded.size());
+    for (uint32_t i = 0; i < nN; i++)
+        GolombRiceDecode(reader, nP);
+}
+
+GCSFilter::GCSFilter(uint64_t nSipHashK0In, uint64_t nSipHashK1In, uint8_t nPIn, uint32_t nMIn,
+                     const ElementSet& elements)
+    : nSipHashK0(nSipHashK0In), nSipHashK1(nSipHashK1In), nP(nPIn), nM(nMIn)
+{
+    if (nP > 32)
+        throw std::invalid_argument("GCSFilter: P must be at most 32");
+    if (elements.size() > std::numeric_limits<uint32_t>::max())
+        throw std::invalid_argument("GCSFilter: N must be less than 2^32");
+    nN = (uint32_t)elements.size();
+    nF = (uint64_t)nN * nM;
+
+    CVectorWriter stream(SER_NETWORK, PROTOCOL_VERSION, vEncoded, 0);
+    WriteCompactSize(stream, nN);
+    if (elements.empty())
+        return;
+
+    BitWriter writer(vEncoded);
+    uint64_t nLast = 0;
+    std::vector<uint64_t> vHashes = BuildHashedSet(elements);
+    BOOST_FOREACH(uint64_t nHash, vHashes) {
+        GolombRiceEncode(writer, nP, nHash - nLast);
+        nLast = nHash;
+    }
+    writer.Flush();
+}
+
+uint64_t GCSFilter::HashToRange(const Element& element) const
+{
+    uint64_t nHash = CSipHasher(nSipHashK0, nSipHashK1)
+        .Write(element.data(), element.size())
+        .Finalize();
+    return MapIntoRange(nHash, nF);
+}
+
+std::vector<uint64_t> GCSFilter::BuildHashedSet(const ElementSet& elements) const
+{
+    std::vector<uint64_t> vHashes;
+    vHashes.reserve(elements.size());
+    BOOST_FOREACH(const Element& element, elements)
+        vHashes.push_back(HashToRange(element));
+    std::sort(vHashes.begin(), vHashes.end());
+    return vHashes;
+}
+
+bool GCSFilter::MatchInternal(const uint64_t* pElementHashes, size_t nSize) const
+{
+    CSpanReader stream(SER_NETWORK, PROTOCOL_VERSION, vEncoded.data(), vEncoded.data() + vEncoded.size());
+    ReadCompactSize(stream);
+    BitReader reader(vEncoded.data() + vEncoded.size() - stream.size(), vEncoded.data() + vEncoded.size());
+
+    // Walk the filter and the sorted query hashes side by side
+    uint64_t nValue = 0;
+    size_t nQuery = 0;
+    for (uint32_t i = 0; i < nN; i++) {
+        nValue += GolombRiceDecode(reader, nP);
+        while (true) {
+            if (nQuery == nSize)
+                return false;
+            if (pElementHashes[nQuery] == nValue)
+                return true;
+            if (pElementHashes[nQuery] > nValue)
+                break;
+            nQuery++;
+        }
+    }
+    return false;
+}
+
+bool GCSFilter::Match(const Element& element) const
+{
+    uint64_t nQuery = HashToRange(element);
+    return MatchInternal(&nQuery, 1);
+}
+
+bool GCSFilter::MatchAny(const ElementSet& elements) const
+{
+    if (elements.empty())
+        return false;
+    const std::vector<uint64_t> vQueries = BuildHashedSet(elements);
+    return MatchInternal(vQueries.data(), vQueries.size());
+}
+
+static GCSFilter::ElementSet BasicFilterElements(const CBlock& block, const CBlockUndo& blockUndo)
+{
+    GCSFilter::ElementSet elements;
+
+    BOOST_FOREACH(const CTransactionRef& tx, block.vtx) {
+        BOOST_FOREACH(const CTxOut& txout, tx->vout) {
+            const CScript& script = txout.scriptPubKey;
+            if (script.empty() || script[0] == OP_RETURN)
+                continue;
+            elements.insert(GCSFilter::Element(script.begin(), script.end()));
+        }
+    }
+
+    BOOST_FOREACH(const CTxUndo& txUndo, blockUndo.vtxundo) {
+        BOOST_FOREACH(const Coin& prevout, txUndo.vprevout) {
+            const CScript& script = prevout.out.scriptPubKey;
+            if (script.empty())
+                continue;
+            elements.insert(GCSFilter::Element(script.begin(), script.end()));
+        }
+    }
+
+    return elements;
+}
+
+BlockFilter::BlockFilter(BlockFilterType filterTypeIn, const uint256& blockHashIn, const std::vector<unsigned char>& vEncoded)
+    : filterType(filterTypeIn), blockHash(blockHashIn)
+{
+    uint64_t nSipHashK0, nSipHashK1;
+    uint8_t nP;
+    uint32_t nM;
+    if (!BuildParams(nSipHashK0, nSipHashK1, nP, nM))
+        throw std::invalid_argument("unknown filter type");
+    filter = GCSFilter(nSipHashK0, nSipHashK1, nP, nM, vEncoded);
+}
+
+BlockFilter::BlockFilter(BlockFilterType filterTypeIn, const CBlock& block, const CBlockUndo& blockUndo)
+    : filterType(filterTypeIn), blockHash(block.GetHash())
+{
+    uint64_t nSipHashK0, nSipHashK1;
+    uint8_t nP;
+    uint32_t nM;
+    if (!BuildParams(nSipHashK0, nSipHashK1, nP, nM))
+        throw std::invalid_argument("unknown filter type");
+    filter = GCSFilter(nSipHashK0, nSipHashK1, nP, nM, BasicFilterElements(block, blockUndo));
+}
+
+bool BlockFilter::BuildParams(uint64_t& nSipHashK0, uint64_t& nSipHashK1, uint8_t& nP, uint32_t& nM) const
+{
+    // The SipHash key is the first 16 bytes of the block hash
+    nSipHashK0 = blockHash.GetUint64(0);
+    nSipHashK1 = blockHash.GetUint64(1);
+
+    switch (filterType) {
+    case BLOCK_FILTER_BASIC:
+        nP = BASIC_FILTER_P;
+        nM = BASIC_FILTER_M;
+        return true;
+    }
+    return false;
+}
+
+uint256 BlockFilter::GetHash() const
+{
+    const std::vector<unsigned char>& vData = GetEncodedFilter();
+    return Hash(vData.begin(), vData.end());
+}
+
+uint256 BlockFilter::ComputeHeader(const uint256& prevHeader) const
+{
+    const uint256 filterHash = GetHash();
+    return Hash(filterHash.begin(), filterHash.end(), prevHeader.begin(), prevHeader.end());
+}
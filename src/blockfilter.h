@@ -0,0 +1,139 @@
+// Copyright (c) 2017 The Bitcoin Core developers
+// Distributed under the MIT software license, see the accompanying
+// file COPYING or http://www.opensource.org/licenses/mit-license.php.
+
+#ifndef BITCOIN_BLOCKFILTER_H
+#define BITCOIN_BLOCKFILTER_H
+
+#include "primitives/block.h"
+#include "serialize.h"
+#include "uint256.h"
+#include "undo.h"
+
+#include <set>
+#include <stdint.h>
+#include <vector>
+
+/**
+ * Golomb-coded set: a compact probabilistic set of byte strings, as used by
+ * the BIP 158 block filters. Elements are hashed with SipHash into
+ * [0, N * M), and the sorted hashes are stored as Golomb-Rice coded
+ * differences with parameter P. Queries for elements not in the set match
+ * with a probability of about 1/M.
+ */
+class GCSFilter
+{
+public:
+    typedef std::vector<unsigned char> Element;
+    typedef std::set<Element> ElementSet;
+
+private:
+    uint64_t nSipHashK0;
+    uint64_t nSipHashK1;
+    uint8_t nP;     //!< Golomb-Rice coding parameter
+    uint32_t nM;    //!< Inverse false positive rate
+    uint32_t nN;    //!< Number of elements in the filter
+    uint64_t nF;    //!< Range of element hashes, F = N * M
+    std::vector<unsigned char> vEncoded;
+
+    uint64_t HashToRange(const Element& element) const;
+    std::vector<uint64_t> BuildHashedSet(const ElementSet& elements) const;
+
+    /** Whether any of the sorted element hashes is in the filter */
+    bool MatchInternal(const uint64_t* pElementHashes, size_t nSize) const;
+
+public:
+    /** Construct an empty filter. */
+    GCSFilter(uint64_t nSipHashK0In = 0, uint64_t nSipHashK1In = 0, uint8_t nPIn = 0, uint32_t nMIn = 0);
+
+    /** Reconstruct a filter from its encoding. Throws std::ios_base::failure if it is malformed. */
+    GCSFilter(uint64_t nSipHashK0In, uint64_t nSipHashK1In, uint8_t nPIn, uint32_t nMIn,
+              const std::vector<unsigned char>& vEncodedIn);
+
+    /** Build a filter of the given elements. */
+    GCSFilter(uint64_t nSipHashK0In, uint64_t nSipHashK1In, uint8_t nPIn, uint32_t nMIn,
+              const ElementSet& elements);
+
+    uint32_t GetN() const { return nN; }
+    const std::vector<unsigned char>& GetEncoded() const { return vEncoded; }
+
+    /** Whether element may be in the filter; false positives happen about once in M. */
+    bool Match(const Element& element) const;
+
+    /**
+     * Whether any of elements may be in the filter. This is faster than
+     * calling Match for each of them, as the filter is decoded only once.
+     */
+    bool MatchAny(const ElementSet& elements) const;
+};
+
+enum BlockFilterType
+{
+    BLOCK_FILTER_BASIC = 0,
+};
+
+/** BIP 158 parameters of basic filters */
+static const uint8_t BASIC_FILTER_P = 19;
+static const uint32_t BASIC_FILTER_M = 784931;
+
+/**
+ * Block filter of BIP 158: a GCSFilter keyed by the block hash. The basic
+ * filter holds the scriptPubKey of every output the block creates, except
+ * empty and OP_RETURN ones, and of every output it spends, which come from
+ * its undo data.
+ */
+class BlockFilter
+{
+private:
+    BlockFilterType filterType;
+    uint256 blockHash;
+    GCSFilter filter;
+
+    bool BuildParams(uint64_t& nSipHashK0, uint64_t& nSipHashK1, uint8_t& nP, uint32_t& nM) const;
+
+public:
+    BlockFilter() : filterType(BLOCK_FILTER_BASIC) {}
+
+    /** Reconstruct a filter from its encoding. Throws std::ios_base::failure if it is malformed. */
+    BlockFilter(BlockFilterType filterTypeIn, const uint256& blockHashIn, const std::vector<unsigned char>& vEncoded);
+
+    /** Compute the filter of a block, with the undo data of the same block. */
+    BlockFilter(BlockFilterType filterTypeIn, const CBlock& block, const CBlockUndo& blockUndo);
+
+    BlockFilterType GetFilterType() const { return filterType; }
+    const uint256& GetBlockHash() const { return blockHash; }
+    const GCSFilter& GetFilter() const { return filter; }
+    const std::vector<unsigned char>& GetEncodedFilter() const { return filter.GetEncoded(); }
+
+    /** Hash of the encoded filter */
+    uint256 GetHash() const;
+
+    /** Filter header as in BIP 157, committing to this filter and the header of the previous block's */
+    uint256 ComputeHeader(const uint256& prevHeader) const;
+
+    template <typename Stream>
+    void Serialize(Stream& s) const {
+        s << (uint8_t)filterType
+          << blockHash
+          << filter.GetEncoded();
+    }
+
+    template <typename Stream>
+    void Unserialize(Stream& s) {
+        std::vector<unsigned char> vEncoded;
+        uint8_t nType;
+        s >> nType
+          >> blockHash
+          >> vEncoded;
+        filterType = (BlockFilterType)nType;
+
+        uint64_t nSipHashK0, nSipHashK1;
+        uint8_t nP;
+        uint32_t nM;
+        if (!BuildParams(nSipHashK0, nSipHashK1, nP, nM))
+            throw std::ios_base::failure("unknown filter type");
+        filter = GCSFilter(nSipHashK0, nSipHashK1, nP, nM, vEncoded);
+    }
+};
+
+#endif // BITCOIN_BLOCKFILTER_H
@@ -0,0 +1,93 @@
+// Copyright (c) 2017 The Bitcoin Core developers
+// Distributed under the MIT software license, see the accompanying
+// file COPYING or http://www.opensource.org/licenses/mit-license.php.
+
+#include "blockfilterindex.h"
+
+#include "primitives/block.h"
+#include "undo.h"
+#include "util.h"
+
+#include <boost/foreach.hpp>
+
+static const char DB_FILTER = 'f';
+static const char DB_BEST_BLOCK = 'B';
+
+CBlockFilterIndex* pblockfilterindex = NULL;
+
+namespace {
+
+/** What the index stores per block */
+struct CBlockFilterEntry
+{
+    std::vector<unsigned char> vFilter;
+    uint256 hashHeader;
+
+    ADD_SERIALIZE_METHODS;
+
+    template <typename Stream, typename Operation>
+    inline void SerializationOp(Stream& s, Operation ser_action) {
+        READWRITE(vFilter);
+        READWRITE(hashHeader);
+    }
+};
+
+} // anon namespace
+
+CBlockFilterIndex::CBlockFilterIndex(size_t nCacheSize, bool fMemory, bool fWipe)
+    : CBackgroundIndex("block filter index"), db(GetDataDir() / "blockfilters", nCacheSize, fMemory, fWipe)
+{
+}
+
+bool CBlockFilterIndex::ReadBestBlock(CBlockLocator& locator) const
+{
+    return db.Read(DB_BEST_BLOCK, locator);
+}
+
+bool CBlockFilterIndex::WriteBlocks(const std::vector<CIndexedBlock>& vBlocks, const CBlockLocator& locator)
+{
+    // Filter headers chain on from that of the parent of the first block,
+    // which was indexed before, unless it is the genesis block
+    uint256 hashHeader;
+    if (vBlocks.front().nHeight > 0 && !LookupFilterHeader(vBlocks.front().hashPrev, hashHeader))
+        return error("%s: no filter header for block %s", __func__, vBlocks.front().hashPrev.ToString());
+
+    CDBBatch batch(db);
+    BOOST_FOREACH(const CIndexedBlock& indexedBlock, vBlocks) {
+        CBlock block;
+        CBlockUndo blockUndo;
+        if (!ReadBlock(indexedBlock, block) || !ReadUndo(indexedBlock, blockUndo))
+            return false;
+
+        BlockFilter filter(BLOCK_FILTER_BASIC, block, blockUndo);
+        CBlockFilterEntry entry;
+        entry.vFilter = filter.GetEncodedFilter();
+        entry.hashHeader = filter.ComputeHeader(hashHeader);
+        hashHeader = entry.hashHeader;
+        batch.Write(std::make_pair(DB_FILTER, indexedBlock.hash), entry);
+    }
+    batch.Write(DB_BEST_BLOCK, locator);
+    return db.WriteBatch(batch);
+}
+
+bool CBlockFilterIndex::LookupFilter(const uint256& hashBlock, BlockFilter& filter) const
+{
+    CBlockFilterEntry entry;
+    if (!db.Read(std::make_pair(DB_FILTER, hashBlock), entry))
+        return false;
+    try {
+        filter = BlockFilter(BLOCK_FILTER_BASIC, hashBlock, entry.vFilter);
+    } catch (const std::exception& e) {
+        return error("%s: invalid filter for block %s: %s", __func__, hashBlock.ToString(), e.what());
+    }
+    return true;
+}
+
+bool CBlockFilterIndex::LookupFilterHeader(const uint256& hashBlock, uint256& header) const
+{
+    CBlockFilterEntry entry;
+    if (!db.Read(std::make_pair(DB_FILTER, hashBlock), entry))
+        return false;
+    header = entry.hashHeader;
+    return true;
+}
@@ -0,0 +1,41 @@
+// Copyright (c) 2017 The Bitcoin Core developers
+// Distributed under the MIT software license, see the accompanying
+// file COPYING or http://www.opensource.org/licenses/mit-license.php.
+
+#ifndef BITCOIN_BLOCKFILTERINDEX_H
+#define BITCOIN_BLOCKFILTERINDEX_H
+
+#include "backgroundindex.h"
+#include "blockfilter.h"
+#include "dbwrapper.h"
+#include "uint256.h"
+
+/** Default for -blockfilterindex */
+static const bool DEFAULT_BLOCKFILTERINDEX = false;
+
+/**
+ * Index of the BIP 158 basic filters of the blocks of the active chain
+ * (-blockfilterindex), with their BIP 157 filter headers, in its own
+ * database under <datadir>/blockfilters. Entries are keyed by block hash, so
+ * those of blocks that were reorganized away do no harm and are kept.
+ */
+class CBlockFilterIndex : public CBackgroundIndex
+{
+private:
+    CDBWrapper db;
+
+protected:
+    bool ReadBestBlock(CBlockLocator& locator) const;
+    bool WriteBlocks(const std::vector<CIndexedBlock>& vBlocks, const CBlockLocator& locator);
+
+public:
+    CBlockFilterIndex(size_t nCacheSize, bool fMemory = false, bool fWipe = false);
+
+    bool LookupFilter(const uint256& hashBlock, BlockFilter& filter) const;
+    bool LookupFilterHeader(const uint256& hashBlock, uint256& header) const;
+};
+
+/** The block filter index, if -blockfilterindex is set */
+extern CBlockFilterIndex* pblockfilterindex;
+
+#endif // BITCOIN_BLOCKFILTERINDEX_H
@@ -0,0 +1,254 @@
+// Copyright (c) 2017 The Bitcoin Core developers
+// Distributed under the MIT software license, see the accompanying
+// file COPYING or http://www.opensource.org/licenses/mit-license.php.
+
+#include "blockmap.h"
+
+#include "crypto/common.h"
+#include "util.h"
+#include "validation.h"
+
+#include <string.h>
+
+#ifndef WIN32
+#include <fcntl.h>
+#include <sys/mman.h>
+#include <sys/stat.h>
+#include <unistd.h>
+#endif
+
+/** A whole block file mapped into memory, unmapped when the last user is gone. */
+class CBlockFileMapping
+{
+public:
+    const unsigned char* const pbegin;
+    const size_t nSize;
+
+    CBlockFileMapping(const unsigned char* pbeginIn, size_t nSizeIn) : pbegin(pbeginIn), nSize(nSizeIn) {}
+
+    ~CBlockFileMapping()
+    {
+#ifndef WIN32
+        munmap((void*)pbegin, nSize);
+#endif
+    }
+};
+
+// Every mapping takes up to MAX_BLOCKFILE_SIZE of address space, which a
+// 32-bit process cannot spare.
+CBlockFileMapper blockFileMapper(sizeof(void*) >= 8 ? DEFAULT_BLOCK_MAPPINGS : 0);
+
+void CRawBlock::SetNull()
+{
+    mapping.reset();
+    pbegin = NULL;
+    nSize = 0;
+}
+
+CBlockFileMapper::CBlockFileMapper(size_t nMaxMappingsIn) : nMaxMappings(nMaxMappingsIn)
+{
+}
+
+std::shared_ptr<const CBlockFileMapping> CBlockFileMapper::GetMapping(int nFile, uint64_t nMinSize)
+{
+    AssertLockHeld(cs);
+    for (std::list<std::pair<int, std::shared_ptr<const CBlockFileMapping> > >::iterator it = listMappings.begin(); it != listMappings.end(); ++it) {
+        if (it->first != nFile)
+            continue;
+        if (it->second->nSize >= nMinSize) {
+            listMappings.splice(listMappings.begin(), listMappings, it);
+            return it->second;
+        }
+        // The file has grown since it was mapped
+        listMappings.erase(it);
+        break;
+    }
+
+#ifdef WIN32
+    return nullptr;
+#else
+    if (nMaxMappings == 0)
+        return nullptr;
+    boost::filesystem::path path = GetBlockPosFilename(CDiskBlockPos(nFile, 0), "blk");
+    int fd = open(path.string().c_str(), O_RDONLY);
+    if (fd < 0)
+        return nullptr;
+    struct stat st;
+    if (fstat(fd, &st) != 0 || st.st_size <= 0 || (uint64_t)st.st_size < nMinSize) {
+        close(fd);
+        return nullptr;
+    }
+    void* p = mmap(NULL, st.st_size, PROT_READ, MAP_SHARED, fd, 0);
+    close(fd);
+    if (p == MAP_FAILED) {
+        LogPrintf("%s: cannot map %s\n", __func__, path.string());
+        return nullptr;
+    }
+    std::shared_ptr<const CBlockFileMapping> mapping = std::make_shared<CBlockFileMapping>((const unsigned char*)p, st.st_size);
+    listMappings.emplace_front(nFile, mapping);
+    if (listMappings.size() > nMaxMappings)
+        listMappings.pop_back();
+    return mapping;
+#endif
+}
+
+bool CBlockFileMapper::ReadRawBlock(CRawBlock& raw, const CDiskBlockPos& pos, const CMessageHeader::MessageStartChars& messageStart)
+{
+    raw.SetNull();
+    // Blocks are stored behind the network magic and their length
+    if (pos.IsNull() || pos.nPos < 8)
+        return false;
+
+    std::shared_ptr<const CBlockFileMapping> mapping;
+    uint32_t nSize = 0;
+    {
+        LOCK(cs);
+        mapping = GetMapping(pos.nFile, (uint64_t)pos.nPos + 80);
+        if (!mapping)
+            return false;
+        const unsigned char* pheader = mapping->pbegin + pos.nPos - 8;
+        if (memcmp(pheader, messageStart, CMessageHeader::MESSAGE_START_SIZE) != 0)
+            return false;
+        nSize = ReadLE32(pheader + 4);
+        if (nSize < 80)
+            return false;
+        if ((uint64_t)pos.nPos + nSize > mapping->nSize) {
+            mapping = GetMapping(pos.nFile, (uint64_t)pos.nPos + nSize);
+            if (!mapping)
+                return false;
+        }
+    }
+
+    raw.mapping = mapping;
+    raw.pbegin = mapping->pbegin + pos.nPos;
+    raw.nSize = nSize;
+    return true;
+}
+
+void CBlockFileMapper::Forget(int nFile)
+{
+    LOCK(cs);
+    for (std::list<std::pair<int, std::shared_ptr<const CBlockFileMapping> > >::iterator it = listMappings.begin(); it != listMappings.end(); ++it) {
+        if (it->first == nFile) {
+            listMappings.erase(it);
+            return;
+        }
+    }
+}
+
+void CBlockFileMapper::Clear()
+{
+    LOCK(cs);
+    listMappings.clear();
+}
+
+namespace {
+
+/** Walks over serialized data, failing rather than reading past its end. */
+class CRawCursor
+{
+private:
+    const unsigned char* p;
+    const unsigned char* const pend;
+
+public:
+    CRawCursor(const unsigned char* pbegin, const unsigned char* pendIn) : p(pbegin), pend(pendIn) {}
+
+    const unsigned char* Pos() const { return p; }
+    size_t Remaining() const { return pend - p; }
+
+    bool Skip(uint64_t n)
+    {
+        if (Remaining() < n)
+            return false;
+        p += n;
+        return true;
+    }
+
+    bool ReadCompactSize(uint64_t& n)
+    {
+        if (!Skip(1))
+            return false;
+        n = p[-1];
+        if (n < 253)
+            return true;
+        size_t nBytes = n == 253 ? 2 : n == 254 ? 4 : 8;
+        if (!Skip(nBytes))
+            return false;
+        n = nBytes == 2 ? ReadLE16(p - 2) : nBytes == 4 ? ReadLE32(p - 4) : ReadLE64(p - 8);
+        return true;
+    }
+
+    //! Skip a length-prefixed byte vector, such as a script
+    bool SkipVector()
+    {
+        uint64_t n;
+        return ReadCompactSize(n) && Skip(n);
+    }
+};
+
+} // anon namespace
+
+bool StripBlockWitness(const unsigned char* pbegin, const unsigned char* pend, std::vector<unsigned char>& vchOut)
+{
+    vchOut.clear();
+    CRawCursor cursor(pbegin, pend);
+    uint64_t nTx;
+    if (!cursor.Skip(80) || !cursor.ReadCompactSize(nTx))
+        return false;
+    vchOut.reserve(pend - pbegin);
+    vchOut.insert(vchOut.end(), pbegin, cursor.Pos());
+
+    // See SerializeTransaction/UnserializeTransaction for the layout
+    for (uint64_t i = 0; i < nTx; i++) {
+        const unsigned char* pversion = cursor.Pos();
+        if (!cursor.Skip(4))
+            return false;
+        const unsigned char* pversionEnd = cursor.Pos();
+        unsigned char nFlags = 0;
+        if (cursor.Remaining() >= 2 && pversionEnd[0] == 0 && pversionEnd[1] != 0) {
+            // Dummy empty vin, followed by the flags
+            nFlags = pversionEnd[1];
+            cursor.Skip(2);
+        }
+        const unsigned char* pvin = cursor.Pos();
+        uint64_t nIn, nOut;
+        if (!cursor.ReadCompactSize(nIn))
+            return false;
+        for (uint64_t j = 0; j < nIn; j++) {
+            // prevout, scriptSig, nSequence
+            if (!cursor.Skip(36) || !cursor.SkipVector() || !cursor.Skip(4))
+                return false;
+        }
+        if (!cursor.ReadCompactSize(nOut))
+            return false;
+        for (uint64_t j = 0; j < nOut; j++) {
+            // nValue, scriptPubKey
+            if (!cursor.Skip(8) || !cursor.SkipVector())
+                return false;
+        }
+        const unsigned char* pvoutEnd = cursor.Pos();
+        if (nFlags & 1) {
+            // One witness stack per input
+            for (uint64_t j = 0; j < nIn; j++) {
+                uint64_t nItems;
+                if (!cursor.ReadCompactSize(nItems))
+                    return false;
+                for (uint64_t k = 0; k < nItems; k++) {
+                    if (!cursor.SkipVector())
+                        return false;
+                }
+            }
+            nFlags ^= 1;
+        }
+        if (nFlags)
+            return false;
+        const unsigned char* plocktime = cursor.Pos();
+        if (!cursor.Skip(4))
+            return false;
+        vchOut.insert(vchOut.end(), pversion, pversionEnd);
+        vchOut.insert(vchOut.end(), pvin, pvoutEnd);
+        vchOut.insert(vchOut.end(), plocktime, cursor.Pos());
+    }
+    return cursor.Remaining() == 0;
+}
@@ -0,0 +1,89 @@
+// Copyright (c) 2017 The Bitcoin Core developers
+// Distributed under the MIT software license, see the accompanying
+// file COPYING or http://www.opensource.org/licenses/mit-license.php.
+
+#ifndef BITCOIN_BLOCKMAP_H
+#define BITCOIN_BLOCKMAP_H
+
+#include "chain.h"
+#include "protocol.h"
+#include "sync.h"
+
+#include <list>
+#include <memory>
+#include <utility>
+#include <vector>
+
+class CBlockFileMapping;
+
+/**
+ * The serialized form of a block (as stored on disk, with witness data),
+ * pointing straight into a memory-mapped block file. The mapping stays valid
+ * for as long as this object, or a copy of it, exists.
+ */
+class CRawBlock
+{
+private:
+    std::shared_ptr<const CBlockFileMapping> mapping;
+    const unsigned char* pbegin;
+    size_t nSize;
+
+    friend class CBlockFileMapper;
+
+public:
+    CRawBlock() : pbegin(NULL), nSize(0) {}
+
+    const unsigned char* begin() const { return pbegin; }
+    const unsigned char* end() const { return pbegin + nSize; }
+    size_t size() const { return nSize; }
+    bool empty() const { return nSize == 0; }
+    void SetNull();
+};
+
+/**
+ * Reads blocks from memory-mapped blk?????.dat files. The most recently used
+ * files stay mapped, so repeated reads cost neither a system call nor a copy.
+ * Where mapping is not available (Windows, 32-bit address spaces) every
+ * read fails, and callers fall back to reading the file.
+ */
+class CBlockFileMapper
+{
+private:
+    CCriticalSection cs;
+    //! Mapped files, most recently used first
+    std::list<std::pair<int, std::shared_ptr<const CBlockFileMapping> > > listMappings;
+    size_t nMaxMappings;
+
+    std::shared_ptr<const CBlockFileMapping> GetMapping(int nFile, uint64_t nMinSize);
+
+public:
+    CBlockFileMapper(size_t nMaxMappingsIn);
+
+    /**
+     * Find the block stored at pos (as in CBlockIndex::GetBlockPos), after
+     * checking the network magic and length in front of it.
+     */
+    bool ReadRawBlock(CRawBlock& raw, const CDiskBlockPos& pos, const CMessageHeader::MessageStartChars& messageStart);
+
+    /** Unmap a block file that is about to be truncated or deleted. Readers holding a CRawBlock are unaffected. */
+    void Forget(int nFile);
+
+    /** Unmap all block files */
+    void Clear();
+};
+
+/**
+ * Turn a serialized block (with witness data, as stored on disk) into the
+ * serialization without witnesses, as sent to peers that did not ask for
+ * them, by copying the parts that remain. Returns false if the data is not
+ * exactly one well-formed block.
+ */
+bool StripBlockWitness(const unsigned char* pbegin, const unsigned char* pend, std::vector<unsigned char>& vchOut);
+
+/** Default number of block files to keep mapped */
+static const size_t DEFAULT_BLOCK_MAPPINGS = 16;
+
+/** The mapper used for block files in the data directory */
+extern CBlockFileMapper blockFileMapper;
+
+#endif // BITCOIN_BLOCKMAP_H
@@ -13,13 +13,16 @@ using namespace std;
 void CChain::SetTip(CBlockIndex *pindex) {
     if (pindex == NULL) {
         vChain.clear();
+        pindexTip = NULL;
         return;
     }
+    CBlockIndex *pindexNewTip = pindex;
     vChain.resize(pindex->nHeight + 1);
     while (pindex && vChain[pindex->nHeight] != pindex) {
         vChain[pindex->nHeight] = pindex;
         pindex = pindex->pprev;
     }
+    pindexTip = pindexNewTip;
 }
 
 CBlockLocator CChain::GetLocator(const CBlockIndex *pindex) const {
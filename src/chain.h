@@ -12,6 +12,7 @@
 #include "tinyformat.h"
 #include "uint256.h"
 
+#include <atomic>
 #include <vector>
 
 class CBlockFileInfo
@@ -409,8 +410,12 @@ public:
 class CChain {
 private:
     std::vector<CBlockIndex*> vChain;
+    //! Copy of the tip for TipUnlocked(), updated by SetTip()
+    std::atomic<CBlockIndex*> pindexTip;
 
 public:
+    CChain() : pindexTip(NULL) {}
+
     /** Returns the index entry for the genesis block of this chain, or NULL if none. */
     CBlockIndex *Genesis() const {
         return vChain.size() > 0 ? vChain[0] : NULL;
@@ -452,6 +457,22 @@ public:
         return vChain.size() - 1;
     }
 
+    /**
+     * Returns the tip without holding the lock that protects the chain
+     * (cs_main for chainActive). It may be outdated by the time it is used,
+     * but block index entries are not freed while the node runs, so only
+     * their fields that can change under cs_main need care.
+     */
+    CBlockIndex *TipUnlocked() const {
+        return pindexTip.load();
+    }
+
+    /** Height of TipUnlocked(), or -1 if there is none. */
+    int HeightUnlocked() const {
+        CBlockIndex *pindex = pindexTip.load();
+        return pindex ? pindex->nHeight : -1;
+    }
+
     /** Set/initialize a chain with a given tip. */
     void SetTip(CBlockIndex *pindex);
 
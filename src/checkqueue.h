@@ -6,31 +6,130 @@
 #define BITCOIN_CHECKQUEUE_H
 
 #include <algorithm>
+#include <atomic>
+#include <memory>
 #include <vector>
 
+#include <assert.h>
+#include <stdint.h>
+
 #include <boost/foreach.hpp>
 #include <boost/thread/condition_variable.hpp>
 #include <boost/thread/locks.hpp>
 #include <boost/thread/mutex.hpp>
 
+/** Maximum number of threads (including the master) that can work on one CCheckQueue */
+static const int MAX_CHECKQUEUE_THREADS = 256;
+
 template <typename T>
 class CCheckQueueControl;
 
-/** 
+/**
  * Queue for verifications that have to be performed.
-  * The verifications are represented by a type T, which must provide an
-  * operator(), returning a bool.
-  *
-  * One thread (the master) is assumed to push batches of verifications
-  * onto the queue, where they are processed by N-1 worker threads. When
-  * the master is done adding work, it temporarily joins the worker pool
-  * as an N'th worker, until all jobs are done.
-  */
+ * The verifications are represented by a type T, which must provide an
+ * operator(), returning a bool.
+ *
+ * One thread (the master) is assumed to push batches of verifications
+ * onto the queue, where they are processed by N-1 worker threads. When
+ * the master is done adding work, it temporarily joins the worker pool
+ * as an N'th worker, until all jobs are done.
+ *
+ * Every thread has a queue of its own. The master deals verifications out
+ * over them, nBatchSize at a time per queue, and a thread that runs out of
+ * work steals from the others, from threads in its own group (e.g. on the
+ * same CPU socket) first. Handing out and taking verifications is
+ * lock-free; the mutex is only used to put idle threads to sleep and to
+ * wake them up.
+ */
 template <typename T>
 class CCheckQueue
 {
 private:
-    //! Mutex to protect the inner state
+    /**
+     * Bounded lock-free queue of verifications, after D. Vyukov's
+     * multi-producer multi-consumer ring buffer. Every cell carries a
+     * sequence number that says whether it is ready to be written or read
+     * at a given position.
+     */
+    class WorkerQueue
+    {
+    private:
+        static const size_t CAPACITY = 2048;
+
+        struct Cell {
+            std::atomic<size_t> sequence;
+            T check;
+        };
+
+        std::unique_ptr<Cell[]> cells;
+        // Keep the positions on separate cache lines, as they are written
+        // by different threads.
+        char padding0[64];
+        std::atomic<size_t> nPushPos;
+        char padding1[64];
+        std::atomic<size_t> nPopPos;
+        char padding2[64];
+
+    public:
+        //! The group of the thread owning this queue.
+        const int nGroup;
+
+        WorkerQueue(int nGroupIn) : cells(new Cell[CAPACITY]), nPushPos(0), nPopPos(0), nGroup(nGroupIn)
+        {
+            for (size_t i = 0; i < CAPACITY; i++)
+                cells[i].sequence.store(i, std::memory_order_relaxed);
+        }
+
+        //! Move check into the queue. Returns false if the queue is full.
+        bool Push(T& check)
+        {
+            size_t pos = nPushPos.load(std::memory_order_relaxed);
+            while (true) {
+                Cell& cell = cells[pos & (CAPACITY - 1)];
+                intptr_t dif = (intptr_t)cell.sequence.load(std::memory_order_acquire) - (intptr_t)pos;
+                if (dif == 0) {
+                    if (nPushPos.compare_exchange_weak(pos, pos + 1, std::memory_order_relaxed)) {
+                        cell.check.swap(check);
+                        cell.sequence.store(pos + 1, std::memory_order_release);
+                        return true;
+                    }
+                } else if (dif < 0) {
+                    return false;
+                } else {
+                    pos = nPushPos.load(std::memory_order_relaxed);
+                }
+            }
+        }
+
+        //! Move the oldest check out of the queue. Returns false if the queue is empty.
+        bool Pop(T& check)
+        {
+            size_t pos = nPopPos.load(std::memory_order_relaxed);
+            while (true) {
+                Cell& cell = cells[pos & (CAPACITY - 1)];
+                intptr_t dif = (intptr_t)cell.sequence.load(std::memory_order_acquire) - (intptr_t)(pos + 1);
+                if (dif == 0) {
+                    if (nPopPos.compare_exchange_weak(pos, pos + 1, std::memory_order_relaxed)) {
+                        check.swap(cell.check);
+                        cell.sequence.store(pos + CAPACITY, std::memory_order_release);
+                        return true;
+                    }
+                } else if (dif < 0) {
+                    return false;
+                } else {
+                    pos = nPopPos.load(std::memory_order_relaxed);
+                }
+            }
+        }
+    };
+
+    //! Per-thread queues; entry 0 belongs to the master. Entries are only added.
+    std::atomic<WorkerQueue*> queues[MAX_CHECKQUEUE_THREADS];
+
+    //! The number of entries of queues in use.
+    std::atomic<int> nQueues;
+
+    //! Mutex to protect adding queues, and to sleep on
     boost::mutex mutex;
 
     //! Worker threads block on this when out of work
@@ -39,137 +138,192 @@ private:
     //! Master thread blocks on this when out of work
     boost::condition_variable condMaster;
 
-    //! The queue of elements to be processed.
-    //! As the order of booleans doesn't matter, it is used as a LIFO (stack)
-    std::vector<T> queue;
+    //! The number of workers sleeping on condWorker.
+    std::atomic<int> nSleeping;
 
-    //! The number of workers (including the master) that are idle.
-    int nIdle;
-
-    //! The total number of workers (including the master).
-    int nTotal;
-
-    //! The temporary evaluation result.
-    bool fAllOk;
+    //! The number of verifications sitting in the queues. May briefly drop below zero.
+    std::atomic<int> nQueued;
 
     /**
      * Number of verifications that haven't completed yet.
-     * This includes elements that are no longer queued, but still in the
-     * worker's own batches.
+     * This includes elements that are no longer queued, but still being
+     * processed by a worker.
      */
-    unsigned int nTodo;
+    std::atomic<unsigned int> nTodo;
 
-    //! Whether we're shutting down.
-    bool fQuit;
+    //! The temporary evaluation result.
+    std::atomic<bool> fAllOk;
 
-    //! The maximum number of elements to be processed in one batch
+    //! The number of elements the master puts in one queue before moving on to the next
     unsigned int nBatchSize;
 
+    //! The queue the master is currently filling, and how much it put there (master only).
+    int nPushQueue;
+    unsigned int nPushedToQueue;
+
+    //! Register a queue for the calling thread. Returns its index, or -1 if there is no room.
+    int AddQueue(int nGroup)
+    {
+        boost::unique_lock<boost::mutex> lock(mutex);
+        int n = nQueues.load();
+        if (n == MAX_CHECKQUEUE_THREADS)
+            return -1;
+        queues[n].store(new WorkerQueue(nGroup));
+        nQueues.store(n + 1);
+        return n;
+    }
+
+    //! Take up to nMax verifications from our own queue, or else steal them, from our own group first.
+    unsigned int Take(int nSelf, std::vector<T>& vChecks, unsigned int nMax)
+    {
+        vChecks.resize(nMax);
+        int n = nQueues.load();
+        int nGroup = queues[nSelf].load()->nGroup;
+        for (int nPass = 0; nPass < 2; nPass++) {
+            for (int i = 0; i < n; i++) {
+                WorkerQueue* pqueue = queues[(nSelf + i) % n].load();
+                if ((pqueue->nGroup == nGroup) != (nPass == 0))
+                    continue;
+                unsigned int nNow = 0;
+                while (nNow < nMax && pqueue->Pop(vChecks[nNow]))
+                    nNow++;
+                if (nNow) {
+                    vChecks.resize(nNow);
+                    nQueued -= nNow;
+                    return nNow;
+                }
+            }
+        }
+        vChecks.clear();
+        return 0;
+    }
+
     /** Internal function that does bulk of the verification work. */
-    bool Loop(bool fMaster = false)
+    bool Loop(int nSelf, bool fMaster = false)
     {
-        boost::condition_variable& cond = fMaster ? condMaster : condWorker;
         std::vector<T> vChecks;
         vChecks.reserve(nBatchSize);
-        unsigned int nNow = 0;
-        bool fOk = true;
-        do {
-            {
-                boost::unique_lock<boost::mutex> lock(mutex);
-                // first do the clean-up of the previous loop run (allowing us to do it in the same critsect)
-                if (nNow) {
-                    fAllOk &= fOk;
-                    nTodo -= nNow;
-                    if (nTodo == 0 && !fMaster)
-                        // We processed the last element; inform the master it can exit and return the result
-                        condMaster.notify_one();
-                } else {
-                    // first iteration
-                    nTotal++;
-                }
-                // logically, the do loop starts here
-                while (queue.empty()) {
-                    if ((fMaster || fQuit) && nTodo == 0) {
-                        nTotal--;
-                        bool fRet = fAllOk;
-                        // reset the status for new work later
-                        if (fMaster)
-                            fAllOk = true;
-                        // return the current status
-                        return fRet;
-                    }
-                    nIdle++;
-                    cond.wait(lock); // wait
-                    nIdle--;
-                }
-                // Decide how many work units to process now.
-                // * Do not try to do everything at once, but aim for increasingly smaller batches so
-                //   all workers finish approximately simultaneously.
-                // * Try to account for idle jobs which will instantly start helping.
-                // * Don't do batches smaller than 1 (duh), or larger than nBatchSize.
-                nNow = std::max(1U, std::min(nBatchSize, (unsigned int)queue.size() / (nTotal + nIdle + 1)));
-                vChecks.resize(nNow);
-                for (unsigned int i = 0; i < nNow; i++) {
-                    // We want the lock on the mutex to be as short as possible, so swap jobs from the global
-                    // queue to the local batch vector instead of copying.
-                    vChecks[i].swap(queue.back());
-                    queue.pop_back();
+        while (true) {
+            // Decide how many work units to process now.
+            // * Do not try to do everything at once, but aim for increasingly smaller batches so
+            //   all workers finish approximately simultaneously.
+            // * Don't do batches smaller than 1 (duh), or larger than nBatchSize.
+            unsigned int nMax = std::max(1, std::min((int)nBatchSize, nQueued.load() / (nQueues.load() + 1)));
+            unsigned int nNow = Take(nSelf, vChecks, nMax);
+            if (nNow) {
+                // Once something failed, the rest is only drained.
+                bool fOk = fAllOk.load(std::memory_order_relaxed);
+                BOOST_FOREACH (T& check, vChecks)
+                    if (fOk)
+                        fOk = check();
+                if (!fOk)
+                    fAllOk.store(false);
+                vChecks.clear();
+                if (nTodo.fetch_sub(nNow) == nNow && !fMaster) {
+                    // We processed the last element; inform the master it can exit and return the result
+                    boost::unique_lock<boost::mutex> lock(mutex);
+                    condMaster.notify_one();
                 }
-                // Check whether we need to do work at all
-                fOk = fAllOk;
+                continue;
             }
-            // execute work
-            BOOST_FOREACH (T& check, vChecks)
-                if (fOk)
-                    fOk = check();
-            vChecks.clear();
-        } while (true);
+            boost::unique_lock<boost::mutex> lock(mutex);
+            if (fMaster) {
+                // Only the master adds work, so all that is left is in
+                // progress in other threads.
+                while (nTodo.load() != 0)
+                    condMaster.wait(lock);
+                // return the current status, and reset it for new work later
+                return fAllOk.exchange(true);
+            }
+            // Either Add sees that we are about to sleep, or we see what it queued.
+            nSleeping++;
+            while (nQueued.load() <= 0)
+                condWorker.wait(lock);
+            nSleeping--;
+        }
     }
 
 public:
     //! Create a new check queue
-    CCheckQueue(unsigned int nBatchSizeIn) : nIdle(0), nTotal(0), fAllOk(true), nTodo(0), fQuit(false), nBatchSize(nBatchSizeIn) {}
+    CCheckQueue(unsigned int nBatchSizeIn) : nQueues(0), nSleeping(0), nQueued(0), nTodo(0), fAllOk(true), nBatchSize(std::max(1U, nBatchSizeIn)), nPushQueue(0), nPushedToQueue(0)
+    {
+        for (int i = 0; i < MAX_CHECKQUEUE_THREADS; i++)
+            queues[i].store(NULL);
+        AddQueue(0);
+    }
 
-    //! Worker thread
+    //! Worker thread. Returns straight away if MAX_CHECKQUEUE_THREADS are working already.
     void Thread()
     {
-        Loop();
+        ThreadInGroup(0);
+    }
+
+    //! Worker thread that prefers the work of other threads in nGroup. The master's queue is
+    //! always in group 0, as the master is whatever thread happens to call Wait().
+    void ThreadInGroup(int nGroup)
+    {
+        int nSelf = AddQueue(nGroup);
+        if (nSelf >= 0)
+            Loop(nSelf);
     }
 
     //! Wait until execution finishes, and return whether all evaluations were successful.
     bool Wait()
     {
-        return Loop(true);
+        return Loop(0, true);
     }
 
     //! Add a batch of checks to the queue
     void Add(std::vector<T>& vChecks)
     {
-        boost::unique_lock<boost::mutex> lock(mutex);
+        if (vChecks.empty())
+            return;
+        nTodo += vChecks.size();
+        int n = nQueues.load();
+        int nPushed = 0;
         BOOST_FOREACH (T& check, vChecks) {
-            queue.push_back(T());
-            check.swap(queue.back());
+            bool fPushed = false;
+            for (int i = 0; i < n && !fPushed; i++) {
+                if (nPushedToQueue >= nBatchSize) {
+                    nPushQueue = (nPushQueue + 1) % n;
+                    nPushedToQueue = 0;
+                }
+                fPushed = queues[nPushQueue % n].load()->Push(check);
+                nPushedToQueue = fPushed ? nPushedToQueue + 1 : nBatchSize;
+            }
+            if (fPushed) {
+                nPushed++;
+            } else {
+                // Every queue is full; do this one right here rather than wait for room.
+                if (fAllOk.load(std::memory_order_relaxed) && !check())
+                    fAllOk.store(false);
+                nTodo--;
+            }
+        }
+        nQueued += nPushed;
+        if (nPushed > 0 && nSleeping.load() > 0) {
+            boost::unique_lock<boost::mutex> lock(mutex);
+            if (nPushed == 1)
+                condWorker.notify_one();
+            else
+                condWorker.notify_all();
         }
-        nTodo += vChecks.size();
-        if (vChecks.size() == 1)
-            condWorker.notify_one();
-        else if (vChecks.size() > 1)
-            condWorker.notify_all();
     }
 
     ~CCheckQueue()
     {
+        for (int i = 0; i < nQueues.load(); i++)
+            delete queues[i].load();
     }
 
     bool IsIdle()
     {
-        boost::unique_lock<boost::mutex> lock(mutex);
-        return (nTotal == nIdle && nTodo == 0 && fAllOk == true);
+        return (nTodo.load() == 0 && fAllOk.load());
     }
 
 };
 
-/** 
+/**
  * RAII-style controller object for a CCheckQueue that guarantees the passed
  * queue is finished before continuing.
  */
@@ -0,0 +1,54 @@
+// Copyright (c) 2017 The Bitcoin Core developers
+// Distributed under the MIT software license, see the accompanying
+// file COPYING or http://www.opensource.org/licenses/mit-license.php.
+
+#ifndef BITCOIN_COMPAT_CPUID_H
+#define BITCOIN_COMPAT_CPUID_H
+
+#include <stdint.h>
+
+#if defined(__x86_64__) || defined(__amd64__) || defined(__i386__)
+#define HAVE_GETCPUID
+
+void static inline GetCPUID(uint32_t leaf, uint32_t subleaf, uint32_t& a, uint32_t& b, uint32_t& c, uint32_t& d)
+{
+    __asm__ ("cpuid" : "=a"(a), "=b"(b), "=c"(c), "=d"(d) : "0"(leaf), "2"(subleaf));
+}
+
+/** Whether the OS has enabled saving the AVX (YMM) registers */
+bool static inline AVXEnabled()
+{
+    uint32_t a, d;
+    __asm__ ("xgetbv" : "=a"(a), "=d"(d) : "c"(0));
+    return (a & 6) == 6;
+}
+
+/** The instruction set extensions there are optional kernels for, as supported by this CPU and OS */
+struct CPUFeatures
+{
+    bool fSSE41;
+    bool fAVX2;
+    bool fSHANI;
+};
+
+CPUFeatures static inline GetCPUFeatures()
+{
+    CPUFeatures features;
+    uint32_t eax, ebx, ecx, edx;
+    GetCPUID(0, 0, eax, ebx, ecx, edx);
+    const uint32_t max_leaf = eax;
+    GetCPUID(1, 0, eax, ebx, ecx, edx);
+    features.fSSE41 = (ecx >> 19) & 1;
+    const bool fAVX = ((ecx >> 27) & 1) && ((ecx >> 28) & 1) && AVXEnabled();
+    features.fAVX2 = false;
+    features.fSHANI = false;
+    if (max_leaf >= 7) {
+        GetCPUID(7, 0, eax, ebx, ecx, edx);
+        features.fAVX2 = fAVX && ((ebx >> 5) & 1);
+        features.fSHANI = features.fSSE41 && ((ebx >> 29) & 1);
+    }
+    return features;
+}
+#endif
+
+#endif // BITCOIN_COMPAT_CPUID_H
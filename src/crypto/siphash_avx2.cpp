@@ -0,0 +1,126 @@
+// Copyright (c) 2017 The Bitcoin Core developers
+// Distributed under the MIT software license, see the accompanying
+// file COPYING or http://www.opensource.org/licenses/mit-license.php.
+
+// This is a translation unit of its own because it is compiled with -mavx -mavx2.
+// Nothing in here may be called unless SipHashAutoDetect() established that
+// the CPU supports AVX2 and that the OS saves the AVX registers.
+
+#include "crypto/common.h"
+
+#ifdef ENABLE_AVX2
+
+#include <stdint.h>
+#include <immintrin.h>
+
+namespace siphash_avx2 {
+namespace {
+
+/** The SipHash state of four independent hashes, one per 64-bit lane. */
+struct State
+{
+    __m256i v0, v1, v2, v3;
+};
+
+__m256i inline K(uint64_t x) { return _mm256_set1_epi64x(x); }
+__m256i inline Add(__m256i x, __m256i y) { return _mm256_add_epi64(x, y); }
+__m256i inline Xor(__m256i x, __m256i y) { return _mm256_xor_si256(x, y); }
+/** AVX2 has no 64-bit rotate; rotating by 32 is a dword swap, anything else takes two shifts. */
+__m256i inline Rotl(__m256i x, int n) { return _mm256_or_si256(_mm256_slli_epi64(x, n), _mm256_srli_epi64(x, 64 - n)); }
+__m256i inline Rotl32(__m256i x) { return _mm256_shuffle_epi32(x, 0xB1); }
+
+void inline Round(State& s)
+{
+    s.v0 = Add(s.v0, s.v1); s.v1 = Rotl(s.v1, 13); s.v1 = Xor(s.v1, s.v0);
+    s.v0 = Rotl32(s.v0);
+    s.v2 = Add(s.v2, s.v3); s.v3 = Rotl(s.v3, 16); s.v3 = Xor(s.v3, s.v2);
+    s.v0 = Add(s.v0, s.v3); s.v3 = Rotl(s.v3, 21); s.v3 = Xor(s.v3, s.v0);
+    s.v2 = Add(s.v2, s.v1); s.v1 = Rotl(s.v1, 17); s.v1 = Xor(s.v1, s.v2);
+    s.v2 = Rotl32(s.v2);
+}
+
+void inline Init(State& s, uint64_t k0, uint64_t k1)
+{
+    s.v0 = K(0x736f6d6570736575ULL ^ k0);
+    s.v1 = K(0x646f72616e646f6dULL ^ k1);
+    s.v2 = K(0x6c7967656e657261ULL ^ k0);
+    s.v3 = K(0x7465646279746573ULL ^ k1);
+}
+
+/** Absorb one 64-bit word per lane (two compression rounds). */
+void inline Compress(State& s, __m256i m)
+{
+    s.v3 = Xor(s.v3, m);
+    Round(s);
+    Round(s);
+    s.v0 = Xor(s.v0, m);
+}
+
+__m256i inline Finalize(State& s)
+{
+    s.v2 = Xor(s.v2, K(0xFF));
+    Round(s);
+    Round(s);
+    Round(s);
+    Round(s);
+    return Xor(Xor(s.v0, s.v1), Xor(s.v2, s.v3));
+}
+
+/** Load four consecutive 32-byte keys, transposed so that w[j] holds word j of each of them. */
+void inline Load(__m256i w[4], const unsigned char* in)
+{
+    __m256i r0 = _mm256_loadu_si256((const __m256i*)in);
+    __m256i r1 = _mm256_loadu_si256((const __m256i*)(in + 32));
+    __m256i r2 = _mm256_loadu_si256((const __m256i*)(in + 64));
+    __m256i r3 = _mm256_loadu_si256((const __m256i*)(in + 96));
+    __m256i t0 = _mm256_unpacklo_epi64(r0, r1);
+    __m256i t1 = _mm256_unpackhi_epi64(r0, r1);
+    __m256i t2 = _mm256_unpacklo_epi64(r2, r3);
+    __m256i t3 = _mm256_unpackhi_epi64(r2, r3);
+    w[0] = _mm256_permute2x128_si256(t0, t2, 0x20);
+    w[1] = _mm256_permute2x128_si256(t1, t3, 0x20);
+    w[2] = _mm256_permute2x128_si256(t0, t2, 0x31);
+    w[3] = _mm256_permute2x128_si256(t1, t3, 0x31);
+}
+
+/** Two groups of four lanes are interleaved to hide the latency of each round. */
+void inline Absorb256(State& a, State& b, uint64_t k0, uint64_t k1, const unsigned char* in)
+{
+    __m256i wa[4], wb[4];
+    Load(wa, in);
+    Load(wb, in + 128);
+    Init(a, k0, k1);
+    Init(b, k0, k1);
+    for (int j = 0; j < 4; ++j) {
+        Compress(a, wa[j]);
+        Compress(b, wb[j]);
+    }
+}
+
+}
+
+void SipHashUint256_8way(uint64_t k0, uint64_t k1, const unsigned char* in, uint64_t* out)
+{
+    State a, b;
+    Absorb256(a, b, k0, k1, in);
+    Compress(a, K(((uint64_t)32) << 56));
+    Compress(b, K(((uint64_t)32) << 56));
+    _mm256_storeu_si256((__m256i*)out, Finalize(a));
+    _mm256_storeu_si256((__m256i*)(out + 4), Finalize(b));
+}
+
+void SipHashUint256Extra_8way(uint64_t k0, uint64_t k1, const unsigned char* in, const uint32_t* extra, uint64_t* out)
+{
+    State a, b;
+    Absorb256(a, b, k0, k1, in);
+    __m256i ea = _mm256_cvtepu32_epi64(_mm_loadu_si128((const __m128i*)extra));
+    __m256i eb = _mm256_cvtepu32_epi64(_mm_loadu_si128((const __m128i*)(extra + 4)));
+    Compress(a, _mm256_or_si256(ea, K(((uint64_t)36) << 56)));
+    Compress(b, _mm256_or_si256(eb, K(((uint64_t)36) << 56)));
+    _mm256_storeu_si256((__m256i*)out, Finalize(a));
+    _mm256_storeu_si256((__m256i*)(out + 4), Finalize(b));
+}
+
+}
+
+#endif
@@ -3,10 +3,30 @@
 // file COPYING or http://www.opensource.org/licenses/mit-license.php.
 
 #include "hash.h"
+#include "compat/cpuid.h"
 #include "crypto/common.h"
 #include "crypto/hmac_sha512.h"
 #include "pubkey.h"
 
+#include <assert.h>
+
+#if defined(HAVE_GETCPUID) && defined(ENABLE_AVX2) && !defined(BUILD_BITCOIN_INTERNAL)
+namespace siphash_avx2
+{
+void SipHashUint256_8way(uint64_t k0, uint64_t k1, const unsigned char* in, uint64_t* out);
+void SipHashUint256Extra_8way(uint64_t k0, uint64_t k1, const unsigned char* in, const uint32_t* extra, uint64_t* out);
+}
+#endif
+
+namespace
+{
+typedef void (*SipHashUint256BatchType)(uint64_t, uint64_t, const unsigned char*, uint64_t*);
+typedef void (*SipHashUint256ExtraBatchType)(uint64_t, uint64_t, const unsigned char*, const uint32_t*, uint64_t*);
+
+// Multi-way kernels selected by SipHashAutoDetect(). Without them the batch functions hash one value at a time.
+SipHashUint256BatchType SipHashUint256_8way = NULL;
+SipHashUint256ExtraBatchType SipHashUint256Extra_8way = NULL;
+} // namespace
 
 inline uint32_t ROTL32(uint32_t x, int8_t r)
 {
@@ -208,3 +228,123 @@ uint64_t SipHashUint256(uint64_t k0, uint64_t k1, const uint256& val)
     SIPROUND;
     return v0 ^ v1 ^ v2 ^ v3;
 }
+
+uint64_t SipHashUint256Extra(uint64_t k0, uint64_t k1, const uint256& val, uint32_t extra)
+{
+    /* Specialized implementation for efficiency */
+    uint64_t d = val.GetUint64(0);
+
+    uint64_t v0 = 0x736f6d6570736575ULL ^ k0;
+    uint64_t v1 = 0x646f72616e646f6dULL ^ k1;
+    uint64_t v2 = 0x6c7967656e657261ULL ^ k0;
+    uint64_t v3 = 0x7465646279746573ULL ^ k1 ^ d;
+
+    SIPROUND;
+    SIPROUND;
+    v0 ^= d;
+    d = val.GetUint64(1);
+    v3 ^= d;
+    SIPROUND;
+    SIPROUND;
+    v0 ^= d;
+    d = val.GetUint64(2);
+    v3 ^= d;
+    SIPROUND;
+    SIPROUND;
+    v0 ^= d;
+    d = val.GetUint64(3);
+    v3 ^= d;
+    SIPROUND;
+    SIPROUND;
+    v0 ^= d;
+    d = (((uint64_t)36) << 56) | extra;
+    v3 ^= d;
+    SIPROUND;
+    SIPROUND;
+    v0 ^= d;
+    v2 ^= 0xFF;
+    SIPROUND;
+    SIPROUND;
+    SIPROUND;
+    SIPROUND;
+    return v0 ^ v1 ^ v2 ^ v3;
+}
+
+void SipHashUint256Batch(uint64_t k0, uint64_t k1, const uint256* vals, size_t count, uint64_t* out)
+{
+    static_assert(sizeof(uint256) == 32, "batch SipHash assumes tightly packed uint256 arrays");
+    if (SipHashUint256_8way) {
+        while (count >= 8) {
+            SipHashUint256_8way(k0, k1, vals->begin(), out);
+            vals += 8;
+            out += 8;
+            count -= 8;
+        }
+    }
+    while (count) {
+        *out++ = SipHashUint256(k0, k1, *vals++);
+        --count;
+    }
+}
+
+void SipHashUint256ExtraBatch(uint64_t k0, uint64_t k1, const uint256* vals, const uint32_t* extras, size_t count, uint64_t* out)
+{
+    if (SipHashUint256Extra_8way) {
+        while (count >= 8) {
+            SipHashUint256Extra_8way(k0, k1, vals->begin(), extras, out);
+            vals += 8;
+            extras += 8;
+            out += 8;
+            count -= 8;
+        }
+    }
+    while (count) {
+        *out++ = SipHashUint256Extra(k0, k1, *vals++, *extras++);
+        --count;
+    }
+}
+
+namespace {
+/** Check the currently selected batch implementations against the portable code. */
+bool SipHashSelfTest()
+{
+    uint256 vals[8];
+    uint32_t extras[8];
+    for (int i = 0; i < 8; ++i) {
+        for (unsigned int j = 0; j < vals[i].size(); ++j)
+            vals[i].begin()[j] = (unsigned char)(i * 37 + j * 7 + 1);
+        extras[i] = 0x10203040 * i + 5;
+    }
+    uint64_t out[8];
+    SipHashUint256Batch(0x0706050403020100ULL, 0x0F0E0D0C0B0A0908ULL, vals, 8, out);
+    for (int i = 0; i < 8; ++i) {
+        if (out[i] != SipHashUint256(0x0706050403020100ULL, 0x0F0E0D0C0B0A0908ULL, vals[i])) return false;
+    }
+    SipHashUint256ExtraBatch(0x0706050403020100ULL, 0x0F0E0D0C0B0A0908ULL, vals, extras, 8, out);
+    for (int i = 0; i < 8; ++i) {
+        if (out[i] != SipHashUint256Extra(0x0706050403020100ULL, 0x0F0E0D0C0B0A0908ULL, vals[i], extras[i])) return false;
+    }
+    return true;
+}
+} // namespace
+
+std::string SipHashAutoDetect()
+{
+    std::string ret = "standard";
+#if defined(HAVE_GETCPUID) && defined(ENABLE_AVX2) && !defined(BUILD_BITCOIN_INTERNAL)
+    if (GetCPUFeatures().fAVX2) {
+        SipHashUint256_8way = siphash_avx2::SipHashUint256_8way;
+        SipHashUint256Extra_8way = siphash_avx2::SipHashUint256Extra_8way;
+        ret = "avx2(8way)";
+    }
+#endif
+
+    // A kernel that disagrees with the portable code is not worth stopping
+    // the node for: fall back to hashing one value at a time.
+    if (!SipHashSelfTest()) {
+        SipHashUint256_8way = NULL;
+        SipHashUint256Extra_8way = NULL;
+        ret = "standard (" + ret + " failed its self-test)";
+    }
+    return ret;
+}
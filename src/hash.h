@@ -13,6 +13,7 @@
 #include "uint256.h"
 #include "version.h"
 
+#include <string>
 #include <vector>
 
 typedef uint256 ChainCode;
@@ -206,5 +207,20 @@ public:
  *      .Finalize()
  */
 uint64_t SipHashUint256(uint64_t k0, uint64_t k1, const uint256& val);
+uint64_t SipHashUint256Extra(uint64_t k0, uint64_t k1, const uint256& val, uint32_t extra);
+
+/** Compute SipHashUint256(k0, k1, vals[i]) for count consecutive values into out.
+ *  Several values are hashed at once when the CPU allows it, so this is
+ *  considerably faster than hashing them one by one for large counts.
+ */
+void SipHashUint256Batch(uint64_t k0, uint64_t k1, const uint256* vals, size_t count, uint64_t* out);
+/** Compute SipHashUint256Extra(k0, k1, vals[i], extras[i]) for count consecutive values into out. */
+void SipHashUint256ExtraBatch(uint64_t k0, uint64_t k1, const uint256* vals, const uint32_t* extras, size_t count, uint64_t* out);
+
+/** Autodetect the best available batch SipHash implementation for this CPU.
+ *  Must be called before any other threads are started. Returns the name
+ *  of the selected implementation.
+ */
+std::string SipHashAutoDetect();
 
 #endif // BITCOIN_HASH_H
@@ -9,19 +9,23 @@
 
 #include "init.h"
 
+#include "addressindex.h"
 #include "addrman.h"
 #include "amount.h"
+#include "blockfilterindex.h"
 #include "chain.h"
 #include "chainparams.h"
 #include "checkpoints.h"
 #include "compat/sanity.h"
 #include "consensus/validation.h"
+#include "crypto/sha256.h"
 #include "httpserver.h"
 #include "httprpc.h"
 #include "key.h"
 #include "validation.h"
 #include "miner.h"
 #include "netbase.h"
+#include "netpoller.h"
 #include "net.h"
 #include "net_processing.h"
 #include "policy/policy.h"
@@ -32,6 +36,7 @@
 #include "scheduler.h"
 #include "timedata.h"
 #include "txdb.h"
+#include "txindexbuilder.h"
 #include "txmempool.h"
 #include "torcontrol.h"
 #include "ui_interface.h"
@@ -68,6 +73,7 @@
 using namespace std;
 
 bool fFeeEstimatesInitialized = false;
+static std::atomic<bool> fMempoolLoaded(false);
 static const bool DEFAULT_PROXYRANDOMIZE = true;
 static const bool DEFAULT_REST_ENABLE = false;
 static const bool DEFAULT_DISABLE_SAFEMODE = false;
@@ -149,9 +155,9 @@ class CCoinsViewErrorCatcher : public CCoinsViewBacked
 {
 public:
     CCoinsViewErrorCatcher(CCoinsView* view) : CCoinsViewBacked(view) {}
-    bool GetCoins(const uint256 &txid, CCoins &coins) const {
+    bool GetCoin(const COutPoint &outpoint, Coin &coin) const {
         try {
-            return CCoinsViewBacked::GetCoins(txid, coins);
+            return CCoinsViewBacked::GetCoin(outpoint, coin);
         } catch(const std::runtime_error& e) {
             uiInterface.ThreadSafeMessageBox(_("Error reading from database, shutting down."), "", CClientUIInterface::MSG_ERROR);
             LogPrintf("Error reading from database: %s\n", e.what());
@@ -162,10 +168,18 @@ public:
             abort();
         }
     }
+    size_t BatchFetch(const std::vector<COutPoint> &vOutpoints, std::vector<Coin> &vCoins) const {
+        try {
+            return CCoinsViewBacked::BatchFetch(vOutpoints, vCoins);
+        } catch(const std::runtime_error& e) {
+            uiInterface.ThreadSafeMessageBox(_("Error reading from database, shutting down."), "", CClientUIInterface::MSG_ERROR);
+            LogPrintf("Error reading from database: %s\n", e.what());
+            abort();
+        }
+    }
     // Writes do not need similar protection, as failure to write is handled by the caller.
 };
 
-static CCoinsViewDB *pcoinsdbview = NULL;
 static CCoinsViewErrorCatcher *pcoinscatcher = NULL;
 static std::unique_ptr<ECCVerifyHandle> globalVerifyHandle;
 
@@ -209,7 +223,10 @@ void Shutdown()
 
     StopTorControl();
     UnregisterNodeSignals(GetNodeSignals());
-    DumpMempool();
+    g_blockassembler.reset();
+    // Don't overwrite the saved mempool with one that has not been loaded yet
+    if (fMempoolLoaded)
+        DumpMempool();
 
     if (fFeeEstimatesInitialized)
     {
@@ -233,9 +250,21 @@ void Shutdown()
         pcoinscatcher = NULL;
         delete pcoinsdbview;
         pcoinsdbview = NULL;
+        delete ptxindexbuilder;
+        ptxindexbuilder = NULL;
         delete pblocktree;
         pblocktree = NULL;
     }
+    if (pblockfilterindex) {
+        UnregisterValidationInterface(pblockfilterindex);
+        delete pblockfilterindex;
+        pblockfilterindex = NULL;
+    }
+    if (paddressindex) {
+        UnregisterValidationInterface(paddressindex);
+        delete paddressindex;
+        paddressindex = NULL;
+    }
 #ifdef ENABLE_WALLET
     if (pwalletMain)
         pwalletMain->Flush(true);
@@ -321,8 +350,11 @@ std::string HelpMessage(HelpMessageMode mode)
     string strUsage = HelpMessageGroup(_("Options:"));
     strUsage += HelpMessageOpt("-?", _("Print this help message and exit"));
     strUsage += HelpMessageOpt("-version", _("Print version and exit"));
+    strUsage += HelpMessageOpt("-addressindex", strprintf(_("Maintain an index of the outputs and spends of every address and script, with their balances, used by the getaddressbalance and getaddresshistory rpc calls and by REST (default: %u)"), DEFAULT_ADDRESSINDEX));
     strUsage += HelpMessageOpt("-alertnotify=<cmd>", _("Execute command when a relevant alert is received or we see a really long fork (%s in cmd is replaced by message)"));
     strUsage += HelpMessageOpt("-blocknotify=<cmd>", _("Execute command when the best block changes (%s in cmd is replaced by block hash)"));
+    strUsage += HelpMessageOpt("-blockfilterindex", strprintf(_("Maintain an index of the BIP 158 block filters of the active chain, used by the getblockfilter rpc call and by wallet rescans (default: %u)"), DEFAULT_BLOCKFILTERINDEX));
+    strUsage += HelpMessageOpt("-blockreconstructionextratxn=<n>", strprintf(_("Extra transactions to keep in memory for compact block reconstructions (default: %u)"), DEFAULT_BLOCK_RECONSTRUCTION_EXTRA_TXN));
     if (showDebug)
         strUsage += HelpMessageOpt("-blocksonly", strprintf(_("Whether to operate in a blocks only mode (default: %u)"), DEFAULT_BLOCKSONLY));
     strUsage += HelpMessageOpt("-checkblocks=<n>", strprintf(_("How many blocks to check at startup (default: %u, 0 = all)"), DEFAULT_CHECKBLOCKS));
@@ -342,8 +374,10 @@ std::string HelpMessage(HelpMessageMode mode)
     strUsage += HelpMessageOpt("-maxorphantx=<n>", strprintf(_("Keep at most <n> unconnectable transactions in memory (default: %u)"), DEFAULT_MAX_ORPHAN_TRANSACTIONS));
     strUsage += HelpMessageOpt("-maxmempool=<n>", strprintf(_("Keep the transaction memory pool below <n> megabytes (default: %u)"), DEFAULT_MAX_MEMPOOL_SIZE));
     strUsage += HelpMessageOpt("-mempoolexpiry=<n>", strprintf(_("Do not keep transactions in the mempool longer than <n> hours (default: %u)"), DEFAULT_MEMPOOL_EXPIRY));
-    strUsage += HelpMessageOpt("-par=<n>", strprintf(_("Set the number of script verification threads (%u to %d, 0 = auto, <0 = leave that many cores free, default: %d)"),
+    strUsage += HelpMessageOpt("-mempooldumpinterval=<n>", strprintf(_("Save the mempool to disk every <n> minutes, in addition to at shutdown (0 to disable, default: %u)"), DEFAULT_MEMPOOL_DUMP_INTERVAL));
+    strUsage += HelpMessageOpt("-par=<n>", strprintf(_("Set the number of script verification threads (%u to %d, 0 = one per core, <0 = leave that many cores free, auto = pick by a short benchmark at startup, default: %d)"),
         -GetNumCores(), MAX_SCRIPTCHECK_THREADS, DEFAULT_SCRIPTCHECK_THREADS));
+    strUsage += HelpMessageOpt("-parpin", strprintf(_("Pin script verification threads to CPUs, and share work between threads on the same CPU socket first (default: %u)"), DEFAULT_SCRIPTCHECK_PIN));
 #ifndef WIN32
     strUsage += HelpMessageOpt("-pid=<file>", strprintf(_("Specify pid file (default: %s)"), BITCOIN_PID_FILENAME));
 #endif
@@ -355,7 +389,7 @@ std::string HelpMessage(HelpMessageMode mode)
 #ifndef WIN32
     strUsage += HelpMessageOpt("-sysperms", _("Create new files with system default permissions, instead of umask 077 (only effective with disabled wallet functionality)"));
 #endif
-    strUsage += HelpMessageOpt("-txindex", strprintf(_("Maintain a full transaction index, used by the getrawtransaction rpc call (default: %u)"), DEFAULT_TXINDEX));
+    strUsage += HelpMessageOpt("-txindex", strprintf(_("Maintain a full transaction index, used by the getrawtransaction rpc call; when turned on, the blocks already downloaded are indexed in the background (default: %u)"), DEFAULT_TXINDEX));
 
     strUsage += HelpMessageGroup(_("Connection options:"));
     strUsage += HelpMessageOpt("-addnode=<ip>", _("Add a node to connect to and attempt to keep the connection open"));
@@ -373,6 +407,7 @@ std::string HelpMessage(HelpMessageMode mode)
     strUsage += HelpMessageOpt("-maxconnections=<n>", strprintf(_("Maintain at most <n> connections to peers (default: %u)"), DEFAULT_MAX_PEER_CONNECTIONS));
     strUsage += HelpMessageOpt("-maxreceivebuffer=<n>", strprintf(_("Maximum per-connection receive buffer, <n>*1000 bytes (default: %u)"), DEFAULT_MAXRECEIVEBUFFER));
     strUsage += HelpMessageOpt("-maxsendbuffer=<n>", strprintf(_("Maximum per-connection send buffer, <n>*1000 bytes (default: %u)"), DEFAULT_MAXSENDBUFFER));
+    strUsage += HelpMessageOpt("-msghandthreads=<n>", strprintf(_("Number of threads to process peer messages, peers are processed concurrently (1 to %d, default: %d)"), MAX_MSGHAND_THREADS, DEFAULT_MSGHAND_THREADS));
     strUsage += HelpMessageOpt("-maxtimeadjustment", strprintf(_("Maximum allowed median peer time offset adjustment. Local perspective of time may be influenced by peers forward or backward by this amount. (default: %u seconds)"), DEFAULT_MAX_TIME_ADJUSTMENT));
     strUsage += HelpMessageOpt("-onion=<ip:port>", strprintf(_("Use separate SOCKS5 proxy to reach peers via Tor hidden services (default: %s)"), "-proxy"));
     strUsage += HelpMessageOpt("-onlynet=<net>", _("Only connect to nodes in network <net> (ipv4, ipv6 or onion)"));
@@ -383,6 +418,7 @@ std::string HelpMessage(HelpMessageMode mode)
     strUsage += HelpMessageOpt("-proxyrandomize", strprintf(_("Randomize credentials for every proxy connection. This enables Tor stream isolation (default: %u)"), DEFAULT_PROXYRANDOMIZE));
     strUsage += HelpMessageOpt("-rpcserialversion", strprintf(_("Sets the serialization of raw transaction or block hex returned in non-verbose mode, non-segwit(0) or segwit(1) (default: %d)"), DEFAULT_RPC_SERIALIZE_VERSION));
     strUsage += HelpMessageOpt("-seednode=<ip>", _("Connect to a node to retrieve peer addresses, and disconnect"));
+    strUsage += HelpMessageOpt("-socketevents=<mode>", strprintf(_("Method used to wait for peer socket events, one of: %s (default: %s)"), GetSocketEventsModes(), DEFAULT_SOCKETEVENTS));
     strUsage += HelpMessageOpt("-timeout=<n>", strprintf(_("Specify connection timeout in milliseconds (minimum: 1, default: %d)"), DEFAULT_CONNECT_TIMEOUT));
     strUsage += HelpMessageOpt("-torcontrol=<ip>:<port>", strprintf(_("Tor control port to use if onion listening enabled (default: %s)"), DEFAULT_TOR_CONTROL));
     strUsage += HelpMessageOpt("-torpassword=<pass>", _("Tor control port password (default: empty)"));
@@ -398,6 +434,7 @@ std::string HelpMessage(HelpMessageMode mode)
         " " + _("Whitelisted peers cannot be DoS banned and their transactions are always relayed, even if they are already in the mempool, useful e.g. for a gateway"));
     strUsage += HelpMessageOpt("-whitelistrelay", strprintf(_("Accept relayed transactions received from whitelisted peers even when not relaying transactions (default: %d)"), DEFAULT_WHITELISTRELAY));
     strUsage += HelpMessageOpt("-whitelistforcerelay", strprintf(_("Force relay of transactions from whitelisted peers even if they violate local relay policy (default: %d)"), DEFAULT_WHITELISTFORCERELAY));
+    strUsage += HelpMessageOpt("-whitelistfastcmpctrelay", strprintf(_("Forward compact blocks to whitelisted high-bandwidth peers as soon as their header is valid, before validating them (default: %d)"), DEFAULT_WHITELISTFASTCMPCTRELAY));
     strUsage += HelpMessageOpt("-maxuploadtarget=<n>", strprintf(_("Tries to keep outbound traffic under the given target (in MiB per 24h), 0 = no limit (default: %d)"), DEFAULT_MAX_UPLOAD_TARGET));
 
 #ifdef ENABLE_WALLET
@@ -423,7 +460,7 @@ std::string HelpMessage(HelpMessageMode mode)
         strUsage += HelpMessageOpt("-testsafemode", strprintf("Force safe mode (default: %u)", DEFAULT_TESTSAFEMODE));
         strUsage += HelpMessageOpt("-dropmessagestest=<n>", "Randomly drop 1 of every <n> network messages");
         strUsage += HelpMessageOpt("-fuzzmessagestest=<n>", "Randomly fuzz 1 of every <n> network messages");
-        strUsage += HelpMessageOpt("-stopafterblockimport", strprintf("Stop running after importing blocks from disk (default: %u)", DEFAULT_STOPAFTERBLOCKIMPORT));
+        strUsage += HelpMessageOpt("-stopafterblockimport", strprintf("Stop running after importing blocks from disk; with -reindex-chainstate, benchmarks block connection (default: %u)", DEFAULT_STOPAFTERBLOCKIMPORT));
         strUsage += HelpMessageOpt("-limitancestorcount=<n>", strprintf("Do not accept transactions if number of in-mempool ancestors is <n> or more (default: %u)", DEFAULT_ANCESTOR_LIMIT));
         strUsage += HelpMessageOpt("-limitancestorsize=<n>", strprintf("Do not accept transactions whose size with all in-mempool ancestors exceeds <n> kilobytes (default: %u)", DEFAULT_ANCESTOR_SIZE_LIMIT));
         strUsage += HelpMessageOpt("-limitdescendantcount=<n>", strprintf("Do not accept transactions if any ancestor would have <n> or more in-mempool descendants (default: %u)", DEFAULT_DESCENDANT_LIMIT));
@@ -474,8 +511,10 @@ std::string HelpMessage(HelpMessageMode mode)
     strUsage += HelpMessageOpt("-blockmaxweight=<n>", strprintf(_("Set maximum BIP141 block weight (default: %d)"), DEFAULT_BLOCK_MAX_WEIGHT));
     strUsage += HelpMessageOpt("-blockmaxsize=<n>", strprintf(_("Set maximum block size in bytes (default: %d)"), DEFAULT_BLOCK_MAX_SIZE));
     strUsage += HelpMessageOpt("-blockprioritysize=<n>", strprintf(_("Set maximum size of high-priority/low-fee transactions in bytes (default: %d)"), DEFAULT_BLOCK_PRIORITY_SIZE));
-    if (showDebug)
+    if (showDebug) {
         strUsage += HelpMessageOpt("-blockversion=<n>", "Override block version to test forking scenarios");
+        strUsage += HelpMessageOpt("-blocktemplaterebuild=<n>", strprintf("Select transactions for getblocktemplate from scratch at least every <n> seconds (default: %u)", DEFAULT_BLOCK_TEMPLATE_REBUILD));
+    }
 
     strUsage += HelpMessageGroup(_("RPC server options:"));
     strUsage += HelpMessageOpt("-server", _("Accept command line and JSON-RPC commands"));
@@ -655,11 +694,19 @@ void ThreadImport(std::vector<boost::filesystem::path> vImportFiles)
     }
 
     // scan for better chains in the block chain database, that are not yet connected in the active best chain
+    int nHeightStart = chainActive.HeightUnlocked();
+    int64_t nTimeStart = GetTimeMicros();
     CValidationState state;
     if (!ActivateBestChain(state, chainparams)) {
         LogPrintf("Failed to connect best block");
         StartShutdown();
     }
+    if (GetBoolArg("-reindex-chainstate", false)) {
+        // Together with -stopafterblockimport this makes a chainstate connection benchmark
+        int nBlocks = chainActive.HeightUnlocked() - nHeightStart;
+        double dSeconds = (GetTimeMicros() - nTimeStart) * 0.000001;
+        LogPrintf("Rebuilt chainstate: connected %d blocks in %.2fs (%.2f blocks/s)\n", nBlocks, dSeconds, dSeconds > 0 ? nBlocks / dSeconds : 0.0);
+    }
 
     if (GetBoolArg("-stopafterblockimport", DEFAULT_STOPAFTERBLOCKIMPORT)) {
         LogPrintf("Stopping after block import\n");
@@ -667,6 +714,13 @@ void ThreadImport(std::vector<boost::filesystem::path> vImportFiles)
     }
     } // End scope of CImportingNow
     LoadMempool();
+    fMempoolLoaded = true;
+}
+
+static void PeriodicDumpMempool()
+{
+    if (fMempoolLoaded)
+        DumpMempool();
 }
 
 /** Sanity checks
@@ -789,6 +843,8 @@ ServiceFlags nRelevantServices = NODE_NETWORK;
 int nMaxConnections;
 int nUserMaxConnections;
 int nFD;
+std::string strSocketEvents;
+static bool fScriptCheckCalibrate = false;
 ServiceFlags nLocalServices = NODE_NETWORK;
 
 }
@@ -859,6 +915,10 @@ bool AppInitParameterInteraction()
     if (GetArg("-prune", 0)) {
         if (GetBoolArg("-txindex", DEFAULT_TXINDEX))
             return InitError(_("Prune mode is incompatible with -txindex."));
+        if (GetBoolArg("-blockfilterindex", DEFAULT_BLOCKFILTERINDEX))
+            return InitError(_("Prune mode is incompatible with -blockfilterindex."));
+        if (GetBoolArg("-addressindex", DEFAULT_ADDRESSINDEX))
+            return InitError(_("Prune mode is incompatible with -addressindex."));
     }
 
     // Make sure enough file descriptors are available
@@ -868,8 +928,22 @@ bool AppInitParameterInteraction()
     nUserMaxConnections = GetArg("-maxconnections", DEFAULT_MAX_PEER_CONNECTIONS);
     nMaxConnections = std::max(nUserMaxConnections, 0);
 
-    // Trim requested connection counts, to fit into system limitations
-    nMaxConnections = std::max(std::min(nMaxConnections, (int)(FD_SETSIZE - nBind - MIN_CORE_FILEDESCRIPTORS)), 0);
+    strSocketEvents = GetArg("-socketevents", DEFAULT_SOCKETEVENTS);
+    std::unique_ptr<CSocketPoller> socketPoller = CreateSocketPoller(strSocketEvents);
+    if (!socketPoller)
+        return InitError(strprintf(_("Unsupported -socketevents mode '%s' (available: %s)"), strSocketEvents, GetSocketEventsModes()));
+
+    // Trim requested connection counts, to fit into system limitations.
+    // Only select() is bound by FD_SETSIZE. On Windows, where it is the only
+    // backend, FD_SETSIZE limits the number of sockets in a set rather than
+    // the descriptor values, so IsSelectable() cannot tell.
+#ifdef WIN32
+    const bool fFDSetSizeBound = true;
+#else
+    const bool fFDSetSizeBound = !socketPoller->IsSelectable(FD_SETSIZE);
+#endif
+    if (fFDSetSizeBound)
+        nMaxConnections = std::max(std::min(nMaxConnections, (int)(FD_SETSIZE - nBind - MIN_CORE_FILEDESCRIPTORS)), 0);
     nFD = RaiseFileDescriptorLimit(nMaxConnections + MIN_CORE_FILEDESCRIPTORS);
     if (nFD < MIN_CORE_FILEDESCRIPTORS)
         return InitError(_("Not enough file descriptors available."));
@@ -922,7 +996,9 @@ bool AppInitParameterInteraction()
         return InitError(strprintf(_("-maxmempool must be at least %d MB"), std::ceil(nMempoolSizeMin / 1000000.0)));
 
     // -par=0 means autodetect, but nScriptCheckThreads==0 means no concurrency
-    nScriptCheckThreads = GetArg("-par", DEFAULT_SCRIPTCHECK_THREADS);
+    // -par=auto is resolved in AppInitMain, once the verification code is set up
+    fScriptCheckCalibrate = GetArg("-par", "") == "auto";
+    nScriptCheckThreads = fScriptCheckCalibrate ? 0 : GetArg("-par", DEFAULT_SCRIPTCHECK_THREADS);
     if (nScriptCheckThreads <= 0)
         nScriptCheckThreads += GetNumCores();
     if (nScriptCheckThreads <= 1)
@@ -1069,6 +1145,11 @@ bool AppInitSanityChecks()
 {
     // ********************************************************* Step 4: sanity checks
 
+    std::string sha256_algo = SHA256AutoDetect();
+    LogPrintf("Using the '%s' SHA256 implementation\n", sha256_algo);
+    std::string siphash_algo = SipHashAutoDetect();
+    LogPrintf("Using the '%s' SipHash batch implementation\n", siphash_algo);
+
     // Initialize elliptic curve code
     ECC_Start();
     globalVerifyHandle.reset(new ECCVerifyHandle());
@@ -1111,10 +1192,29 @@ bool AppInitMain(boost::thread_group& threadGroup, CScheduler& scheduler)
 
     InitSignatureCache();
 
+    if (fScriptCheckCalibrate) {
+        int nCpus = std::max(1, std::min((int)boost::thread::hardware_concurrency(), MAX_SCRIPTCHECK_THREADS));
+        nScriptCheckThreads = CalibrateScriptCheckThreads(nCpus);
+        LogPrintf("Calibrated script verification to %d threads (of %d cores)\n", nScriptCheckThreads, nCpus);
+        if (nScriptCheckThreads <= 1)
+            nScriptCheckThreads = 0;
+    }
+
     LogPrintf("Using %u threads for script verification\n", nScriptCheckThreads);
     if (nScriptCheckThreads) {
+        // With -parpin, worker i goes to CPU i+1 (wrapping around). CPU 0 is
+        // not reserved for anything: the thread connecting a block (a message
+        // handler, the import thread or an RPC thread) verifies alongside the
+        // workers as the queue's master, but it is not pinned, and its queue
+        // counts as group 0 whichever CPU it runs on.
+        bool fPin = GetBoolArg("-parpin", DEFAULT_SCRIPTCHECK_PIN);
+        int nCpus = std::max(1, (int)boost::thread::hardware_concurrency());
+        for (int i=0; i<nScriptCheckThreads-1; i++)
+            threadGroup.create_thread(boost::bind(&ThreadScriptCheck, fPin ? (i + 1) % nCpus : -1));
+        // Relayed transactions get a check queue of their own, as they are
+        // verified while a block may be using the one above.
         for (int i=0; i<nScriptCheckThreads-1; i++)
-            threadGroup.create_thread(&ThreadScriptCheck);
+            threadGroup.create_thread(&ThreadTxScriptCheck);
     }
 
     // Start the lightweight task scheduler thread
@@ -1334,19 +1434,33 @@ bool AppInitMain(boost::thread_group& threadGroup, CScheduler& scheduler)
     int64_t nBlockTreeDBCache = nTotalCache / 8;
     nBlockTreeDBCache = std::min(nBlockTreeDBCache, (GetBoolArg("-txindex", DEFAULT_TXINDEX) ? nMaxBlockDBAndTxIndexCache : nMaxBlockDBCache) << 20);
     nTotalCache -= nBlockTreeDBCache;
+    int64_t nBlockFilterIndexCache = 0;
+    if (GetBoolArg("-blockfilterindex", DEFAULT_BLOCKFILTERINDEX))
+        nBlockFilterIndexCache = std::min(nTotalCache / 8, nMaxBlockDBCache << 20);
+    nTotalCache -= nBlockFilterIndexCache;
+    int64_t nAddressIndexCache = 0;
+    if (GetBoolArg("-addressindex", DEFAULT_ADDRESSINDEX))
+        nAddressIndexCache = std::min(nTotalCache / 8, nMaxBlockDBCache << 20);
+    nTotalCache -= nAddressIndexCache;
     int64_t nCoinDBCache = std::min(nTotalCache / 2, (nTotalCache / 4) + (1 << 23)); // use 25%-50% of the remainder for disk cache
     nCoinDBCache = std::min(nCoinDBCache, nMaxCoinsDBCache << 20); // cap total coins db cache
     nTotalCache -= nCoinDBCache;
     nCoinCacheUsage = nTotalCache; // the rest goes to in-memory cache
     LogPrintf("Cache configuration:\n");
     LogPrintf("* Using %.1fMiB for block index database\n", nBlockTreeDBCache * (1.0 / 1024 / 1024));
+    if (nBlockFilterIndexCache)
+        LogPrintf("* Using %.1fMiB for block filter index database\n", nBlockFilterIndexCache * (1.0 / 1024 / 1024));
+    if (nAddressIndexCache)
+        LogPrintf("* Using %.1fMiB for address index database\n", nAddressIndexCache * (1.0 / 1024 / 1024));
     LogPrintf("* Using %.1fMiB for chain state database\n", nCoinDBCache * (1.0 / 1024 / 1024));
     LogPrintf("* Using %.1fMiB for in-memory UTXO set\n", nCoinCacheUsage * (1.0 / 1024 / 1024));
 
     bool fLoaded = false;
+    bool fBuildTxIndex = false;
     while (!fLoaded) {
         bool fReset = fReindex;
         std::string strLoadError;
+        fBuildTxIndex = false;
 
         uiInterface.InitMessage(_("Loading block index..."));
 
@@ -1364,6 +1478,17 @@ bool AppInitMain(boost::thread_group& threadGroup, CScheduler& scheduler)
                 pcoinscatcher = new CCoinsViewErrorCatcher(pcoinsdbview);
                 pcoinsTip = new CCoinsViewCache(pcoinscatcher);
 
+                // If necessary, upgrade from older database format.
+                if (!pcoinsdbview->Upgrade()) {
+                    if (ShutdownRequested()) {
+                        // Interrupted; the upgrade resumes where it left off on the next start.
+                        fLoaded = true;
+                        break;
+                    }
+                    strLoadError = _("Error upgrading chainstate database");
+                    break;
+                }
+
                 if (fReindex) {
                     pblocktree->WriteReindexing(true);
                     //If we're reindexing in prune mode, wipe away unusable block files and all undo data files
@@ -1387,11 +1512,17 @@ bool AppInitMain(boost::thread_group& threadGroup, CScheduler& scheduler)
                     break;
                 }
 
-                // Check for changed -txindex state
-                if (fTxIndex != GetBoolArg("-txindex", DEFAULT_TXINDEX)) {
-                    strLoadError = _("You need to rebuild the database using -reindex-chainstate to change -txindex");
+                // Check for changed -txindex state. Turning it on does not need a
+                // rebuild: new blocks are indexed as they are connected, and the
+                // others in the background.
+                if (fTxIndex && !GetBoolArg("-txindex", DEFAULT_TXINDEX)) {
+                    strLoadError = _("You need to rebuild the database using -reindex-chainstate to turn off -txindex");
                     break;
                 }
+                if (!fTxIndex && GetBoolArg("-txindex", DEFAULT_TXINDEX)) {
+                    fTxIndex = true;
+                    fBuildTxIndex = true;
+                }
 
                 // Check for changed -prune state.  What we are concerned about is a user who has pruned blocks
                 // in the past, but is now trying to run unpruned.
@@ -1533,8 +1664,51 @@ bool AppInitMain(boost::thread_group& threadGroup, CScheduler& scheduler)
             vImportFiles.push_back(strFile);
     }
 
+    // Follow the mempool from before it is loaded from disk
+    g_blockassembler.reset(new IncrementalBlockAssembler(chainparams));
+
     threadGroup.create_thread(boost::bind(&ThreadImport, vImportFiles));
 
+    if (fBuildTxIndex) {
+        // Batches as large as the LevelDB write buffer of the block tree database
+        ptxindexbuilder = new CTxIndexBuilder(*pblocktree, nBlockTreeDBCache / 4);
+        {
+            LOCK(cs_main);
+            if (!ptxindexbuilder->Init())
+                return InitError(_("Error loading the transaction index"));
+        }
+        threadGroup.create_thread(boost::bind(&TraceThread<boost::function<void()> >, "txindex",
+                                              boost::function<void()>(boost::bind(&CTxIndexBuilder::ThreadBuild, ptxindexbuilder))));
+    }
+
+    if (GetBoolArg("-blockfilterindex", DEFAULT_BLOCKFILTERINDEX)) {
+        pblockfilterindex = new CBlockFilterIndex(nBlockFilterIndexCache, false, fReindex);
+        {
+            LOCK(cs_main);
+            if (!pblockfilterindex->Init())
+                return InitError(_("Error loading the block filter index"));
+        }
+        RegisterValidationInterface(pblockfilterindex);
+        threadGroup.create_thread(boost::bind(&TraceThread<boost::function<void()> >, "blockfilterindex",
+                                              boost::function<void()>(boost::bind(&CBlockFilterIndex::ThreadSync, pblockfilterindex))));
+    }
+
+    if (GetBoolArg("-addressindex", DEFAULT_ADDRESSINDEX)) {
+        paddressindex = new CAddressIndex(nAddressIndexCache, false, fReindex);
+        {
+            LOCK(cs_main);
+            if (!paddressindex->Init())
+                return InitError(_("Error loading the address index"));
+        }
+        RegisterValidationInterface(paddressindex);
+        threadGroup.create_thread(boost::bind(&TraceThread<boost::function<void()> >, "addressindex",
+                                              boost::function<void()>(boost::bind(&CAddressIndex::ThreadSync, paddressindex))));
+    }
+
+    int64_t nMempoolDumpInterval = GetArg("-mempooldumpinterval", DEFAULT_MEMPOOL_DUMP_INTERVAL);
+    if (nMempoolDumpInterval > 0)
+        scheduler.scheduleEvery(&PeriodicDumpMempool, nMempoolDumpInterval * 60);
+
     // Wait for genesis block to be processed
     {
         boost::unique_lock<boost::mutex> lock(cs_GenesisWait);
@@ -1571,6 +1745,8 @@ bool AppInitMain(boost::thread_group& threadGroup, CScheduler& scheduler)
 
     connOptions.nMaxOutboundTimeframe = nMaxOutboundTimeframe;
     connOptions.nMaxOutboundLimit = nMaxOutboundLimit;
+    connOptions.strSocketEvents = strSocketEvents;
+    connOptions.nMessageHandlerThreads = GetArg("-msghandthreads", DEFAULT_MSGHAND_THREADS);
 
     if(!connman.Start(threadGroup, scheduler, strNodeError, connOptions))
         return InitError(strNodeError);
@@ -26,6 +26,7 @@
 #include "validationinterface.h"
 
 #include <algorithm>
+#include <boost/bind.hpp>
 #include <boost/thread.hpp>
 #include <boost/tuple/tuple.hpp>
 #include <queue>
@@ -74,6 +75,33 @@ int64_t UpdateTime(CBlockHeader* pblock, const Consensus::Params& consensusParam
     return nNewTime - nOldTime;
 }
 
+// Add the coinbase paying nFees plus the subsidy to scriptPubKeyIn, and fill
+// in the header of a block template whose other transactions are in place.
+static void FinishBlockTemplate(CBlockTemplate& blocktemplate, const CBlockIndex* pindexPrev, const CScript& scriptPubKeyIn, CAmount nFees, const CChainParams& chainparams)
+{
+    CBlock* pblock = &blocktemplate.block;
+    const int nHeight = pindexPrev->nHeight + 1;
+
+    // Create coinbase transaction.
+    CMutableTransaction coinbaseTx;
+    coinbaseTx.vin.resize(1);
+    coinbaseTx.vin[0].prevout.SetNull();
+    coinbaseTx.vout.resize(1);
+    coinbaseTx.vout[0].scriptPubKey = scriptPubKeyIn;
+    coinbaseTx.vout[0].nValue = nFees + GetBlockSubsidy(nHeight, chainparams.GetConsensus());
+    coinbaseTx.vin[0].scriptSig = CScript() << nHeight << OP_0;
+    pblock->vtx[0] = MakeTransactionRef(std::move(coinbaseTx));
+    blocktemplate.vchCoinbaseCommitment = GenerateCoinbaseCommitment(*pblock, pindexPrev, chainparams.GetConsensus());
+    blocktemplate.vTxFees[0] = -nFees;
+
+    // Fill in header
+    pblock->hashPrevBlock  = pindexPrev->GetBlockHash();
+    UpdateTime(pblock, chainparams.GetConsensus(), pindexPrev);
+    pblock->nBits          = GetNextWorkRequired(pindexPrev, pblock, chainparams.GetConsensus());
+    pblock->nNonce         = 0;
+    blocktemplate.vTxSigOpsCost[0] = WITNESS_SCALE_FACTOR * GetLegacySigOpCount(*pblock->vtx[0]);
+}
+
 BlockAssembler::BlockAssembler(const CChainParams& _chainparams)
     : chainparams(_chainparams)
 {
@@ -170,28 +198,11 @@ std::unique_ptr<CBlockTemplate> BlockAssembler::CreateNewBlock(const CScript& sc
     nLastBlockSize = nBlockSize;
     nLastBlockWeight = nBlockWeight;
 
-    // Create coinbase transaction.
-    CMutableTransaction coinbaseTx;
-    coinbaseTx.vin.resize(1);
-    coinbaseTx.vin[0].prevout.SetNull();
-    coinbaseTx.vout.resize(1);
-    coinbaseTx.vout[0].scriptPubKey = scriptPubKeyIn;
-    coinbaseTx.vout[0].nValue = nFees + GetBlockSubsidy(nHeight, chainparams.GetConsensus());
-    coinbaseTx.vin[0].scriptSig = CScript() << nHeight << OP_0;
-    pblock->vtx[0] = MakeTransactionRef(std::move(coinbaseTx));
-    pblocktemplate->vchCoinbaseCommitment = GenerateCoinbaseCommitment(*pblock, pindexPrev, chainparams.GetConsensus());
-    pblocktemplate->vTxFees[0] = -nFees;
+    FinishBlockTemplate(*pblocktemplate, pindexPrev, scriptPubKeyIn, nFees, chainparams);
 
     uint64_t nSerializeSize = GetSerializeSize(*pblock, SER_NETWORK, PROTOCOL_VERSION);
     LogPrintf("CreateNewBlock(): total size: %u block weight: %u txs: %u fees: %ld sigops %d\n", nSerializeSize, GetBlockWeight(*pblock), nBlockTx, nFees, nBlockSigOpsCost);
 
-    // Fill in header
-    pblock->hashPrevBlock  = pindexPrev->GetBlockHash();
-    UpdateTime(pblock, chainparams.GetConsensus(), pindexPrev);
-    pblock->nBits          = GetNextWorkRequired(pindexPrev, pblock, chainparams.GetConsensus());
-    pblock->nNonce         = 0;
-    pblocktemplate->vTxSigOpsCost[0] = WITNESS_SCALE_FACTOR * GetLegacySigOpCount(*pblock->vtx[0]);
-
     CValidationState state;
     if (!TestBlockValidity(state, chainparams, *pblock, pindexPrev, false, false)) {
         throw std::runtime_error(strprintf("%s: TestBlockValidity failed: %s", __func__, FormatStateMessage(state)));
@@ -590,6 +601,183 @@ void BlockAssembler::addPriorityTxs()
     fNeedSizeAccounting = fSizeAccounting;
 }
 
+std::unique_ptr<IncrementalBlockAssembler> g_blockassembler;
+
+IncrementalBlockAssembler::IncrementalBlockAssembler(const CChainParams& _chainparams)
+    : chainparams(_chainparams), assembler(_chainparams), pindexPrev(NULL), fDirty(false), nLastRebuild(0), nSelectedChecked(0), nRebuilds(0)
+{
+    fIncremental = GetArg("-blockprioritysize", DEFAULT_BLOCK_PRIORITY_SIZE) == 0;
+    nRebuildInterval = GetArg("-blocktemplaterebuild", DEFAULT_BLOCK_TEMPLATE_REBUILD);
+    mempool.NotifyEntryAdded.connect(boost::bind(&IncrementalBlockAssembler::TransactionAdded, this, _1));
+    mempool.NotifyEntryRemoved.connect(boost::bind(&IncrementalBlockAssembler::TransactionRemoved, this, _1));
+}
+
+IncrementalBlockAssembler::~IncrementalBlockAssembler()
+{
+    mempool.NotifyEntryAdded.disconnect(boost::bind(&IncrementalBlockAssembler::TransactionAdded, this, _1));
+    mempool.NotifyEntryRemoved.disconnect(boost::bind(&IncrementalBlockAssembler::TransactionRemoved, this, _1));
+}
+
+void IncrementalBlockAssembler::TransactionAdded(CTransactionRef ptx)
+{
+    LOCK(cs);
+    if (pindexPrev == NULL || fDirty)
+        return;
+    CTxMemPool::txiter it = mempool.mapTx.find(ptx->GetHash());
+    if (it == mempool.mapTx.end())
+        return;
+
+    // The checks addPackageTxs makes, for a package of just this transaction.
+    if (it->GetModifiedFee() < ::minRelayTxFee.GetFee(it->GetTxSize()))
+        return;
+    if (!IsFinalTx(it->GetTx(), nHeight, nLockTimeCutoff) || (!fIncludeWitness && it->GetTx().HasWitness()))
+        return;
+    bool fFits = nBlockWeight + WITNESS_SCALE_FACTOR * it->GetTxSize() < assembler.GetMaxWeight() &&
+        nBlockSigOpsCost + it->GetSigOpCost() < MAX_BLOCK_SIGOPS_COST;
+    uint64_t nTxSize = 0;
+    if (fFits && assembler.NeedsSizeAccounting()) {
+        nTxSize = ::GetSerializeSize(it->GetTx(), SER_NETWORK, PROTOCOL_VERSION);
+        fFits = nBlockSize + nTxSize < assembler.GetMaxSize();
+    }
+    BOOST_FOREACH(CTxMemPool::txiter parent, mempool.GetMemPoolParents(it)) {
+        if (!setSelected.count(parent))
+            fFits = false;
+    }
+    if (!fFits) {
+        nFeesMissed += it->GetModifiedFee();
+        return;
+    }
+
+    vSelected.push_back(it);
+    setSelected.insert(it);
+    nBlockWeight += it->GetTxWeight();
+    nBlockSize += nTxSize;
+    nBlockSigOpsCost += it->GetSigOpCost();
+    nFees += it->GetFee();
+}
+
+void IncrementalBlockAssembler::TransactionRemoved(CTransactionRef ptx)
+{
+    LOCK(cs);
+    if (pindexPrev == NULL || fDirty)
+        return;
+    CTxMemPool::txiter it = mempool.mapTx.find(ptx->GetHash());
+    if (it != mempool.mapTx.end() && setSelected.count(it)) {
+        // Whatever the reason, the rest of the selection may depend on it.
+        fDirty = true;
+        vSelected.clear();
+        setSelected.clear();
+    }
+}
+
+std::unique_ptr<CBlockTemplate> IncrementalBlockAssembler::Rebuild(const CScript& scriptPubKeyIn, const char* strReason)
+{
+    AssertLockHeld(cs);
+    CAmount nFeesBefore = nFees;
+    size_t nTxBefore = vSelected.size();
+    pindexPrev = NULL;
+    vSelected.clear();
+    setSelected.clear();
+
+    std::unique_ptr<CBlockTemplate> pblocktemplate = assembler.CreateNewBlock(scriptPubKeyIn);
+    if (!pblocktemplate)
+        return nullptr;
+    const CBlock& block = pblocktemplate->block;
+    const CBlockIndex* pindexTip = chainActive.Tip();
+    nVersion = block.nVersion;
+    nHeight = pindexTip->nHeight + 1;
+    nLockTimeCutoff = (STANDARD_LOCKTIME_VERIFY_FLAGS & LOCKTIME_MEDIAN_TIME_PAST)
+                       ? pindexTip->GetMedianTimePast()
+                       : block.GetBlockTime();
+    fIncludeWitness = IsWitnessEnabled(pindexTip, chainparams.GetConsensus());
+
+    // Same reservations for the coinbase as BlockAssembler::resetBlock
+    nBlockWeight = 4000;
+    nBlockSize = 1000;
+    nBlockSigOpsCost = 400;
+    nFees = 0;
+    nFeesMissed = 0;
+    vSelected.reserve(block.vtx.size());
+    for (size_t i = 1; i < block.vtx.size(); i++) {
+        CTxMemPool::txiter it = mempool.mapTx.find(block.vtx[i]->GetHash());
+        assert(it != mempool.mapTx.end());
+        vSelected.push_back(it);
+        setSelected.insert(it);
+        nBlockWeight += it->GetTxWeight();
+        if (assembler.NeedsSizeAccounting())
+            nBlockSize += ::GetSerializeSize(it->GetTx(), SER_NETWORK, PROTOCOL_VERSION);
+        nBlockSigOpsCost += it->GetSigOpCost();
+        nFees += it->GetFee();
+    }
+
+    LogPrint("bench", "%s: rebuilt block template (%s): %u txs, %s fees; incremental selection had %u txs, %s fees\n",
+             __func__, strReason, (unsigned int)vSelected.size(), FormatMoney(nFees), (unsigned int)nTxBefore, FormatMoney(nFeesBefore));
+    pindexPrev = pindexTip;
+    fDirty = false;
+    nLastRebuild = GetTime();
+    nSelectedChecked = vSelected.size();
+    nRebuilds++;
+    return pblocktemplate;
+}
+
+std::unique_ptr<CBlockTemplate> IncrementalBlockAssembler::CreateNewBlock(const CScript& scriptPubKeyIn)
+{
+    LOCK2(cs_main, mempool.cs);
+    LOCK(cs);
+
+    if (!fIncremental)
+        return Rebuild(scriptPubKeyIn, "priority space");
+    if (pindexPrev != chainActive.Tip())
+        return Rebuild(scriptPubKeyIn, "new tip");
+    if (fDirty)
+        return Rebuild(scriptPubKeyIn, "transaction removed");
+    if (GetTime() - nLastRebuild >= nRebuildInterval)
+        return Rebuild(scriptPubKeyIn, "periodic");
+    // Better transactions that could not be appended are worth a rebuild,
+    // but not on every request.
+    if (nFeesMissed > nFees / 100 && GetTime() - nLastRebuild >= BLOCK_TEMPLATE_MIN_REBUILD)
+        return Rebuild(scriptPubKeyIn, "missed fees");
+
+    std::unique_ptr<CBlockTemplate> pblocktemplate(new CBlockTemplate());
+    CBlock* pblock = &pblocktemplate->block;
+    pblock->vtx.reserve(vSelected.size() + 1);
+    pblock->vtx.emplace_back();
+    pblocktemplate->vTxFees.reserve(vSelected.size() + 1);
+    pblocktemplate->vTxFees.push_back(-1); // updated at end
+    pblocktemplate->vTxSigOpsCost.reserve(vSelected.size() + 1);
+    pblocktemplate->vTxSigOpsCost.push_back(-1); // updated at end
+    BOOST_FOREACH(CTxMemPool::txiter it, vSelected) {
+        pblock->vtx.emplace_back(it->GetSharedTx());
+        pblocktemplate->vTxFees.push_back(it->GetFee());
+        pblocktemplate->vTxSigOpsCost.push_back(it->GetSigOpCost());
+    }
+    pblock->nVersion = nVersion;
+    pblock->nTime = GetAdjustedTime();
+    FinishBlockTemplate(*pblocktemplate, pindexPrev, scriptPubKeyIn, nFees, chainparams);
+
+    // Appending checks much less than selecting from scratch does, so the
+    // first template with newly appended transactions is validated, as is
+    // every template on chains with consistency checks on (regtest).
+    if (vSelected.size() != nSelectedChecked || chainparams.DefaultConsistencyChecks()) {
+        CValidationState state;
+        if (!TestBlockValidity(state, chainparams, *pblock, chainActive.Tip(), false, false)) {
+            // Start over from scratch next time
+            fDirty = true;
+            vSelected.clear();
+            setSelected.clear();
+            throw std::runtime_error(strprintf("%s: TestBlockValidity failed: %s", __func__, FormatStateMessage(state)));
+        }
+        nSelectedChecked = vSelected.size();
+    }
+    return pblocktemplate;
+}
+
+unsigned int IncrementalBlockAssembler::GetRebuildCount()
+{
+    LOCK(cs);
+    return nRebuilds;
+}
+
 void IncrementExtraNonce(CBlock* pblock, const CBlockIndex* pindexPrev, unsigned int& nExtraNonce)
 {
     // Update nExtraNonce
@@ -7,6 +7,7 @@
 #define BITCOIN_MINER_H
 
 #include "primitives/block.h"
+#include "sync.h"
 #include "txmempool.h"
 
 #include <stdint.h>
@@ -23,6 +24,10 @@ class CWallet;
 namespace Consensus { struct Params; };
 
 static const bool DEFAULT_PRINTPRIORITY = false;
+/** Default for -blocktemplaterebuild, the most seconds a block template is kept up to date without selecting transactions from scratch */
+static const int64_t DEFAULT_BLOCK_TEMPLATE_REBUILD = 30;
+/** Fewest seconds between rebuilds of the block template for transactions that could not be added to it */
+static const int64_t BLOCK_TEMPLATE_MIN_REBUILD = 5;
 
 struct CBlockTemplate
 {
@@ -73,7 +78,7 @@ struct modifiedentry_iter {
 // except operating on CTxMemPoolModifiedEntry.
 // TODO: refactor to avoid duplication of this logic.
 struct CompareModifiedEntry {
-    bool operator()(const CTxMemPoolModifiedEntry &a, const CTxMemPoolModifiedEntry &b)
+    bool operator()(const CTxMemPoolModifiedEntry &a, const CTxMemPoolModifiedEntry &b) const
     {
         double f1 = (double)a.nModFeesWithAncestors * b.nSizeWithAncestors;
         double f2 = (double)b.nModFeesWithAncestors * a.nSizeWithAncestors;
@@ -88,7 +93,7 @@ struct CompareModifiedEntry {
 // This is sufficient to sort an ancestor package in an order that is valid
 // to appear in a block.
 struct CompareTxIterByAncestorCount {
-    bool operator()(const CTxMemPool::txiter &a, const CTxMemPool::txiter &b)
+    bool operator()(const CTxMemPool::txiter &a, const CTxMemPool::txiter &b) const
     {
         if (a->GetCountWithAncestors() != b->GetCountWithAncestors())
             return a->GetCountWithAncestors() < b->GetCountWithAncestors();
@@ -166,6 +171,10 @@ public:
     /** Construct a new block template with coinbase to scriptPubKeyIn */
     std::unique_ptr<CBlockTemplate> CreateNewBlock(const CScript& scriptPubKeyIn);
 
+    unsigned int GetMaxWeight() const { return nBlockMaxWeight; }
+    unsigned int GetMaxSize() const { return nBlockMaxSize; }
+    bool NeedsSizeAccounting() const { return fNeedSizeAccounting; }
+
 private:
     // utility functions
     /** Clear the block's state and prepare for assembling a new block */
@@ -205,6 +214,67 @@ private:
     void UpdatePackagesForAdded(const CTxMemPool::setEntries& alreadyAdded, indexed_modified_transaction_set &mapModifiedTx);
 };
 
+/**
+ * Keeps a block template up to date as transactions enter the mempool, so
+ * that most requests for a template do not select transactions from scratch.
+ *
+ * A new mempool transaction is appended to the current selection when all
+ * its in-mempool parents are selected already and it still fits. Anything
+ * that cannot be handled that way (a new tip, a selected transaction leaving
+ * the mempool, or better transactions piling up that did not fit) causes a
+ * full rebuild by BlockAssembler on the next request. So does the passage of
+ * -blocktemplaterebuild seconds, as only full rebuilds run TestBlockValidity.
+ */
+class IncrementalBlockAssembler
+{
+private:
+    const CChainParams& chainparams;
+    BlockAssembler assembler;
+    // Only selected without priority space; otherwise every request rebuilds.
+    bool fIncremental;
+    int64_t nRebuildInterval;
+
+    CCriticalSection cs;
+
+    // The current selection, valid for the tip pindexPrev unless fDirty
+    const CBlockIndex* pindexPrev;
+    bool fDirty;
+    int64_t nLastRebuild;
+    int32_t nVersion;
+    int nHeight;
+    int64_t nLockTimeCutoff;
+    bool fIncludeWitness;
+    std::vector<CTxMemPool::txiter> vSelected;
+    CTxMemPool::setEntries setSelected;
+    uint64_t nBlockWeight;
+    uint64_t nBlockSize;
+    int64_t nBlockSigOpsCost;
+    CAmount nFees;
+    // Fees of transactions a rebuild might have picked, but appending could not
+    CAmount nFeesMissed;
+    // Number of selected transactions in the last template that was validated
+    size_t nSelectedChecked;
+    unsigned int nRebuilds;
+
+    void TransactionAdded(CTransactionRef ptx);
+    void TransactionRemoved(CTransactionRef ptx);
+    /** Select transactions from scratch, and keep the selection */
+    std::unique_ptr<CBlockTemplate> Rebuild(const CScript& scriptPubKeyIn, const char* strReason);
+
+public:
+    IncrementalBlockAssembler(const CChainParams& chainparams);
+    ~IncrementalBlockAssembler();
+
+    /** Return a block template with coinbase to scriptPubKeyIn, from the current selection if possible */
+    std::unique_ptr<CBlockTemplate> CreateNewBlock(const CScript& scriptPubKeyIn);
+
+    /** The number of times transactions were selected from scratch */
+    unsigned int GetRebuildCount();
+};
+
+/** The assembler used by getblocktemplate, kept up to date while the node runs */
+extern std::unique_ptr<IncrementalBlockAssembler> g_blockassembler;
+
 /** Modify the extranonce in a block */
 void IncrementExtraNonce(CBlock* pblock, const CBlockIndex* pindexPrev, unsigned int& nExtraNonce);
 int64_t UpdateTime(CBlockHeader* pblock, const Consensus::Params& consensusParams, const CBlockIndex* pindexPrev);
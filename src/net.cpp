@@ -18,6 +18,7 @@
 #include "hash.h"
 #include "primitives/transaction.h"
 #include "netbase.h"
+#include "netpoller.h"
 #include "scheduler.h"
 #include "ui_interface.h"
 #include "utilstrencodings.h"
@@ -360,7 +361,7 @@ CNode* CConnman::ConnectNode(CAddress addrConnect, const char *pszDest, bool fCo
     if (pszDest ? ConnectSocketByName(addrConnect, hSocket, pszDest, Params().GetDefaultPort(), nConnectTimeout, &proxyConnectionFailed) :
                   ConnectSocket(addrConnect, hSocket, nConnectTimeout, &proxyConnectionFailed))
     {
-        if (!IsSelectableSocket(hSocket)) {
+        if (!socketPoller->IsSelectable(hSocket)) {
             LogPrintf("Cannot create connection: non-selectable socket created (fd >= FD_SETSIZE ?)\n");
             CloseSocket(hSocket);
             return NULL;
@@ -399,6 +400,10 @@ CNode* CConnman::ConnectNode(CAddress addrConnect, const char *pszDest, bool fCo
         {
             LOCK(cs_vNodes);
             vNodes.push_back(pnode);
+            if (socketPoller->CanRegister()) {
+                pnode->AddRef();
+                vNodesToRegister.push_back(pnode);
+            }
         }
 
         return pnode;
@@ -990,7 +995,7 @@ void CConnman::AcceptConnection(const ListenSocket& hListenSocket) {
         return;
     }
 
-    if (!IsSelectableSocket(hSocket))
+    if (!socketPoller->IsSelectable(hSocket))
     {
         LogPrintf("connection from %s dropped: non-selectable socket\n", addr.ToString());
         CloseSocket(hSocket);
@@ -1036,286 +1041,458 @@ void CConnman::AcceptConnection(const ListenSocket& hListenSocket) {
     {
         LOCK(cs_vNodes);
         vNodes.push_back(pnode);
+        if (socketPoller->CanRegister()) {
+            pnode->AddRef();
+            vNodesToRegister.push_back(pnode);
+        }
     }
 }
 
-void CConnman::ThreadSocketHandler()
+void CConnman::DisconnectNodes()
 {
-    unsigned int nPrevNodeCount = 0;
-    while (true)
     {
-        //
-        // Disconnect nodes
-        //
+        LOCK(cs_vNodes);
+        // Disconnect unused nodes
+        std::vector<CNode*> vNodesCopy = vNodes;
+        BOOST_FOREACH(CNode* pnode, vNodesCopy)
         {
-            LOCK(cs_vNodes);
-            // Disconnect unused nodes
-            std::vector<CNode*> vNodesCopy = vNodes;
-            BOOST_FOREACH(CNode* pnode, vNodesCopy)
+            if (pnode->fDisconnect ||
+                (pnode->GetRefCount() <= 0 && pnode->vRecvMsg.empty() && pnode->nSendSize == 0))
             {
-                if (pnode->fDisconnect ||
-                    (pnode->GetRefCount() <= 0 && pnode->vRecvMsg.empty() && pnode->nSendSize == 0))
-                {
-                    // remove from vNodes
-                    vNodes.erase(remove(vNodes.begin(), vNodes.end(), pnode), vNodes.end());
+                // remove from vNodes
+                vNodes.erase(remove(vNodes.begin(), vNodes.end(), pnode), vNodes.end());
 
-                    // release outbound grant (if any)
-                    pnode->grantOutbound.Release();
+                // release outbound grant (if any)
+                pnode->grantOutbound.Release();
 
-                    // close socket and cleanup
-                    pnode->CloseSocketDisconnect();
+                // close socket and cleanup
+                pnode->CloseSocketDisconnect();
 
-                    // hold in disconnected pool until all refs are released
+                // drop the reference held for the socket poller (if any)
+                std::map<NodeId, CNode*>::iterator it = mapRegisteredNodes.find(pnode->id);
+                if (it != mapRegisteredNodes.end()) {
+                    mapRegisteredNodes.erase(it);
                     pnode->Release();
-                    vNodesDisconnected.push_back(pnode);
                 }
+
+                // hold in disconnected pool until all refs are released
+                pnode->Release();
+                vNodesDisconnected.push_back(pnode);
             }
         }
+    }
+    {
+        // Delete disconnected nodes
+        std::list<CNode*> vNodesDisconnectedCopy = vNodesDisconnected;
+        BOOST_FOREACH(CNode* pnode, vNodesDisconnectedCopy)
         {
-            // Delete disconnected nodes
-            std::list<CNode*> vNodesDisconnectedCopy = vNodesDisconnected;
-            BOOST_FOREACH(CNode* pnode, vNodesDisconnectedCopy)
+            // wait until threads are done using it
+            if (pnode->GetRefCount() <= 0)
             {
-                // wait until threads are done using it
-                if (pnode->GetRefCount() <= 0)
+                bool fDelete = false;
                 {
-                    bool fDelete = false;
+                    TRY_LOCK(pnode->cs_vSend, lockSend);
+                    if (lockSend)
                     {
-                        TRY_LOCK(pnode->cs_vSend, lockSend);
-                        if (lockSend)
+                        TRY_LOCK(pnode->cs_vRecvMsg, lockRecv);
+                        if (lockRecv)
                         {
-                            TRY_LOCK(pnode->cs_vRecvMsg, lockRecv);
-                            if (lockRecv)
-                            {
-                                TRY_LOCK(pnode->cs_inventory, lockInv);
-                                if (lockInv)
-                                    fDelete = true;
-                            }
+                            TRY_LOCK(pnode->cs_inventory, lockInv);
+                            if (lockInv)
+                                fDelete = true;
                         }
                     }
-                    if (fDelete)
-                    {
-                        vNodesDisconnected.remove(pnode);
-                        DeleteNode(pnode);
-                    }
+                }
+                if (fDelete)
+                {
+                    vNodesDisconnected.remove(pnode);
+                    DeleteNode(pnode);
                 }
             }
         }
-        size_t vNodesSize;
+    }
+}
+
+void CConnman::NotifyNumConnectionsChanged()
+{
+    size_t vNodesSize;
+    {
+        LOCK(cs_vNodes);
+        vNodesSize = vNodes.size();
+    }
+    if(vNodesSize != nPrevNodeCount) {
+        nPrevNodeCount = vNodesSize;
+        if(clientInterface)
+            clientInterface->NotifyNumConnectionsChanged(nPrevNodeCount);
+    }
+}
+
+void CConnman::InactivityCheck(CNode* pnode)
+{
+    int64_t nTime = GetTime();
+    if (nTime - pnode->nTimeConnected > 60)
+    {
+        if (pnode->nLastRecv == 0 || pnode->nLastSend == 0)
+        {
+            LogPrint("net", "socket no message in first 60 seconds, %d %d from %d\n", pnode->nLastRecv != 0, pnode->nLastSend != 0, pnode->id);
+            pnode->fDisconnect = true;
+        }
+        else if (nTime - pnode->nLastSend > TIMEOUT_INTERVAL)
         {
-            LOCK(cs_vNodes);
-            vNodesSize = vNodes.size();
+            LogPrintf("socket sending timeout: %is\n", nTime - pnode->nLastSend);
+            pnode->fDisconnect = true;
         }
-        if(vNodesSize != nPrevNodeCount) {
-            nPrevNodeCount = vNodesSize;
-            if(clientInterface)
-                clientInterface->NotifyNumConnectionsChanged(nPrevNodeCount);
+        else if (nTime - pnode->nLastRecv > (pnode->nVersion > BIP0031_VERSION ? TIMEOUT_INTERVAL : 90*60))
+        {
+            LogPrintf("socket receive timeout: %is\n", nTime - pnode->nLastRecv);
+            pnode->fDisconnect = true;
+        }
+        else if (pnode->nPingNonceSent && pnode->nPingUsecStart + TIMEOUT_INTERVAL * 1000000 < GetTimeMicros())
+        {
+            LogPrintf("ping timeout: %fs\n", 0.000001 * (GetTimeMicros() - pnode->nPingUsecStart));
+            pnode->fDisconnect = true;
         }
+    }
+}
 
-        //
-        // Find which sockets have data to receive
-        //
-        struct timeval timeout;
-        timeout.tv_sec  = 0;
-        timeout.tv_usec = 50000; // frequency to poll pnode->vSend
+// requires LOCK(cs_vRecvMsg)
+int CConnman::SocketRecvData(CNode* pnode)
+{
+    // typical socket buffer is 8K-64K
+    char pchBuf[0x10000];
+    int nBytes = recv(pnode->hSocket, pchBuf, sizeof(pchBuf), MSG_DONTWAIT);
+    if (nBytes > 0)
+    {
+        bool notify = false;
+        if (!pnode->ReceiveMsgBytes(pchBuf, nBytes, notify))
+            pnode->CloseSocketDisconnect();
+        if(notify)
+            messageHandlerCondition.notify_one();
+        pnode->nLastRecv = GetTime();
+        pnode->nRecvBytes += nBytes;
+        RecordBytesRecv(nBytes);
+    }
+    else if (nBytes == 0)
+    {
+        // socket closed gracefully
+        if (!pnode->fDisconnect)
+            LogPrint("net", "socket closed\n");
+        pnode->CloseSocketDisconnect();
+    }
+    else if (nBytes < 0)
+    {
+        // error
+        int nErr = WSAGetLastError();
+        if (nErr != WSAEWOULDBLOCK && nErr != WSAEMSGSIZE && nErr != WSAEINTR && nErr != WSAEINPROGRESS)
+        {
+            if (!pnode->fDisconnect)
+                LogPrintf("socket recv error %s\n", NetworkErrorString(nErr));
+            pnode->CloseSocketDisconnect();
+        }
+    }
+    return nBytes;
+}
 
-        fd_set fdsetRecv;
-        fd_set fdsetSend;
-        fd_set fdsetError;
-        FD_ZERO(&fdsetRecv);
-        FD_ZERO(&fdsetSend);
-        FD_ZERO(&fdsetError);
-        SOCKET hSocketMax = 0;
-        bool have_fds = false;
+/** Wait on the listen sockets and every node, as select() needs the full list each time */
+void CConnman::SocketHandler()
+{
+    //
+    // Find which sockets have data to receive
+    //
+    const int64_t nTimeout = 50; // frequency to poll pnode->vSend
 
-        BOOST_FOREACH(const ListenSocket& hListenSocket, vhListenSocket) {
-            FD_SET(hListenSocket.socket, &fdsetRecv);
-            hSocketMax = std::max(hSocketMax, hListenSocket.socket);
-            have_fds = true;
-        }
+    std::vector<CNode*> vNodesCopy;
+    {
+        LOCK(cs_vNodes);
+        vNodesCopy = vNodes;
+        BOOST_FOREACH(CNode* pnode, vNodesCopy)
+            pnode->AddRef();
+    }
 
+    // Listen sockets come first, owned by negative ids so they never
+    // collide with a node id. vNodeSocket maps each node in vNodesCopy
+    // to its entry, or -1 if it is not waited on.
+    std::vector<PolledSocket> vSockets;
+    vSockets.reserve(vhListenSocket.size() + vNodesCopy.size());
+    for (size_t i = 0; i < vhListenSocket.size(); i++)
+        vSockets.push_back(PolledSocket(vhListenSocket[i].socket, -1 - (int64_t)i, SOCKET_EVENT_RECV));
+    std::vector<int> vNodeSocket(vNodesCopy.size(), -1);
+
+    for (size_t i = 0; i < vNodesCopy.size(); i++)
+    {
+        CNode* pnode = vNodesCopy[i];
+        if (pnode->hSocket == INVALID_SOCKET)
+            continue;
+        int requested = SOCKET_EVENT_ERR;
+
+        // Implement the following logic:
+        // * If there is data to send, select() for sending data. As this only
+        //   happens when optimistic write failed, we choose to first drain the
+        //   write buffer in this case before receiving more. This avoids
+        //   needlessly queueing received data, if the remote peer is not themselves
+        //   receiving data. This means properly utilizing TCP flow control signalling.
+        // * Otherwise, if there is no (complete) message in the receive buffer,
+        //   or there is space left in the buffer, select() for receiving data.
+        // * (if neither of the above applies, there is certainly one message
+        //   in the receiver buffer ready to be processed).
+        // Together, that means that at least one of the following is always possible,
+        // so we don't deadlock:
+        // * We send some data.
+        // * We wait for data to be received (and disconnect after timeout).
+        // * We process a message in the buffer (message handler thread).
+        bool fSend = false;
         {
-            LOCK(cs_vNodes);
-            BOOST_FOREACH(CNode* pnode, vNodes)
-            {
-                if (pnode->hSocket == INVALID_SOCKET)
-                    continue;
-                FD_SET(pnode->hSocket, &fdsetError);
-                hSocketMax = std::max(hSocketMax, pnode->hSocket);
-                have_fds = true;
-
-                // Implement the following logic:
-                // * If there is data to send, select() for sending data. As this only
-                //   happens when optimistic write failed, we choose to first drain the
-                //   write buffer in this case before receiving more. This avoids
-                //   needlessly queueing received data, if the remote peer is not themselves
-                //   receiving data. This means properly utilizing TCP flow control signalling.
-                // * Otherwise, if there is no (complete) message in the receive buffer,
-                //   or there is space left in the buffer, select() for receiving data.
-                // * (if neither of the above applies, there is certainly one message
-                //   in the receiver buffer ready to be processed).
-                // Together, that means that at least one of the following is always possible,
-                // so we don't deadlock:
-                // * We send some data.
-                // * We wait for data to be received (and disconnect after timeout).
-                // * We process a message in the buffer (message handler thread).
-                {
-                    TRY_LOCK(pnode->cs_vSend, lockSend);
-                    if (lockSend) {
-                        if (!pnode->vSendMsg.empty()) {
-                            FD_SET(pnode->hSocket, &fdsetSend);
-                            continue;
-                        }
-                    }
-                }
-                {
-                    TRY_LOCK(pnode->cs_vRecvMsg, lockRecv);
-                    if (lockRecv && (
-                        pnode->vRecvMsg.empty() || !pnode->vRecvMsg.front().complete() ||
-                        pnode->GetTotalRecvSize() <= GetReceiveFloodSize()))
-                        FD_SET(pnode->hSocket, &fdsetRecv);
-                }
+            TRY_LOCK(pnode->cs_vSend, lockSend);
+            if (lockSend && !pnode->vSendMsg.empty()) {
+                requested |= SOCKET_EVENT_SEND;
+                fSend = true;
             }
         }
+        if (!fSend)
+        {
+            TRY_LOCK(pnode->cs_vRecvMsg, lockRecv);
+            if (lockRecv && (
+                pnode->vRecvMsg.empty() || !pnode->vRecvMsg.front().complete() ||
+                pnode->GetTotalRecvSize() <= GetReceiveFloodSize()))
+                requested |= SOCKET_EVENT_RECV;
+        }
+        vNodeSocket[i] = vSockets.size();
+        vSockets.push_back(PolledSocket(pnode->hSocket, pnode->id, requested));
+    }
 
-        int nSelect = select(have_fds ? hSocketMax + 1 : 0,
-                             &fdsetRecv, &fdsetSend, &fdsetError, &timeout);
-        boost::this_thread::interruption_point();
+    int nReady = socketPoller->Wait(vSockets, nTimeout);
+    boost::this_thread::interruption_point();
 
-        if (nSelect == SOCKET_ERROR)
+    if (nReady == SOCKET_ERROR)
+    {
+        if (!vSockets.empty())
         {
-            if (have_fds)
-            {
-                int nErr = WSAGetLastError();
-                LogPrintf("socket select error %s\n", NetworkErrorString(nErr));
-                for (unsigned int i = 0; i <= hSocketMax; i++)
-                    FD_SET(i, &fdsetRecv);
-            }
-            FD_ZERO(&fdsetSend);
-            FD_ZERO(&fdsetError);
-            MilliSleep(timeout.tv_usec/1000);
+            int nErr = WSAGetLastError();
+            LogPrintf("socket %s error %s\n", socketPoller->GetName(), NetworkErrorString(nErr));
+            BOOST_FOREACH(PolledSocket& ps, vSockets)
+                ps.ready = SOCKET_EVENT_RECV;
         }
+        MilliSleep(nTimeout);
+    }
+
+    //
+    // Accept new connections
+    //
+    for (size_t i = 0; i < vhListenSocket.size(); i++)
+    {
+        if (vhListenSocket[i].socket != INVALID_SOCKET && (vSockets[i].ready & SOCKET_EVENT_RECV))
+        {
+            AcceptConnection(vhListenSocket[i]);
+        }
+    }
+
+    //
+    // Service each socket
+    //
+    for (size_t i = 0; i < vNodesCopy.size(); i++)
+    {
+        CNode* pnode = vNodesCopy[i];
+        const int ready = vNodeSocket[i] >= 0 ? vSockets[vNodeSocket[i]].ready : 0;
+        boost::this_thread::interruption_point();
 
         //
-        // Accept new connections
+        // Receive
         //
-        BOOST_FOREACH(const ListenSocket& hListenSocket, vhListenSocket)
+        if (pnode->hSocket == INVALID_SOCKET)
+            continue;
+        if (ready & (SOCKET_EVENT_RECV | SOCKET_EVENT_ERR))
         {
-            if (hListenSocket.socket != INVALID_SOCKET && FD_ISSET(hListenSocket.socket, &fdsetRecv))
-            {
-                AcceptConnection(hListenSocket);
-            }
+            TRY_LOCK(pnode->cs_vRecvMsg, lockRecv);
+            if (lockRecv)
+                SocketRecvData(pnode);
         }
 
         //
-        // Service each socket
+        // Send
         //
-        std::vector<CNode*> vNodesCopy;
+        if (pnode->hSocket == INVALID_SOCKET)
+            continue;
+        if (ready & SOCKET_EVENT_SEND)
         {
-            LOCK(cs_vNodes);
-            vNodesCopy = vNodes;
-            BOOST_FOREACH(CNode* pnode, vNodesCopy)
-                pnode->AddRef();
+            TRY_LOCK(pnode->cs_vSend, lockSend);
+            if (lockSend) {
+                size_t nBytes = SocketSendData(pnode);
+                if (nBytes)
+                    RecordBytesSent(nBytes);
+            }
         }
+    }
+    {
+        LOCK(cs_vNodes);
         BOOST_FOREACH(CNode* pnode, vNodesCopy)
-        {
-            boost::this_thread::interruption_point();
+            pnode->Release();
+    }
+}
 
-            //
-            // Receive
-            //
-            if (pnode->hSocket == INVALID_SOCKET)
-                continue;
-            if (FD_ISSET(pnode->hSocket, &fdsetRecv) || FD_ISSET(pnode->hSocket, &fdsetError))
-            {
-                TRY_LOCK(pnode->cs_vRecvMsg, lockRecv);
-                if (lockRecv)
-                {
-                    {
-                        // typical socket buffer is 8K-64K
-                        char pchBuf[0x10000];
-                        int nBytes = recv(pnode->hSocket, pchBuf, sizeof(pchBuf), MSG_DONTWAIT);
-                        if (nBytes > 0)
-                        {
-                            bool notify = false;
-                            if (!pnode->ReceiveMsgBytes(pchBuf, nBytes, notify))
-                                pnode->CloseSocketDisconnect();
-                            if(notify)
-                                messageHandlerCondition.notify_one();
-                            pnode->nLastRecv = GetTime();
-                            pnode->nRecvBytes += nBytes;
-                            RecordBytesRecv(nBytes);
-                        }
-                        else if (nBytes == 0)
-                        {
-                            // socket closed gracefully
-                            if (!pnode->fDisconnect)
-                                LogPrint("net", "socket closed\n");
-                            pnode->CloseSocketDisconnect();
-                        }
-                        else if (nBytes < 0)
-                        {
-                            // error
-                            int nErr = WSAGetLastError();
-                            if (nErr != WSAEWOULDBLOCK && nErr != WSAEMSGSIZE && nErr != WSAEINTR && nErr != WSAEINPROGRESS)
-                            {
-                                if (!pnode->fDisconnect)
-                                    LogPrintf("socket recv error %s\n", NetworkErrorString(nErr));
-                                pnode->CloseSocketDisconnect();
-                            }
-                        }
-                    }
-                }
-            }
+/**
+ * Wait on registered sockets and service only the nodes that have events, or
+ * had events they could not be serviced for yet. Node sockets are registered
+ * edge-triggered for both directions, so a node stays in setReceivableNodes or
+ * setSendableNodes until its socket runs into EWOULDBLOCK, and the poller is
+ * never asked to change interest. Returns whether a node was left with more to
+ * do, so the next wait should not block.
+ */
+bool CConnman::SocketHandlerEvents(int64_t nTimeoutMs)
+{
+    std::vector<CNode*> vNodesNew;
+    {
+        LOCK(cs_vNodes);
+        vNodesNew.swap(vNodesToRegister);
+    }
+    BOOST_FOREACH(CNode* pnode, vNodesNew)
+    {
+        // Disconnected before it got here: drop the reference it was queued with
+        if (pnode->hSocket == INVALID_SOCKET) {
+            LOCK(cs_vNodes);
+            pnode->Release();
+            continue;
+        }
+        if (!socketPoller->Register(pnode->hSocket, pnode->id, SOCKET_EVENT_RECV | SOCKET_EVENT_SEND, true)) {
+            LogPrintf("socket %s error registering peer=%d: %s\n", socketPoller->GetName(), pnode->id, NetworkErrorString(WSAGetLastError()));
+            pnode->fDisconnect = true;
+        }
+        mapRegisteredNodes.insert(std::make_pair(pnode->id, pnode));
+    }
+
+    std::vector<SocketEvent> vEvents;
+    if (socketPoller->WaitEvents(vEvents, nTimeoutMs) == SOCKET_ERROR)
+    {
+        int nErr = WSAGetLastError();
+        LogPrintf("socket %s error %s\n", socketPoller->GetName(), NetworkErrorString(nErr));
+        MilliSleep(nTimeoutMs);
+    }
+    boost::this_thread::interruption_point();
+
+    BOOST_FOREACH(const SocketEvent& event, vEvents)
+    {
+        if (event.owner < 0) {
+            // Listen sockets are level-triggered: accept one connection per
+            // wakeup, and hear about the rest on the next one
+            size_t i = -1 - event.owner;
+            if (i < vhListenSocket.size() && vhListenSocket[i].socket != INVALID_SOCKET && (event.ready & SOCKET_EVENT_RECV))
+                AcceptConnection(vhListenSocket[i]);
+            continue;
+        }
+        if (event.ready & (SOCKET_EVENT_RECV | SOCKET_EVENT_ERR))
+            setReceivableNodes.insert(event.owner);
+        if (event.ready & SOCKET_EVENT_SEND)
+            setSendableNodes.insert(event.owner);
+    }
+
+    bool fMore = false;
+
+    //
+    // Send
+    //
+    for (std::set<NodeId>::iterator it = setSendableNodes.begin(); it != setSendableNodes.end(); )
+    {
+        boost::this_thread::interruption_point();
+        std::map<NodeId, CNode*>::const_iterator mi = mapRegisteredNodes.find(*it);
+        if (mi == mapRegisteredNodes.end() || mi->second->hSocket == INVALID_SOCKET) {
+            setSendableNodes.erase(it++);
+            continue;
+        }
+        CNode* pnode = mi->second;
+        TRY_LOCK(pnode->cs_vSend, lockSend);
+        if (!lockSend) {
+            ++it;
+            continue;
+        }
+        // With an empty queue, the next message goes out by optimistic write,
+        // and is left queued only once the socket would block
+        size_t nBytes = 0;
+        if (!pnode->vSendMsg.empty())
+            nBytes = SocketSendData(pnode);
+        if (nBytes)
+            RecordBytesSent(nBytes);
+        if (nBytes && !pnode->vSendMsg.empty()) {
+            fMore = true;
+            ++it;
+        } else {
+            setSendableNodes.erase(it++);
+        }
+    }
 
-            //
-            // Send
-            //
-            if (pnode->hSocket == INVALID_SOCKET)
+    //
+    // Receive
+    //
+    for (std::set<NodeId>::iterator it = setReceivableNodes.begin(); it != setReceivableNodes.end(); )
+    {
+        boost::this_thread::interruption_point();
+        std::map<NodeId, CNode*>::const_iterator mi = mapRegisteredNodes.find(*it);
+        if (mi == mapRegisteredNodes.end() || mi->second->hSocket == INVALID_SOCKET) {
+            setReceivableNodes.erase(it++);
+            continue;
+        }
+        CNode* pnode = mi->second;
+        // As in SocketHandler, drain the send queue before receiving more, and
+        // leave the socket alone while the receive buffer is full
+        {
+            TRY_LOCK(pnode->cs_vSend, lockSend);
+            if (!lockSend || !pnode->vSendMsg.empty()) {
+                ++it;
                 continue;
-            if (FD_ISSET(pnode->hSocket, &fdsetSend))
-            {
-                TRY_LOCK(pnode->cs_vSend, lockSend);
-                if (lockSend) {
-                    size_t nBytes = SocketSendData(pnode);
-                    if (nBytes)
-                        RecordBytesSent(nBytes);
-                }
             }
+        }
+        TRY_LOCK(pnode->cs_vRecvMsg, lockRecv);
+        if (!lockRecv || (!pnode->vRecvMsg.empty() && pnode->vRecvMsg.front().complete() &&
+                          pnode->GetTotalRecvSize() > GetReceiveFloodSize())) {
+            ++it;
+            continue;
+        }
+        if (SocketRecvData(pnode) > 0) {
+            fMore = true;
+            ++it;
+        } else {
+            setReceivableNodes.erase(it++);
+        }
+    }
+    return fMore;
+}
 
-            //
-            // Inactivity checking
-            //
-            int64_t nTime = GetTime();
-            if (nTime - pnode->nTimeConnected > 60)
-            {
-                if (pnode->nLastRecv == 0 || pnode->nLastSend == 0)
-                {
-                    LogPrint("net", "socket no message in first 60 seconds, %d %d from %d\n", pnode->nLastRecv != 0, pnode->nLastSend != 0, pnode->id);
-                    pnode->fDisconnect = true;
-                }
-                else if (nTime - pnode->nLastSend > TIMEOUT_INTERVAL)
-                {
-                    LogPrintf("socket sending timeout: %is\n", nTime - pnode->nLastSend);
-                    pnode->fDisconnect = true;
-                }
-                else if (nTime - pnode->nLastRecv > (pnode->nVersion > BIP0031_VERSION ? TIMEOUT_INTERVAL : 90*60))
-                {
-                    LogPrintf("socket receive timeout: %is\n", nTime - pnode->nLastRecv);
-                    pnode->fDisconnect = true;
-                }
-                else if (pnode->nPingNonceSent && pnode->nPingUsecStart + TIMEOUT_INTERVAL * 1000000 < GetTimeMicros())
-                {
-                    LogPrintf("ping timeout: %fs\n", 0.000001 * (GetTimeMicros() - pnode->nPingUsecStart));
-                    pnode->fDisconnect = true;
-                }
-            }
+void CConnman::ThreadSocketHandler()
+{
+    const int64_t nTimeout = 50; // frequency to poll pnode->vSend
+    const bool fRegister = socketPoller->CanRegister();
+    if (fRegister) {
+        for (size_t i = 0; i < vhListenSocket.size(); i++)
+            if (!socketPoller->Register(vhListenSocket[i].socket, -1 - (int64_t)i, SOCKET_EVENT_RECV, false))
+                LogPrintf("socket %s error registering listen socket: %s\n", socketPoller->GetName(), NetworkErrorString(WSAGetLastError()));
+    }
+
+    int64_t nLastSweep = 0;
+    int64_t nLastInactivityCheck = 0;
+    bool fMore = false;
+    while (true)
+    {
+        // A registering backend wakes this loop for every event, rather than
+        // for every batch of them, so the sweeps over all nodes run on a
+        // timer: disconnecting at most once per poll interval, and checking
+        // for inactivity (with timeouts of a minute or more) once a second.
+        int64_t nNow = GetTimeMillis();
+        if (!fRegister || nNow - nLastSweep >= nTimeout)
+        {
+            nLastSweep = nNow;
+            DisconnectNodes();
+            NotifyNumConnectionsChanged();
         }
+        if (nNow - nLastInactivityCheck >= 1000)
         {
+            nLastInactivityCheck = nNow;
             LOCK(cs_vNodes);
-            BOOST_FOREACH(CNode* pnode, vNodesCopy)
-                pnode->Release();
+            BOOST_FOREACH(CNode* pnode, vNodes)
+                InactivityCheck(pnode);
         }
+
+        if (fRegister)
+            fMore = SocketHandlerEvents(fMore ? 0 : nTimeout);
+        else
+            SocketHandler();
     }
 }
 
@@ -1823,9 +2000,6 @@ bool CConnman::OpenNetworkConnection(const CAddress& addrConnect, bool fCountFai
 
 void CConnman::ThreadMessageHandler()
 {
-    boost::mutex condition_mutex;
-    boost::unique_lock<boost::mutex> lock(condition_mutex);
-
     while (true)
     {
         std::vector<CNode*> vNodesCopy;
@@ -1844,6 +2018,13 @@ void CConnman::ThreadMessageHandler()
             if (pnode->fDisconnect)
                 continue;
 
+            // Several handler threads may run. Each node is worked on by one
+            // of them at a time, which keeps its messages processed (and
+            // answered) in order; the others move on to the next node.
+            TRY_LOCK(pnode->cs_msgProcessing, lockProcessing);
+            if (!lockProcessing)
+                continue;
+
             // Receive messages
             {
                 TRY_LOCK(pnode->cs_vRecvMsg, lockRecv);
@@ -1878,8 +2059,10 @@ void CConnman::ThreadMessageHandler()
                 pnode->Release();
         }
 
-        if (fSleep)
+        if (fSleep) {
+            boost::unique_lock<boost::mutex> lock(mutexMsgProc);
             messageHandlerCondition.timed_wait(lock, boost::posix_time::microsec_clock::universal_time() + boost::posix_time::milliseconds(100));
+        }
     }
 }
 
@@ -2071,6 +2254,7 @@ CConnman::CConnman(uint64_t nSeed0In, uint64_t nSeed1In) : nSeed0(nSeed0In), nSe
     nMaxOutbound = 0;
     nBestHeight = 0;
     clientInterface = NULL;
+    nPrevNodeCount = 0;
 }
 
 NodeId CConnman::GetNewNodeId()
@@ -2094,11 +2278,20 @@ bool CConnman::Start(boost::thread_group& threadGroup, CScheduler& scheduler, st
     nSendBufferMaxSize = connOptions.nSendBufferMaxSize;
     nReceiveFloodSize = connOptions.nSendBufferMaxSize;
 
+    nMessageHandlerThreads = std::max(1, std::min(connOptions.nMessageHandlerThreads, MAX_MSGHAND_THREADS));
+
     nMaxOutboundLimit = connOptions.nMaxOutboundLimit;
     nMaxOutboundTimeframe = connOptions.nMaxOutboundTimeframe;
 
     SetBestHeight(connOptions.nBestHeight);
 
+    socketPoller = CreateSocketPoller(connOptions.strSocketEvents);
+    if (!socketPoller) {
+        strNodeError = strprintf(_("Unsupported -socketevents mode '%s' (available: %s)"), connOptions.strSocketEvents, GetSocketEventsModes());
+        return false;
+    }
+    LogPrintf("Using %s for peer socket events\n", socketPoller->GetName());
+
     clientInterface = connOptions.uiInterface;
     if (clientInterface)
         clientInterface->InitMessage(_("Loading addresses..."));
@@ -2162,7 +2355,8 @@ bool CConnman::Start(boost::thread_group& threadGroup, CScheduler& scheduler, st
         threadGroup.create_thread(boost::bind(&TraceThread<boost::function<void()> >, "opencon", boost::function<void()>(boost::bind(&CConnman::ThreadOpenConnections, this))));
 
     // Process messages
-    threadGroup.create_thread(boost::bind(&TraceThread<boost::function<void()> >, "msghand", boost::function<void()>(boost::bind(&CConnman::ThreadMessageHandler, this))));
+    for (int i = 0; i < nMessageHandlerThreads; i++)
+        threadGroup.create_thread(boost::bind(&TraceThread<boost::function<void()> >, "msghand", boost::function<void()>(boost::bind(&CConnman::ThreadMessageHandler, this))));
 
     // Dump network addresses
     scheduler.scheduleEvery(boost::bind(&CConnman::DumpData, this), DUMP_ADDRESSES_INTERVAL);
@@ -2216,6 +2410,10 @@ void CConnman::Stop()
     }
     vNodes.clear();
     vNodesDisconnected.clear();
+    vNodesToRegister.clear();
+    mapRegisteredNodes.clear();
+    setReceivableNodes.clear();
+    setSendableNodes.clear();
     vhListenSocket.clear();
     delete semOutbound;
     semOutbound = NULL;
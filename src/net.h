@@ -14,6 +14,7 @@
 #include "hash.h"
 #include "limitedmap.h"
 #include "netaddress.h"
+#include "netpoller.h"
 #include "protocol.h"
 #include "random.h"
 #include "streams.h"
@@ -71,6 +72,10 @@ static const size_t MAPASKFOR_MAX_SZ = MAX_INV_SZ;
 static const size_t SETASKFOR_MAX_SZ = 2 * MAX_INV_SZ;
 /** The maximum number of peer connections to maintain. */
 static const unsigned int DEFAULT_MAX_PEER_CONNECTIONS = 125;
+/** The default number of threads processing peer messages */
+static const int DEFAULT_MSGHAND_THREADS = 2;
+/** Maximum number of threads processing peer messages */
+static const int MAX_MSGHAND_THREADS = 16;
 /** The default for -maxuploadtarget. 0 = Unlimited */
 static const uint64_t DEFAULT_MAX_UPLOAD_TARGET = 0;
 /** The default timeframe for -maxuploadtarget. 1 day. */
@@ -139,6 +144,8 @@ public:
         unsigned int nReceiveFloodSize = 0;
         uint64_t nMaxOutboundTimeframe = 0;
         uint64_t nMaxOutboundLimit = 0;
+        std::string strSocketEvents = DEFAULT_SOCKETEVENTS;
+        int nMessageHandlerThreads = 1;
     };
     CConnman(uint64_t seed0, uint64_t seed1);
     ~CConnman();
@@ -333,6 +340,12 @@ private:
     void ThreadOpenConnections();
     void ThreadMessageHandler();
     void AcceptConnection(const ListenSocket& hListenSocket);
+    void DisconnectNodes();
+    void NotifyNumConnectionsChanged();
+    void InactivityCheck(CNode* pnode);
+    int SocketRecvData(CNode* pnode);
+    void SocketHandler();
+    bool SocketHandlerEvents(int64_t nTimeoutMs);
     void ThreadSocketHandler();
     void ThreadDNSAddressSeed();
 
@@ -388,6 +401,19 @@ private:
     unsigned int nReceiveFloodSize;
 
     std::vector<ListenSocket> vhListenSocket;
+    /** Backend ThreadSocketHandler waits on (see -socketevents) */
+    std::unique_ptr<CSocketPoller> socketPoller;
+    /**
+     * With a backend that can register sockets: new nodes, each holding a
+     * reference, for ThreadSocketHandler to register (guarded by cs_vNodes),
+     * the registered nodes, each still holding that reference, and the nodes
+     * whose sockets reported being readable or writable and have not run into
+     * EWOULDBLOCK since (socket thread only).
+     */
+    std::vector<CNode*> vNodesToRegister;
+    std::map<NodeId, CNode*> mapRegisteredNodes;
+    std::set<NodeId> setReceivableNodes;
+    std::set<NodeId> setSendableNodes;
     std::atomic<bool> fNetworkActive;
     banmap_t setBanned;
     CCriticalSection cs_setBanned;
@@ -401,7 +427,10 @@ private:
     std::vector<CNode*> vNodes;
     std::list<CNode*> vNodesDisconnected;
     mutable CCriticalSection cs_vNodes;
+    unsigned int nPrevNodeCount;
     std::atomic<NodeId> nLastNodeId;
+    int nMessageHandlerThreads;
+    boost::mutex mutexMsgProc;
     boost::condition_variable messageHandlerCondition;
 
     /** Services this instance offers */
@@ -419,6 +448,8 @@ private:
 
     /** SipHasher seeds for deterministic randomness */
     const uint64_t nSeed0, nSeed1;
+
+    friend struct CConnmanTest;
 };
 extern std::unique_ptr<CConnman> g_connman;
 void Discover(boost::thread_group& threadGroup);
@@ -592,6 +623,9 @@ public:
     std::deque<CInv> vRecvGetData;
     std::deque<CNetMessage> vRecvMsg;
     CCriticalSection cs_vRecvMsg;
+    // Held by the message handler thread that is processing or sending
+    // messages for this node, so no two threads do so at the same time.
+    CCriticalSection cs_msgProcessing;
     uint64_t nRecvBytes;
     int nRecvVersion;
 
@@ -638,8 +672,11 @@ public:
     int nStartingHeight;
 
     // flood relay
+    // vAddrToSend and addrKnown are protected by cs_vAddrToSend, as other
+    // nodes' message handlers relay addresses to this node.
     std::vector<CAddress> vAddrToSend;
     CRollingBloomFilter addrKnown;
+    CCriticalSection cs_vAddrToSend;
     bool fGetAddr;
     std::set<uint256> setKnown;
     int64_t nNextAddrSend;
@@ -775,6 +812,7 @@ public:
 
     void AddAddressKnown(const CAddress& _addr)
     {
+        LOCK(cs_vAddrToSend);
         addrKnown.insert(_addr.GetKey());
     }
 
@@ -783,6 +821,7 @@ public:
         // Known checking here is only to save space from duplicates.
         // SendMessages will filter it again for knowns that were added
         // after addresses were pushed.
+        LOCK(cs_vAddrToSend);
         if (_addr.IsValid() && !addrKnown.contains(_addr.GetKey())) {
             if (vAddrToSend.size() >= MAX_ADDR_TO_SEND) {
                 vAddrToSend[insecure_rand.rand32() % vAddrToSend.size()] = _addr;
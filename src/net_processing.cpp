@@ -8,6 +8,7 @@
 #include "addrman.h"
 #include "arith_uint256.h"
 #include "blockencodings.h"
+#include "blockmap.h"
 #include "chainparams.h"
 #include "consensus/validation.h"
 #include "hash.h"
@@ -24,6 +25,7 @@
 #include "random.h"
 #include "tinyformat.h"
 #include "txmempool.h"
+#include "txrelay.h"
 #include "ui_interface.h"
 #include "util.h"
 #include "utilmoneystr.h"
@@ -43,7 +45,7 @@ int64_t nTimeBestReceived = 0; // Used only to inform the wallet of when we last
 struct IteratorComparator
 {
     template<typename I>
-    bool operator()(const I& a, const I& b)
+    bool operator()(const I& a, const I& b) const
     {
         return &(*a) < &(*b);
     }
@@ -110,6 +112,19 @@ namespace {
     /** Stack of nodes which we have set to announce using compact blocks */
     list<NodeId> lNodesAnnouncingHeaderAndIDs;
 
+    /** Extra transactions for compact block reconstruction. Has its own lock. */
+    CBlockReconstructionIndex blockReconstruction;
+
+    /**
+     * The last compact block forwarded to whitelisted peers ahead of
+     * validation (-whitelistfastcmpctrelay), the peer it came from, and
+     * getblocktxn requests for it that have to wait until we have the block
+     * ourselves. Protected by cs_main.
+     */
+    uint256 hashFastRelayBlock;
+    NodeId nodeFastRelaySource = -1;
+    std::vector<std::pair<NodeId, BlockTransactionsRequest> > vFastRelayBlockTxnRequests;
+
     /** Number of preferable block download peers. */
     int nPreferredDownload = 0;
 
@@ -121,6 +136,9 @@ namespace {
     MapRelay mapRelay;
     /** Expiration-time ordered list of (expire time, relay map entry) pairs, protected by cs_main). */
     std::deque<std::pair<int64_t, MapRelay::iterator>> vRelayExpiration;
+
+    /** Announcement order of recently relayed transactions, shared by all peers. */
+    CTxRelayScheduler txRelayScheduler;
 } // anon namespace
 
 //////////////////////////////////////////////////////////////////////////////
@@ -162,7 +180,7 @@ struct CNodeState {
     //! The last full block we both have.
     CBlockIndex *pindexLastCommonBlock;
     //! The best header we have sent our peer.
-    CBlockIndex *pindexBestHeaderSent;
+    const CBlockIndex *pindexBestHeaderSent;
     //! Length of current-streak of unconnecting headers announcements
     int nUnconnectingHeaders;
     //! Whether we've started headers synchronization with this peer.
@@ -195,6 +213,8 @@ struct CNodeState {
      * otherwise: whether this peer sends non-witnesses in cmpctblocks/blocktxns.
      */
     bool fSupportsDesiredCmpctVersion;
+    //! Whether a compact block from this peer turned out invalid after we forwarded it ahead of validation.
+    bool fFastRelayFailed;
 
     CNodeState(CAddress addrIn, std::string addrNameIn) : address(addrIn), name(addrNameIn) {
         fCurrentlyConnected = false;
@@ -217,6 +237,7 @@ struct CNodeState {
         fHaveWitness = false;
         fWantsCmpctWitness = false;
         fSupportsDesiredCmpctVersion = false;
+        fFastRelayFailed = false;
     }
 };
 
@@ -346,7 +367,7 @@ bool MarkBlockAsInFlight(NodeId nodeid, const uint256& hash, const Consensus::Pa
     MarkBlockAsReceived(hash);
 
     list<QueuedBlock>::iterator it = state->vBlocksInFlight.insert(state->vBlocksInFlight.end(),
-            {hash, pindex, pindex != NULL, std::unique_ptr<PartiallyDownloadedBlock>(pit ? new PartiallyDownloadedBlock(&mempool) : NULL)});
+            {hash, pindex, pindex != NULL, std::unique_ptr<PartiallyDownloadedBlock>(pit ? new PartiallyDownloadedBlock(&mempool, &blockReconstruction) : NULL)});
     state->nBlocksInFlight++;
     state->nBlocksInFlightValidHeaders += it->fValidatedHeaders;
     if (state->nBlocksInFlight == 1) {
@@ -432,7 +453,7 @@ bool CanDirectFetch(const Consensus::Params &consensusParams)
 }
 
 // Requires cs_main
-bool PeerHasHeader(CNodeState *state, CBlockIndex *pindex)
+bool PeerHasHeader(CNodeState *state, const CBlockIndex *pindex)
 {
     if (state->pindexBestKnownBlock && pindex == state->pindexBestKnownBlock->GetAncestor(pindex->nHeight))
         return true;
@@ -550,6 +571,10 @@ void FindNextBlocksToDownload(NodeId nodeid, unsigned int count, std::vector<CBl
 
 } // anon namespace
 
+void GetTxRelayStats(CTxRelayStats &stats) {
+    txRelayScheduler.GetStats(stats);
+}
+
 bool GetNodeStateStats(NodeId nodeid, CNodeStateStats &stats) {
     LOCK(cs_main);
     CNodeState *state = State(nodeid);
@@ -586,6 +611,12 @@ void UnregisterNodeSignals(CNodeSignals& nodeSignals)
 // mapOrphanTransactions
 //
 
+static void AddToCompactExtraTransactions(const CTransactionRef& tx)
+{
+    size_t nMax = (size_t)std::max((int64_t)0, GetArg("-blockreconstructionextratxn", DEFAULT_BLOCK_RECONSTRUCTION_EXTRA_TXN));
+    blockReconstruction.AddExtraTransaction(tx, nMax);
+}
+
 bool AddOrphanTx(const CTransaction& tx, NodeId peer) EXCLUSIVE_LOCKS_REQUIRED(cs_main)
 {
     uint256 hash = tx.GetHash();
@@ -782,12 +813,132 @@ void PeerLogicValidation::UpdatedBlockTip(const CBlockIndex *pindexNew, const CB
     nTimeBestReceived = GetTime();
 }
 
+static void SendBlockTransactions(const CBlock& block, const BlockTransactionsRequest& req, CNode* pfrom, CConnman& connman) EXCLUSIVE_LOCKS_REQUIRED(cs_main)
+{
+    BlockTransactions resp(req);
+    for (size_t i = 0; i < req.indexes.size(); i++) {
+        if (req.indexes[i] >= block.vtx.size()) {
+            Misbehaving(pfrom->GetId(), 100);
+            LogPrintf("Peer %d sent us a getblocktxn with out-of-bounds tx indices", pfrom->id);
+            return;
+        }
+        resp.txn[i] = block.vtx[req.indexes[i]];
+    }
+    int nSendFlags = State(pfrom->GetId())->fWantsCmpctWitness ? 0 : SERIALIZE_TRANSACTION_NO_WITNESS;
+    connman.PushMessage(pfrom, CNetMsgMaker(pfrom->GetSendVersion()).Make(nSendFlags, NetMsgType::BLOCKTXN, resp));
+}
+
+/** Answer the getblocktxn requests that arrived for a fast-relayed block before we had it. */
+static void SendFastRelayBlockTransactions(const CBlock& block, CConnman& connman) EXCLUSIVE_LOCKS_REQUIRED(cs_main)
+{
+    if (block.GetHash() != hashFastRelayBlock)
+        return;
+    for (const std::pair<NodeId, BlockTransactionsRequest>& request : vFastRelayBlockTxnRequests) {
+        connman.ForNode(request.first, [&block, &request, &connman](CNode* pnode) {
+            SendBlockTransactions(block, request.second, pnode, connman);
+            return true;
+        });
+    }
+    vFastRelayBlockTxnRequests.clear();
+}
+
+/**
+ * Forward a compact block we got from pfrom, and were able to decode, to our
+ * whitelisted high-bandwidth peers before we have validated (or even
+ * reconstructed) the block. Its header is valid, and peers of at least
+ * INVALID_CB_NO_BAN_VERSION do not punish us if the block is not.
+ */
+static void FastRelayCompactBlock(CNode* pfrom, const CBlockIndex* pindex, const CBlockHeaderAndShortTxIDs& cmpctblock, CConnman& connman) EXCLUSIVE_LOCKS_REQUIRED(cs_main)
+{
+    if (!GetBoolArg("-whitelistfastcmpctrelay", DEFAULT_WHITELISTFASTCMPCTRELAY))
+        return;
+    CNodeState* nodestate = State(pfrom->GetId());
+    if (nodestate->fFastRelayFailed || pindex->GetBlockHash() == hashFastRelayBlock ||
+            pindex->pprev != chainActive.Tip() || IsInitialBlockDownload())
+        return;
+
+    // The peer sends the compact block version we asked for if it supports
+    // it, so the short IDs are of wtxids if and only if we asked for those
+    bool fWitness = (pfrom->GetLocalServices() & NODE_WITNESS) && nodestate->fSupportsDesiredCmpctVersion;
+
+    hashFastRelayBlock = pindex->GetBlockHash();
+    nodeFastRelaySource = pfrom->GetId();
+    vFastRelayBlockTxnRequests.clear();
+
+    int nForwarded = 0;
+    connman.ForEachNode([pfrom, pindex, &cmpctblock, fWitness, &nForwarded, &connman](CNode* pnode) {
+        if (pnode == pfrom || !pnode->fWhitelisted || pnode->nVersion < INVALID_CB_NO_BAN_VERSION || pnode->fDisconnect)
+            return;
+        ProcessBlockAvailability(pnode->GetId());
+        CNodeState &state = *State(pnode->GetId());
+        if (!state.fPreferHeaderAndIDs || state.fWantsCmpctWitness != fWitness ||
+                PeerHasHeader(&state, pindex) || !PeerHasHeader(&state, pindex->pprev))
+            return;
+        int nSendFlags = state.fWantsCmpctWitness ? 0 : SERIALIZE_TRANSACTION_NO_WITNESS;
+        connman.PushMessage(pnode, CNetMsgMaker(pnode->GetSendVersion()).Make(nSendFlags, NetMsgType::CMPCTBLOCK, cmpctblock));
+        state.pindexBestHeaderSent = pindex;
+        nForwarded++;
+    });
+    LogPrint("cmpctblock", "Forwarded compact block %s from peer=%d to %d peers ahead of validation\n",
+        hashFastRelayBlock.ToString(), pfrom->id, nForwarded);
+}
+
+void PeerLogicValidation::NewPoWValidBlock(const CBlockIndex *pindex, const CBlock& block) {
+    LOCK(cs_main);
+
+    SendFastRelayBlockTransactions(block, *connman);
+
+    // BIP 152 permits announcing a block with a cmpctblock message once its
+    // header is valid, so high-bandwidth peers get it now rather than after
+    // the block is connected. Peers that could still ban us for a block
+    // that turns out invalid get it from SendMessages as before.
+    std::unique_ptr<CBlockHeaderAndShortTxIDs> pcmpctblocks[2];
+    CConnman* connmanIn = connman;
+    connman->ForEachNode([pindex, &block, &pcmpctblocks, connmanIn](CNode* pnode) {
+        if (pnode->nVersion < INVALID_CB_NO_BAN_VERSION || pnode->fDisconnect)
+            return;
+        ProcessBlockAvailability(pnode->GetId());
+        CNodeState &state = *State(pnode->GetId());
+        if (!state.fPreferHeaderAndIDs || PeerHasHeader(&state, pindex) || !PeerHasHeader(&state, pindex->pprev))
+            return;
+        std::unique_ptr<CBlockHeaderAndShortTxIDs>& pcmpctblock = pcmpctblocks[state.fWantsCmpctWitness];
+        if (!pcmpctblock)
+            pcmpctblock.reset(new CBlockHeaderAndShortTxIDs(block, state.fWantsCmpctWitness));
+        LogPrint("net", "%s sending header-and-ids %s to peer %d\n", "PeerLogicValidation::NewPoWValidBlock",
+                pindex->GetBlockHash().ToString(), pnode->id);
+        int nSendFlags = state.fWantsCmpctWitness ? 0 : SERIALIZE_TRANSACTION_NO_WITNESS;
+        connmanIn->PushMessage(pnode, CNetMsgMaker(pnode->GetSendVersion()).Make(nSendFlags, NetMsgType::CMPCTBLOCK, *pcmpctblock));
+        state.pindexBestHeaderSent = pindex;
+    });
+}
+
 void PeerLogicValidation::BlockChecked(const CBlock& block, const CValidationState& state) {
     LOCK(cs_main);
 
     const uint256 hash(block.GetHash());
     std::map<uint256, std::pair<NodeId, bool>>::iterator it = mapBlockSource.find(hash);
 
+    if (hash == hashFastRelayBlock) {
+        if (state.IsInvalid()) {
+            // We already passed it on to our whitelisted peers. Don't do that
+            // with blocks from this peer again.
+            CNodeState* sourceState = State(nodeFastRelaySource);
+            if (sourceState)
+                sourceState->fFastRelayFailed = true;
+            LogPrintf("Block %s, forwarded ahead of validation from peer=%d, is invalid: %s\n",
+                hash.ToString(), nodeFastRelaySource, FormatStateMessage(state));
+            // Answer the peers waiting for its transactions all the same, so
+            // that they find out it is invalid rather than time out, and
+            // forget about it, so that later requests are not queued forever.
+            SendFastRelayBlockTransactions(block, *connman);
+            hashFastRelayBlock.SetNull();
+            nodeFastRelaySource = -1;
+        } else {
+            // In case it was not announced through NewPoWValidBlock
+            SendFastRelayBlockTransactions(block, *connman);
+        }
+    }
+
     int nDoS = 0;
     if (state.IsInvalid(nDoS)) {
         if (it != mapBlockSource.end() && State(it->second.first)) {
@@ -826,12 +977,13 @@ bool static AlreadyHave(const CInv& inv) EXCLUSIVE_LOCKS_REQUIRED(cs_main)
                 recentRejects->reset();
             }
 
-            // Use pcoinsTip->HaveCoinsInCache as a quick approximation to exclude
+            // Use pcoinsTip->HaveCoinInCache as a quick approximation to exclude
             // requesting or processing some txs which have already been included in a block
             return recentRejects->contains(inv.hash) ||
                    mempool.exists(inv.hash) ||
                    mapOrphanTransactions.count(inv.hash) ||
-                   pcoinsTip->HaveCoinsInCache(inv.hash);
+                   pcoinsTip->HaveCoinInCache(COutPoint(inv.hash, 0)) || // Best effort: only try output 0 and 1
+                   pcoinsTip->HaveCoinInCache(COutPoint(inv.hash, 1));
         }
     case MSG_BLOCK:
     case MSG_WITNESS_BLOCK:
@@ -844,6 +996,7 @@ bool static AlreadyHave(const CInv& inv) EXCLUSIVE_LOCKS_REQUIRED(cs_main)
 static void RelayTransaction(const CTransaction& tx, CConnman& connman)
 {
     CInv inv(MSG_TX, tx.GetHash());
+    txRelayScheduler.Queue(inv.hash, GetTimeMicros());
     connman.ForEachNode([&inv](CNode* pnode)
     {
         pnode->PushInventory(inv);
@@ -886,6 +1039,26 @@ static void RelayAddress(const CAddress& addr, bool fReachable, CConnman& connma
     connman.ForEachNodeThen(std::move(sortfunc), std::move(pushfunc));
 }
 
+/**
+ * Send a block as it is stored on disk, without deserializing it, stripping
+ * the witness data for peers that did not ask for it. Returns false if the
+ * block is not available that way, and has to be sent from a CBlock.
+ */
+static bool PushRawBlock(CNode* pfrom, CConnman& connman, const CBlockIndex* pindex, bool fWitness)
+{
+    CRawBlock raw;
+    if (!ReadRawBlockFromDisk(raw, pindex, Params()))
+        return false;
+    CSerializedNetMsg msg;
+    msg.command = NetMsgType::BLOCK;
+    if (fWitness)
+        msg.data.assign(raw.begin(), raw.end());
+    else if (!StripBlockWitness(raw.begin(), raw.end(), msg.data))
+        return error("%s: cannot strip witness from block %s", __func__, pindex->GetBlockHash().ToString());
+    connman.PushMessage(pfrom, std::move(msg));
+    return true;
+}
+
 void static ProcessGetData(CNode* pfrom, const Consensus::Params& consensusParams, CConnman& connman)
 {
     std::deque<CInv>::iterator it = pfrom->vRecvGetData.begin();
@@ -940,11 +1113,17 @@ void static ProcessGetData(CNode* pfrom, const Consensus::Params& consensusParam
                 // it's available before trying to send.
                 if (send && (mi->second->nStatus & BLOCK_HAVE_DATA))
                 {
+                    // Full blocks go out as stored, without building a CBlock
+                    bool fSentRaw = (inv.type == MSG_BLOCK || inv.type == MSG_WITNESS_BLOCK) &&
+                        PushRawBlock(pfrom, connman, mi->second, inv.type == MSG_WITNESS_BLOCK);
+
                     // Send block from disk
                     CBlock block;
-                    if (!ReadBlockFromDisk(block, (*mi).second, consensusParams))
+                    if (!fSentRaw && !ReadBlockFromDisk(block, (*mi).second, consensusParams))
                         assert(!"cannot load block from disk");
-                    if (inv.type == MSG_BLOCK)
+                    if (fSentRaw) {
+                        // Nothing left to send
+                    } else if (inv.type == MSG_BLOCK)
                         connman.PushMessage(pfrom, msgMaker.Make(SERIALIZE_TRANSACTION_NO_WITNESS, NetMsgType::BLOCK, block));
                     else if (inv.type == MSG_WITNESS_BLOCK)
                         connman.PushMessage(pfrom, msgMaker.Make(NetMsgType::BLOCK, block));
@@ -1367,15 +1546,34 @@ bool static ProcessMessage(CNode* pfrom, string strCommand, CDataStream& vRecv,
         if (pfrom->fWhitelisted && GetBoolArg("-whitelistrelay", DEFAULT_WHITELISTRELAY))
             fBlocksOnly = false;
 
+        // Bookkeeping that does not need cs_main: remember what the peer
+        // announced, and drop transaction announcements in blocks only mode.
+        std::vector<CInv> vInvToCheck;
+        vInvToCheck.reserve(vInv.size());
+        BOOST_FOREACH(const CInv& inv, vInv)
+        {
+            if (inv.type != MSG_BLOCK) {
+                pfrom->AddInventoryKnown(inv);
+                if (fBlocksOnly) {
+                    LogPrint("net", "transaction (%s) inv sent in violation of protocol peer=%d\n", inv.hash.ToString(), pfrom->id);
+                    GetMainSignals().Inventory(inv.hash);
+                    continue;
+                }
+            }
+            vInvToCheck.push_back(inv);
+        }
+        if (vInvToCheck.empty())
+            return true;
+
         LOCK(cs_main);
 
         uint32_t nFetchFlags = GetFetchFlags(pfrom, chainActive.Tip(), chainparams.GetConsensus());
 
         std::vector<CInv> vToFetch;
 
-        for (unsigned int nInv = 0; nInv < vInv.size(); nInv++)
+        for (unsigned int nInv = 0; nInv < vInvToCheck.size(); nInv++)
         {
-            CInv &inv = vInv[nInv];
+            CInv &inv = vInvToCheck[nInv];
 
             boost::this_thread::interruption_point();
 
@@ -1400,10 +1598,7 @@ bool static ProcessMessage(CNode* pfrom, string strCommand, CDataStream& vRecv,
             }
             else
             {
-                pfrom->AddInventoryKnown(inv);
-                if (fBlocksOnly)
-                    LogPrint("net", "transaction (%s) inv sent in violation of protocol peer=%d\n", inv.hash.ToString(), pfrom->id);
-                else if (!fAlreadyHave && !fImporting && !fReindex && !IsInitialBlockDownload())
+                if (!fAlreadyHave && !fImporting && !fReindex && !IsInitialBlockDownload())
                     pfrom->AskFor(inv);
             }
 
@@ -1495,6 +1690,16 @@ bool static ProcessMessage(CNode* pfrom, string strCommand, CDataStream& vRecv,
         LOCK(cs_main);
 
         BlockMap::iterator it = mapBlockIndex.find(req.blockhash);
+        if (it != mapBlockIndex.end() && !(it->second->nStatus & BLOCK_HAVE_DATA) && req.blockhash == hashFastRelayBlock) {
+            // We forwarded the compact block before having the block; answer
+            // once we have it (one request per peer).
+            for (const std::pair<NodeId, BlockTransactionsRequest>& request : vFastRelayBlockTxnRequests) {
+                if (request.first == pfrom->GetId())
+                    return true;
+            }
+            vFastRelayBlockTxnRequests.emplace_back(pfrom->GetId(), req);
+            return true;
+        }
         if (it == mapBlockIndex.end() || !(it->second->nStatus & BLOCK_HAVE_DATA)) {
             LogPrintf("Peer %d sent us a getblocktxn for a block we don't have", pfrom->id);
             return true;
@@ -1521,17 +1726,7 @@ bool static ProcessMessage(CNode* pfrom, string strCommand, CDataStream& vRecv,
         bool ret = ReadBlockFromDisk(block, it->second, chainparams.GetConsensus());
         assert(ret);
 
-        BlockTransactions resp(req);
-        for (size_t i = 0; i < req.indexes.size(); i++) {
-            if (req.indexes[i] >= block.vtx.size()) {
-                Misbehaving(pfrom->GetId(), 100);
-                LogPrintf("Peer %d sent us a getblocktxn with out-of-bounds tx indices", pfrom->id);
-                return true;
-            }
-            resp.txn[i] = block.vtx[req.indexes[i]];
-        }
-        int nSendFlags = State(pfrom->GetId())->fWantsCmpctWitness ? 0 : SERIALIZE_TRANSACTION_NO_WITNESS;
-        connman.PushMessage(pfrom, msgMaker.Make(nSendFlags, NetMsgType::BLOCKTXN, resp));
+        SendBlockTransactions(block, req, pfrom, connman);
     }
 
 
@@ -1596,20 +1791,35 @@ bool static ProcessMessage(CNode* pfrom, string strCommand, CDataStream& vRecv,
 
         deque<COutPoint> vWorkQueue;
         vector<uint256> vEraseQueue;
-        CTransaction tx(deserialize, vRecv);
+        CTransactionRef ptx;
+        vRecv >> ptx;
+        const CTransaction& tx = *ptx;
 
         CInv inv(MSG_TX, tx.GetHash());
         pfrom->AddInventoryKnown(inv);
 
+        // Verify the scripts while other threads can use cs_main, so that
+        // AcceptToMemoryPool finds the signatures cached. A transaction with
+        // an invalid script is rejected right away.
+        CValidationState state;
+        bool fAlreadyHave;
+        {
+            LOCK(cs_main);
+            fAlreadyHave = AlreadyHave(inv);
+        }
+        if (!fAlreadyHave)
+            PreVerifyTransactionScripts(mempool, tx, state);
+
         LOCK(cs_main);
 
         bool fMissingInputs = false;
-        CValidationState state;
 
         pfrom->setAskFor.erase(inv.hash);
         mapAlreadyAskedFor.erase(inv.hash);
 
-        if (!AlreadyHave(inv) && AcceptToMemoryPool(mempool, state, tx, true, &fMissingInputs)) {
+        std::list<CTransactionRef> lRemovedTxn;
+
+        if (!AlreadyHave(inv) && !state.IsInvalid() && AcceptToMemoryPool(mempool, state, tx, true, &fMissingInputs, false, 0, &lRemovedTxn)) {
             mempool.check(pcoinsTip);
             RelayTransaction(tx, connman);
             for (unsigned int i = 0; i < tx.vout.size(); i++) {
@@ -1646,7 +1856,7 @@ bool static ProcessMessage(CNode* pfrom, string strCommand, CDataStream& vRecv,
 
                     if (setMisbehaving.count(fromPeer))
                         continue;
-                    if (AcceptToMemoryPool(mempool, stateDummy, orphanTx, true, &fMissingInputs2)) {
+                    if (AcceptToMemoryPool(mempool, stateDummy, orphanTx, true, &fMissingInputs2, false, 0, &lRemovedTxn)) {
                         LogPrint("mempool", "   accepted orphan tx %s\n", orphanHash.ToString());
                         RelayTransaction(orphanTx, connman);
                         for (unsigned int i = 0; i < orphanTx.vout.size(); i++) {
@@ -1699,7 +1909,8 @@ bool static ProcessMessage(CNode* pfrom, string strCommand, CDataStream& vRecv,
                     pfrom->AddInventoryKnown(_inv);
                     if (!AlreadyHave(_inv)) pfrom->AskFor(_inv);
                 }
-                AddOrphanTx(tx, pfrom->GetId());
+                if (AddOrphanTx(tx, pfrom->GetId()))
+                    AddToCompactExtraTransactions(ptx);
 
                 // DoS prevention: do not allow mapOrphanTransactions to grow unbounded
                 unsigned int nMaxOrphanTx = (unsigned int)std::max((int64_t)0, GetArg("-maxorphantx", DEFAULT_MAX_ORPHAN_TRANSACTIONS));
@@ -1716,6 +1927,9 @@ bool static ProcessMessage(CNode* pfrom, string strCommand, CDataStream& vRecv,
                 // See https://github.com/bitcoin/bitcoin/issues/8279 for details.
                 assert(recentRejects);
                 recentRejects->insert(tx.GetHash());
+                // It may still be mined, e.g. if it was only below our fee
+                // rate, and can then fill in a compact block.
+                AddToCompactExtraTransactions(ptx);
             }
 
             if (pfrom->fWhitelisted && GetBoolArg("-whitelistforcerelay", DEFAULT_WHITELISTFORCERELAY)) {
@@ -1736,6 +1950,10 @@ bool static ProcessMessage(CNode* pfrom, string strCommand, CDataStream& vRecv,
                 }
             }
         }
+
+        for (const CTransactionRef& removedTx : lRemovedTxn)
+            AddToCompactExtraTransactions(removedTx);
+
         int nDoS = 0;
         if (state.IsInvalid(nDoS))
         {
@@ -1830,7 +2048,7 @@ bool static ProcessMessage(CNode* pfrom, string strCommand, CDataStream& vRecv,
                 list<QueuedBlock>::iterator *queuedBlockIt = NULL;
                 if (!MarkBlockAsInFlight(pfrom->GetId(), pindex->GetBlockHash(), chainparams.GetConsensus(), pindex, &queuedBlockIt)) {
                     if (!(*queuedBlockIt)->partialBlock)
-                        (*queuedBlockIt)->partialBlock.reset(new PartiallyDownloadedBlock(&mempool));
+                        (*queuedBlockIt)->partialBlock.reset(new PartiallyDownloadedBlock(&mempool, &blockReconstruction));
                     else {
                         // The block was already in flight using compact blocks from the same peer
                         LogPrint("net", "Peer sent us compact block we were already syncing!\n");
@@ -1853,6 +2071,8 @@ bool static ProcessMessage(CNode* pfrom, string strCommand, CDataStream& vRecv,
                     return true;
                 }
 
+                FastRelayCompactBlock(pfrom, pindex, cmpctblock, connman);
+
                 if (!fAlreadyInFlight && mapBlocksInFlight.size() == 1 && pindex->pprev->IsValid(BLOCK_VALID_CHAIN)) {
                     // We seem to be rather well-synced, so it appears pfrom was the first to provide us
                     // with this block! Let's get them to announce using compact blocks in the future.
@@ -1881,12 +2101,13 @@ bool static ProcessMessage(CNode* pfrom, string strCommand, CDataStream& vRecv,
                 // download from.
                 // Optimistically try to reconstruct anyway since we might be
                 // able to without any round trips.
-                PartiallyDownloadedBlock tempBlock(&mempool);
+                PartiallyDownloadedBlock tempBlock(&mempool, &blockReconstruction);
                 ReadStatus status = tempBlock.InitData(cmpctblock);
                 if (status != READ_STATUS_OK) {
                     // TODO: don't ignore failures
                     return true;
                 }
+                FastRelayCompactBlock(pfrom, pindex, cmpctblock, connman);
                 std::vector<CTransactionRef> dummy;
                 status = tempBlock.FillBlock(*pblock, dummy);
                 if (status == READ_STATUS_OK) {
@@ -2205,7 +2426,10 @@ bool static ProcessMessage(CNode* pfrom, string strCommand, CDataStream& vRecv,
         }
         pfrom->fSentAddr = true;
 
-        pfrom->vAddrToSend.clear();
+        {
+            LOCK(pfrom->cs_vAddrToSend);
+            pfrom->vAddrToSend.clear();
+        }
         vector<CAddress> vAddr = connman.GetAddresses();
         FastRandomContext insecure_rand;
         BOOST_FOREACH(const CAddress &addr, vAddr)
@@ -2567,9 +2791,38 @@ public:
     }
 };
 
+class CompareInvRank
+{
+public:
+    bool operator()(const std::pair<uint32_t, std::set<uint256>::iterator>& a, const std::pair<uint32_t, std::set<uint256>::iterator>& b)
+    {
+        // Max-heap again, so the lowest rank goes first
+        return a.first > b.first;
+    }
+};
+
+/** Adds a SendMessages call to the relay statistics when it returns */
+class CSendMessagesTimer
+{
+public:
+    int64_t nStart;
+    int64_t nMainLocked;
+    int64_t nInventoryTime;
+    unsigned int nAnnounced;
+
+    CSendMessagesTimer() : nStart(GetTimeMicros()), nMainLocked(0), nInventoryTime(0), nAnnounced(0) {}
+
+    ~CSendMessagesTimer()
+    {
+        int64_t nEnd = GetTimeMicros();
+        txRelayScheduler.RecordSendMessages(nEnd - nStart, nMainLocked ? nEnd - nMainLocked : 0, nInventoryTime, nAnnounced);
+    }
+};
+
 bool SendMessages(CNode* pto, CConnman& connman)
 {
     const Consensus::Params& consensusParams = Params().GetConsensus();
+    CSendMessagesTimer timer;
     {
         // Don't send anything until we get its version message
         if (pto->nVersion == 0 || pto->fDisconnect)
@@ -2610,6 +2863,7 @@ bool SendMessages(CNode* pto, CConnman& connman)
         TRY_LOCK(cs_main, lockMain); // Acquire cs_main for IsInitialBlockDownload() and CNodeState()
         if (!lockMain)
             return true;
+        timer.nMainLocked = GetTimeMicros();
 
         CNodeState &state = *State(pto->GetId());
 
@@ -2644,6 +2898,7 @@ bool SendMessages(CNode* pto, CConnman& connman)
         // Message: addr
         //
         if (pto->nNextAddrSend < nNow) {
+            LOCK(pto->cs_vAddrToSend);
             pto->nNextAddrSend = PoissonNextSend(nNow, AVG_ADDRESS_BROADCAST_INTERVAL);
             vector<CAddress> vAddr;
             vAddr.reserve(pto->vAddrToSend.size());
@@ -2830,6 +3085,7 @@ bool SendMessages(CNode* pto, CConnman& connman)
         // Message: inventory
         //
         vector<CInv> vInv;
+        int64_t nInventoryStart = GetTimeMicros();
         {
             LOCK(pto->cs_inventory);
             vInv.reserve(std::max<size_t>(pto->vInventoryBlockToSend.size(), INVENTORY_BROADCAST_MAX));
@@ -2893,30 +3149,51 @@ bool SendMessages(CNode* pto, CConnman& connman)
 
             // Determine transactions to relay
             if (fSendTrickle) {
-                // Produce a vector with all candidates for sending
+                // Topologically and fee-rate sort the inventory we send for privacy and priority reasons.
+                // Transactions in the shared announcement order already have
+                // their place in it; only the others (relayed since it was
+                // built, or long ago) are sorted through mempool lookups.
+                std::shared_ptr<const CTxRelaySnapshot> schedule = txRelayScheduler.GetSnapshot(mempool, nNow);
+                vector<std::pair<uint32_t, std::set<uint256>::iterator> > vRankedTx;
                 vector<std::set<uint256>::iterator> vInvTx;
-                vInvTx.reserve(pto->setInventoryTxToSend.size());
+                vRankedTx.reserve(pto->setInventoryTxToSend.size());
                 for (std::set<uint256>::iterator it = pto->setInventoryTxToSend.begin(); it != pto->setInventoryTxToSend.end(); it++) {
-                    vInvTx.push_back(it);
+                    uint32_t nRank;
+                    if (schedule->Find(*it, nRank)) {
+                        vRankedTx.push_back(std::make_pair(nRank, it));
+                    } else {
+                        vInvTx.push_back(it);
+                    }
                 }
                 CAmount filterrate = 0;
                 {
                     LOCK(pto->cs_feeFilter);
                     filterrate = pto->minFeeFilter;
                 }
-                // Topologically and fee-rate sort the inventory we send for privacy and priority reasons.
-                // A heap is used so that not all items need sorting if only a few are being sent.
+                // Heaps are used so that not all items need sorting if only a few are being sent.
+                CompareInvRank compareInvRank;
+                std::make_heap(vRankedTx.begin(), vRankedTx.end(), compareInvRank);
                 CompareInvMempoolOrder compareInvMempoolOrder(&mempool);
                 std::make_heap(vInvTx.begin(), vInvTx.end(), compareInvMempoolOrder);
                 // No reason to drain out at many times the network's capacity,
                 // especially since we have many peers and some will draw much shorter delays.
                 unsigned int nRelayedTransactions = 0;
                 LOCK(pto->cs_filter);
-                while (!vInvTx.empty() && nRelayedTransactions < INVENTORY_BROADCAST_MAX) {
-                    // Fetch the top element from the heap
-                    std::pop_heap(vInvTx.begin(), vInvTx.end(), compareInvMempoolOrder);
-                    std::set<uint256>::iterator it = vInvTx.back();
-                    vInvTx.pop_back();
+                while ((!vRankedTx.empty() || !vInvTx.empty()) && nRelayedTransactions < INVENTORY_BROADCAST_MAX) {
+                    // Fetch the top element from the heaps
+                    std::set<uint256>::iterator it;
+                    TxMempoolInfo txinfo;
+                    bool fRanked = vInvTx.empty() || (!vRankedTx.empty() && !compareInvMempoolOrder(vRankedTx.front().second, vInvTx.front()));
+                    if (fRanked) {
+                        std::pop_heap(vRankedTx.begin(), vRankedTx.end(), compareInvRank);
+                        it = vRankedTx.back().second;
+                        txinfo = schedule->vInfo[vRankedTx.back().first];
+                        vRankedTx.pop_back();
+                    } else {
+                        std::pop_heap(vInvTx.begin(), vInvTx.end(), compareInvMempoolOrder);
+                        it = vInvTx.back();
+                        vInvTx.pop_back();
+                    }
                     uint256 hash = *it;
                     // Remove it from the to-be-sent set
                     pto->setInventoryTxToSend.erase(it);
@@ -2925,9 +3202,17 @@ bool SendMessages(CNode* pto, CConnman& connman)
                         continue;
                     }
                     // Not in the mempool anymore? don't bother sending it.
-                    auto txinfo = mempool.info(hash);
-                    if (!txinfo.tx) {
-                        continue;
+                    // Scheduled transactions come with the info they had when
+                    // the order was built, but may have left the mempool since.
+                    if (txinfo.tx) {
+                        if (!mempool.exists(hash)) {
+                            continue;
+                        }
+                    } else {
+                        txinfo = mempool.info(hash);
+                        if (!txinfo.tx) {
+                            continue;
+                        }
                     }
                     if (filterrate && txinfo.feeRate.GetFeePerK() < filterrate) {
                         continue;
@@ -2955,10 +3240,12 @@ bool SendMessages(CNode* pto, CConnman& connman)
                     }
                     pto->filterInventoryKnown.insert(hash);
                 }
+                timer.nAnnounced = nRelayedTransactions;
             }
         }
         if (!vInv.empty())
             connman.PushMessage(pto, msgMaker.Make(NetMsgType::INV, vInv));
+        timer.nInventoryTime = GetTimeMicros() - nInventoryStart;
 
         // Detect whether we're stalling
         nNow = GetTimeMicros();
@@ -9,6 +9,8 @@
 #include "net.h"
 #include "validationinterface.h"
 
+struct CTxRelayStats;
+
 /** Register with a network node to receive its signals */
 void RegisterNodeSignals(CNodeSignals& nodeSignals);
 /** Unregister a network node */
@@ -24,6 +26,7 @@ public:
     virtual void SyncTransaction(const CTransaction& tx, const CBlockIndex* pindex, int nPosInBlock);
     virtual void UpdatedBlockTip(const CBlockIndex *pindexNew, const CBlockIndex *pindexFork, bool fInitialDownload);
     virtual void BlockChecked(const CBlock& block, const CValidationState& state);
+    virtual void NewPoWValidBlock(const CBlockIndex *pindex, const CBlock& block);
 };
 
 struct CNodeStateStats {
@@ -35,10 +38,18 @@ struct CNodeStateStats {
 
 /** Get statistics from node state */
 bool GetNodeStateStats(NodeId nodeid, CNodeStateStats &stats);
+/** Get statistics on transaction announcements and SendMessages */
+void GetTxRelayStats(CTxRelayStats &stats);
 /** Increase a node's misbehavior score. */
 void Misbehaving(NodeId nodeid, int howmuch);
 
-/** Process protocol messages received from a given node */
+/**
+ * Process protocol messages received from a given node.
+ *
+ * Message handler threads may call this (and SendMessages) for different
+ * nodes concurrently, but never for the same node at once. Anything shared
+ * between nodes must be protected by cs_main or a lock of its own.
+ */
 bool ProcessMessages(CNode* pfrom, CConnman& connman);
 /**
  * Send queued protocol messages to be sent to a give node.
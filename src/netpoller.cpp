@@ -0,0 +1,227 @@
+// Copyright (c) 2017 The Bitcoin Core developers
+// Distributed under the MIT software license, see the accompanying
+// file COPYING or http://www.opensource.org/licenses/mit-license.php.
+
+#include "netpoller.h"
+
+#include "netbase.h"
+
+#include <algorithm>
+
+#ifdef HAVE_EPOLL
+#include <sys/epoll.h>
+#endif
+
+#ifdef HAVE_EPOLL
+const char * const DEFAULT_SOCKETEVENTS = "epoll";
+#else
+const char * const DEFAULT_SOCKETEVENTS = "select";
+#endif
+
+int CSelectPoller::Wait(std::vector<PolledSocket>& sockets, int64_t nTimeoutMs)
+{
+    struct timeval timeout = MillisToTimeval(nTimeoutMs);
+
+    fd_set fdsetRecv;
+    fd_set fdsetSend;
+    fd_set fdsetError;
+    FD_ZERO(&fdsetRecv);
+    FD_ZERO(&fdsetSend);
+    FD_ZERO(&fdsetError);
+    SOCKET hSocketMax = 0;
+    bool have_fds = false;
+
+    for (std::vector<PolledSocket>::iterator it = sockets.begin(); it != sockets.end(); ++it) {
+        it->ready = 0;
+        if (it->requested & SOCKET_EVENT_RECV)
+            FD_SET(it->socket, &fdsetRecv);
+        if (it->requested & SOCKET_EVENT_SEND)
+            FD_SET(it->socket, &fdsetSend);
+        if (it->requested & SOCKET_EVENT_ERR)
+            FD_SET(it->socket, &fdsetError);
+        hSocketMax = std::max(hSocketMax, it->socket);
+        have_fds = true;
+    }
+
+    int nSelect = select(have_fds ? hSocketMax + 1 : 0, &fdsetRecv, &fdsetSend, &fdsetError, &timeout);
+    if (nSelect <= 0)
+        return nSelect;
+
+    int nReady = 0;
+    for (std::vector<PolledSocket>::iterator it = sockets.begin(); it != sockets.end(); ++it) {
+        if ((it->requested & SOCKET_EVENT_RECV) && FD_ISSET(it->socket, &fdsetRecv))
+            it->ready |= SOCKET_EVENT_RECV;
+        if ((it->requested & SOCKET_EVENT_SEND) && FD_ISSET(it->socket, &fdsetSend))
+            it->ready |= SOCKET_EVENT_SEND;
+        if ((it->requested & SOCKET_EVENT_ERR) && FD_ISSET(it->socket, &fdsetError))
+            it->ready |= SOCKET_EVENT_ERR;
+        if (it->ready)
+            nReady++;
+    }
+    return nReady;
+}
+
+#ifdef HAVE_EPOLL
+std::unique_ptr<CEpollPoller> CEpollPoller::Create()
+{
+    int fd = epoll_create1(EPOLL_CLOEXEC);
+    if (fd < 0)
+        return nullptr;
+    return std::unique_ptr<CEpollPoller>(new CEpollPoller(fd));
+}
+
+CEpollPoller::~CEpollPoller()
+{
+    close(epollfd);
+}
+
+/** Upper bound on the events one epoll_wait call returns; the rest wait for the next call */
+static const int MAX_EPOLL_EVENTS = 256;
+
+bool CEpollPoller::Update(int op, SOCKET s, int requested)
+{
+    struct epoll_event event;
+    event.events = 0;
+    if (requested & SOCKET_EVENT_RECV)
+        event.events |= EPOLLIN;
+    if (requested & SOCKET_EVENT_SEND)
+        event.events |= EPOLLOUT;
+    // EPOLLERR and EPOLLHUP are always reported
+    event.data.u64 = 0;
+    event.data.fd = s;
+    return epoll_ctl(epollfd, op, s, &event) == 0;
+}
+
+int CEpollPoller::Wait(std::vector<PolledSocket>& sockets, int64_t nTimeoutMs)
+{
+    nGeneration++;
+    int nFailed = 0;
+
+    // Bring the interest list in line with this request. Only sockets that are
+    // new, changed owner, or want different events cost a system call. A socket
+    // that cannot be registered is reported as failed straight away, so that
+    // the caller runs into the error on its next operation on it.
+    for (size_t i = 0; i < sockets.size(); i++) {
+        PolledSocket& ps = sockets[i];
+        ps.ready = 0;
+        std::unordered_map<SOCKET, Registration>::iterator it = mapRegistered.find(ps.socket);
+        if (it == mapRegistered.end()) {
+            if (!Update(EPOLL_CTL_ADD, ps.socket, ps.requested)) {
+                ps.ready = SOCKET_EVENT_ERR;
+                nFailed++;
+                continue;
+            }
+            Registration reg = {ps.owner, ps.requested, i, nGeneration};
+            mapRegistered.emplace(ps.socket, reg);
+            continue;
+        }
+        Registration& reg = it->second;
+        bool fOk = true;
+        if (reg.owner != ps.owner) {
+            // The descriptor was closed and reused. Closing already dropped the
+            // old socket from the interest list, unless it was duplicated.
+            epoll_ctl(epollfd, EPOLL_CTL_DEL, ps.socket, NULL);
+            fOk = Update(EPOLL_CTL_ADD, ps.socket, ps.requested);
+        } else if (reg.requested != ps.requested) {
+            fOk = Update(EPOLL_CTL_MOD, ps.socket, ps.requested) ||
+                  (errno == ENOENT && Update(EPOLL_CTL_ADD, ps.socket, ps.requested));
+        }
+        if (!fOk) {
+            ps.ready = SOCKET_EVENT_ERR;
+            nFailed++;
+            mapRegistered.erase(it);
+            continue;
+        }
+        reg.owner = ps.owner;
+        reg.requested = ps.requested;
+        reg.index = i;
+        reg.generation = nGeneration;
+    }
+
+    // Forget sockets that are no longer of interest. Most of them are closed
+    // already, in which case the kernel has forgotten them too.
+    for (std::unordered_map<SOCKET, Registration>::iterator it = mapRegistered.begin(); it != mapRegistered.end(); ) {
+        if (it->second.generation != nGeneration) {
+            epoll_ctl(epollfd, EPOLL_CTL_DEL, it->first, NULL);
+            it = mapRegistered.erase(it);
+        } else {
+            ++it;
+        }
+    }
+
+    std::vector<struct epoll_event> events(std::max<size_t>(sockets.size(), 1));
+    int nEvents = epoll_wait(epollfd, events.data(), events.size(), nFailed ? 0 : nTimeoutMs);
+    if (nEvents < 0) {
+        if (errno != EINTR)
+            return SOCKET_ERROR;
+        nEvents = 0;
+    }
+
+    for (int i = 0; i < nEvents; i++) {
+        std::unordered_map<SOCKET, Registration>::const_iterator it = mapRegistered.find(events[i].data.fd);
+        if (it == mapRegistered.end())
+            continue;
+        PolledSocket& ps = sockets[it->second.index];
+        if (events[i].events & EPOLLIN)
+            ps.ready |= SOCKET_EVENT_RECV;
+        if (events[i].events & EPOLLOUT)
+            ps.ready |= SOCKET_EVENT_SEND;
+        if (events[i].events & (EPOLLERR | EPOLLHUP))
+            ps.ready |= SOCKET_EVENT_ERR;
+    }
+    return nEvents + nFailed;
+}
+
+bool CEpollPoller::Register(SOCKET s, int64_t owner, int requested, bool fEdgeTriggered)
+{
+    struct epoll_event event;
+    event.events = fEdgeTriggered ? EPOLLET : 0;
+    if (requested & SOCKET_EVENT_RECV)
+        event.events |= EPOLLIN;
+    if (requested & SOCKET_EVENT_SEND)
+        event.events |= EPOLLOUT;
+    event.data.u64 = owner;
+    return epoll_ctl(epollfd, EPOLL_CTL_ADD, s, &event) == 0;
+}
+
+int CEpollPoller::WaitEvents(std::vector<SocketEvent>& events, int64_t nTimeoutMs)
+{
+    events.clear();
+    struct epoll_event vEvents[MAX_EPOLL_EVENTS];
+    int nEvents = epoll_wait(epollfd, vEvents, MAX_EPOLL_EVENTS, nTimeoutMs);
+    if (nEvents < 0)
+        return errno == EINTR ? 0 : SOCKET_ERROR;
+
+    for (int i = 0; i < nEvents; i++) {
+        int ready = 0;
+        if (vEvents[i].events & EPOLLIN)
+            ready |= SOCKET_EVENT_RECV;
+        if (vEvents[i].events & EPOLLOUT)
+            ready |= SOCKET_EVENT_SEND;
+        if (vEvents[i].events & (EPOLLERR | EPOLLHUP))
+            ready |= SOCKET_EVENT_ERR;
+        events.push_back(SocketEvent(vEvents[i].data.u64, ready));
+    }
+    return nEvents;
+}
+#endif
+
+std::string GetSocketEventsModes()
+{
+    std::string strModes = "select";
+#ifdef HAVE_EPOLL
+    strModes += ", epoll";
+#endif
+    return strModes;
+}
+
+std::unique_ptr<CSocketPoller> CreateSocketPoller(const std::string& mode)
+{
+    if (mode == "select")
+        return std::unique_ptr<CSocketPoller>(new CSelectPoller());
+#ifdef HAVE_EPOLL
+    if (mode == "epoll")
+        return CEpollPoller::Create();
+#endif
+    return nullptr;
+}
@@ -0,0 +1,160 @@
+// Copyright (c) 2017 The Bitcoin Core developers
+// Distributed under the MIT software license, see the accompanying
+// file COPYING or http://www.opensource.org/licenses/mit-license.php.
+
+#ifndef BITCOIN_NETPOLLER_H
+#define BITCOIN_NETPOLLER_H
+
+#if defined(HAVE_CONFIG_H)
+#include "config/bitcoin-config.h"
+#endif
+
+#include "compat.h"
+
+#include <memory>
+#include <string>
+#include <unordered_map>
+#include <vector>
+
+#include <stdint.h>
+
+/** Event flags for PolledSocket::requested and PolledSocket::ready */
+enum SocketEventFlags
+{
+    SOCKET_EVENT_RECV = (1U << 0),
+    SOCKET_EVENT_SEND = (1U << 1),
+    SOCKET_EVENT_ERR  = (1U << 2),
+};
+
+/** A socket to wait on, what to wait for, and (after the wait) what happened. */
+struct PolledSocket
+{
+    SOCKET socket;
+    /**
+     * Identifies the owner of the socket (the node id for peers). Backends that
+     * keep state between waits use it to tell a reused descriptor number apart
+     * from the closed socket that had it before.
+     */
+    int64_t owner;
+    int requested;
+    int ready;
+
+    PolledSocket(SOCKET socketIn, int64_t ownerIn, int requestedIn) : socket(socketIn), owner(ownerIn), requested(requestedIn), ready(0) {}
+};
+
+/** Events on a registered socket, as reported by CSocketPoller::WaitEvents */
+struct SocketEvent
+{
+    int64_t owner;
+    int ready;
+
+    SocketEvent(int64_t ownerIn, int readyIn) : owner(ownerIn), ready(readyIn) {}
+};
+
+/**
+ * Waits for readiness on a group of sockets. This is what
+ * CConnman::ThreadSocketHandler sleeps in; the backend is selected with
+ * -socketevents.
+ */
+class CSocketPoller
+{
+public:
+    virtual ~CSocketPoller() {}
+
+    /** Name of the backend, as accepted by -socketevents */
+    virtual const char* GetName() const = 0;
+
+    /** Whether this backend can wait on the given socket at all */
+    virtual bool IsSelectable(SOCKET s) const = 0;
+
+    /**
+     * Wait up to nTimeoutMs milliseconds for any of the requested events and
+     * fill in the ready flags of every entry. An empty list just sleeps.
+     * Returns the number of entries with events, or SOCKET_ERROR.
+     */
+    virtual int Wait(std::vector<PolledSocket>& sockets, int64_t nTimeoutMs) = 0;
+
+    /**
+     * Whether this backend can also be driven by registration instead of Wait:
+     * every socket is registered once, and WaitEvents only reports the sockets
+     * that have events, so a wakeup costs nothing per idle socket. A poller
+     * is used either way, not both.
+     */
+    virtual bool CanRegister() const { return false; }
+
+    /**
+     * Register a socket for the requested events. A level-triggered socket is
+     * reported for as long as the events are pending; an edge-triggered one
+     * only when they newly occur, so the caller has to keep track of sockets
+     * it did not exhaust. Closing the socket unregisters it.
+     */
+    virtual bool Register(SOCKET s, int64_t owner, int requested, bool fEdgeTriggered) { return false; }
+
+    /**
+     * Wait up to nTimeoutMs milliseconds for events on registered sockets and
+     * replace the contents of events with them. Returns the number of events,
+     * or SOCKET_ERROR.
+     */
+    virtual int WaitEvents(std::vector<SocketEvent>& events, int64_t nTimeoutMs) { return SOCKET_ERROR; }
+};
+
+/** select() backend. Available everywhere, but limited to FD_SETSIZE descriptors. */
+class CSelectPoller : public CSocketPoller
+{
+public:
+    const char* GetName() const { return "select"; }
+    bool IsSelectable(SOCKET s) const { return IsSelectableSocket(s); }
+    int Wait(std::vector<PolledSocket>& sockets, int64_t nTimeoutMs);
+};
+
+#ifdef HAVE_EPOLL
+/**
+ * epoll backend (Linux). With Wait, the kernel interest list is kept in sync
+ * with the requested events, so a wait only issues epoll_ctl calls for sockets
+ * whose interest changed; it still walks the list it is given. Registered
+ * sockets cost nothing until they have events.
+ */
+class CEpollPoller : public CSocketPoller
+{
+private:
+    struct Registration
+    {
+        int64_t owner;
+        int requested;
+        size_t index;
+        uint64_t generation;
+    };
+
+    int epollfd;
+    uint64_t nGeneration;
+    std::unordered_map<SOCKET, Registration> mapRegistered;
+
+    CEpollPoller(int epollfdIn) : epollfd(epollfdIn), nGeneration(0) {}
+    bool Update(int op, SOCKET s, int requested);
+
+public:
+    ~CEpollPoller();
+
+    /** Returns nullptr if the kernel refuses to create an epoll instance. */
+    static std::unique_ptr<CEpollPoller> Create();
+
+    const char* GetName() const { return "epoll"; }
+    bool IsSelectable(SOCKET s) const { return true; }
+    int Wait(std::vector<PolledSocket>& sockets, int64_t nTimeoutMs);
+
+    bool CanRegister() const { return true; }
+    bool Register(SOCKET s, int64_t owner, int requested, bool fEdgeTriggered);
+    int WaitEvents(std::vector<SocketEvent>& events, int64_t nTimeoutMs);
+};
+#endif
+
+/** The best backend compiled in */
+extern const char * const DEFAULT_SOCKETEVENTS;
+
+/** Comma-separated list of the modes -socketevents accepts */
+std::string GetSocketEventsModes();
+
+/** Create the backend for a -socketevents mode, or nullptr if it is unknown or unavailable. */
+std::unique_ptr<CSocketPoller> CreateSocketPoller(const std::string& mode);
+
+#endif // BITCOIN_NETPOLLER_H
@@ -68,8 +68,7 @@ int ClientModel::getNumConnections(unsigned int flags) const
 
 int ClientModel::getNumBlocks() const
 {
-    LOCK(cs_main);
-    return chainActive.Height();
+    return chainActive.HeightUnlocked();
 }
 
 int ClientModel::getHeaderTipHeight() const
@@ -104,10 +103,9 @@ quint64 ClientModel::getTotalBytesSent() const
 
 QDateTime ClientModel::getLastBlockDate() const
 {
-    LOCK(cs_main);
-
-    if (chainActive.Tip())
-        return QDateTime::fromTime_t(chainActive.Tip()->GetBlockTime());
+    const CBlockIndex *tip = chainActive.TipUnlocked();
+    if (tip)
+        return QDateTime::fromTime_t(tip->GetBlockTime());
 
     return QDateTime::fromTime_t(Params().GenesisBlock().GetBlockTime()); // Genesis block's time of current network
 }
@@ -126,10 +124,7 @@ double ClientModel::getVerificationProgress(const CBlockIndex *tipIn) const
 {
     CBlockIndex *tip = const_cast<CBlockIndex *>(tipIn);
     if (!tip)
-    {
-        LOCK(cs_main);
-        tip = chainActive.Tip();
-    }
+        tip = chainActive.TipUnlocked();
     return Checkpoints::GuessVerificationProgress(Params().Checkpoints(), tip);
 }
 
@@ -3,6 +3,8 @@
 // Distributed under the MIT software license, see the accompanying
 // file COPYING or http://www.opensource.org/licenses/mit-license.php.
 
+#include "addressindex.h"
+#include "blockmap.h"
 #include "chain.h"
 #include "chainparams.h"
 #include "primitives/block.h"
@@ -43,16 +45,19 @@ static const struct {
 };
 
 struct CCoin {
-    uint32_t nTxVer; // Don't call this nVersion, that name has a special meaning inside IMPLEMENT_SERIALIZE
     uint32_t nHeight;
     CTxOut out;
 
     ADD_SERIALIZE_METHODS;
 
+    CCoin() : nHeight(0) {}
+    CCoin(Coin&& in) : nHeight(in.nHeight), out(std::move(in.out)) {}
+
     template <typename Stream, typename Operation>
     inline void SerializationOp(Stream& s, Operation ser_action)
     {
-        READWRITE(nTxVer);
+        uint32_t nTxVerDummy = 0;
+        READWRITE(nTxVerDummy);
         READWRITE(nHeight);
         READWRITE(out);
     }
@@ -64,6 +69,9 @@ extern UniValue mempoolInfoToJSON();
 extern UniValue mempoolToJSON(bool fVerbose = false);
 extern void ScriptPubKeyToJSON(const CScript& scriptPubKey, UniValue& out, bool fIncludeHex);
 extern UniValue blockheaderToJSON(const CBlockIndex* blockindex);
+extern bool ParseAddressOrScript(const std::string& str, CScript& scriptPubKey);
+extern UniValue addressBalanceToJSON(const CScript& scriptPubKey, const CAddressBalance& balance);
+extern UniValue addressHistoryToJSON(const std::vector<CAddressHistoryEntry>& vEntries);
 
 static bool RESTERR(HTTPRequest* req, enum HTTPStatusCode status, string message)
 {
@@ -214,6 +222,7 @@ static bool rest_block(HTTPRequest* req,
         return RESTERR(req, HTTP_BAD_REQUEST, "Invalid hash: " + hashStr);
 
     CBlock block;
+    CRawBlock rawBlock;
     CBlockIndex* pblockindex = NULL;
     {
         LOCK(cs_main);
@@ -224,23 +233,26 @@ static bool rest_block(HTTPRequest* req,
         if (fHavePruned && !(pblockindex->nStatus & BLOCK_HAVE_DATA) && pblockindex->nTx > 0)
             return RESTERR(req, HTTP_NOT_FOUND, hashStr + " not available (pruned data)");
 
-        if (!ReadBlockFromDisk(block, pblockindex, Params().GetConsensus()))
+        // With witness data, the binary and hex forms are the block as stored on disk
+        bool fRaw = rf != RF_JSON && RPCSerializationFlags() == 0 && ReadRawBlockFromDisk(rawBlock, pblockindex, Params());
+        if (!fRaw && !ReadBlockFromDisk(block, pblockindex, Params().GetConsensus()))
             return RESTERR(req, HTTP_NOT_FOUND, hashStr + " not found");
     }
 
     CDataStream ssBlock(SER_NETWORK, PROTOCOL_VERSION | RPCSerializationFlags());
-    ssBlock << block;
+    if (rawBlock.empty())
+        ssBlock << block;
 
     switch (rf) {
     case RF_BINARY: {
-        string binaryBlock = ssBlock.str();
+        string binaryBlock = rawBlock.empty() ? ssBlock.str() : string(rawBlock.begin(), rawBlock.end());
         req->WriteHeader("Content-Type", "application/octet-stream");
         req->WriteReply(HTTP_OK, binaryBlock);
         return true;
     }
 
     case RF_HEX: {
-        string strHex = HexStr(ssBlock.begin(), ssBlock.end()) + "\n";
+        string strHex = (rawBlock.empty() ? HexStr(ssBlock.begin(), ssBlock.end()) : HexStr(rawBlock.begin(), rawBlock.end())) + "\n";
         req->WriteHeader("Content-Type", "text/plain");
         req->WriteReply(HTTP_OK, strHex);
         return true;
@@ -516,21 +528,10 @@ static bool rest_getutxos(HTTPRequest* req, const std::string& strURIPart)
             view.SetBackend(viewMempool); // switch cache backend to db+mempool in case user likes to query mempool
 
         for (size_t i = 0; i < vOutPoints.size(); i++) {
-            CCoins coins;
-            uint256 hash = vOutPoints[i].hash;
-            if (view.GetCoins(hash, coins)) {
-                mempool.pruneSpent(hash, coins);
-                if (coins.IsAvailable(vOutPoints[i].n)) {
-                    hits[i] = true;
-                    // Safe to index into vout here because IsAvailable checked if it's off the end of the array, or if
-                    // n is valid but points to an already spent output (IsNull).
-                    CCoin coin;
-                    coin.nTxVer = coins.nVersion;
-                    coin.nHeight = coins.nHeight;
-                    coin.out = coins.vout.at(vOutPoints[i].n);
-                    assert(!coin.out.IsNull());
-                    outs.push_back(coin);
-                }
+            Coin coin;
+            if (view.GetCoin(vOutPoints[i], coin) && !mempool.isSpent(vOutPoints[i])) {
+                hits[i] = true;
+                outs.emplace_back(std::move(coin));
             }
 
             bitmapStringRepresentation.append(hits[i] ? "1" : "0"); // form a binary string representation (human-readable for json output)
@@ -573,7 +574,6 @@ static bool rest_getutxos(HTTPRequest* req, const std::string& strURIPart)
         UniValue utxos(UniValue::VARR);
         BOOST_FOREACH (const CCoin& coin, outs) {
             UniValue utxo(UniValue::VOBJ);
-            utxo.push_back(Pair("txvers", (int32_t)coin.nTxVer));
             utxo.push_back(Pair("height", (int32_t)coin.nHeight));
             utxo.push_back(Pair("value", ValueFromAmount(coin.out.nValue)));
 
@@ -600,6 +600,95 @@ static bool rest_getutxos(HTTPRequest* req, const std::string& strURIPart)
     return true; // continue to process further HTTP reqs on this cxn
 }
 
+static bool rest_address_balance(HTTPRequest* req, const std::string& strURIPart)
+{
+    if (!CheckWarmup(req))
+        return false;
+    if (!paddressindex)
+        return RESTERR(req, HTTP_NOT_FOUND, "Addresses are not indexed; start with -addressindex");
+    std::string param;
+    const RetFormat rf = ParseDataFormat(param, strURIPart);
+
+    CScript scriptPubKey;
+    if (!ParseAddressOrScript(param, scriptPubKey))
+        return RESTERR(req, HTTP_BAD_REQUEST, "Invalid address or script: " + param);
+
+    const CBlockIndex* pindexBest;
+    CAddressBalance balance;
+    if (!paddressindex->GetBalance(GetScriptHash(scriptPubKey), balance, pindexBest))
+        return RESTERR(req, HTTP_INTERNAL_SERVER_ERROR, "Failed to read the address index");
+
+    switch (rf) {
+    case RF_JSON: {
+        UniValue ret = addressBalanceToJSON(scriptPubKey, balance);
+        ret.push_back(Pair("height", pindexBest ? pindexBest->nHeight : -1));
+        string strJSON = ret.write() + "\n";
+        req->WriteHeader("Content-Type", "application/json");
+        req->WriteReply(HTTP_OK, strJSON);
+        return true;
+    }
+    default: {
+        return RESTERR(req, HTTP_NOT_FOUND, "output format not found (available: json)");
+    }
+    }
+
+    // not reached
+    return true; // continue to process further HTTP reqs on this cxn
+}
+
+static bool rest_address_history(HTTPRequest* req, const std::string& strURIPart)
+{
+    if (!CheckWarmup(req))
+        return false;
+    if (!paddressindex)
+        return RESTERR(req, HTTP_NOT_FOUND, "Addresses are not indexed; start with -addressindex");
+    std::string param;
+    const RetFormat rf = ParseDataFormat(param, strURIPart);
+    vector<string> path;
+    boost::split(path, param, boost::is_any_of("/"));
+
+    if (path.size() != 3)
+        return RESTERR(req, HTTP_BAD_REQUEST, "No range specified. Use /rest/address/history/<skip>/<count>/<address>.<ext>.");
+
+    int64_t nSkip;
+    if (!ParseInt64(path[0], &nSkip) || nSkip < 0)
+        return RESTERR(req, HTTP_BAD_REQUEST, "Invalid skip: " + path[0]);
+    int64_t nCount;
+    if (!ParseInt64(path[1], &nCount) || nCount < 1 || nCount > MAX_ADDRESS_HISTORY_COUNT)
+        return RESTERR(req, HTTP_BAD_REQUEST, "Count out of range: " + path[1]);
+
+    CScript scriptPubKey;
+    if (!ParseAddressOrScript(path[2], scriptPubKey))
+        return RESTERR(req, HTTP_BAD_REQUEST, "Invalid address or script: " + path[2]);
+
+    const uint256 scriptHash = GetScriptHash(scriptPubKey);
+    const CBlockIndex* pindexBest;
+    CAddressBalance balance;
+    std::vector<CAddressHistoryEntry> vEntries;
+    if (!paddressindex->GetHistory(scriptHash, nSkip, nCount, balance, vEntries, pindexBest))
+        return RESTERR(req, HTTP_INTERNAL_SERVER_ERROR, "Failed to read the address index");
+
+    switch (rf) {
+    case RF_JSON: {
+        UniValue ret(UniValue::VOBJ);
+        ret.push_back(Pair("scripthash", scriptHash.GetHex()));
+        ret.push_back(Pair("entries", balance.nEntries));
+        ret.push_back(Pair("height", pindexBest ? pindexBest->nHeight : -1));
+        ret.push_back(Pair("history", addressHistoryToJSON(vEntries)));
+        string strJSON = ret.write() + "\n";
+        req->WriteHeader("Content-Type", "application/json");
+        req->WriteReply(HTTP_OK, strJSON);
+        return true;
+    }
+    default: {
+        return RESTERR(req, HTTP_NOT_FOUND, "output format not found (available: json)");
+    }
+    }
+
+    // not reached
+    return true; // continue to process further HTTP reqs on this cxn
+}
+
 static const struct {
     const char* prefix;
     bool (*handler)(HTTPRequest* req, const std::string& strReq);
@@ -612,6 +701,8 @@ static const struct {
       {"/rest/mempool/contents", rest_mempool_contents},
       {"/rest/headers/", rest_headers},
       {"/rest/getutxos", rest_getutxos},
+      {"/rest/address/balance/", rest_address_balance},
+      {"/rest/address/history/", rest_address_history},
 };
 
 bool StartREST()
@@ -3,7 +3,11 @@
 // Distributed under the MIT software license, see the accompanying
 // file COPYING or http://www.opensource.org/licenses/mit-license.php.
 
+#include "addressindex.h"
 #include "amount.h"
+#include "base58.h"
+#include "blockfilterindex.h"
+#include "blockmap.h"
 #include "chain.h"
 #include "chainparams.h"
 #include "checkpoints.h"
@@ -13,6 +17,7 @@
 #include "policy/policy.h"
 #include "primitives/transaction.h"
 #include "rpc/server.h"
+#include "script/standard.h"
 #include "streams.h"
 #include "sync.h"
 #include "txmempool.h"
@@ -159,8 +164,7 @@ UniValue getblockcount(const JSONRPCRequest& request)
             + HelpExampleRpc("getblockcount", "")
         );
 
-    LOCK(cs_main);
-    return chainActive.Height();
+    return chainActive.HeightUnlocked();
 }
 
 UniValue getbestblockhash(const JSONRPCRequest& request)
@@ -176,8 +180,7 @@ UniValue getbestblockhash(const JSONRPCRequest& request)
             + HelpExampleRpc("getbestblockhash", "")
         );
 
-    LOCK(cs_main);
-    return chainActive.Tip()->GetBlockHash().GetHex();
+    return chainActive.TipUnlocked()->GetBlockHash().GetHex();
 }
 
 void RPCNotifyBlockChange(bool ibd, const CBlockIndex * pindex)
@@ -687,6 +690,47 @@ UniValue getblockheader(const JSONRPCRequest& request)
     return blockheaderToJSON(pblockindex);
 }
 
+UniValue getblockfilter(const JSONRPCRequest& request)
+{
+    if (request.fHelp || request.params.size() != 1)
+        throw runtime_error(
+            "getblockfilter \"hash\"\n"
+            "\nReturns the BIP 158 basic filter of block 'hash', and its BIP 157 filter header.\n"
+            "Requires -blockfilterindex; blocks of the active chain are indexed in the background.\n"
+            "\nArguments:\n"
+            "1. \"hash\"          (string, required) The block hash\n"
+            "\nResult:\n"
+            "{\n"
+            "  \"filter\" : \"xxxx\",   (string) the hex-encoded filter data\n"
+            "  \"header\" : \"hash\"    (string) the hex-encoded filter header\n"
+            "}\n"
+            "\nExamples:\n"
+            + HelpExampleCli("getblockfilter", "\"00000000c937983704a73af28acdec37b049d214adbda81d7e2a3dd146f6ed09\"")
+            + HelpExampleRpc("getblockfilter", "\"00000000c937983704a73af28acdec37b049d214adbda81d7e2a3dd146f6ed09\"")
+        );
+
+    if (!pblockfilterindex)
+        throw JSONRPCError(RPC_MISC_ERROR, "Block filters are not indexed; start with -blockfilterindex");
+
+    uint256 hash(uint256S(request.params[0].get_str()));
+    {
+        LOCK(cs_main);
+        if (mapBlockIndex.count(hash) == 0)
+            throw JSONRPCError(RPC_INVALID_ADDRESS_OR_KEY, "Block not found");
+    }
+
+    // The index is read without cs_main
+    BlockFilter filter;
+    uint256 header;
+    if (!pblockfilterindex->LookupFilter(hash, filter) || !pblockfilterindex->LookupFilterHeader(hash, header))
+        throw JSONRPCError(RPC_MISC_ERROR, "Filter not available (the block is not on the active chain, or not indexed yet)");
+
+    UniValue ret(UniValue::VOBJ);
+    ret.push_back(Pair("filter", HexStr(filter.GetEncodedFilter())));
+    ret.push_back(Pair("header", header.GetHex()));
+    return ret;
+}
+
 UniValue getblock(const JSONRPCRequest& request)
 {
     if (request.fHelp || request.params.size() < 1 || request.params.size() > 2)
@@ -746,6 +790,11 @@ UniValue getblock(const JSONRPCRequest& request)
     if (fHavePruned && !(pblockindex->nStatus & BLOCK_HAVE_DATA) && pblockindex->nTx > 0)
         throw JSONRPCError(RPC_INTERNAL_ERROR, "Block not available (pruned data)");
 
+    // With witness data, the serialized block is the block as stored on disk
+    CRawBlock rawBlock;
+    if (!fVerbose && RPCSerializationFlags() == 0 && ReadRawBlockFromDisk(rawBlock, pblockindex, Params()))
+        return HexStr(rawBlock.begin(), rawBlock.end());
+
     if(!ReadBlockFromDisk(block, pblockindex, Params().GetConsensus()))
         throw JSONRPCError(RPC_INTERNAL_ERROR, "Can't read block from disk");
 
@@ -773,6 +822,21 @@ struct CCoinsStats
     CCoinsStats() : nHeight(0), nTransactions(0), nTransactionOutputs(0), nSerializedSize(0), nTotalAmount(0) {}
 };
 
+static void ApplyStats(CCoinsStats &stats, CHashWriter& ss, const uint256& hash, const std::map<uint32_t, Coin>& outputs)
+{
+    assert(!outputs.empty());
+    ss << hash;
+    ss << VARINT(outputs.begin()->second.nHeight * 2 + outputs.begin()->second.fCoinBase);
+    stats.nTransactions++;
+    for (const auto& output : outputs) {
+        ss << VARINT(output.first + 1);
+        ss << output.second.out;
+        stats.nTransactionOutputs++;
+        stats.nTotalAmount += output.second.out.nValue;
+    }
+    ss << VARINT(0);
+}
+
 //! Calculate statistics about the unspent transaction output set
 static bool GetUTXOStats(CCoinsView *view, CCoinsStats &stats)
 {
@@ -785,32 +849,32 @@ static bool GetUTXOStats(CCoinsView *view, CCoinsStats &stats)
         stats.nHeight = mapBlockIndex.find(stats.hashBlock)->second->nHeight;
     }
     ss << stats.hashBlock;
-    CAmount nTotalAmount = 0;
+    uint256 prevkey;
+    std::map<uint32_t, Coin> outputs;
     while (pcursor->Valid()) {
         boost::this_thread::interruption_point();
-        uint256 key;
-        CCoins coins;
-        if (pcursor->GetKey(key) && pcursor->GetValue(coins)) {
-            stats.nTransactions++;
-            ss << key;
-            for (unsigned int i=0; i<coins.vout.size(); i++) {
-                const CTxOut &out = coins.vout[i];
-                if (!out.IsNull()) {
-                    stats.nTransactionOutputs++;
-                    ss << VARINT(i+1);
-                    ss << out;
-                    nTotalAmount += out.nValue;
-                }
+        COutPoint key;
+        Coin coin;
+        if (pcursor->GetKey(key) && pcursor->GetValue(coin)) {
+            // Outputs are stored sorted by txid; collect all of a transaction's
+            // outputs before hashing them, so the result does not depend on the
+            // database layout.
+            if (!outputs.empty() && key.hash != prevkey) {
+                ApplyStats(stats, ss, prevkey, outputs);
+                outputs.clear();
             }
-            stats.nSerializedSize += 32 + pcursor->GetValueSize();
-            ss << VARINT(0);
+            prevkey = key.hash;
+            outputs[key.n] = std::move(coin);
+            stats.nSerializedSize += 32 + 4 + pcursor->GetValueSize();
         } else {
             return error("%s: unable to read value", __func__);
         }
         pcursor->Next();
     }
+    if (!outputs.empty()) {
+        ApplyStats(stats, ss, prevkey, outputs);
+    }
     stats.hashSerialized = ss.GetHash();
-    stats.nTotalAmount = nTotalAmount;
     return true;
 }
 
@@ -879,7 +943,6 @@ UniValue gettxout(const JSONRPCRequest& request)
             "        ,...\n"
             "     ]\n"
             "  },\n"
-            "  \"version\" : n,            (numeric) The version\n"
             "  \"coinbase\" : true|false   (boolean) Coinbase or not\n"
             "}\n"
 
@@ -903,33 +966,33 @@ UniValue gettxout(const JSONRPCRequest& request)
     if (request.params.size() > 2)
         fMempool = request.params[2].get_bool();
 
-    CCoins coins;
+    COutPoint out(hash, n);
+    Coin coin;
     if (fMempool) {
         LOCK(mempool.cs);
         CCoinsViewMemPool view(pcoinsTip, mempool);
-        if (!view.GetCoins(hash, coins))
+        if (!view.GetCoin(out, coin) || mempool.isSpent(out)) { // TODO: filtering spent coins should be done by the CCoinsViewMemPool
             return NullUniValue;
-        mempool.pruneSpent(hash, coins); // TODO: this should be done by the CCoinsViewMemPool
+        }
     } else {
-        if (!pcoinsTip->GetCoins(hash, coins))
+        if (!pcoinsTip->GetCoin(out, coin)) {
             return NullUniValue;
+        }
     }
-    if (n<0 || (unsigned int)n>=coins.vout.size() || coins.vout[n].IsNull())
-        return NullUniValue;
 
     BlockMap::iterator it = mapBlockIndex.find(pcoinsTip->GetBestBlock());
     CBlockIndex *pindex = it->second;
     ret.push_back(Pair("bestblock", pindex->GetBlockHash().GetHex()));
-    if ((unsigned int)coins.nHeight == MEMPOOL_HEIGHT)
+    if (coin.nHeight == MEMPOOL_HEIGHT) {
         ret.push_back(Pair("confirmations", 0));
-    else
-        ret.push_back(Pair("confirmations", pindex->nHeight - coins.nHeight + 1));
-    ret.push_back(Pair("value", ValueFromAmount(coins.vout[n].nValue)));
+    } else {
+        ret.push_back(Pair("confirmations", (int64_t)(pindex->nHeight - coin.nHeight + 1)));
+    }
+    ret.push_back(Pair("value", ValueFromAmount(coin.out.nValue)));
     UniValue o(UniValue::VOBJ);
-    ScriptPubKeyToJSON(coins.vout[n].scriptPubKey, o, true);
+    ScriptPubKeyToJSON(coin.out.scriptPubKey, o, true);
     ret.push_back(Pair("scriptPubKey", o));
-    ret.push_back(Pair("version", coins.nVersion));
-    ret.push_back(Pair("coinbase", coins.fCoinBase));
+    ret.push_back(Pair("coinbase", (bool)coin.fCoinBase));
 
     return ret;
 }
@@ -1366,15 +1429,168 @@ UniValue reconsiderblock(const JSONRPCRequest& request)
     return NullUniValue;
 }
 
+/** The scriptPubKey of an address, or a hex-encoded scriptPubKey */
+bool ParseAddressOrScript(const std::string& str, CScript& scriptPubKey)
+{
+    CBitcoinAddress address(str);
+    if (address.IsValid()) {
+        scriptPubKey = GetScriptForDestination(address.Get());
+        return true;
+    }
+    if (!str.empty() && IsHex(str)) {
+        std::vector<unsigned char> vch(ParseHex(str));
+        scriptPubKey = CScript(vch.begin(), vch.end());
+        return true;
+    }
+    return false;
+}
+
+UniValue addressBalanceToJSON(const CScript& scriptPubKey, const CAddressBalance& balance)
+{
+    UniValue ret(UniValue::VOBJ);
+    ret.push_back(Pair("scripthash", GetScriptHash(scriptPubKey).GetHex()));
+    ret.push_back(Pair("balance", ValueFromAmount(balance.nBalance)));
+    ret.push_back(Pair("received", ValueFromAmount(balance.nReceived)));
+    ret.push_back(Pair("entries", balance.nEntries));
+    return ret;
+}
+
+UniValue addressHistoryToJSON(const std::vector<CAddressHistoryEntry>& vEntries)
+{
+    UniValue history(UniValue::VARR);
+    BOOST_FOREACH(const CAddressHistoryEntry& entry, vEntries) {
+        UniValue obj(UniValue::VOBJ);
+        obj.push_back(Pair("height", entry.first.nHeight));
+        obj.push_back(Pair("txid", entry.first.txid.GetHex()));
+        if (entry.first.fSpend) {
+            obj.push_back(Pair("vin", (int64_t)entry.first.n));
+            obj.push_back(Pair("prevtxid", entry.second.prevout.hash.GetHex()));
+            obj.push_back(Pair("prevvout", (int64_t)entry.second.prevout.n));
+        } else {
+            obj.push_back(Pair("vout", (int64_t)entry.first.n));
+        }
+        obj.push_back(Pair("value", ValueFromAmount(entry.second.nValue)));
+        history.push_back(obj);
+    }
+    return history;
+}
+
+static void CheckAddressIndex()
+{
+    if (!paddressindex)
+        throw JSONRPCError(RPC_MISC_ERROR, "Addresses are not indexed; start with -addressindex");
+}
+
+UniValue getaddressbalance(const JSONRPCRequest& request)
+{
+    if (request.fHelp || request.params.size() != 1)
+        throw runtime_error(
+            "getaddressbalance \"address\"\n"
+            "\nReturns the balance of an address or script, as of the last block the address index has reached.\n"
+            "Requires -addressindex; the index is built in the background.\n"
+            "\nArguments:\n"
+            "1. \"address\"       (string, required) The address, or a hex-encoded scriptPubKey\n"
+            "\nResult:\n"
+            "{\n"
+            "  \"scripthash\" : \"hash\", (string) The SHA256 of the scriptPubKey, as the index is keyed by\n"
+            "  \"balance\" : x.xxx,     (numeric) The value of its unspent outputs in " + CURRENCY_UNIT + "\n"
+            "  \"received\" : x.xxx,    (numeric) The total value of its outputs in " + CURRENCY_UNIT + "\n"
+            "  \"entries\" : n,         (numeric) The number of outputs and spends in its history\n"
+            "  \"height\" : n           (numeric) The height of the last block indexed\n"
+            "}\n"
+            "\nExamples:\n"
+            + HelpExampleCli("getaddressbalance", "\"1PSSGeFHDnKNxiEyFrD1wcEaHr9hrQDDWc\"")
+            + HelpExampleRpc("getaddressbalance", "\"1PSSGeFHDnKNxiEyFrD1wcEaHr9hrQDDWc\"")
+        );
+
+    CheckAddressIndex();
+    CScript scriptPubKey;
+    if (!ParseAddressOrScript(request.params[0].get_str(), scriptPubKey))
+        throw JSONRPCError(RPC_INVALID_ADDRESS_OR_KEY, "Invalid address or script");
+
+    const CBlockIndex* pindexBest;
+    CAddressBalance balance;
+    if (!paddressindex->GetBalance(GetScriptHash(scriptPubKey), balance, pindexBest))
+        throw JSONRPCError(RPC_DATABASE_ERROR, "Failed to read the address index");
+
+    UniValue ret = addressBalanceToJSON(scriptPubKey, balance);
+    ret.push_back(Pair("height", pindexBest ? pindexBest->nHeight : -1));
+    return ret;
+}
+
+UniValue getaddresshistory(const JSONRPCRequest& request)
+{
+    if (request.fHelp || request.params.size() < 1 || request.params.size() > 3)
+        throw runtime_error(
+            "getaddresshistory \"address\" ( skip count )\n"
+            "\nReturns the outputs paying to an address or script, and the inputs spending them, in chain order.\n"
+            "Requires -addressindex; the index is built in the background.\n"
+            "\nArguments:\n"
+            "1. \"address\"       (string, required) The address, or a hex-encoded scriptPubKey\n"
+            "2. skip            (numeric, optional, default=0) The number of entries to skip\n"
+            "3. count           (numeric, optional, default=100) The number of entries to return, at most " + strprintf("%u", MAX_ADDRESS_HISTORY_COUNT) + "\n"
+            "\nResult:\n"
+            "{\n"
+            "  \"scripthash\" : \"hash\", (string) The SHA256 of the scriptPubKey\n"
+            "  \"entries\" : n,         (numeric) The total number of entries\n"
+            "  \"height\" : n,          (numeric) The height of the last block indexed\n"
+            "  \"history\" : [\n"
+            "    {\n"
+            "      \"height\" : n,      (numeric) The height of the block of the transaction\n"
+            "      \"txid\" : \"id\",     (string) The transaction id\n"
+            "      \"vout\" : n,        (numeric) For outputs: the output index\n"
+            "      \"vin\" : n,         (numeric) For spends: the input index\n"
+            "      \"prevtxid\" : \"id\", (string) For spends: the transaction id of the output spent\n"
+            "      \"prevvout\" : n,    (numeric) For spends: the index of the output spent\n"
+            "      \"value\" : x.xxx    (numeric) The value received, or minus the value spent, in " + CURRENCY_UNIT + "\n"
+            "    }, ...\n"
+            "  ]\n"
+            "}\n"
+            "\nExamples:\n"
+            + HelpExampleCli("getaddresshistory", "\"1PSSGeFHDnKNxiEyFrD1wcEaHr9hrQDDWc\" 100 100")
+            + HelpExampleRpc("getaddresshistory", "\"1PSSGeFHDnKNxiEyFrD1wcEaHr9hrQDDWc\", 100, 100")
+        );
+
+    CheckAddressIndex();
+    CScript scriptPubKey;
+    if (!ParseAddressOrScript(request.params[0].get_str(), scriptPubKey))
+        throw JSONRPCError(RPC_INVALID_ADDRESS_OR_KEY, "Invalid address or script");
+    int64_t nSkip = 0;
+    if (request.params.size() > 1)
+        nSkip = request.params[1].get_int64();
+    int nCount = 100;
+    if (request.params.size() > 2)
+        nCount = request.params[2].get_int();
+    if (nSkip < 0 || nCount < 0 || nCount > (int)MAX_ADDRESS_HISTORY_COUNT)
+        throw JSONRPCError(RPC_INVALID_PARAMETER, "Invalid skip or count");
+
+    const uint256 scriptHash = GetScriptHash(scriptPubKey);
+    const CBlockIndex* pindexBest;
+    CAddressBalance balance;
+    std::vector<CAddressHistoryEntry> vEntries;
+    if (!paddressindex->GetHistory(scriptHash, nSkip, nCount, balance, vEntries, pindexBest))
+        throw JSONRPCError(RPC_DATABASE_ERROR, "Failed to read the address index");
+
+    UniValue ret(UniValue::VOBJ);
+    ret.push_back(Pair("scripthash", scriptHash.GetHex()));
+    ret.push_back(Pair("entries", balance.nEntries));
+    ret.push_back(Pair("height", pindexBest ? pindexBest->nHeight : -1));
+    ret.push_back(Pair("history", addressHistoryToJSON(vEntries)));
+    return ret;
+}
+
 static const CRPCCommand commands[] =
 { //  category              name                      actor (function)         okSafeMode
   //  --------------------- ------------------------  -----------------------  ----------
+    { "blockchain",         "getaddressbalance",      &getaddressbalance,      true  },
+    { "blockchain",         "getaddresshistory",      &getaddresshistory,      true  },
     { "blockchain",         "getblockchaininfo",      &getblockchaininfo,      true  },
     { "blockchain",         "getbestblockhash",       &getbestblockhash,       true  },
     { "blockchain",         "getblockcount",          &getblockcount,          true  },
     { "blockchain",         "getblock",               &getblock,               true  },
     { "blockchain",         "getblockhash",           &getblockhash,           true  },
     { "blockchain",         "getblockheader",         &getblockheader,         true  },
+    { "blockchain",         "getblockfilter",         &getblockfilter,         true  },
     { "blockchain",         "getchaintips",           &getchaintips,           true  },
     { "blockchain",         "getdifficulty",          &getdifficulty,          true  },
     { "blockchain",         "getmempoolancestors",    &getmempoolancestors,    true  },
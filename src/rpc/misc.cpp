@@ -492,6 +492,40 @@ UniValue getmemoryinfo(const JSONRPCRequest& request)
     return obj;
 }
 
+#ifdef DEBUG_LOCKCONTENTION
+UniValue getlockcontention(const JSONRPCRequest& request)
+{
+    if (request.fHelp || request.params.size() != 0)
+        throw runtime_error(
+            "getlockcontention\n"
+            "Returns how often, and for how long, each LOCK() in the code had to wait for its lock.\n"
+            "Only available when built with -DDEBUG_LOCKCONTENTION.\n"
+            "\nResult:\n"
+            "[                           (json array) Most waited for first\n"
+            "  {\n"
+            "    \"lock\": \"name\",         (string) The lock, e.g. cs_main\n"
+            "    \"location\": \"file:line\", (string) Where it was taken\n"
+            "    \"contended\": n,         (numeric) Number of times the lock was not immediately available\n"
+            "    \"wait_us\": n            (numeric) Total time spent waiting for it, in microseconds\n"
+            "  },...\n"
+            "]\n"
+            "\nExamples:\n"
+            + HelpExampleCli("getlockcontention", "")
+            + HelpExampleRpc("getlockcontention", "")
+        );
+    UniValue ret(UniValue::VARR);
+    BOOST_FOREACH(const LockContentionStats& stats, GetLockContentionStats()) {
+        UniValue obj(UniValue::VOBJ);
+        obj.push_back(Pair("lock", stats.name));
+        obj.push_back(Pair("location", stats.location));
+        obj.push_back(Pair("contended", stats.nContended));
+        obj.push_back(Pair("wait_us", stats.nWaitMicros));
+        ret.push_back(obj);
+    }
+    return ret;
+}
+#endif
+
 static const CRPCCommand commands[] =
 { //  category              name                      actor (function)         okSafeMode
   //  --------------------- ------------------------  -----------------------  ----------
@@ -504,6 +538,9 @@ static const CRPCCommand commands[] =
 
     /* Not shown in help */
     { "hidden",             "setmocktime",            &setmocktime,            true  },
+#ifdef DEBUG_LOCKCONTENTION
+    { "hidden",             "getlockcontention",      &getlockcontention,      true  },
+#endif
 };
 
 void RegisterMiscRPCCommands(CRPCTable &t)
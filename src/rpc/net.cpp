@@ -13,6 +13,7 @@
 #include "protocol.h"
 #include "sync.h"
 #include "timedata.h"
+#include "txrelay.h"
 #include "ui_interface.h"
 #include "util.h"
 #include "utilstrencodings.h"
@@ -387,6 +388,46 @@ static UniValue GetNetworksInfo()
     return networks;
 }
 
+UniValue getrelayinfo(const JSONRPCRequest& request)
+{
+    if (request.fHelp || request.params.size() != 0)
+        throw runtime_error(
+            "getrelayinfo\n"
+            "\nReturns statistics on transaction announcements and on the time spent sending messages to peers.\n"
+            "Times are in microseconds, totalled since startup.\n"
+            "\nResult:\n"
+            "{\n"
+            "  \"scheduled\": n,            (numeric) Transactions in the announcement order shared by all peers\n"
+            "  \"rebuilds\": n,             (numeric) Number of times that order was built\n"
+            "  \"rebuildtime\": n,          (numeric) Time spent building it\n"
+            "  \"mempoollocktime\": n,      (numeric) Part of rebuildtime that the mempool was locked\n"
+            "  \"sendmessages\": n,         (numeric) Number of SendMessages calls\n"
+            "  \"sendmessagestime\": n,     (numeric) Time spent in SendMessages\n"
+            "  \"sendmessageslocktime\": n, (numeric) Part of sendmessagestime that cs_main was held\n"
+            "  \"inventorytime\": n,        (numeric) Part of sendmessagestime spent on inv messages\n"
+            "  \"announced\": n             (numeric) Transactions announced to peers\n"
+            "}\n"
+            "\nExamples:\n"
+            + HelpExampleCli("getrelayinfo", "")
+            + HelpExampleRpc("getrelayinfo", "")
+        );
+
+    CTxRelayStats stats;
+    GetTxRelayStats(stats);
+
+    UniValue obj(UniValue::VOBJ);
+    obj.push_back(Pair("scheduled", (uint64_t)stats.nScheduled));
+    obj.push_back(Pair("rebuilds", stats.nRebuilds));
+    obj.push_back(Pair("rebuildtime", stats.nRebuildTime));
+    obj.push_back(Pair("mempoollocktime", stats.nMempoolLockTime));
+    obj.push_back(Pair("sendmessages", stats.nSendMessages));
+    obj.push_back(Pair("sendmessagestime", stats.nSendMessagesTime));
+    obj.push_back(Pair("sendmessageslocktime", stats.nSendMessagesLockTime));
+    obj.push_back(Pair("inventorytime", stats.nInventoryTime));
+    obj.push_back(Pair("announced", stats.nAnnounced));
+    return obj;
+}
+
 UniValue getnetworkinfo(const JSONRPCRequest& request)
 {
     if (request.fHelp || request.params.size() != 0)
@@ -603,6 +644,7 @@ static const CRPCCommand commands[] =
     { "network",            "disconnectnode",         &disconnectnode,         true  },
     { "network",            "getaddednodeinfo",       &getaddednodeinfo,       true  },
     { "network",            "getnettotals",           &getnettotals,           true  },
+    { "network",            "getrelayinfo",           &getrelayinfo,           true  },
     { "network",            "getnetworkinfo",         &getnetworkinfo,         true  },
     { "network",            "setban",                 &setban,                 true  },
     { "network",            "listbanned",             &listbanned,             true  },
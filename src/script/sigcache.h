@@ -30,4 +30,7 @@ public:
 
 void InitSignatureCache();
 
+/** Whether the signature cache holds vchSig as valid for sighash and pubkey (used in tests) */
+bool SignatureCacheContains(const uint256& sighash, const std::vector<unsigned char>& vchSig, const CPubKey& pubkey);
+
 #endif // BITCOIN_SCRIPT_SIGCACHE_H
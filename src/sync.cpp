@@ -7,6 +7,8 @@
 #include "util.h"
 #include "utilstrencodings.h"
 
+#include <algorithm>
+#include <map>
 #include <stdio.h>
 
 #include <boost/foreach.hpp>
@@ -18,6 +20,51 @@ void PrintLockContention(const char* pszName, const char* pszFile, int nLine)
     LogPrintf("LOCKCONTENTION: %s\n", pszName);
     LogPrintf("Locker: %s:%d\n", pszFile, nLine);
 }
+
+struct LockContentionData {
+    typedef std::map<std::pair<std::string, std::string>, std::pair<uint64_t, int64_t> > ContentionMap;
+    //! (lock name, file:line) -> (times contended, total microseconds waited)
+    ContentionMap contention;
+    boost::mutex cs_contention;
+};
+
+static LockContentionData& GetLockContentionData()
+{
+    // Never destroyed, as locks can still be taken by global destructors
+    static LockContentionData* data = new LockContentionData();
+    return *data;
+}
+
+void RecordLockContention(const char* pszName, const char* pszFile, int nLine, int64_t nWaitMicros)
+{
+    LockContentionData& data = GetLockContentionData();
+    boost::unique_lock<boost::mutex> lock(data.cs_contention);
+    std::pair<uint64_t, int64_t>& entry = data.contention[std::make_pair(std::string(pszName), strprintf("%s:%d", pszFile, nLine))];
+    entry.first++;
+    entry.second += nWaitMicros;
+}
+
+std::vector<LockContentionStats> GetLockContentionStats()
+{
+    std::vector<LockContentionStats> vStats;
+    {
+        LockContentionData& data = GetLockContentionData();
+        boost::unique_lock<boost::mutex> lock(data.cs_contention);
+        vStats.reserve(data.contention.size());
+        BOOST_FOREACH(const LockContentionData::ContentionMap::value_type& entry, data.contention) {
+            LockContentionStats stats;
+            stats.name = entry.first.first;
+            stats.location = entry.first.second;
+            stats.nContended = entry.second.first;
+            stats.nWaitMicros = entry.second.second;
+            vStats.push_back(stats);
+        }
+    }
+    std::sort(vStats.begin(), vStats.end(), [](const LockContentionStats& a, const LockContentionStats& b) {
+        return a.nWaitMicros > b.nWaitMicros;
+    });
+    return vStats;
+}
 #endif /* DEBUG_LOCKCONTENTION */
 
 #ifdef DEBUG_LOCKORDER
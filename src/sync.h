@@ -7,6 +7,11 @@
 #define BITCOIN_SYNC_H
 
 #include "threadsafety.h"
+#include "utiltime.h"
+
+#include <stdint.h>
+#include <string>
+#include <vector>
 
 #include <boost/thread/condition_variable.hpp>
 #include <boost/thread/locks.hpp>
@@ -106,6 +111,19 @@ typedef boost::condition_variable CConditionVariable;
 
 #ifdef DEBUG_LOCKCONTENTION
 void PrintLockContention(const char* pszName, const char* pszFile, int nLine);
+/** Account nWaitMicros of waiting for a contended lock to the place that took it */
+void RecordLockContention(const char* pszName, const char* pszFile, int nLine, int64_t nWaitMicros);
+
+struct LockContentionStats
+{
+    std::string name;       //!< Name of the lock, as passed to LOCK()
+    std::string location;   //!< file:line that took it
+    uint64_t nContended;    //!< Number of times it was not immediately available
+    int64_t nWaitMicros;    //!< Total time spent waiting for it
+};
+
+/** Return the contention recorded so far, most waited for first */
+std::vector<LockContentionStats> GetLockContentionStats();
 #endif
 
 /** Wrapper around boost::unique_lock<Mutex> */
@@ -121,10 +139,12 @@ private:
 #ifdef DEBUG_LOCKCONTENTION
         if (!lock.try_lock()) {
             PrintLockContention(pszName, pszFile, nLine);
-#endif
+            int64_t nWaitStart = GetTimeMicros();
             lock.lock();
-#ifdef DEBUG_LOCKCONTENTION
+            RecordLockContention(pszName, pszFile, nLine, GetTimeMicros() - nWaitStart);
         }
+#else
+        lock.lock();
 #endif
     }
 
@@ -0,0 +1,180 @@
+// Copyright (c) 2017 The Bitcoin Core developers
+// Distributed under the MIT software license, see the accompanying
+// file COPYING or http://www.opensource.org/licenses/mit-license.php.
+
+#include "addressindex.h"
+#include "arith_uint256.h"
+#include "chainparams.h"
+#include "consensus/validation.h"
+#include "key.h"
+#include "script/interpreter.h"
+#include "script/standard.h"
+#include "test/test_bitcoin.h"
+#include "validation.h"
+
+#include <boost/test/unit_test.hpp>
+
+BOOST_FIXTURE_TEST_SUITE(addressindex_tests, TestChain100Setup)
+
+BOOST_AUTO_TEST_CASE(addressindex_sync)
+{
+    CAddressIndex index(1 << 20, true);
+    {
+        LOCK(cs_main);
+        BOOST_CHECK(index.Init());
+    }
+    while (index.SyncStep()) {}
+    BOOST_CHECK(index.GetBest() == chainActive.Tip());
+
+    CScript coinbaseScript = CScript() << ToByteVector(coinbaseKey.GetPubKey()) << OP_CHECKSIG;
+    const uint256 coinbaseHash = GetScriptHash(coinbaseScript);
+    CAmount nMined = 0;
+    BOOST_FOREACH(const CTransaction& tx, coinbaseTxns)
+        nMined += tx.vout[0].nValue;
+
+    CAddressBalance balance;
+    const CBlockIndex* pindexBest;
+    BOOST_CHECK(index.GetBalance(coinbaseHash, balance, pindexBest));
+    BOOST_CHECK(pindexBest == chainActive.Tip());
+    BOOST_CHECK_EQUAL(balance.nBalance, nMined);
+    BOOST_CHECK_EQUAL(balance.nReceived, nMined);
+    BOOST_CHECK_EQUAL(balance.nEntries, coinbaseTxns.size());
+
+    // A page of history, in chain order
+    std::vector<CAddressHistoryEntry> vEntries;
+    BOOST_CHECK(index.GetHistory(coinbaseHash, 10, 5, balance, vEntries, pindexBest));
+    BOOST_CHECK(pindexBest == chainActive.Tip());
+    BOOST_CHECK_EQUAL(balance.nEntries, coinbaseTxns.size());
+    BOOST_CHECK_EQUAL(vEntries.size(), 5U);
+    for (unsigned int i = 0; i < vEntries.size(); i++) {
+        BOOST_CHECK_EQUAL(vEntries[i].first.nHeight, (int)(11 + i));
+        BOOST_CHECK(vEntries[i].first.txid == coinbaseTxns[10 + i].GetHash());
+        BOOST_CHECK(!vEntries[i].first.fSpend);
+        BOOST_CHECK_EQUAL(vEntries[i].second.nValue, coinbaseTxns[10 + i].vout[0].nValue);
+    }
+
+    // Spend the first coinbase to another script
+    CKey key;
+    key.MakeNewKey(true);
+    CScript script = GetScriptForDestination(key.GetPubKey().GetID());
+    CMutableTransaction spend;
+    spend.vin.resize(1);
+    spend.vin[0].prevout = COutPoint(coinbaseTxns[0].GetHash(), 0);
+    spend.vout.resize(1);
+    spend.vout[0].nValue = 11 * CENT;
+    spend.vout[0].scriptPubKey = script;
+    std::vector<unsigned char> vchSig;
+    uint256 hash = SignatureHash(coinbaseScript, spend, 0, SIGHASH_ALL, 0, SIGVERSION_BASE);
+    BOOST_CHECK(coinbaseKey.Sign(hash, vchSig));
+    vchSig.push_back((unsigned char)SIGHASH_ALL);
+    spend.vin[0].scriptSig << vchSig;
+
+    CBlock block = CreateAndProcessBlock(std::vector<CMutableTransaction>(1, spend), coinbaseScript);
+    BOOST_CHECK(chainActive.Tip()->GetBlockHash() == block.GetHash());
+    while (index.SyncStep()) {}
+    BOOST_CHECK(index.GetBest() == chainActive.Tip());
+
+    const CAmount nCoinbase = block.vtx[0]->vout[0].nValue;
+    const CAmount nSpent = coinbaseTxns[0].vout[0].nValue;
+    BOOST_CHECK(index.GetBalance(coinbaseHash, balance, pindexBest));
+    BOOST_CHECK_EQUAL(balance.nBalance, nMined + nCoinbase - nSpent);
+    BOOST_CHECK_EQUAL(balance.nReceived, nMined + nCoinbase);
+    BOOST_CHECK_EQUAL(balance.nEntries, coinbaseTxns.size() + 2);
+    BOOST_CHECK(index.GetBalance(GetScriptHash(script), balance, pindexBest));
+    BOOST_CHECK_EQUAL(balance.nBalance, 11 * CENT);
+    BOOST_CHECK_EQUAL(balance.nEntries, 1U);
+
+    // The last page holds the new coinbase and the spend
+    BOOST_CHECK(index.GetHistory(coinbaseHash, coinbaseTxns.size(), 10, balance, vEntries, pindexBest));
+    BOOST_CHECK_EQUAL(vEntries.size(), 2U);
+    int nSpends = 0;
+    BOOST_FOREACH(const CAddressHistoryEntry& entry, vEntries) {
+        BOOST_CHECK_EQUAL(entry.first.nHeight, 101);
+        if (!entry.first.fSpend)
+            continue;
+        nSpends++;
+        BOOST_CHECK(entry.first.txid == spend.GetHash());
+        BOOST_CHECK_EQUAL(entry.second.nValue, -nSpent);
+        BOOST_CHECK(entry.second.prevout == spend.vin[0].prevout);
+    }
+    BOOST_CHECK_EQUAL(nSpends, 1);
+
+    // Disconnecting the block takes it out of the index again
+    {
+        CValidationState state;
+        LOCK(cs_main);
+        BOOST_CHECK(InvalidateBlock(state, Params(), chainActive.Tip()));
+    }
+    while (index.SyncStep()) {}
+    BOOST_CHECK(index.GetBest() == chainActive.Tip());
+
+    BOOST_CHECK(index.GetBalance(coinbaseHash, balance, pindexBest));
+    BOOST_CHECK_EQUAL(balance.nBalance, nMined);
+    BOOST_CHECK_EQUAL(balance.nReceived, nMined);
+    BOOST_CHECK_EQUAL(balance.nEntries, coinbaseTxns.size());
+    BOOST_CHECK(index.GetBalance(GetScriptHash(script), balance, pindexBest));
+    BOOST_CHECK_EQUAL(balance.nEntries, 0U);
+    BOOST_CHECK(index.GetHistory(GetScriptHash(script), 0, 10, balance, vEntries, pindexBest));
+    BOOST_CHECK(vEntries.empty());
+}
+
+BOOST_AUTO_TEST_CASE(addressindex_block_order)
+{
+    CAddressIndex index(1 << 20, true);
+    {
+        LOCK(cs_main);
+        BOOST_CHECK(index.Init());
+    }
+    while (index.SyncStep()) {}
+
+    // Pay a coinbase to a new script, and spend that output in the same block
+    CScript coinbaseScript = CScript() << ToByteVector(coinbaseKey.GetPubKey()) << OP_CHECKSIG;
+    CScript script = CScript() << OP_TRUE;
+    CMutableTransaction pay;
+    pay.vin.resize(1);
+    pay.vin[0].prevout = COutPoint(coinbaseTxns[0].GetHash(), 0);
+    pay.vout.resize(1);
+    pay.vout[0].nValue = 11 * CENT;
+    pay.vout[0].scriptPubKey = script;
+    std::vector<unsigned char> vchSig;
+    uint256 hash = SignatureHash(coinbaseScript, pay, 0, SIGHASH_ALL, 0, SIGVERSION_BASE);
+    BOOST_CHECK(coinbaseKey.Sign(hash, vchSig));
+    vchSig.push_back((unsigned char)SIGHASH_ALL);
+    pay.vin[0].scriptSig << vchSig;
+
+    // With a txid that sorts before the one of the transaction it spends
+    CMutableTransaction spend;
+    spend.vin.resize(1);
+    spend.vin[0].prevout = COutPoint(pay.GetHash(), 0);
+    spend.vout.resize(1);
+    spend.vout[0].nValue = 10 * CENT;
+    spend.vout[0].scriptPubKey = coinbaseScript;
+    while (UintToArith256(spend.GetHash()) >= UintToArith256(pay.GetHash()))
+        spend.nLockTime++;
+
+    std::vector<CMutableTransaction> txns;
+    txns.push_back(pay);
+    txns.push_back(spend);
+    CBlock block = CreateAndProcessBlock(txns, coinbaseScript);
+    BOOST_CHECK(chainActive.Tip()->GetBlockHash() == block.GetHash());
+    while (index.SyncStep()) {}
+
+    // The output comes before its spend
+    CAddressBalance balance;
+    std::vector<CAddressHistoryEntry> vEntries;
+    const CBlockIndex* pindexBest;
+    BOOST_CHECK(index.GetHistory(GetScriptHash(script), 0, 10, balance, vEntries, pindexBest));
+    BOOST_CHECK(pindexBest == chainActive.Tip());
+    BOOST_CHECK_EQUAL(balance.nBalance, 0);
+    BOOST_CHECK_EQUAL(vEntries.size(), 2U);
+    if (vEntries.size() == 2) {
+        BOOST_CHECK(!vEntries[0].first.fSpend);
+        BOOST_CHECK(vEntries[0].first.txid == pay.GetHash());
+        BOOST_CHECK_EQUAL(vEntries[0].first.nTxIndex, 1U);
+        BOOST_CHECK(vEntries[1].first.fSpend);
+        BOOST_CHECK(vEntries[1].first.txid == spend.GetHash());
+        BOOST_CHECK_EQUAL(vEntries[1].first.nTxIndex, 2U);
+    }
+}
+
+BOOST_AUTO_TEST_SUITE_END()
@@ -299,6 +299,74 @@ BOOST_AUTO_TEST_CASE(EmptyBlockRoundTripTest)
     }
 }
 
+BOOST_AUTO_TEST_CASE(ReconstructionIndexTest)
+{
+    CTxMemPool pool(CFeeRate(0));
+    TestMemPoolEntryHelper entry;
+    CBlock block(BuildBlockTestCase());
+    CBlockReconstructionIndex reconstruction;
+
+    // One transaction is in the mempool, the other only among the extra
+    // transactions (and the mempool one is there too, which is no collision)
+    pool.addUnchecked(block.vtx[2]->GetHash(), entry.FromTx(*block.vtx[2]));
+    reconstruction.AddExtraTransaction(block.vtx[1], 10);
+    reconstruction.AddExtraTransaction(block.vtx[2], 10);
+    BOOST_CHECK_EQUAL(reconstruction.ExtraTransactionCount(), 2);
+
+    CBlockHeaderAndShortTxIDs shortIDs(block, true);
+    {
+        PartiallyDownloadedBlock partialBlock(&pool, &reconstruction);
+        BOOST_CHECK(partialBlock.InitData(shortIDs) == READ_STATUS_OK);
+        BOOST_CHECK(partialBlock.IsTxAvailable(0));
+        BOOST_CHECK(partialBlock.IsTxAvailable(1));
+        BOOST_CHECK(partialBlock.IsTxAvailable(2));
+
+        CBlock block2;
+        std::vector<CTransactionRef> vtx_missing;
+        BOOST_CHECK(partialBlock.FillBlock(block2, vtx_missing) == READ_STATUS_OK);
+        BOOST_CHECK_EQUAL(block.GetHash().ToString(), block2.GetHash().ToString());
+    }
+
+    // The extra transactions are a ring buffer
+    CMutableTransaction tx(*block.vtx[2]);
+    for (int i = 0; i < 10; i++) {
+        tx.vin[0].prevout.hash = GetRandHash();
+        reconstruction.AddExtraTransaction(MakeTransactionRef(tx), 10);
+    }
+    BOOST_CHECK_EQUAL(reconstruction.ExtraTransactionCount(), 10);
+    reconstruction.AddExtraTransaction(MakeTransactionRef(tx), 5);
+    BOOST_CHECK_EQUAL(reconstruction.ExtraTransactionCount(), 5);
+
+    // The mempool is hashed again for every announcement, so the same one
+    // sees the mempool transaction replaced by another one in its vTxHashes
+    // slot
+    pool.removeRecursive(*block.vtx[2]);
+    pool.addUnchecked(tx.GetHash(), entry.FromTx(tx));
+    BOOST_CHECK_EQUAL(pool.vTxHashes.size(), 1);
+    {
+        PartiallyDownloadedBlock partialBlock(&pool, &reconstruction);
+        BOOST_CHECK(partialBlock.InitData(shortIDs) == READ_STATUS_OK);
+        BOOST_CHECK(partialBlock.IsTxAvailable(0));
+        BOOST_CHECK(!partialBlock.IsTxAvailable(1));
+        BOOST_CHECK(!partialBlock.IsTxAvailable(2));
+    }
+
+    // And back, behind enough other transactions that its short ID is
+    // computed in a later batch than the first
+    pool.removeRecursive(tx);
+    for (int i = 0; i < 150; i++) {
+        tx.vin[0].prevout.hash = GetRandHash();
+        pool.addUnchecked(tx.GetHash(), entry.FromTx(tx));
+    }
+    pool.addUnchecked(block.vtx[2]->GetHash(), entry.FromTx(*block.vtx[2]));
+    BOOST_CHECK_EQUAL(pool.vTxHashes.size(), 151);
+    {
+        PartiallyDownloadedBlock partialBlock(&pool, &reconstruction);
+        BOOST_CHECK(partialBlock.InitData(shortIDs) == READ_STATUS_OK);
+        BOOST_CHECK(partialBlock.IsTxAvailable(2));
+    }
+}
+
 BOOST_AUTO_TEST_CASE(TransactionsRequestSerializationTest) {
     BlockTransactionsRequest req1;
     req1.blockhash = GetRandHash();
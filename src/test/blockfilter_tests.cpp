@@ -0,0 +1,217 @@
+// Copyright (c) 2017 The Bitcoin Core developers
+// Distributed under the MIT software license, see the accompanying
+// file COPYING or http://www.opensource.org/licenses/mit-license.php.
+
+#include "blockfilter.h"
+#include "blockfilterindex.h"
+#include "chainparams.h"
+#include "chainparamsbase.h"
+#include "consensus/validation.h"
+#include "script/standard.h"
+#include "streams.h"
+#include "test/test_bitcoin.h"
+#include "test/test_random.h"
+#include "utilstrencodings.h"
+#include "validation.h"
+
+#include <boost/test/unit_test.hpp>
+
+BOOST_FIXTURE_TEST_SUITE(blockfilter_tests, BasicTestingSetup)
+
+static GCSFilter::Element RandomElement()
+{
+    GCSFilter::Element element(32);
+    for (size_t i = 0; i < element.size(); i++)
+        element[i] = insecure_rand() & 0xff;
+    return element;
+}
+
+BOOST_AUTO_TEST_CASE(gcsfilter_test)
+{
+    GCSFilter::ElementSet included, excluded;
+    for (int i = 0; i < 100; ++i) {
+        included.insert(RandomElement());
+        excluded.insert(RandomElement());
+    }
+
+    GCSFilter filter(0, 0, 10, 1 << 10, included);
+    BOOST_CHECK_EQUAL(filter.GetN(), included.size());
+    BOOST_FOREACH(const GCSFilter::Element& element, included) {
+        BOOST_CHECK(filter.Match(element));
+
+        GCSFilter::ElementSet query(excluded);
+        query.insert(element);
+        BOOST_CHECK(filter.MatchAny(query));
+    }
+
+    // Decoding gives back the same filter
+    GCSFilter decoded(0, 0, 10, 1 << 10, filter.GetEncoded());
+    BOOST_CHECK_EQUAL(decoded.GetN(), filter.GetN());
+    BOOST_FOREACH(const GCSFilter::Element& element, included)
+        BOOST_CHECK(decoded.Match(element));
+
+    // A different key hashes the elements elsewhere
+    GCSFilter rekeyed(1, 2, 10, 1 << 10, included);
+    BOOST_CHECK(filter.GetEncoded() != rekeyed.GetEncoded());
+
+    // A truncated filter is rejected
+    std::vector<unsigned char> vTruncated(filter.GetEncoded().begin(), filter.GetEncoded().end() - 8);
+    BOOST_CHECK_THROW(GCSFilter(0, 0, 10, 1 << 10, vTruncated), std::ios_base::failure);
+
+    // Nothing matches an empty filter, and an empty query matches nothing
+    GCSFilter empty(0, 0, 10, 1 << 10, GCSFilter::ElementSet());
+    BOOST_CHECK_EQUAL(empty.GetN(), 0U);
+    BOOST_CHECK(!empty.Match(*included.begin()));
+    BOOST_CHECK(!filter.MatchAny(GCSFilter::ElementSet()));
+}
+
+BOOST_AUTO_TEST_CASE(blockfilter_basic_test)
+{
+    CScript included_scripts[5], excluded_scripts[3];
+
+    // First two are outputs on a single transaction.
+    included_scripts[0] << std::vector<unsigned char>(0, 65) << OP_CHECKSIG;
+    included_scripts[1] << OP_DUP << OP_HASH160 << std::vector<unsigned char>(1, 20) << OP_EQUALVERIFY << OP_CHECKSIG;
+
+    // Third is an output on a second transaction.
+    included_scripts[2] << OP_1 << std::vector<unsigned char>(2, 33) << OP_1 << OP_CHECKMULTISIG;
+
+    // Last two are spent by a single transaction.
+    included_scripts[3] << OP_0 << std::vector<unsigned char>(3, 32);
+    included_scripts[4] << OP_4 << OP_ADD << OP_8 << OP_EQUAL;
+
+    // OP_RETURN output.
+    excluded_scripts[0] << OP_RETURN << std::vector<unsigned char>(4, 40);
+
+    // This script is not related to the block at all.
+    excluded_scripts[1] << std::vector<unsigned char>(5, 33) << OP_CHECKSIG;
+
+    // Empty output.
+    excluded_scripts[2] = CScript();
+
+    CMutableTransaction tx_1;
+    tx_1.vout.push_back(CTxOut(100, included_scripts[0]));
+    tx_1.vout.push_back(CTxOut(200, included_scripts[1]));
+    tx_1.vout.push_back(CTxOut(0, excluded_scripts[0]));
+
+    CMutableTransaction tx_2;
+    tx_2.vout.push_back(CTxOut(300, included_scripts[2]));
+    tx_2.vout.push_back(CTxOut(0, excluded_scripts[2]));
+
+    CBlock block;
+    block.vtx.push_back(MakeTransactionRef(tx_1));
+    block.vtx.push_back(MakeTransactionRef(tx_2));
+
+    CBlockUndo block_undo;
+    block_undo.vtxundo.push_back(CTxUndo());
+    block_undo.vtxundo.back().vprevout.push_back(Coin(CTxOut(400, included_scripts[3]), 1000, true));
+    block_undo.vtxundo.back().vprevout.push_back(Coin(CTxOut(500, included_scripts[4]), 10000, false));
+    block_undo.vtxundo.back().vprevout.push_back(Coin(CTxOut(600, excluded_scripts[2]), 100000, false));
+
+    BlockFilter block_filter(BLOCK_FILTER_BASIC, block, block_undo);
+    const GCSFilter& filter = block_filter.GetFilter();
+
+    for (int i = 0; i < 5; i++)
+        BOOST_CHECK(filter.Match(GCSFilter::Element(included_scripts[i].begin(), included_scripts[i].end())));
+    for (int i = 0; i < 3; i++)
+        BOOST_CHECK(!filter.Match(GCSFilter::Element(excluded_scripts[i].begin(), excluded_scripts[i].end())));
+
+    // Serialization round trip
+    CDataStream stream(SER_NETWORK, PROTOCOL_VERSION);
+    stream << block_filter;
+    BlockFilter block_filter2;
+    stream >> block_filter2;
+    BOOST_CHECK_EQUAL(block_filter.GetFilterType(), block_filter2.GetFilterType());
+    BOOST_CHECK(block_filter.GetBlockHash() == block_filter2.GetBlockHash());
+    BOOST_CHECK(block_filter.GetEncodedFilter() == block_filter2.GetEncodedFilter());
+
+    // Filter headers commit to the previous one
+    uint256 header = block_filter.ComputeHeader(uint256());
+    BOOST_CHECK(header == block_filter2.ComputeHeader(uint256()));
+    BOOST_CHECK(header != block_filter.ComputeHeader(header));
+}
+
+BOOST_AUTO_TEST_CASE(blockfilter_bip158_vectors)
+{
+    // The BIP 158 test vector for the testnet genesis block
+    const CBlock& genesis = Params(CBaseChainParams::TESTNET).GenesisBlock();
+    BlockFilter block_filter(BLOCK_FILTER_BASIC, genesis, CBlockUndo());
+    BOOST_CHECK(block_filter.GetBlockHash() == genesis.GetHash());
+    BOOST_CHECK(block_filter.GetEncodedFilter() == ParseHex("019dfca8"));
+    BOOST_CHECK(block_filter.ComputeHeader(uint256()) == uint256S("21584579b7eb08997773e5aeff3a7f932700042d0ed2a6129012b7d7ae81b750"));
+
+    // Which decodes to the same filter
+    BlockFilter decoded(BLOCK_FILTER_BASIC, genesis.GetHash(), ParseHex("019dfca8"));
+    const CScript& script = genesis.vtx[0]->vout[0].scriptPubKey;
+    BOOST_CHECK(decoded.GetFilter().Match(GCSFilter::Element(script.begin(), script.end())));
+    BOOST_CHECK_EQUAL(decoded.GetFilter().GetN(), 1U);
+}
+
+BOOST_AUTO_TEST_SUITE_END()
+
+BOOST_FIXTURE_TEST_SUITE(blockfilterindex_tests, TestChain100Setup)
+
+static bool CheckFilters(const CBlockFilterIndex& index, const CBlockIndex* pindexTip)
+{
+    uint256 prevHeader;
+    for (int nHeight = 0; nHeight <= pindexTip->nHeight; nHeight++) {
+        const CBlockIndex* pindex = pindexTip->GetAncestor(nHeight);
+        BlockFilter filter;
+        uint256 header;
+        if (!index.LookupFilter(pindex->GetBlockHash(), filter) ||
+            !index.LookupFilterHeader(pindex->GetBlockHash(), header))
+            return false;
+        if (header != filter.ComputeHeader(prevHeader))
+            return false;
+        prevHeader = header;
+
+        // The coinbase output is in it
+        CBlock block;
+        if (!ReadBlockFromDisk(block, pindex, Params().GetConsensus()))
+            return false;
+        const CScript& script = block.vtx[0]->vout[0].scriptPubKey;
+        if (!filter.GetFilter().Match(GCSFilter::Element(script.begin(), script.end())))
+            return false;
+    }
+    return true;
+}
+
+BOOST_AUTO_TEST_CASE(blockfilterindex_sync)
+{
+    CBlockFilterIndex index(1 << 20, true);
+    {
+        LOCK(cs_main);
+        BOOST_CHECK(index.Init());
+    }
+    BOOST_CHECK(index.GetBest() == NULL);
+
+    // Initial build, a batch at a time
+    while (index.SyncStep()) {}
+    BOOST_CHECK(index.GetBest() == chainActive.Tip());
+    BOOST_CHECK(CheckFilters(index, chainActive.Tip()));
+
+    // New blocks
+    CScript scriptPubKey = CScript() << ToByteVector(coinbaseKey.GetPubKey()) << OP_CHECKSIG;
+    for (int i = 0; i < 2; i++)
+        CreateAndProcessBlock(std::vector<CMutableTransaction>(), scriptPubKey);
+    BOOST_CHECK(index.SyncStep());
+    BOOST_CHECK(!index.SyncStep());
+    BOOST_CHECK(index.GetBest() == chainActive.Tip());
+
+    // Reorganization: the index continues from the fork
+    const CBlockIndex* pindexFork = chainActive.Tip()->pprev->pprev;
+    {
+        CValidationState state;
+        LOCK(cs_main);
+        BOOST_CHECK(InvalidateBlock(state, Params(), chainActive.Tip()->pprev));
+    }
+    BOOST_CHECK(chainActive.Tip() == pindexFork);
+    CScript scriptOther = CScript() << OP_TRUE;
+    for (int i = 0; i < 3; i++)
+        CreateAndProcessBlock(std::vector<CMutableTransaction>(), scriptOther);
+    while (index.SyncStep()) {}
+    BOOST_CHECK(index.GetBest() == chainActive.Tip());
+    BOOST_CHECK(CheckFilters(index, chainActive.Tip()));
+}
+
+BOOST_AUTO_TEST_SUITE_END()
@@ -0,0 +1,103 @@
+// Copyright (c) 2017 The Bitcoin Core developers
+// Distributed under the MIT software license, see the accompanying
+// file COPYING or http://www.opensource.org/licenses/mit-license.php.
+
+#include "blockmap.h"
+#include "chainparams.h"
+#include "clientversion.h"
+#include "primitives/transaction.h"
+#include "streams.h"
+#include "validation.h"
+
+#include "test/test_bitcoin.h"
+
+#include <boost/test/unit_test.hpp>
+
+BOOST_FIXTURE_TEST_SUITE(blockmap_tests, TestChain100Setup)
+
+BOOST_AUTO_TEST_CASE(raw_blocks)
+{
+    LOCK(cs_main);
+    const CChainParams& chainparams = Params();
+
+    // The mapped bytes are the block as serialized to disk
+    for (CBlockIndex* pindex = chainActive.Tip(); pindex != NULL; pindex = pindex->pprev) {
+        CBlock block;
+        BOOST_CHECK(ReadBlockFromDisk(block, pindex, chainparams.GetConsensus()));
+        CDataStream ssBlock(SER_DISK, CLIENT_VERSION);
+        ssBlock << block;
+
+        CRawBlock raw;
+        BOOST_CHECK(ReadRawBlockFromDisk(raw, pindex, chainparams));
+        BOOST_CHECK_EQUAL(raw.size(), ssBlock.size());
+        BOOST_CHECK(std::equal(raw.begin(), raw.end(), (const unsigned char*)&ssBlock[0]));
+    }
+
+    // Positions that do not hold a block are rejected
+    CRawBlock raw;
+    CDiskBlockPos pos = chainActive.Tip()->GetBlockPos();
+    pos.nPos += 1;
+    BOOST_CHECK(!blockFileMapper.ReadRawBlock(raw, pos, chainparams.MessageStart()));
+    BOOST_CHECK(raw.empty());
+    pos.nFile += 1;
+    BOOST_CHECK(!blockFileMapper.ReadRawBlock(raw, pos, chainparams.MessageStart()));
+
+    // Handed out blocks outlive their file's mapping
+    BOOST_CHECK(ReadRawBlockFromDisk(raw, chainActive.Tip(), chainparams));
+    blockFileMapper.Forget(chainActive.Tip()->GetBlockPos().nFile);
+    CBlock block;
+    CSpanReader reader(SER_DISK, CLIENT_VERSION, raw.begin(), raw.end());
+    reader >> block;
+    BOOST_CHECK(reader.empty());
+    BOOST_CHECK(block.GetHash() == chainActive.Tip()->GetBlockHash());
+}
+
+BOOST_AUTO_TEST_CASE(strip_witness)
+{
+    // A block with and without witness data, and a transaction with an empty witness
+    CBlock block;
+    {
+        LOCK(cs_main);
+        BOOST_CHECK(ReadBlockFromDisk(block, chainActive.Tip(), Params().GetConsensus()));
+    }
+    CMutableTransaction tx;
+    tx.vin.resize(2);
+    tx.vin[0].prevout = COutPoint(block.vtx[0]->GetHash(), 0);
+    tx.vin[0].scriptWitness.stack.push_back(std::vector<unsigned char>(72, 1));
+    tx.vin[0].scriptWitness.stack.push_back(std::vector<unsigned char>(300, 2));
+    tx.vin[1].prevout = COutPoint(block.vtx[0]->GetHash(), 1);
+    tx.vin[1].scriptSig = CScript() << OP_TRUE;
+    tx.vout.resize(1);
+    tx.vout[0].scriptPubKey = CScript() << OP_TRUE;
+    tx.nLockTime = 17;
+    block.vtx.push_back(MakeTransactionRef(tx));
+    tx.vin.resize(1);
+    tx.vin[0].scriptWitness.SetNull();
+    block.vtx.push_back(MakeTransactionRef(tx));
+
+    CDataStream ssWitness(SER_NETWORK, PROTOCOL_VERSION);
+    ssWitness << block;
+    CDataStream ssNoWitness(SER_NETWORK, PROTOCOL_VERSION | SERIALIZE_TRANSACTION_NO_WITNESS);
+    ssNoWitness << block;
+    BOOST_CHECK(ssWitness.size() > ssNoWitness.size());
+
+    const unsigned char* pbegin = (const unsigned char*)&ssWitness[0];
+    const unsigned char* pend = pbegin + ssWitness.size();
+    std::vector<unsigned char> vchStripped;
+    BOOST_CHECK(StripBlockWitness(pbegin, pend, vchStripped));
+    BOOST_CHECK(vchStripped == std::vector<unsigned char>(ssNoWitness.begin(), ssNoWitness.end()));
+
+    // Stripping is a no-op for blocks without witness data
+    std::vector<unsigned char> vchStrippedTwice;
+    BOOST_CHECK(StripBlockWitness(vchStripped.data(), vchStripped.data() + vchStripped.size(), vchStrippedTwice));
+    BOOST_CHECK(vchStrippedTwice == vchStripped);
+
+    // Anything shorter or longer than a block is rejected
+    for (const unsigned char* p = pbegin; p < pend; p++)
+        BOOST_CHECK(!StripBlockWitness(pbegin, p, vchStripped));
+    ssWitness << (unsigned char)0;
+    pbegin = (const unsigned char*)&ssWitness[0];
+    BOOST_CHECK(!StripBlockWitness(pbegin, pbegin + ssWitness.size(), vchStripped));
+}
+
+BOOST_AUTO_TEST_SUITE_END()
@@ -0,0 +1,95 @@
+// Copyright (c) 2017 The Bitcoin Core developers
+// Distributed under the MIT software license, see the accompanying
+// file COPYING or http://www.opensource.org/licenses/mit-license.php.
+
+#include "checkqueue.h"
+
+#include "test/test_bitcoin.h"
+
+#include <atomic>
+#include <vector>
+
+#include <boost/bind.hpp>
+#include <boost/thread.hpp>
+#include <boost/test/unit_test.hpp>
+
+BOOST_FIXTURE_TEST_SUITE(checkqueue_tests, BasicTestingSetup)
+
+/** Counts its executions; fails if constructed with fOk false. */
+struct CountingCheck
+{
+    std::atomic<int>* pnCalls;
+    bool fOk;
+
+    CountingCheck() : pnCalls(NULL), fOk(true) {}
+    CountingCheck(std::atomic<int>* pnCallsIn, bool fOkIn) : pnCalls(pnCallsIn), fOk(fOkIn) {}
+
+    bool operator()()
+    {
+        if (pnCalls)
+            (*pnCalls)++;
+        return fOk;
+    }
+
+    void swap(CountingCheck& x)
+    {
+        std::swap(pnCalls, x.pnCalls);
+        std::swap(fOk, x.fOk);
+    }
+};
+
+static bool RunChecks(CCheckQueue<CountingCheck>& queue, std::atomic<int>& nCalls, int nChecks, int nBatch, int nFailAt)
+{
+    CCheckQueueControl<CountingCheck> control(&queue);
+    for (int i = 0; i < nChecks; i += nBatch) {
+        std::vector<CountingCheck> vChecks;
+        for (int j = i; j < std::min(nChecks, i + nBatch); j++)
+            vChecks.push_back(CountingCheck(&nCalls, j != nFailAt));
+        control.Add(vChecks);
+    }
+    return control.Wait();
+}
+
+static void TestCheckQueue(int nThreads)
+{
+    CCheckQueue<CountingCheck> queue(16);
+    boost::thread_group threadGroup;
+    for (int i = 0; i < nThreads - 1; i++)
+        threadGroup.create_thread(boost::bind(&CCheckQueue<CountingCheck>::Thread, boost::ref(queue)));
+
+    // Every check runs exactly once, in batches of any size, and also when
+    // there are more than the per-thread queues can hold.
+    const int sizes[] = {0, 1, 7, 100, 10000};
+    BOOST_FOREACH(int nChecks, sizes) {
+        for (int nBatch = 1; nBatch <= 1000; nBatch *= 10) {
+            std::atomic<int> nCalls(0);
+            BOOST_CHECK(RunChecks(queue, nCalls, nChecks, nBatch, -1));
+            BOOST_CHECK_EQUAL(nCalls.load(), nChecks);
+            BOOST_CHECK(queue.IsIdle());
+        }
+    }
+
+    // A failure anywhere is reported, and does not leak into the next run.
+    std::atomic<int> nCalls(0);
+    BOOST_CHECK(!RunChecks(queue, nCalls, 1000, 3, 500));
+    BOOST_CHECK(queue.IsIdle());
+    BOOST_CHECK(!RunChecks(queue, nCalls, 1000, 3, 0));
+    BOOST_CHECK(!RunChecks(queue, nCalls, 1000, 3, 999));
+    BOOST_CHECK(RunChecks(queue, nCalls, 1000, 3, -1));
+
+    threadGroup.interrupt_all();
+    threadGroup.join_all();
+}
+
+BOOST_AUTO_TEST_CASE(checkqueue_master_only)
+{
+    TestCheckQueue(1);
+}
+
+BOOST_AUTO_TEST_CASE(checkqueue_workers)
+{
+    TestCheckQueue(2);
+    TestCheckQueue(8);
+}
+
+BOOST_AUTO_TEST_SUITE_END()
@@ -2,13 +2,20 @@
 // Distributed under the MIT software license, see the accompanying
 // file COPYING or http://www.opensource.org/licenses/mit-license.php.
 
+#if defined(HAVE_CONFIG_H)
+#include "config/bitcoin-config.h"
+#endif
+
+#include "compat/cpuid.h"
 #include "crypto/aes.h"
+#include "crypto/common.h"
 #include "crypto/ripemd160.h"
 #include "crypto/sha1.h"
 #include "crypto/sha256.h"
 #include "crypto/sha512.h"
 #include "crypto/hmac_sha256.h"
 #include "crypto/hmac_sha512.h"
+#include "hash.h"
 #include "utilstrencodings.h"
 #include "test/test_bitcoin.h"
 #include "test/test_random.h"
@@ -20,6 +27,29 @@
 #include <openssl/aes.h>
 #include <openssl/evp.h>
 
+#if defined(HAVE_GETCPUID)
+#if defined(ENABLE_SSE41)
+namespace sha256d64_sse41
+{
+void Transform_4way(unsigned char* out, const unsigned char* in);
+}
+#endif
+
+#if defined(ENABLE_AVX2)
+namespace sha256d64_avx2
+{
+void Transform_8way(unsigned char* out, const unsigned char* in);
+}
+#endif
+
+#if defined(ENABLE_SHANI)
+namespace sha256_shani
+{
+void Transform(uint32_t* s, const unsigned char* chunk, size_t blocks);
+}
+#endif
+#endif
+
 BOOST_FIXTURE_TEST_SUITE(crypto_tests, BasicTestingSetup)
 
 template<typename Hasher, typename In, typename Out>
@@ -292,6 +322,111 @@ BOOST_AUTO_TEST_CASE(sha512_testvectors) {
                "37de8c3ef5459d76a52cedc02dc499a3c9ed9dedbfb3281afd9653b8a112fafc");
 }
 
+BOOST_AUTO_TEST_CASE(sha256d64)
+{
+    // Fixed inputs: bytes 0x00..0x3f, and 64 zero bytes.
+    unsigned char in[128];
+    unsigned char out[64];
+    for (int i = 0; i < 64; ++i) {
+        in[i] = i;
+        in[64 + i] = 0;
+    }
+    SHA256D64(out, in, 2);
+    BOOST_CHECK_EQUAL(HexStr(out, out + 32), "01c9f464780a1b6af4eb400fe2f2896cfb2169f5a65701439e4c2c4e213903ef");
+    BOOST_CHECK_EQUAL(HexStr(out + 32, out + 64), "e2f61c3f71d1defd3fa999dfa36953755c690689799962b48bebd836974e8cf9");
+
+    // Random inputs of every batch size up to 32, compared against CHash256.
+    // This covers the multi-way kernels as well as the remainders they leave.
+    for (int i = 0; i <= 32; ++i) {
+        unsigned char in[64 * 32];
+        unsigned char out1[32 * 32], out2[32 * 32];
+        for (int j = 0; j < 64 * i; ++j) {
+            in[j] = insecure_rand();
+        }
+        for (int j = 0; j < i; ++j) {
+            CHash256().Write(in + 64 * j, 64).Finalize(out1 + 32 * j);
+        }
+        SHA256D64(out2, in, i);
+        BOOST_CHECK(memcmp(out1, out2, 32 * i) == 0);
+    }
+}
+
+#if defined(HAVE_GETCPUID) && (defined(ENABLE_SSE41) || defined(ENABLE_AVX2))
+/** Check a multi-way double-SHA256 kernel of nWays 64-byte blobs against CHash256 */
+static void TestTransformD64(void (*transform)(unsigned char*, const unsigned char*), int nWays)
+{
+    std::vector<unsigned char> in(64 * nWays), out1(32 * nWays), out2(32 * nWays);
+    for (int i = 0; i < 16; ++i) {
+        for (size_t j = 0; j < in.size(); ++j) {
+            in[j] = insecure_rand();
+        }
+        for (int j = 0; j < nWays; ++j) {
+            CHash256().Write(&in[64 * j], 64).Finalize(&out1[32 * j]);
+        }
+        transform(&out2[0], &in[0]);
+        BOOST_CHECK(out1 == out2);
+    }
+}
+#endif
+
+#if defined(HAVE_GETCPUID) && defined(ENABLE_SHANI)
+/** Check a single-way SHA256 compression function against CSHA256, on padded messages of 0 to 199 bytes */
+static void TestTransform(void (*transform)(uint32_t*, const unsigned char*, size_t))
+{
+    for (size_t nSize = 0; nSize < 200; ++nSize) {
+        std::vector<unsigned char> msg(nSize);
+        for (size_t j = 0; j < nSize; ++j) {
+            msg[j] = insecure_rand();
+        }
+        unsigned char expected[32];
+        CSHA256().Write(msg.data(), msg.size()).Finalize(expected);
+
+        // Padding: 0x80, zeroes, and the length in bits, to a multiple of 64 bytes
+        std::vector<unsigned char> padded(msg);
+        padded.push_back(0x80);
+        while (padded.size() % 64 != 56) {
+            padded.push_back(0);
+        }
+        for (int j = 7; j >= 0; --j) {
+            padded.push_back(((uint64_t)nSize * 8) >> (8 * j));
+        }
+
+        uint32_t s[8] = {0x6a09e667ul, 0xbb67ae85ul, 0x3c6ef372ul, 0xa54ff53aul, 0x510e527ful, 0x9b05688cul, 0x1f83d9abul, 0x5be0cd19ul};
+        transform(s, padded.data(), padded.size() / 64);
+        unsigned char hash[32];
+        for (int j = 0; j < 8; ++j) {
+            WriteBE32(hash + 4 * j, s[j]);
+        }
+        BOOST_CHECK(memcmp(hash, expected, 32) == 0);
+    }
+}
+#endif
+
+BOOST_AUTO_TEST_CASE(sha256_kernels)
+{
+    // SHA256AutoDetect picks at most one kernel per width, so call every
+    // kernel this CPU supports directly.
+#if defined(HAVE_GETCPUID)
+    const CPUFeatures features = GetCPUFeatures();
+    (void)features;
+#if defined(ENABLE_SSE41)
+    if (features.fSSE41) {
+        TestTransformD64(sha256d64_sse41::Transform_4way, 4);
+    }
+#endif
+#if defined(ENABLE_AVX2)
+    if (features.fAVX2) {
+        TestTransformD64(sha256d64_avx2::Transform_8way, 8);
+    }
+#endif
+#if defined(ENABLE_SHANI)
+    if (features.fSHANI) {
+        TestTransform(sha256_shani::Transform);
+    }
+#endif
+#endif
+}
+
 BOOST_AUTO_TEST_CASE(hmac_sha256_testvectors) {
     // test cases 1, 2, 3, 4, 6 and 7 of RFC 4231
     TestHMACSHA256("0b0b0b0b0b0b0b0b0b0b0b0b0b0b0b0b0b0b0b0b",
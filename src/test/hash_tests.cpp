@@ -3,8 +3,10 @@
 // file COPYING or http://www.opensource.org/licenses/mit-license.php.
 
 #include "hash.h"
+#include "random.h"
 #include "utilstrencodings.h"
 #include "test/test_bitcoin.h"
+#include "test/test_random.h"
 
 #include <vector>
 
@@ -130,6 +132,45 @@ BOOST_AUTO_TEST_CASE(siphash)
     tx.nVersion = 1;
     ss << tx;
     BOOST_CHECK_EQUAL(SipHashUint256(1, 2, ss.GetHash()), 0x79751e980c2a0a35ULL);
+
+    // Check that the specialized outpoint hash matches the generic hasher
+    uint256 h = uint256S("1f1e1d1c1b1a191817161514131211100f0e0d0c0b0a09080706050403020100");
+    static const unsigned char extra[4] = {0x20, 0x21, 0x22, 0x23};
+    CSipHasher hasher4(0x0706050403020100ULL, 0x0F0E0D0C0B0A0908ULL);
+    hasher4.Write(h.GetUint64(0)).Write(h.GetUint64(1)).Write(h.GetUint64(2)).Write(h.GetUint64(3)).Write(extra, 4);
+    BOOST_CHECK_EQUAL(SipHashUint256Extra(0x0706050403020100ULL, 0x0F0E0D0C0B0A0908ULL, h, 0x23222120), hasher4.Finalize());
+}
+
+BOOST_AUTO_TEST_CASE(siphash_batch)
+{
+    // The batch functions must agree with the single value ones for every
+    // count, including the values left over after the multi-way kernels.
+    std::vector<uint256> vals(37);
+    std::vector<uint32_t> extras(vals.size());
+    for (size_t i = 0; i < vals.size(); i++) {
+        vals[i] = GetRandHash();
+        extras[i] = insecure_rand();
+    }
+    uint64_t k0 = GetRand(std::numeric_limits<uint64_t>::max());
+    uint64_t k1 = GetRand(std::numeric_limits<uint64_t>::max());
+    for (size_t count = 0; count <= vals.size(); count++) {
+        std::vector<uint64_t> out(count + 1, 0x5555555555555555ULL);
+        SipHashUint256Batch(k0, k1, vals.data(), count, out.data());
+        for (size_t i = 0; i < count; i++)
+            BOOST_CHECK_EQUAL(out[i], SipHashUint256(k0, k1, vals[i]));
+        BOOST_CHECK_EQUAL(out[count], 0x5555555555555555ULL);
+
+        SipHashUint256ExtraBatch(k0, k1, vals.data(), extras.data(), count, out.data());
+        for (size_t i = 0; i < count; i++)
+            BOOST_CHECK_EQUAL(out[i], SipHashUint256Extra(k0, k1, vals[i], extras[i]));
+        BOOST_CHECK_EQUAL(out[count], 0x5555555555555555ULL);
+    }
+
+    // Test vector through a batch, at an offset that is handled by a multi-way kernel
+    std::vector<uint256> vec(8, uint256S("1f1e1d1c1b1a191817161514131211100f0e0d0c0b0a09080706050403020100"));
+    std::vector<uint64_t> out(vec.size());
+    SipHashUint256Batch(0x0706050403020100ULL, 0x0F0E0D0C0B0A0908ULL, vec.data(), vec.size(), out.data());
+    BOOST_CHECK_EQUAL(out[5], 0x7127512f72f27cceull);
 }
 
 BOOST_AUTO_TEST_SUITE_END()
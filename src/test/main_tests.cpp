@@ -2,9 +2,16 @@
 // Distributed under the MIT software license, see the accompanying
 // file COPYING or http://www.opensource.org/licenses/mit-license.php.
 
+#include "blockencodings.h"
 #include "chainparams.h"
 #include "validation.h"
 #include "net.h"
+#include "net_processing.h"
+#include "netbase.h"
+#include "netmessagemaker.h"
+#include "random.h"
+#include "script/interpreter.h"
+#include "validationinterface.h"
 
 #include "test/test_bitcoin.h"
 
@@ -73,4 +80,192 @@ BOOST_AUTO_TEST_CASE(test_combiner_all)
     Test.disconnect(&ReturnTrue);
     BOOST_CHECK(Test());
 }
+
+struct NewPoWValidBlockListener : public CValidationInterface
+{
+    std::vector<uint256> vHashes;
+
+protected:
+    void NewPoWValidBlock(const CBlockIndex *pindex, const CBlock& block)
+    {
+        BOOST_CHECK(pindex->GetBlockHash() == block.GetHash());
+        vHashes.push_back(block.GetHash());
+    }
+};
+
+BOOST_FIXTURE_TEST_CASE(new_pow_valid_block, TestChain100Setup)
+{
+    NewPoWValidBlockListener listener;
+    RegisterValidationInterface(&listener);
+    CScript scriptPubKey = CScript() << ToByteVector(coinbaseKey.GetPubKey()) << OP_CHECKSIG;
+
+    CBlock block = CreateAndProcessBlock(std::vector<CMutableTransaction>(), scriptPubKey);
+    BOOST_CHECK(chainActive.Tip()->GetBlockHash() == block.GetHash());
+    BOOST_REQUIRE_EQUAL(listener.vHashes.size(), 1);
+    BOOST_CHECK(listener.vHashes[0] == block.GetHash());
+
+    // A block that only fails when it is connected is announced before that
+    CMutableTransaction tx;
+    tx.vin.resize(1);
+    tx.vin[0].prevout = COutPoint(GetRandHash(), 0);
+    tx.vin[0].scriptSig = CScript() << OP_TRUE;
+    tx.vout.resize(1);
+    tx.vout[0].nValue = 1;
+    tx.vout[0].scriptPubKey = scriptPubKey;
+    CBlock invalid = CreateAndProcessBlock(std::vector<CMutableTransaction>(1, tx), scriptPubKey);
+    BOOST_CHECK(chainActive.Tip()->GetBlockHash() == block.GetHash());
+    BOOST_REQUIRE_EQUAL(listener.vHashes.size(), 2);
+    BOOST_CHECK(listener.vHashes[1] == invalid.GetHash());
+
+    UnregisterValidationInterface(&listener);
+}
+
+#ifndef WIN32
+// Process a message as if node had sent it to us
+template <typename... Args>
+static void ReceiveMessage(CNode& node, CConnman& connman, const std::string& strCommand, Args&&... args)
+{
+    QueueReceivedMessage(node, CNetMsgMaker(PROTOCOL_VERSION).Make(strCommand, std::forward<Args>(args)...));
+    LOCK(node.cs_vRecvMsg);
+    for (size_t i = node.vRecvMsg.size(); i > 0; i--)
+        ProcessMessages(&node, connman);
+    BOOST_CHECK(node.vRecvMsg.empty());
+}
+
+// The messages we sent to a node, read from the other end of its socket
+static std::vector<std::pair<std::string, CDataStream> > ReadSentMessages(SOCKET hSocket)
+{
+    std::vector<char> vData;
+    char buf[0x10000];
+    ssize_t nBytes;
+    while ((nBytes = recv(hSocket, buf, sizeof(buf), MSG_DONTWAIT)) > 0)
+        vData.insert(vData.end(), buf, buf + nBytes);
+
+    std::vector<std::pair<std::string, CDataStream> > vMessages;
+    CDataStream ss(vData, SER_NETWORK, PROTOCOL_VERSION);
+    while (!ss.empty()) {
+        CMessageHeader hdr(Params().MessageStart());
+        ss >> hdr;
+        std::vector<char> vPayload(hdr.nMessageSize);
+        if (!vPayload.empty())
+            ss.read(&vPayload[0], vPayload.size());
+        vMessages.emplace_back(hdr.GetCommand(), CDataStream(vPayload, SER_NETWORK, PROTOCOL_VERSION));
+    }
+    return vMessages;
+}
+
+BOOST_FIXTURE_TEST_CASE(fast_relay_compact_block, TestChain100Setup)
+{
+    // The peer compact blocks come from, and a whitelisted peer they are
+    // forwarded to, whose messages we read back
+    int sockets[2];
+    BOOST_REQUIRE(socketpair(AF_UNIX, SOCK_STREAM, 0, sockets) == 0);
+    PeerLogicValidation peerLogic(connman);
+    RegisterValidationInterface(&peerLogic);
+    ForceSetArg("-whitelistfastcmpctrelay", "1");
+    CScript scriptPubKey = CScript() << ToByteVector(coinbaseKey.GetPubKey()) << OP_CHECKSIG;
+
+    CNode nodeFrom(1000, NODE_NETWORK, 0, INVALID_SOCKET, CAddress(LookupNumeric("1.2.3.4"), NODE_NETWORK), 0, 0, "", true);
+    CNode nodeTo(1001, NODE_NETWORK, 0, sockets[0], CAddress(LookupNumeric("1.2.3.5"), NODE_NETWORK), 1, 1, "", true);
+    nodeTo.fWhitelisted = true;
+    for (CNode* pnode : {&nodeFrom, &nodeTo}) {
+        pnode->nVersion = PROTOCOL_VERSION;
+        pnode->SetSendVersion(PROTOCOL_VERSION);
+        pnode->SetRecvVersion(PROTOCOL_VERSION);
+        pnode->fSuccessfullyConnected = true;
+        GetNodeSignals().InitializeNode(pnode, *connman);
+        CConnmanTest::AddNode(*pnode);
+    }
+    ReceiveMessage(nodeFrom, *connman, NetMsgType::SENDCMPCT, false, (uint64_t)1);
+    ReceiveMessage(nodeTo, *connman, NetMsgType::SENDCMPCT, true, (uint64_t)1);
+    ReceiveMessage(nodeTo, *connman, NetMsgType::HEADERS, std::vector<CBlock>(1, CBlock(chainActive.Tip()->GetBlockHeader())));
+    std::vector<std::pair<std::string, CDataStream> > vSent = ReadSentMessages(sockets[1]);
+
+    // A block with a transaction we do not have is forwarded before we can
+    // reconstruct it. Its transactions are sent on once we have them.
+    CMutableTransaction spend;
+    spend.vin.resize(1);
+    spend.vin[0].prevout = COutPoint(coinbaseTxns[0].GetHash(), 0);
+    spend.vout.resize(1);
+    spend.vout[0].nValue = 11*CENT;
+    spend.vout[0].scriptPubKey = scriptPubKey;
+    std::vector<unsigned char> vchSig;
+    uint256 hash = SignatureHash(scriptPubKey, spend, 0, SIGHASH_ALL, 0, SIGVERSION_BASE);
+    BOOST_CHECK(coinbaseKey.Sign(hash, vchSig));
+    vchSig.push_back((unsigned char)SIGHASH_ALL);
+    spend.vin[0].scriptSig << vchSig;
+    CBlock block = CreateBlock(std::vector<CMutableTransaction>(1, spend), scriptPubKey);
+
+    BlockTransactionsRequest req;
+    req.blockhash = block.GetHash();
+    req.indexes.push_back(1);
+    BlockTransactions resp(req);
+    resp.txn[0] = block.vtx[1];
+
+    ReceiveMessage(nodeFrom, *connman, NetMsgType::CMPCTBLOCK, CBlockHeaderAndShortTxIDs(block, false));
+    vSent = ReadSentMessages(sockets[1]);
+    BOOST_CHECK(vSent.size() == 1 && vSent[0].first == NetMsgType::CMPCTBLOCK);
+    ReceiveMessage(nodeTo, *connman, NetMsgType::GETBLOCKTXN, req);
+    BOOST_CHECK(ReadSentMessages(sockets[1]).empty());
+
+    ReceiveMessage(nodeFrom, *connman, NetMsgType::BLOCKTXN, resp);
+    BOOST_CHECK(chainActive.Tip()->GetBlockHash() == block.GetHash());
+    vSent = ReadSentMessages(sockets[1]);
+    BOOST_CHECK(vSent.size() == 1 && vSent[0].first == NetMsgType::BLOCKTXN);
+    BlockTransactions sent;
+    if (!vSent.empty())
+        vSent[0].second >> sent;
+    BOOST_CHECK(sent.blockhash == block.GetHash());
+    BOOST_CHECK(sent.txn.size() == 1 && sent.txn[0]->GetHash() == spend.GetHash());
+
+    // A block that turns out invalid: the peers waiting for its transactions
+    // get them all the same, rather than wait for them forever
+    CMutableTransaction negative;
+    negative.vin.resize(1);
+    negative.vin[0].prevout = COutPoint(coinbaseTxns[1].GetHash(), 0);
+    negative.vout.resize(1);
+    negative.vout[0].nValue = -1;
+    negative.vout[0].scriptPubKey = scriptPubKey;
+    CBlock invalid = CreateBlock(std::vector<CMutableTransaction>(1, negative), scriptPubKey);
+    req.blockhash = invalid.GetHash();
+    resp = BlockTransactions(req);
+    resp.txn[0] = invalid.vtx[1];
+
+    ReceiveMessage(nodeFrom, *connman, NetMsgType::CMPCTBLOCK, CBlockHeaderAndShortTxIDs(invalid, false));
+    vSent = ReadSentMessages(sockets[1]);
+    BOOST_CHECK(vSent.size() == 1 && vSent[0].first == NetMsgType::CMPCTBLOCK);
+    ReceiveMessage(nodeTo, *connman, NetMsgType::GETBLOCKTXN, req);
+    BOOST_CHECK(ReadSentMessages(sockets[1]).empty());
+
+    ReceiveMessage(nodeFrom, *connman, NetMsgType::BLOCKTXN, resp);
+    BOOST_CHECK(chainActive.Tip()->GetBlockHash() == block.GetHash());
+    vSent = ReadSentMessages(sockets[1]);
+    BOOST_CHECK(vSent.size() == 1 && vSent[0].first == NetMsgType::BLOCKTXN);
+    BlockTransactions sentInvalid;
+    if (!vSent.empty())
+        vSent[0].second >> sentInvalid;
+    BOOST_CHECK(sentInvalid.blockhash == invalid.GetHash());
+    BOOST_CHECK(sentInvalid.txn.size() == 1 && sentInvalid.txn[0]->GetHash() == negative.GetHash());
+
+    // Asking again gets no answer, as we do not have the block
+    ReceiveMessage(nodeTo, *connman, NetMsgType::GETBLOCKTXN, req);
+    BOOST_CHECK(ReadSentMessages(sockets[1]).empty());
+
+    // Compact blocks from the peer that relayed the invalid block are not
+    // forwarded any more
+    spend.vin[0].prevout = COutPoint(coinbaseTxns[2].GetHash(), 0);
+    CBlock next = CreateBlock(std::vector<CMutableTransaction>(1, spend), scriptPubKey);
+    ReceiveMessage(nodeFrom, *connman, NetMsgType::CMPCTBLOCK, CBlockHeaderAndShortTxIDs(next, false));
+    BOOST_CHECK(ReadSentMessages(sockets[1]).empty());
+
+    CConnmanTest::ClearNodes();
+    bool fUpdateConnectionTime = false;
+    GetNodeSignals().FinalizeNode(nodeFrom.GetId(), fUpdateConnectionTime);
+    GetNodeSignals().FinalizeNode(nodeTo.GetId(), fUpdateConnectionTime);
+    close(sockets[1]);
+    ForceSetArg("-whitelistfastcmpctrelay", "0");
+    UnregisterValidationInterface(&peerLogic);
+}
+#endif
+
 BOOST_AUTO_TEST_SUITE_END()
@@ -0,0 +1,159 @@
+// Copyright (c) 2017 The Bitcoin Core developers
+// Distributed under the MIT software license, see the accompanying
+// file COPYING or http://www.opensource.org/licenses/mit-license.php.
+
+#include "consensus/validation.h"
+#include "key.h"
+#include "validation.h"
+#include "pubkey.h"
+#include "txmempool.h"
+#include "script/standard.h"
+#include "test/test_bitcoin.h"
+
+#include <boost/test/unit_test.hpp>
+
+BOOST_FIXTURE_TEST_SUITE(mempool_persist_tests, TestChain100Setup)
+
+static CMutableTransaction Spend(const COutPoint& prevout, CAmount nValue, const CScript& scriptPubKey, const CKey& key)
+{
+    CMutableTransaction tx;
+    tx.nVersion = 1;
+    tx.vin.resize(1);
+    tx.vin[0].prevout = prevout;
+    tx.vout.resize(1);
+    tx.vout[0].nValue = nValue;
+    tx.vout[0].scriptPubKey = scriptPubKey;
+
+    std::vector<unsigned char> vchSig;
+    uint256 hash = SignatureHash(scriptPubKey, tx, 0, SIGHASH_ALL, 0, SIGVERSION_BASE);
+    BOOST_CHECK(key.Sign(hash, vchSig));
+    vchSig.push_back((unsigned char)SIGHASH_ALL);
+    tx.vin[0].scriptSig << vchSig;
+    return tx;
+}
+
+BOOST_AUTO_TEST_CASE(dump_and_load)
+{
+    CScript scriptPubKey = CScript() << ToByteVector(coinbaseKey.GetPubKey()) << OP_CHECKSIG;
+    // Mature the second coinbase too
+    CreateAndProcessBlock(std::vector<CMutableTransaction>(), scriptPubKey);
+
+    // A parent and child, and a transaction that gets mined while the node
+    // is "down"
+    CMutableTransaction txParent = Spend(COutPoint(coinbaseTxns[0].GetHash(), 0), 40 * COIN, scriptPubKey, coinbaseKey);
+    CMutableTransaction txChild = Spend(COutPoint(txParent.GetHash(), 0), 39 * COIN, scriptPubKey, coinbaseKey);
+    CMutableTransaction txMined = Spend(COutPoint(coinbaseTxns[1].GetHash(), 0), 40 * COIN, scriptPubKey, coinbaseKey);
+    {
+        LOCK(cs_main);
+        CValidationState state;
+        BOOST_CHECK(AcceptToMemoryPool(mempool, state, txParent, false, NULL, true, 0));
+        BOOST_CHECK(AcceptToMemoryPool(mempool, state, txChild, false, NULL, true, 0));
+        BOOST_CHECK(AcceptToMemoryPool(mempool, state, txMined, false, NULL, true, 0));
+    }
+    double dPriorityDummy = 0;
+    mempool.PrioritiseTransaction(txChild.GetHash(), txChild.GetHash().ToString(), dPriorityDummy, 12345);
+    // And a delta on a transaction not in the mempool
+    uint256 hashOther = uint256S("01");
+    mempool.PrioritiseTransaction(hashOther, hashOther.ToString(), dPriorityDummy, 678);
+
+    CTxMemPoolEntry parentEntry = *mempool.mapTx.find(txParent.GetHash());
+    CTxMemPoolEntry childEntry = *mempool.mapTx.find(txChild.GetHash());
+
+    DumpMempool();
+    mempool.clear();
+    mempool.ClearPrioritisation(txChild.GetHash());
+    mempool.ClearPrioritisation(hashOther);
+
+    std::vector<CMutableTransaction> vMined;
+    vMined.push_back(txMined);
+    CreateAndProcessBlock(vMined, scriptPubKey);
+    BOOST_CHECK_EQUAL(mempool.size(), 0);
+
+    BOOST_CHECK(LoadMempool());
+    BOOST_CHECK_EQUAL(mempool.size(), 2);
+    BOOST_CHECK(!mempool.exists(txMined.GetHash()));
+
+    CTxMemPool::txiter it = mempool.mapTx.find(txParent.GetHash());
+    BOOST_REQUIRE(it != mempool.mapTx.end());
+    BOOST_CHECK_EQUAL(it->GetFee(), parentEntry.GetFee());
+    BOOST_CHECK_EQUAL(it->GetTime(), parentEntry.GetTime());
+    BOOST_CHECK_EQUAL(it->GetHeight(), parentEntry.GetHeight());
+    BOOST_CHECK_EQUAL(it->GetSigOpCost(), parentEntry.GetSigOpCost());
+    BOOST_CHECK(it->GetSpendsCoinbase());
+
+    it = mempool.mapTx.find(txChild.GetHash());
+    BOOST_REQUIRE(it != mempool.mapTx.end());
+    BOOST_CHECK_EQUAL(it->GetFee(), childEntry.GetFee());
+    BOOST_CHECK_EQUAL(it->GetModifiedFee(), childEntry.GetFee() + 12345);
+    BOOST_CHECK_EQUAL(it->GetCountWithAncestors(), 2);
+    BOOST_CHECK(!it->GetSpendsCoinbase());
+
+    CAmount nDelta = 0;
+    mempool.ApplyDeltas(hashOther, dPriorityDummy, nDelta);
+    BOOST_CHECK_EQUAL(nDelta, 678);
+    mempool.check(pcoinsTip);
+
+    // Loading a file from the future does nothing
+    mempool.clear();
+    {
+        CAutoFile file(fopen((GetDataDir() / "mempool.dat").string().c_str(), "wb"), SER_DISK, CLIENT_VERSION);
+        file << (uint64_t)3;
+    }
+    BOOST_CHECK(!LoadMempool());
+    BOOST_CHECK_EQUAL(mempool.size(), 0);
+    mempool.ClearPrioritisation(txChild.GetHash());
+    mempool.ClearPrioritisation(hashOther);
+}
+
+BOOST_AUTO_TEST_CASE(load_version_1)
+{
+    CScript scriptPubKey = CScript() << ToByteVector(coinbaseKey.GetPubKey()) << OP_CHECKSIG;
+    CMutableTransaction txParent = Spend(COutPoint(coinbaseTxns[0].GetHash(), 0), 40 * COIN, scriptPubKey, coinbaseKey);
+    CMutableTransaction txChild = Spend(COutPoint(txParent.GetHash(), 0), 39 * COIN, scriptPubKey, coinbaseKey);
+    uint256 hashOther = uint256S("01");
+
+    // As older versions dumped it: transactions with their time and fee
+    // delta, and the deltas of transactions not in the mempool
+    int64_t nTime = GetTime() - 60;
+    {
+        CAutoFile file(fopen((GetDataDir() / "mempool.dat").string().c_str(), "wb"), SER_DISK, CLIENT_VERSION);
+        file << (uint64_t)1;
+        file << (uint64_t)2;
+        file << CTransaction(txParent) << nTime << (int64_t)0;
+        file << CTransaction(txChild) << nTime << (int64_t)12345;
+        std::map<uint256, CAmount> mapDeltas;
+        mapDeltas[hashOther] = 678;
+        file << mapDeltas;
+    }
+
+    BOOST_CHECK(LoadMempool());
+    BOOST_CHECK_EQUAL(mempool.size(), 2);
+    CTxMemPool::txiter it = mempool.mapTx.find(txChild.GetHash());
+    BOOST_REQUIRE(it != mempool.mapTx.end());
+    BOOST_CHECK_EQUAL(it->GetTime(), nTime);
+    BOOST_CHECK_EQUAL(it->GetFee(), 1 * COIN);
+    BOOST_CHECK_EQUAL(it->GetModifiedFee(), 1 * COIN + 12345);
+    BOOST_CHECK_EQUAL(it->GetCountWithAncestors(), 2);
+
+    double dPriorityDummy = 0;
+    CAmount nDelta = 0;
+    mempool.ApplyDeltas(hashOther, dPriorityDummy, nDelta);
+    BOOST_CHECK_EQUAL(nDelta, 678);
+    mempool.check(pcoinsTip);
+
+    // Dumped again in the current version, it loads the same
+    DumpMempool();
+    mempool.clear();
+    mempool.ClearPrioritisation(txChild.GetHash());
+    mempool.ClearPrioritisation(hashOther);
+    BOOST_CHECK(LoadMempool());
+    BOOST_CHECK_EQUAL(mempool.size(), 2);
+    it = mempool.mapTx.find(txChild.GetHash());
+    BOOST_REQUIRE(it != mempool.mapTx.end());
+    BOOST_CHECK_EQUAL(it->GetModifiedFee(), 1 * COIN + 12345);
+    mempool.clear();
+    mempool.ClearPrioritisation(txChild.GetHash());
+    mempool.ClearPrioritisation(hashOther);
+}
+
+BOOST_AUTO_TEST_SUITE_END()
@@ -195,6 +195,7 @@ BOOST_AUTO_TEST_CASE(MempoolIndexingTest)
 
     CTxMemPool::setEntries setAncestorsCalculated;
     std::string dummy;
+    LOCK(pool.cs);
     BOOST_CHECK_EQUAL(pool.CalculateMemPoolAncestors(entry.Fee(2000000LL).FromTx(tx7), setAncestorsCalculated, 100, 1000000, 1000, 1000000, dummy), true);
     BOOST_CHECK(setAncestorsCalculated == setAncestors);
 
@@ -431,6 +432,156 @@ BOOST_AUTO_TEST_CASE(MempoolAncestorIndexingTest)
     CheckSort<ancestor_score>(pool, sortedOrder);
 }
 
+static CMutableTransaction SpendOutputs(const std::vector<COutPoint>& vPrevouts, int nOutputs)
+{
+    CMutableTransaction tx;
+    tx.vin.resize(vPrevouts.size());
+    for (size_t i = 0; i < vPrevouts.size(); i++) {
+        tx.vin[i].prevout = vPrevouts[i];
+        tx.vin[i].scriptSig = CScript() << OP_11;
+    }
+    tx.vout.resize(nOutputs);
+    for (int i = 0; i < nOutputs; i++) {
+        tx.vout[i].scriptPubKey = CScript() << OP_11 << OP_EQUAL;
+        tx.vout[i].nValue = COIN;
+    }
+    return tx;
+}
+
+BOOST_AUTO_TEST_CASE(MempoolWalkTest)
+{
+    CTxMemPool pool(CFeeRate(0));
+    TestMemPoolEntryHelper entry;
+    LOCK(pool.cs);
+
+    // Two diamonds: txA -> txB, txC -> txD, and txA, txD -> txE -> txF
+    CMutableTransaction txA = SpendOutputs(std::vector<COutPoint>(), 3);
+    CMutableTransaction txB = SpendOutputs(std::vector<COutPoint>(1, COutPoint(txA.GetHash(), 0)), 1);
+    CMutableTransaction txC = SpendOutputs(std::vector<COutPoint>(1, COutPoint(txA.GetHash(), 1)), 1);
+    std::vector<COutPoint> vPrevoutsD;
+    vPrevoutsD.push_back(COutPoint(txB.GetHash(), 0));
+    vPrevoutsD.push_back(COutPoint(txC.GetHash(), 0));
+    CMutableTransaction txD = SpendOutputs(vPrevoutsD, 1);
+    std::vector<COutPoint> vPrevoutsE;
+    vPrevoutsE.push_back(COutPoint(txD.GetHash(), 0));
+    vPrevoutsE.push_back(COutPoint(txA.GetHash(), 2));
+    CMutableTransaction txE = SpendOutputs(vPrevoutsE, 1);
+    CMutableTransaction txF = SpendOutputs(std::vector<COutPoint>(1, COutPoint(txE.GetHash(), 0)), 1);
+
+    pool.addUnchecked(txA.GetHash(), entry.FromTx(txA));
+    pool.addUnchecked(txB.GetHash(), entry.FromTx(txB));
+    pool.addUnchecked(txC.GetHash(), entry.FromTx(txC));
+    pool.addUnchecked(txD.GetHash(), entry.FromTx(txD));
+    pool.addUnchecked(txE.GetHash(), entry.FromTx(txE));
+
+    CTxMemPool::txiter itA = pool.mapTx.find(txA.GetHash());
+    CTxMemPool::txiter itB = pool.mapTx.find(txB.GetHash());
+    CTxMemPool::txiter itC = pool.mapTx.find(txC.GetHash());
+    CTxMemPool::txiter itD = pool.mapTx.find(txD.GetHash());
+    CTxMemPool::txiter itE = pool.mapTx.find(txE.GetHash());
+
+    CTxMemPool::setEntries setAncestorsD;
+    setAncestorsD.insert(itA);
+    setAncestorsD.insert(itB);
+    setAncestorsD.insert(itC);
+    CTxMemPool::setEntries setAncestorsE = setAncestorsD;
+    setAncestorsE.insert(itD);
+    CTxMemPool::setEntries setAncestorsF = setAncestorsE;
+    setAncestorsF.insert(itE);
+
+    // Each entry is reached once however many paths lead to it
+    BOOST_CHECK_EQUAL(itD->GetCountWithAncestors(), 4);
+    BOOST_CHECK_EQUAL(itE->GetCountWithAncestors(), 5);
+    BOOST_CHECK_EQUAL(itA->GetCountWithDescendants(), 5);
+
+    const uint64_t nNoLimit = std::numeric_limits<uint64_t>::max();
+    std::string dummy;
+    CTxMemPoolEntry entryF = entry.FromTx(txF);
+    for (int i = 0; i < 2; i++) {
+        CTxMemPool::setEntries setAncestors;
+        BOOST_CHECK(pool.CalculateMemPoolAncestors(entryF, setAncestors, nNoLimit, nNoLimit, nNoLimit, nNoLimit, dummy));
+        BOOST_CHECK(setAncestors == setAncestorsF);
+
+        // Walks made while going through the result of another one
+        BOOST_FOREACH(CTxMemPool::txiter it, setAncestors) {
+            CTxMemPool::setEntries setInner;
+            BOOST_CHECK(pool.CalculateMemPoolAncestors(*it, setInner, nNoLimit, nNoLimit, nNoLimit, nNoLimit, dummy, false));
+            BOOST_CHECK_EQUAL(setInner.size(), it->GetCountWithAncestors() - 1);
+            CTxMemPool::setEntries setDescendants;
+            pool.CalculateDescendants(it, setDescendants);
+            BOOST_CHECK_EQUAL(setDescendants.size(), it->GetCountWithDescendants());
+        }
+        setAncestors.clear();
+        BOOST_CHECK(pool.CalculateMemPoolAncestors(*itE, setAncestors, nNoLimit, nNoLimit, nNoLimit, nNoLimit, dummy, false));
+        BOOST_CHECK(setAncestors == setAncestorsE);
+    }
+
+    // The limits count every ancestor once
+    CTxMemPool::setEntries setLimited;
+    BOOST_CHECK(pool.CalculateMemPoolAncestors(entryF, setLimited, 6, nNoLimit, nNoLimit, nNoLimit, dummy));
+    setLimited.clear();
+    BOOST_CHECK(!pool.CalculateMemPoolAncestors(entryF, setLimited, 5, nNoLimit, nNoLimit, nNoLimit, dummy));
+    setLimited.clear();
+    BOOST_CHECK(pool.CalculateMemPoolAncestors(entryF, setLimited, nNoLimit, nNoLimit, 6, nNoLimit, dummy));
+    setLimited.clear();
+    BOOST_CHECK(!pool.CalculateMemPoolAncestors(entryF, setLimited, nNoLimit, nNoLimit, 5, nNoLimit, dummy));
+
+    // Ancestors the caller already has are kept, and those of a direct
+    // parent are still found
+    CTxMemPool::setEntries setPrefilled;
+    setPrefilled.insert(itB);
+    BOOST_CHECK(pool.CalculateMemPoolAncestors(*itD, setPrefilled, nNoLimit, nNoLimit, nNoLimit, nNoLimit, dummy, false));
+    BOOST_CHECK(setPrefilled == setAncestorsD);
+    setPrefilled = setAncestorsE;
+    BOOST_CHECK(pool.CalculateMemPoolAncestors(entryF, setPrefilled, nNoLimit, nNoLimit, nNoLimit, nNoLimit, dummy));
+    BOOST_CHECK(setPrefilled == setAncestorsF);
+    setPrefilled.clear();
+    setPrefilled.insert(itA);
+    BOOST_CHECK(pool.CalculateMemPoolAncestors(*itE, setPrefilled, nNoLimit, nNoLimit, nNoLimit, nNoLimit, dummy, false));
+    BOOST_CHECK(setPrefilled == setAncestorsE);
+    setPrefilled.clear();
+    setPrefilled.insert(itD);
+    BOOST_CHECK(pool.CalculateMemPoolAncestors(*itE, setPrefilled, nNoLimit, nNoLimit, nNoLimit, nNoLimit, dummy, false));
+    BOOST_CHECK(setPrefilled == setAncestorsE);
+
+    // Descendants, both of a fresh walk and on top of ones already known
+    pool.addUnchecked(txF.GetHash(), entryF);
+    CTxMemPool::txiter itF = pool.mapTx.find(txF.GetHash());
+    CTxMemPool::setEntries setDescendants;
+    pool.CalculateDescendants(itA, setDescendants);
+    BOOST_CHECK(setDescendants.size() == 6 && setDescendants.count(itF));
+    setDescendants.clear();
+    pool.CalculateDescendants(itB, setDescendants);
+    pool.CalculateDescendants(itC, setDescendants);
+    BOOST_CHECK_EQUAL(setDescendants.size(), 5);
+    BOOST_CHECK(!setDescendants.count(itA));
+    BOOST_CHECK_EQUAL(itA->GetCountWithDescendants(), 6);
+    BOOST_CHECK_EQUAL(itF->GetCountWithAncestors(), 6);
+
+    // Reinserting a diamond from a disconnected block walks the descendants
+    // of each of its transactions in turn
+    std::vector<CTransactionRef> vtx;
+    vtx.push_back(MakeTransactionRef(txA));
+    vtx.push_back(MakeTransactionRef(txB));
+    vtx.push_back(MakeTransactionRef(txC));
+    pool.removeForBlock(vtx, 1);
+    BOOST_CHECK_EQUAL(pool.size(), 3);
+    std::vector<uint256> vHashesToUpdate;
+    for (size_t i = 0; i < vtx.size(); i++) {
+        pool.addUnchecked(vtx[i]->GetHash(), entry.FromTx(*vtx[i]));
+        vHashesToUpdate.push_back(vtx[i]->GetHash());
+    }
+    pool.UpdateTransactionsFromBlock(vHashesToUpdate);
+    itA = pool.mapTx.find(txA.GetHash());
+    itB = pool.mapTx.find(txB.GetHash());
+    itC = pool.mapTx.find(txC.GetHash());
+    BOOST_CHECK_EQUAL(itA->GetCountWithDescendants(), 6);
+    BOOST_CHECK_EQUAL(itB->GetCountWithDescendants(), 4);
+    BOOST_CHECK_EQUAL(itC->GetCountWithDescendants(), 4);
+    BOOST_CHECK_EQUAL(itD->GetCountWithAncestors(), 4);
+    BOOST_CHECK_EQUAL(itE->GetCountWithAncestors(), 5);
+    BOOST_CHECK_EQUAL(itF->GetCountWithAncestors(), 6);
+}
 
 BOOST_AUTO_TEST_CASE(MempoolSizeLimitTest)
 {
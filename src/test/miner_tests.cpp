@@ -179,6 +179,95 @@ void TestPackageSelection(const CChainParams& chainparams, CScript scriptPubKey,
     BOOST_CHECK(pblocktemplate->block.vtx[8]->GetHash() == hashLowFeeTx2);
 }
 
+// Note that this test assumes blockprioritysize is 0.
+void TestIncrementalAssembly(const CChainParams& chainparams, CScript scriptPubKey, std::vector<CTransactionRef>& txFirst)
+{
+    TestMemPoolEntryHelper entry;
+    const int64_t nTime = GetTime();
+    SetMockTime(nTime);
+    IncrementalBlockAssembler assembler(chainparams);
+    CValidationState state;
+
+    // The first template is always selected from scratch
+    std::unique_ptr<CBlockTemplate> pblocktemplate = assembler.CreateNewBlock(scriptPubKey);
+    BOOST_CHECK_EQUAL(pblocktemplate->block.vtx.size(), 1);
+    BOOST_CHECK_EQUAL(assembler.GetRebuildCount(), 1);
+
+    // A transaction and its child are appended as they arrive
+    CMutableTransaction tx;
+    tx.vin.resize(1);
+    tx.vin[0].scriptSig = CScript() << OP_1;
+    tx.vin[0].prevout.hash = txFirst[0]->GetHash();
+    tx.vin[0].prevout.n = 0;
+    tx.vout.resize(1);
+    tx.vout[0].nValue = 5000000000LL - 10000;
+    uint256 hashParentTx = tx.GetHash();
+    mempool.addUnchecked(hashParentTx, entry.Fee(10000).Time(GetTime()).SpendsCoinbase(true).FromTx(tx));
+    tx.vin[0].prevout.hash = hashParentTx;
+    tx.vout[0].nValue = 5000000000LL - 20000;
+    uint256 hashChildTx = tx.GetHash();
+    mempool.addUnchecked(hashChildTx, entry.Fee(10000).SpendsCoinbase(false).FromTx(tx));
+
+    pblocktemplate = assembler.CreateNewBlock(scriptPubKey);
+    BOOST_CHECK_EQUAL(assembler.GetRebuildCount(), 1);
+    BOOST_REQUIRE_EQUAL(pblocktemplate->block.vtx.size(), 3);
+    BOOST_CHECK(pblocktemplate->block.vtx[1]->GetHash() == hashParentTx);
+    BOOST_CHECK(pblocktemplate->block.vtx[2]->GetHash() == hashChildTx);
+    BOOST_CHECK_EQUAL(pblocktemplate->vTxFees[0], -20000);
+    BOOST_CHECK_EQUAL(pblocktemplate->block.vtx[0]->vout[0].nValue, GetBlockSubsidy(chainActive.Height() + 1, chainparams.GetConsensus()) + 20000);
+    BOOST_CHECK(TestBlockValidity(state, chainparams, pblocktemplate->block, chainActive.Tip(), false, false));
+
+    // A package behind a free transaction cannot be appended...
+    tx.vin[0].prevout.hash = txFirst[1]->GetHash();
+    tx.vout[0].nValue = 5000000000LL;
+    uint256 hashFreeTx = tx.GetHash();
+    mempool.addUnchecked(hashFreeTx, entry.Fee(0).FromTx(tx));
+    tx.vin[0].prevout.hash = hashFreeTx;
+    tx.vout[0].nValue = 5000000000LL - 100000;
+    uint256 hashHighFeeTx = tx.GetHash();
+    mempool.addUnchecked(hashHighFeeTx, entry.Fee(100000).FromTx(tx));
+
+    pblocktemplate = assembler.CreateNewBlock(scriptPubKey);
+    BOOST_CHECK_EQUAL(assembler.GetRebuildCount(), 1);
+    BOOST_CHECK_EQUAL(pblocktemplate->block.vtx.size(), 3);
+
+    // ...but its fees make the next template after BLOCK_TEMPLATE_MIN_REBUILD a full rebuild
+    SetMockTime(nTime + BLOCK_TEMPLATE_MIN_REBUILD);
+    pblocktemplate = assembler.CreateNewBlock(scriptPubKey);
+    BOOST_CHECK_EQUAL(assembler.GetRebuildCount(), 2);
+    BOOST_CHECK_EQUAL(pblocktemplate->block.vtx.size(), 5);
+
+    // Selected transactions leaving the mempool force a rebuild
+    mempool.removeRecursive(*mempool.get(hashChildTx));
+    pblocktemplate = assembler.CreateNewBlock(scriptPubKey);
+    BOOST_CHECK_EQUAL(assembler.GetRebuildCount(), 3);
+    BOOST_CHECK_EQUAL(pblocktemplate->block.vtx.size(), 4);
+    BOOST_CHECK(TestBlockValidity(state, chainparams, pblocktemplate->block, chainActive.Tip(), false, false));
+    pblocktemplate = assembler.CreateNewBlock(scriptPubKey);
+    BOOST_CHECK_EQUAL(assembler.GetRebuildCount(), 3);
+
+    // An appended transaction that makes the block invalid is caught before
+    // the template is handed out, and the next one is selected from scratch
+    tx.vin[0].prevout.hash = txFirst[2]->GetHash();
+    tx.vin[0].prevout.n = 5;
+    tx.vout[0].nValue = 5000000000LL - 10000;
+    uint256 hashMissingInputTx = tx.GetHash();
+    mempool.addUnchecked(hashMissingInputTx, entry.Fee(10000).FromTx(tx));
+    BOOST_CHECK_THROW(assembler.CreateNewBlock(scriptPubKey), std::runtime_error);
+    mempool.removeRecursive(*mempool.get(hashMissingInputTx));
+    pblocktemplate = assembler.CreateNewBlock(scriptPubKey);
+    BOOST_CHECK_EQUAL(assembler.GetRebuildCount(), 4);
+    BOOST_CHECK_EQUAL(pblocktemplate->block.vtx.size(), 4);
+
+    // And the template is selected from scratch every -blocktemplaterebuild seconds
+    SetMockTime(nTime + BLOCK_TEMPLATE_MIN_REBUILD + DEFAULT_BLOCK_TEMPLATE_REBUILD);
+    pblocktemplate = assembler.CreateNewBlock(scriptPubKey);
+    BOOST_CHECK_EQUAL(assembler.GetRebuildCount(), 5);
+    BOOST_CHECK_EQUAL(pblocktemplate->block.vtx.size(), 4);
+
+    SetMockTime(0);
+}
+
 // NOTE: These tests rely on CreateNewBlock doing its own self-validation!
 BOOST_AUTO_TEST_CASE(CreateNewBlock_validity)
 {
@@ -487,6 +576,10 @@ BOOST_AUTO_TEST_CASE(CreateNewBlock_validity)
 
     TestPackageSelection(chainparams, scriptPubKey, txFirst);
 
+    mempool.clear();
+
+    TestIncrementalAssembly(chainparams, scriptPubKey, txFirst);
+
     fCheckpointsEnabled = true;
 }
 
@@ -9,8 +9,21 @@
 #include "serialize.h"
 #include "streams.h"
 #include "net.h"
+#include "net_processing.h"
 #include "netbase.h"
+#include "netmessagemaker.h"
+#include "netpoller.h"
 #include "chainparams.h"
+#include "random.h"
+#include "timedata.h"
+#include "utiltime.h"
+#include "validation.h"
+#include "validationinterface.h"
+
+#include <map>
+#include <set>
+
+#include <boost/bind.hpp>
 
 using namespace std;
 
@@ -174,4 +187,367 @@ BOOST_AUTO_TEST_CASE(cnode_simple_test)
     BOOST_CHECK(pnode2->fFeeler == false);
 }
 
+#ifndef WIN32
+static void CheckSocketPoller(const std::string& mode)
+{
+    std::unique_ptr<CSocketPoller> poller = CreateSocketPoller(mode);
+    BOOST_REQUIRE(poller);
+    BOOST_CHECK_EQUAL(poller->GetName(), mode);
+
+    int fds[2];
+    BOOST_REQUIRE(socketpair(AF_UNIX, SOCK_STREAM, 0, fds) == 0);
+    std::vector<PolledSocket> vSockets;
+
+    // Nothing to receive yet, but the send buffer is empty
+    vSockets.push_back(PolledSocket(fds[0], 1, SOCKET_EVENT_RECV | SOCKET_EVENT_ERR));
+    vSockets.push_back(PolledSocket(fds[1], 2, SOCKET_EVENT_SEND | SOCKET_EVENT_ERR));
+    BOOST_CHECK_EQUAL(poller->Wait(vSockets, 0), 1);
+    BOOST_CHECK_EQUAL(vSockets[0].ready, 0);
+    BOOST_CHECK_EQUAL(vSockets[1].ready, SOCKET_EVENT_SEND);
+
+    char ch = 'x';
+    BOOST_CHECK_EQUAL(send(fds[1], &ch, 1, MSG_NOSIGNAL), 1);
+    vSockets[1].requested = SOCKET_EVENT_ERR;
+    BOOST_CHECK_EQUAL(poller->Wait(vSockets, 1000), 1);
+    BOOST_CHECK_EQUAL(vSockets[0].ready, SOCKET_EVENT_RECV);
+    BOOST_CHECK_EQUAL(vSockets[1].ready, 0);
+    BOOST_CHECK_EQUAL(recv(fds[0], &ch, 1, MSG_DONTWAIT), 1);
+
+    // Close both ends and reuse the descriptor numbers for a new pair, which
+    // must not be mistaken for the old sockets.
+    close(fds[0]);
+    close(fds[1]);
+    int fdsNew[2];
+    BOOST_REQUIRE(socketpair(AF_UNIX, SOCK_STREAM, 0, fdsNew) == 0);
+    vSockets.clear();
+    vSockets.push_back(PolledSocket(fdsNew[0], 3, SOCKET_EVENT_RECV | SOCKET_EVENT_ERR));
+    BOOST_CHECK_EQUAL(send(fdsNew[1], &ch, 1, MSG_NOSIGNAL), 1);
+    BOOST_CHECK_EQUAL(poller->Wait(vSockets, 1000), 1);
+    BOOST_CHECK_EQUAL(vSockets[0].ready, SOCKET_EVENT_RECV);
+
+    // A hung up peer is reported even when not waiting for receiving (select()
+    // only reports out-of-band data as exceptional)
+    close(fdsNew[1]);
+    if (mode != "select") {
+        vSockets[0].requested = SOCKET_EVENT_ERR;
+        BOOST_CHECK_EQUAL(poller->Wait(vSockets, 1000), 1);
+        BOOST_CHECK(vSockets[0].ready & SOCKET_EVENT_ERR);
+    }
+    close(fdsNew[0]);
+
+    // Nothing to wait on just times out
+    vSockets.clear();
+    BOOST_CHECK_EQUAL(poller->Wait(vSockets, 1), 0);
+}
+
+static void CheckRegisteredSocketPoller(const std::string& mode)
+{
+    std::unique_ptr<CSocketPoller> poller = CreateSocketPoller(mode);
+    BOOST_REQUIRE(poller);
+    BOOST_REQUIRE(poller->CanRegister());
+
+    int fds[2];
+    BOOST_REQUIRE(socketpair(AF_UNIX, SOCK_STREAM, 0, fds) == 0);
+    std::vector<SocketEvent> vEvents;
+
+    // An edge-triggered socket reports being writable once
+    BOOST_CHECK(poller->Register(fds[0], 1, SOCKET_EVENT_RECV | SOCKET_EVENT_SEND, true));
+    BOOST_CHECK_EQUAL(poller->WaitEvents(vEvents, 1000), 1);
+    BOOST_CHECK_EQUAL(vEvents[0].owner, 1);
+    BOOST_CHECK_EQUAL(vEvents[0].ready, SOCKET_EVENT_SEND);
+    BOOST_CHECK_EQUAL(poller->WaitEvents(vEvents, 1), 0);
+    BOOST_CHECK(vEvents.empty());
+
+    // Incoming data is reported once, even if it is not read
+    char ch = 'x';
+    BOOST_CHECK_EQUAL(send(fds[1], &ch, 1, MSG_NOSIGNAL), 1);
+    BOOST_CHECK_EQUAL(poller->WaitEvents(vEvents, 1000), 1);
+    BOOST_CHECK(vEvents[0].ready & SOCKET_EVENT_RECV);
+    BOOST_CHECK_EQUAL(poller->WaitEvents(vEvents, 1), 0);
+
+    // A level-triggered socket is reported until the data is read
+    BOOST_CHECK(poller->Register(fds[1], -1, SOCKET_EVENT_RECV, false));
+    BOOST_CHECK_EQUAL(send(fds[0], &ch, 1, MSG_NOSIGNAL), 1);
+    for (int i = 0; i < 2; i++) {
+        BOOST_CHECK_EQUAL(poller->WaitEvents(vEvents, 1000), 1);
+        BOOST_CHECK_EQUAL(vEvents[0].owner, -1);
+        BOOST_CHECK_EQUAL(vEvents[0].ready, SOCKET_EVENT_RECV);
+    }
+    BOOST_CHECK_EQUAL(recv(fds[1], &ch, 1, MSG_DONTWAIT), 1);
+
+    // A hung up peer is reported, and closing unregisters
+    close(fds[1]);
+    BOOST_CHECK_EQUAL(poller->WaitEvents(vEvents, 1000), 1);
+    BOOST_CHECK_EQUAL(vEvents[0].owner, 1);
+    BOOST_CHECK(vEvents[0].ready & SOCKET_EVENT_ERR);
+    close(fds[0]);
+    BOOST_CHECK_EQUAL(poller->WaitEvents(vEvents, 1), 0);
+}
+
+BOOST_AUTO_TEST_CASE(socket_poller)
+{
+    CheckSocketPoller("select");
+    BOOST_CHECK(!CreateSocketPoller("select")->CanRegister());
+#ifdef HAVE_EPOLL
+    CheckSocketPoller("epoll");
+    CheckRegisteredSocketPoller("epoll");
+#endif
+    BOOST_CHECK(CreateSocketPoller(DEFAULT_SOCKETEVENTS));
+    BOOST_CHECK(!CreateSocketPoller("nonsense"));
+}
+#endif
+
+#ifndef WIN32
+// The messages a node sent us, read from the other end of its socket as they
+// arrive
+class SentMessageReader
+{
+    SOCKET hSocket;
+    std::vector<char> vBuffer;
+    std::vector<std::pair<std::string, CDataStream> > vMessages;
+
+    // Read what has arrived, keeping a partial message for later
+    void Read()
+    {
+        char buf[0x10000];
+        ssize_t nBytes;
+        while ((nBytes = recv(hSocket, buf, sizeof(buf), MSG_DONTWAIT)) > 0)
+            vBuffer.insert(vBuffer.end(), buf, buf + nBytes);
+
+        size_t nPos = 0;
+        while (vBuffer.size() - nPos >= CMessageHeader::HEADER_SIZE) {
+            const char* pch = &vBuffer[nPos];
+            CDataStream ss(pch, pch + CMessageHeader::HEADER_SIZE, SER_NETWORK, PROTOCOL_VERSION);
+            CMessageHeader hdr(Params().MessageStart());
+            ss >> hdr;
+            if (vBuffer.size() - nPos - CMessageHeader::HEADER_SIZE < hdr.nMessageSize)
+                break;
+            pch += CMessageHeader::HEADER_SIZE;
+            vMessages.emplace_back(hdr.GetCommand(), CDataStream(pch, pch + hdr.nMessageSize, SER_NETWORK, PROTOCOL_VERSION));
+            nPos += CMessageHeader::HEADER_SIZE + hdr.nMessageSize;
+        }
+        vBuffer.erase(vBuffer.begin(), vBuffer.begin() + nPos);
+    }
+
+public:
+    SentMessageReader(SOCKET hSocketIn) : hSocket(hSocketIn) {}
+
+    // Wait up to 30 seconds for nCount messages of a kind, and take all of
+    // that kind that arrived
+    std::vector<CDataStream> Take(const std::string& strCommand, size_t nCount)
+    {
+        std::vector<CDataStream> vTaken;
+        for (int64_t nTimeout = GetTimeMillis() + 30000; ; MilliSleep(10)) {
+            Read();
+            for (auto it = vMessages.begin(); it != vMessages.end(); ) {
+                if (it->first == strCommand) {
+                    vTaken.push_back(it->second);
+                    it = vMessages.erase(it);
+                } else {
+                    ++it;
+                }
+            }
+            if (vTaken.size() >= nCount || GetTimeMillis() > nTimeout)
+                return vTaken;
+        }
+    }
+};
+
+// Records the handler threads that worked on nodes, and counts the times two
+// of them processed or sent the same node's messages at once
+struct NodeMessagesMonitor
+{
+    boost::mutex mutex;
+    std::map<NodeId, int> mapBusy;
+    std::set<boost::thread::id> setThreads;
+    int nOverlaps;
+
+    NodeMessagesMonitor() : nOverlaps(0) {}
+
+    bool ProcessOrSendMessages(CNode* pnode, CConnman& connman)
+    {
+        {
+            boost::unique_lock<boost::mutex> lock(mutex);
+            setThreads.insert(boost::this_thread::get_id());
+            if (mapBusy[pnode->GetId()]++ > 0)
+                nOverlaps++;
+        }
+        // Give the other threads time to pick up the same node
+        MilliSleep(1);
+        boost::unique_lock<boost::mutex> lock(mutex);
+        mapBusy[pnode->GetId()]--;
+        return true;
+    }
+};
+
+// Wait for the node to answer a ping, after the messages queued before it
+static bool SyncWithNode(CNode& node, SentMessageReader& reader, uint64_t nonce)
+{
+    QueueReceivedMessage(node, CNetMsgMaker(PROTOCOL_VERSION).Make(NetMsgType::PING, nonce));
+    std::vector<CDataStream> vPongs = reader.Take(NetMsgType::PONG, 1);
+    uint64_t nonceReceived = 0;
+    if (vPongs.size() == 1)
+        vPongs[0] >> nonceReceived;
+    return nonceReceived == nonce;
+}
+
+// Whether a node asked us for a transaction
+static bool AskedFor(SentMessageReader& reader, const uint256& hash, size_t nCount)
+{
+    bool fAsked = false;
+    for (CDataStream& ss : reader.Take(NetMsgType::GETDATA, nCount)) {
+        std::vector<CInv> vInv;
+        ss >> vInv;
+        for (const CInv& inv : vInv)
+            fAsked |= inv.hash == hash;
+    }
+    return fAsked;
+}
+
+BOOST_FIXTURE_TEST_CASE(message_handler_threads, TestChain100Setup)
+{
+    // Transactions are only asked for outside initial block download
+    BOOST_REQUIRE(!IsInitialBlockDownload());
+
+    PeerLogicValidation peerLogic(connman);
+    RegisterValidationInterface(&peerLogic);
+    NodeMessagesMonitor monitor;
+    boost::signals2::connection connProcess = GetNodeSignals().ProcessMessages.connect(boost::bind(&NodeMessagesMonitor::ProcessOrSendMessages, &monitor, _1, _2), boost::signals2::at_front);
+    boost::signals2::connection connSend = GetNodeSignals().SendMessages.connect(boost::bind(&NodeMessagesMonitor::ProcessOrSendMessages, &monitor, _1, _2), boost::signals2::at_front);
+
+    const int nNodes = 4;
+    int sockets[nNodes][2];
+    std::vector<std::unique_ptr<CNode> > vNodes;
+    std::vector<SentMessageReader> vReaders;
+    for (int i = 0; i < nNodes; i++) {
+        BOOST_REQUIRE(socketpair(AF_UNIX, SOCK_STREAM, 0, sockets[i]) == 0);
+        CAddress addr(LookupNumeric(strprintf("1.2.3.%d", i + 1).c_str()), NODE_NETWORK);
+        CNode* pnode = new CNode(2000 + i, NODE_NETWORK, 0, sockets[i][0], addr, i, i, "", true);
+        pnode->nVersion = PROTOCOL_VERSION;
+        pnode->SetSendVersion(PROTOCOL_VERSION);
+        pnode->SetRecvVersion(PROTOCOL_VERSION);
+        pnode->fSuccessfullyConnected = true;
+        GetNodeSignals().InitializeNode(pnode, *connman);
+        CConnmanTest::AddNode(*pnode);
+        vNodes.emplace_back(pnode);
+        vReaders.emplace_back(sockets[i][1]);
+    }
+    vNodes[3]->fWhitelisted = true;
+
+    // Several threads process the nodes' messages, but each node's one at a
+    // time and in order
+    CNetMsgMaker msgMaker(PROTOCOL_VERSION);
+    const uint64_t nPings = 50;
+    for (int i = 0; i < nNodes; i++) {
+        for (uint64_t nonce = 1; nonce <= nPings; nonce++)
+            QueueReceivedMessage(*vNodes[i], msgMaker.Make(NetMsgType::PING, nonce));
+    }
+    boost::thread_group threadGroup;
+    CConnmanTest::StartMessageHandlers(threadGroup, 4);
+    for (int i = 0; i < nNodes; i++) {
+        std::vector<CDataStream> vPongs = vReaders[i].Take(NetMsgType::PONG, nPings);
+        BOOST_CHECK_EQUAL(vPongs.size(), nPings);
+        for (size_t n = 0; n < vPongs.size(); n++) {
+            uint64_t nonce;
+            vPongs[n] >> nonce;
+            BOOST_CHECK_EQUAL(nonce, n + 1);
+        }
+    }
+    {
+        boost::unique_lock<boost::mutex> lock(monitor.mutex);
+        BOOST_CHECK_EQUAL(monitor.nOverlaps, 0);
+        BOOST_CHECK(monitor.setThreads.size() > 1);
+    }
+
+    // An address is relayed to other nodes, whose handlers may be sending
+    // theirs at the same time
+    CAddress addr(LookupNumeric("5.6.7.8", 8333), NODE_NETWORK);
+    addr.nTime = GetAdjustedTime();
+    QueueReceivedMessage(*vNodes[0], msgMaker.Make(NetMsgType::ADDR, std::vector<CAddress>(1, addr)));
+    BOOST_CHECK(SyncWithNode(*vNodes[0], vReaders[0], 1000));
+    {
+        LOCK(vNodes[0]->cs_vAddrToSend);
+        BOOST_CHECK(vNodes[0]->addrKnown.contains(addr.GetKey()));
+    }
+    bool fRelayed = false;
+    for (int64_t nTimeout = GetTimeMillis() + 30000; !fRelayed && GetTimeMillis() < nTimeout; MilliSleep(10)) {
+        for (int i = 1; i < nNodes; i++) {
+            {
+                LOCK(vNodes[i]->cs_vAddrToSend);
+                for (const CAddress& addrToSend : vNodes[i]->vAddrToSend)
+                    fRelayed |= addrToSend == addr;
+            }
+            for (CDataStream& ss : vReaders[i].Take(NetMsgType::ADDR, 0)) {
+                std::vector<CAddress> vAddr;
+                ss >> vAddr;
+                for (const CAddress& addrSent : vAddr)
+                    fRelayed |= addrSent == addr;
+            }
+        }
+    }
+    BOOST_CHECK(fRelayed);
+
+    // Announcements are remembered before cs_main is taken; transactions are
+    // asked for, and blocks' headers
+    CInv invTx(MSG_TX, GetRandHash());
+    CInv invBlock(MSG_BLOCK, GetRandHash());
+    std::vector<CInv> vInv;
+    vInv.push_back(invTx);
+    vInv.push_back(invBlock);
+    QueueReceivedMessage(*vNodes[1], msgMaker.Make(NetMsgType::INV, vInv));
+    BOOST_CHECK(SyncWithNode(*vNodes[1], vReaders[1], 1001));
+    {
+        LOCK(vNodes[1]->cs_inventory);
+        BOOST_CHECK(vNodes[1]->filterInventoryKnown.contains(invTx.hash));
+    }
+    {
+        LOCK(vNodes[1]->cs_msgProcessing);
+        BOOST_CHECK(vNodes[1]->setAskFor.count(invTx.hash));
+    }
+    BOOST_CHECK(AskedFor(vReaders[1], invTx.hash, 1));
+    bool fGetHeaders = false;
+    for (CDataStream& ss : vReaders[1].Take(NetMsgType::GETHEADERS, 0)) {
+        CBlockLocator locator;
+        uint256 hashStop;
+        ss >> locator >> hashStop;
+        fGetHeaders |= hashStop == invBlock.hash;
+    }
+    BOOST_CHECK(fGetHeaders);
+
+    // In blocks only mode transactions announced are remembered but not asked
+    // for, unless the node is whitelisted
+    fRelayTxes = false;
+    CInv invBlocksOnly(MSG_TX, GetRandHash());
+    QueueReceivedMessage(*vNodes[2], msgMaker.Make(NetMsgType::INV, std::vector<CInv>(1, invBlocksOnly)));
+    BOOST_CHECK(SyncWithNode(*vNodes[2], vReaders[2], 1002));
+    {
+        LOCK(vNodes[2]->cs_inventory);
+        BOOST_CHECK(vNodes[2]->filterInventoryKnown.contains(invBlocksOnly.hash));
+    }
+    {
+        LOCK(vNodes[2]->cs_msgProcessing);
+        BOOST_CHECK(!vNodes[2]->setAskFor.count(invBlocksOnly.hash));
+    }
+    BOOST_CHECK(!AskedFor(vReaders[2], invBlocksOnly.hash, 0));
+
+    CInv invWhitelisted(MSG_TX, GetRandHash());
+    QueueReceivedMessage(*vNodes[3], msgMaker.Make(NetMsgType::INV, std::vector<CInv>(1, invWhitelisted)));
+    BOOST_CHECK(SyncWithNode(*vNodes[3], vReaders[3], 1003));
+    BOOST_CHECK(AskedFor(vReaders[3], invWhitelisted.hash, 1));
+    fRelayTxes = true;
+
+    threadGroup.interrupt_all();
+    threadGroup.join_all();
+    connProcess.disconnect();
+    connSend.disconnect();
+    CConnmanTest::ClearNodes();
+    bool fUpdateConnectionTime = false;
+    for (int i = 0; i < nNodes; i++) {
+        GetNodeSignals().FinalizeNode(vNodes[i]->GetId(), fUpdateConnectionTime);
+        close(sockets[i][1]);
+    }
+    UnregisterValidationInterface(&peerLogic);
+}
+#endif
+
 BOOST_AUTO_TEST_SUITE_END()
@@ -100,4 +100,30 @@ BOOST_AUTO_TEST_CASE(getlocator_test)
     }
 }
 
+BOOST_AUTO_TEST_CASE(chain_tip_unlocked)
+{
+    std::vector<CBlockIndex> vBlocks(100);
+    for (unsigned int i = 0; i < vBlocks.size(); i++) {
+        vBlocks[i].nHeight = i;
+        vBlocks[i].pprev = i ? &vBlocks[i - 1] : NULL;
+    }
+
+    CChain chain;
+    BOOST_CHECK(chain.TipUnlocked() == NULL);
+    BOOST_CHECK_EQUAL(chain.HeightUnlocked(), -1);
+
+    chain.SetTip(&vBlocks[50]);
+    BOOST_CHECK(chain.TipUnlocked() == chain.Tip());
+    BOOST_CHECK_EQUAL(chain.HeightUnlocked(), 50);
+
+    // Moving to another branch, or back, is reflected as well
+    chain.SetTip(&vBlocks[20]);
+    BOOST_CHECK(chain.TipUnlocked() == &vBlocks[20]);
+    BOOST_CHECK_EQUAL(chain.HeightUnlocked(), chain.Height());
+
+    chain.SetTip(NULL);
+    BOOST_CHECK(chain.TipUnlocked() == NULL);
+    BOOST_CHECK_EQUAL(chain.HeightUnlocked(), -1);
+}
+
 BOOST_AUTO_TEST_SUITE_END()
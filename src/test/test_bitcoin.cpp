@@ -9,9 +9,12 @@
 #include "chainparams.h"
 #include "consensus/consensus.h"
 #include "consensus/validation.h"
+#include "crypto/sha256.h"
+#include "hash.h"
 #include "key.h"
 #include "validation.h"
 #include "miner.h"
+#include "net.h"
 #include "net_processing.h"
 #include "pubkey.h"
 #include "random.h"
@@ -26,6 +29,7 @@
 
 #include <memory>
 
+#include <boost/bind.hpp>
 #include <boost/filesystem.hpp>
 #include <boost/test/unit_test.hpp>
 #include <boost/thread.hpp>
@@ -38,6 +42,8 @@ extern void noui_connect();
 
 BasicTestingSetup::BasicTestingSetup(const std::string& chainName)
 {
+        SHA256AutoDetect();
+        SipHashAutoDetect();
         ECC_Start();
         SetupEnvironment();
         SetupNetworking();
@@ -77,7 +83,9 @@ TestingSetup::TestingSetup(const std::string& chainName) : BasicTestingSetup(cha
         }
         nScriptCheckThreads = 3;
         for (int i=0; i < nScriptCheckThreads-1; i++)
-            threadGroup.create_thread(&ThreadScriptCheck);
+            threadGroup.create_thread(boost::bind(&ThreadScriptCheck, -1));
+        for (int i=0; i < nScriptCheckThreads-1; i++)
+            threadGroup.create_thread(&ThreadTxScriptCheck);
         g_connman = std::unique_ptr<CConnman>(new CConnman(0x1337, 0x1337)); // Deterministic randomness for tests.
         connman = g_connman.get();
         RegisterNodeSignals(GetNodeSignals());
@@ -114,6 +122,15 @@ TestChain100Setup::TestChain100Setup() : TestingSetup(CBaseChainParams::REGTEST)
 //
 CBlock
 TestChain100Setup::CreateAndProcessBlock(const std::vector<CMutableTransaction>& txns, const CScript& scriptPubKey)
+{
+    CBlock block = CreateBlock(txns, scriptPubKey);
+    std::shared_ptr<const CBlock> shared_pblock = std::make_shared<const CBlock>(block);
+    ProcessNewBlock(Params(), shared_pblock, true, NULL);
+    return block;
+}
+
+CBlock
+TestChain100Setup::CreateBlock(const std::vector<CMutableTransaction>& txns, const CScript& scriptPubKey)
 {
     const CChainParams& chainparams = Params();
     std::unique_ptr<CBlockTemplate> pblocktemplate = BlockAssembler(chainparams).CreateNewBlock(scriptPubKey);
@@ -129,9 +146,6 @@ TestChain100Setup::CreateAndProcessBlock(const std::vector<CMutableTransaction>&
 
     while (!CheckProofOfWork(block.GetHash(), block.nBits, chainparams.GetConsensus())) ++block.nNonce;
 
-    std::shared_ptr<const CBlock> shared_pblock = std::make_shared<const CBlock>(block);
-    ProcessNewBlock(chainparams, shared_pblock, true, NULL);
-
     CBlock result = block;
     return result;
 }
@@ -140,6 +154,40 @@ TestChain100Setup::~TestChain100Setup()
 {
 }
 
+void CConnmanTest::AddNode(CNode& node)
+{
+    LOCK(g_connman->cs_vNodes);
+    // Messages are not processed at all without room to send replies
+    g_connman->nSendBufferMaxSize = 1000 * DEFAULT_MAXSENDBUFFER;
+    g_connman->vNodes.push_back(&node);
+}
+
+void CConnmanTest::ClearNodes()
+{
+    LOCK(g_connman->cs_vNodes);
+    g_connman->vNodes.clear();
+}
+
+void CConnmanTest::StartMessageHandlers(boost::thread_group& threadGroup, int nThreads)
+{
+    for (int i = 0; i < nThreads; i++)
+        threadGroup.create_thread(boost::bind(&CConnman::ThreadMessageHandler, g_connman.get()));
+}
+
+void QueueReceivedMessage(CNode& node, const CSerializedNetMsg& msg)
+{
+    uint256 hash = Hash(msg.data.data(), msg.data.data() + msg.data.size());
+    CMessageHeader hdr(Params().MessageStart(), msg.command.c_str(), msg.data.size());
+    memcpy(hdr.pchChecksum, hash.begin(), CMessageHeader::CHECKSUM_SIZE);
+    CDataStream ss(SER_NETWORK, PROTOCOL_VERSION);
+    ss << hdr;
+    ss.write((const char*)msg.data.data(), msg.data.size());
+
+    LOCK(node.cs_vRecvMsg);
+    bool fComplete = false;
+    BOOST_CHECK(node.ReceiveMsgBytes(&ss[0], ss.size(), fComplete));
+    BOOST_CHECK(fComplete);
+}
 
 CTxMemPoolEntry TestMemPoolEntryHelper::FromTx(const CMutableTransaction &tx, CTxMemPool *pool) {
     CTransaction txn(tx);
@@ -54,12 +54,33 @@ struct TestChain100Setup : public TestingSetup {
     CBlock CreateAndProcessBlock(const std::vector<CMutableTransaction>& txns,
                                  const CScript& scriptPubKey);
 
+    // Create a new block on the current tip, as CreateAndProcessBlock does,
+    // without processing it.
+    CBlock CreateBlock(const std::vector<CMutableTransaction>& txns,
+                       const CScript& scriptPubKey);
+
     ~TestChain100Setup();
 
     std::vector<CTransaction> coinbaseTxns; // For convenience, coinbase transactions
     CKey coinbaseKey; // private/public key needed to spend coinbase transactions
 };
 
+class CNode;
+struct CSerializedNetMsg;
+
+// Lets tests connect CNodes to g_connman, so that messages can be processed
+// as if they came from them.
+struct CConnmanTest {
+    static void AddNode(CNode& node);
+    static void ClearNodes();
+    // Run g_connman's message handler threads, as CConnman::Start does
+    static void StartMessageHandlers(boost::thread_group& threadGroup, int nThreads);
+};
+
+// Queue a message as if node had sent it to us, for the message handler to
+// process
+void QueueReceivedMessage(CNode& node, const CSerializedNetMsg& msg);
+
 class CTxMemPoolEntry;
 class CTxMemPool;
 
@@ -0,0 +1,62 @@
+// Copyright (c) 2017 The Bitcoin Core developers
+// Distributed under the MIT software license, see the accompanying
+// file COPYING or http://www.opensource.org/licenses/mit-license.php.
+
+#include "chainparams.h"
+#include "test/test_bitcoin.h"
+#include "txdb.h"
+#include "txindexbuilder.h"
+#include "validation.h"
+
+#include <boost/test/unit_test.hpp>
+
+BOOST_FIXTURE_TEST_SUITE(txindex_tests, TestChain100Setup)
+
+BOOST_AUTO_TEST_CASE(txindex_background_build)
+{
+    // Small batches, so that the entries of a step take several writes
+    CTxIndexBuilder builder(*pblocktree, 1 << 10);
+    {
+        LOCK(cs_main);
+        BOOST_CHECK(builder.Init());
+        BOOST_CHECK(builder.GetBest() == NULL);
+        BOOST_CHECK(!builder.Finish());
+    }
+
+    // The first step indexes the first batch of blocks, and checkpoints it
+    BOOST_CHECK(builder.SyncStep());
+    {
+        LOCK(cs_main);
+        BOOST_CHECK(builder.GetBest() == chainActive[BACKGROUND_INDEX_BATCH_SIZE - 1]);
+        BOOST_CHECK(!builder.Finish());
+
+        CTxIndexBuilder resumed(*pblocktree, 1 << 10);
+        BOOST_CHECK(resumed.Init());
+        BOOST_CHECK(resumed.GetBest() == builder.GetBest());
+    }
+
+    while (builder.SyncStep()) {}
+    {
+        LOCK(cs_main);
+        BOOST_CHECK(builder.GetBest() == chainActive.Tip());
+        BOOST_CHECK(builder.Finish());
+    }
+    BOOST_CHECK(builder.IsBuilt());
+    bool fFlag = false;
+    BOOST_CHECK(pblocktree->ReadFlag("txindex", fFlag));
+    BOOST_CHECK(fFlag);
+    CBlockLocator locator;
+    BOOST_CHECK(!pblocktree->ReadTxIndexProgress(locator));
+
+    // Every transaction is found through the index
+    fTxIndex = true;
+    BOOST_FOREACH(const CTransaction& tx, coinbaseTxns) {
+        CTransactionRef ptx;
+        uint256 hashBlock;
+        BOOST_CHECK(GetTransaction(tx.GetHash(), ptx, Params().GetConsensus(), hashBlock, false));
+        BOOST_CHECK(ptx && ptx->GetHash() == tx.GetHash());
+    }
+    fTxIndex = false;
+}
+
+BOOST_AUTO_TEST_SUITE_END()
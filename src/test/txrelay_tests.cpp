@@ -0,0 +1,103 @@
+// Copyright (c) 2017 The Bitcoin Core developers
+// Distributed under the MIT software license, see the accompanying
+// file COPYING or http://www.opensource.org/licenses/mit-license.php.
+
+#include "txmempool.h"
+#include "txrelay.h"
+
+#include "test/test_bitcoin.h"
+
+#include <boost/test/unit_test.hpp>
+
+BOOST_FIXTURE_TEST_SUITE(txrelay_tests, BasicTestingSetup)
+
+static CMutableTransaction MakeTx(const COutPoint& prevout)
+{
+    CMutableTransaction tx;
+    tx.vin.resize(1);
+    tx.vin[0].prevout = prevout;
+    tx.vin[0].scriptSig = CScript() << OP_11;
+    tx.vout.resize(1);
+    tx.vout[0].scriptPubKey = CScript() << OP_11 << OP_EQUAL;
+    tx.vout[0].nValue = 10 * COIN;
+    return tx;
+}
+
+BOOST_AUTO_TEST_CASE(schedule_order)
+{
+    CTxMemPool pool(CFeeRate(0));
+    TestMemPoolEntryHelper entry;
+    CTxRelayScheduler scheduler;
+    int64_t nNow = 1000 * TX_RELAY_SCHEDULE_INTERVAL;
+
+    // A low fee parent with a high fee child, and an unrelated transaction
+    // paying in between
+    CMutableTransaction txParent = MakeTx(COutPoint(uint256S("01"), 0));
+    CMutableTransaction txChild = MakeTx(COutPoint(txParent.GetHash(), 0));
+    CMutableTransaction txOther = MakeTx(COutPoint(uint256S("02"), 0));
+    CMutableTransaction txGone = MakeTx(COutPoint(uint256S("03"), 0));
+    pool.addUnchecked(txParent.GetHash(), entry.Fee(1000).FromTx(txParent));
+    pool.addUnchecked(txChild.GetHash(), entry.Fee(100000).FromTx(txChild));
+    pool.addUnchecked(txOther.GetHash(), entry.Fee(10000).FromTx(txOther));
+
+    // Queued in the wrong order, twice, and one is not in the mempool
+    scheduler.Queue(txChild.GetHash(), nNow);
+    scheduler.Queue(txGone.GetHash(), nNow);
+    scheduler.Queue(txParent.GetHash(), nNow);
+    scheduler.Queue(txOther.GetHash(), nNow);
+    scheduler.Queue(txChild.GetHash(), nNow);
+
+    std::shared_ptr<const CTxRelaySnapshot> snapshot = scheduler.GetSnapshot(pool, nNow);
+    BOOST_CHECK_EQUAL(snapshot->vInfo.size(), 3);
+    BOOST_CHECK(snapshot->vInfo[0].tx->GetHash() == txOther.GetHash());
+    BOOST_CHECK(snapshot->vInfo[1].tx->GetHash() == txParent.GetHash());
+    BOOST_CHECK(snapshot->vInfo[2].tx->GetHash() == txChild.GetHash());
+    BOOST_CHECK(snapshot->vInfo[0].feeRate == CFeeRate(10000, ::GetSerializeSize(txOther, SER_NETWORK, PROTOCOL_VERSION)));
+
+    uint32_t nRank;
+    BOOST_CHECK(snapshot->Find(txChild.GetHash(), nRank));
+    BOOST_CHECK_EQUAL(nRank, 2);
+    BOOST_CHECK(!snapshot->Find(txGone.GetHash(), nRank));
+
+    // Not rebuilt before the interval is over, even with new transactions
+    pool.addUnchecked(txGone.GetHash(), entry.Fee(1000000).FromTx(txGone));
+    BOOST_CHECK(scheduler.GetSnapshot(pool, nNow + TX_RELAY_SCHEDULE_INTERVAL - 1) == snapshot);
+
+    // Rebuilt after it, dropping transactions that left the mempool
+    pool.removeRecursive(txParent);
+    std::shared_ptr<const CTxRelaySnapshot> rebuilt = scheduler.GetSnapshot(pool, nNow + TX_RELAY_SCHEDULE_INTERVAL);
+    BOOST_CHECK(rebuilt != snapshot);
+    BOOST_CHECK_EQUAL(rebuilt->vInfo.size(), 2);
+    BOOST_CHECK(rebuilt->vInfo[0].tx->GetHash() == txGone.GetHash());
+    BOOST_CHECK(rebuilt->vInfo[1].tx->GetHash() == txOther.GetHash());
+    // The previous order is unaffected for whoever still holds it
+    BOOST_CHECK_EQUAL(snapshot->vInfo.size(), 3);
+
+    // Everything expires eventually
+    rebuilt = scheduler.GetSnapshot(pool, nNow + TX_RELAY_SCHEDULE_EXPIRY + 1);
+    BOOST_CHECK(rebuilt->vInfo.empty());
+    BOOST_CHECK(rebuilt->mapRank.empty());
+
+    CTxRelayStats stats;
+    scheduler.GetStats(stats);
+    BOOST_CHECK_EQUAL(stats.nRebuilds, 3);
+    BOOST_CHECK_EQUAL(stats.nScheduled, 0);
+}
+
+BOOST_AUTO_TEST_CASE(sendmessages_stats)
+{
+    CTxRelayScheduler scheduler;
+    scheduler.RecordSendMessages(100, 60, 20, 3);
+    scheduler.RecordSendMessages(50, 0, 0, 0);
+
+    CTxRelayStats stats;
+    scheduler.GetStats(stats);
+    BOOST_CHECK_EQUAL(stats.nSendMessages, 2);
+    BOOST_CHECK_EQUAL(stats.nSendMessagesTime, 150);
+    BOOST_CHECK_EQUAL(stats.nSendMessagesLockTime, 60);
+    BOOST_CHECK_EQUAL(stats.nInventoryTime, 20);
+    BOOST_CHECK_EQUAL(stats.nAnnounced, 3);
+    BOOST_CHECK_EQUAL(stats.nRebuilds, 0);
+}
+
+BOOST_AUTO_TEST_SUITE_END()
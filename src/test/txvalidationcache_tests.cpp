@@ -9,6 +9,7 @@
 #include "pubkey.h"
 #include "txmempool.h"
 #include "random.h"
+#include "script/sigcache.h"
 #include "script/standard.h"
 #include "test/test_bitcoin.h"
 #include "utiltime.h"
@@ -84,4 +85,95 @@ BOOST_FIXTURE_TEST_CASE(tx_mempool_block_doublespend, TestChain100Setup)
     BOOST_CHECK_EQUAL(mempool.size(), 0);
 }
 
+// Spend a coinbase output to scriptPubKey, returning the signature (without
+// its hashtype byte) and the hash it signs
+static CMutableTransaction
+SignedSpend(const CTransaction& coinbase, const CKey& key, const CScript& scriptPubKey, CAmount nValue,
+            uint32_t nLockTime, std::vector<unsigned char>& vchSig, uint256& hash)
+{
+    CMutableTransaction spend;
+    spend.nVersion = 1;
+    spend.nLockTime = nLockTime;
+    spend.vin.resize(1);
+    spend.vin[0].prevout.hash = coinbase.GetHash();
+    spend.vin[0].prevout.n = 0;
+    if (nLockTime)
+        spend.vin[0].nSequence = 0;
+    spend.vout.resize(1);
+    spend.vout[0].nValue = nValue;
+    spend.vout[0].scriptPubKey = scriptPubKey;
+
+    hash = SignatureHash(scriptPubKey, spend, 0, SIGHASH_ALL, 0, SIGVERSION_BASE);
+    BOOST_CHECK(key.Sign(hash, vchSig));
+    std::vector<unsigned char> vchSigHashType(vchSig);
+    vchSigHashType.push_back((unsigned char)SIGHASH_ALL);
+    spend.vin[0].scriptSig = CScript() << vchSigHashType;
+    return spend;
+}
+
+BOOST_FIXTURE_TEST_CASE(tx_preverify, TestChain100Setup)
+{
+    CScript scriptPubKey = CScript() <<  ToByteVector(coinbaseKey.GetPubKey()) << OP_CHECKSIG;
+    CPubKey pubkey = coinbaseKey.GetPubKey();
+    std::vector<unsigned char> vchSig;
+    uint256 hash;
+
+    // A bad signature gets the transaction rejected, as AcceptToMemoryPool would
+    CMutableTransaction spend = SignedSpend(coinbaseTxns[0], coinbaseKey, scriptPubKey, 11*CENT, 0, vchSig, hash);
+    CMutableTransaction badSpend(spend);
+    std::vector<unsigned char> vchBadSig(vchSig);
+    vchBadSig[10] ^= 1;
+    vchBadSig.push_back((unsigned char)SIGHASH_ALL);
+    badSpend.vin[0].scriptSig = CScript() << vchBadSig;
+    {
+        CValidationState state;
+        BOOST_CHECK(!PreVerifyTransactionScripts(mempool, badSpend, state));
+        BOOST_CHECK(state.IsInvalid());
+        BOOST_CHECK(state.GetRejectReason().find("mandatory-script-verify-flag-failed") == 0);
+    }
+    BOOST_CHECK(!ToMemPool(badSpend));
+
+    // A good signature ends up in the signature cache
+    BOOST_CHECK(!SignatureCacheContains(hash, vchSig, pubkey));
+    {
+        CValidationState state;
+        BOOST_CHECK(PreVerifyTransactionScripts(mempool, spend, state));
+        BOOST_CHECK(state.IsValid());
+    }
+    BOOST_CHECK(SignatureCacheContains(hash, vchSig, pubkey));
+    BOOST_CHECK(ToMemPool(spend));
+
+    // Transactions AcceptToMemoryPool turns down before verifying scripts are
+    // neither verified nor rejected: one already in the mempool, one spending
+    // missing outputs, one that is not final yet, and one without a fee
+    {
+        CValidationState state;
+        BOOST_CHECK(!PreVerifyTransactionScripts(mempool, spend, state));
+        BOOST_CHECK(state.IsValid());
+    }
+    CMutableTransaction orphan(spend);
+    orphan.vin[0].prevout.hash = GetRandHash();
+    {
+        CValidationState state;
+        BOOST_CHECK(!PreVerifyTransactionScripts(mempool, orphan, state));
+        BOOST_CHECK(state.IsValid());
+    }
+    CMutableTransaction nonFinal = SignedSpend(coinbaseTxns[1], coinbaseKey, scriptPubKey, 11*CENT, chainActive.Height() + 10, vchSig, hash);
+    {
+        CValidationState state;
+        BOOST_CHECK(!PreVerifyTransactionScripts(mempool, nonFinal, state));
+        BOOST_CHECK(state.IsValid());
+        BOOST_CHECK(!SignatureCacheContains(hash, vchSig, pubkey));
+    }
+    CMutableTransaction noFee = SignedSpend(coinbaseTxns[2], coinbaseKey, scriptPubKey, coinbaseTxns[2].vout[0].nValue, 0, vchSig, hash);
+    {
+        CValidationState state;
+        BOOST_CHECK(!PreVerifyTransactionScripts(mempool, noFee, state));
+        BOOST_CHECK(state.IsValid());
+        BOOST_CHECK(!SignatureCacheContains(hash, vchSig, pubkey));
+    }
+
+    mempool.clear();
+}
+
 BOOST_AUTO_TEST_SUITE_END()
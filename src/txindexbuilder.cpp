@@ -0,0 +1,85 @@
+// Copyright (c) 2017 The Bitcoin Core developers
+// Distributed under the MIT software license, see the accompanying
+// file COPYING or http://www.opensource.org/licenses/mit-license.php.
+
+#include "txindexbuilder.h"
+
+#include "primitives/block.h"
+#include "txdb.h"
+#include "util.h"
+#include "utiltime.h"
+#include "validation.h"
+
+#include <boost/foreach.hpp>
+#include <boost/thread.hpp>
+
+CTxIndexBuilder* ptxindexbuilder = NULL;
+
+CTxIndexBuilder::CTxIndexBuilder(CBlockTreeDB& dbIn, size_t nBatchSizeIn)
+    : CBackgroundIndex("transaction index"), db(dbIn), nBatchSize(nBatchSizeIn), fBuilt(false)
+{
+}
+
+bool CTxIndexBuilder::ReadBestBlock(CBlockLocator& locator) const
+{
+    return db.ReadTxIndexProgress(locator);
+}
+
+bool CTxIndexBuilder::WriteBlocks(const std::vector<CIndexedBlock>& vBlocks, const CBlockLocator& locator)
+{
+    std::vector<std::pair<uint256, CDiskTxPos> > vPos;
+    BOOST_FOREACH(const CIndexedBlock& indexedBlock, vBlocks) {
+        CBlock block;
+        if (!ReadBlock(indexedBlock, block))
+            return false;
+        // As in ConnectBlock
+        CDiskTxPos pos(indexedBlock.pos, GetSizeOfCompactSize(block.vtx.size()));
+        BOOST_FOREACH(const CTransactionRef& tx, block.vtx) {
+            vPos.push_back(std::make_pair(tx->GetHash(), pos));
+            pos.nTxOffset += ::GetSerializeSize(*tx, SER_DISK, CLIENT_VERSION);
+        }
+    }
+    return db.WriteTxIndexProgress(vPos, locator, nBatchSize);
+}
+
+bool CTxIndexBuilder::Finish()
+{
+    AssertLockHeld(cs_main);
+    if (GetBest() != chainActive.Tip())
+        return false;
+    if (!db.FinishTxIndexBuild())
+        return error("%s: failed to write to the block tree database", __func__);
+    fBuilt = true;
+    return true;
+}
+
+void CTxIndexBuilder::ThreadBuild()
+{
+    const CBlockIndex* pindexStuck = NULL;
+    int64_t nLastLog = GetTime();
+    while (true) {
+        boost::this_thread::interruption_point();
+        if (SyncStep()) {
+            if (GetTime() >= nLastLog + 60) {
+                nLastLog = GetTime();
+                LogPrintf("Building the transaction index, at height %d\n", GetBest()->nHeight);
+            }
+            continue;
+        }
+
+        {
+            LOCK(cs_main);
+            if (Finish()) {
+                LogPrintf("Transaction index built\n");
+                return;
+            }
+        }
+
+        // Either blocks were connected since the last step, or it failed
+        if (GetBest() == pindexStuck) {
+            LogPrintf("Building the transaction index failed; it will be resumed on restart\n");
+            return;
+        }
+        pindexStuck = GetBest();
+    }
+}
@@ -0,0 +1,50 @@
+// Copyright (c) 2017 The Bitcoin Core developers
+// Distributed under the MIT software license, see the accompanying
+// file COPYING or http://www.opensource.org/licenses/mit-license.php.
+
+#ifndef BITCOIN_TXINDEXBUILDER_H
+#define BITCOIN_TXINDEXBUILDER_H
+
+#include "backgroundindex.h"
+
+#include <atomic>
+
+class CBlockTreeDB;
+
+/**
+ * Builds the transaction index (-txindex) of the blocks that were connected
+ * before it was turned on, from the block files, while the node keeps
+ * running; ConnectBlock indexes the transactions of new blocks. Its progress
+ * is checkpointed in the block tree database with the entries, so that an
+ * interrupted build is resumed on restart. Once it has caught up with the
+ * tip, the "txindex" flag is set and it is done.
+ */
+class CTxIndexBuilder : public CBackgroundIndex
+{
+private:
+    CBlockTreeDB& db;
+    //! Bytes of entries written to the database at once
+    const size_t nBatchSize;
+    std::atomic<bool> fBuilt;
+
+protected:
+    bool ReadBestBlock(CBlockLocator& locator) const;
+    bool WriteBlocks(const std::vector<CIndexedBlock>& vBlocks, const CBlockLocator& locator);
+
+public:
+    /** nBatchSizeIn is best the size of the LevelDB write buffer of db */
+    CTxIndexBuilder(CBlockTreeDB& dbIn, size_t nBatchSizeIn);
+
+    /** Mark the index as complete, if it has caught up with the active chain. Requires cs_main. */
+    bool Finish();
+
+    /** Build the index, until it is complete or interrupted */
+    void ThreadBuild();
+
+    bool IsBuilt() const { return fBuilt; }
+};
+
+/** The transaction index builder, if -txindex was turned on without a reindex */
+extern CTxIndexBuilder* ptxindexbuilder;
+
+#endif // BITCOIN_TXINDEXBUILDER_H
@@ -0,0 +1,96 @@
+// Copyright (c) 2017 The Bitcoin Core developers
+// Distributed under the MIT software license, see the accompanying
+// file COPYING or http://www.opensource.org/licenses/mit-license.php.
+
+#include "txrelay.h"
+
+#include "utiltime.h"
+
+bool CTxRelaySnapshot::Find(const uint256& hash, uint32_t& nRank) const
+{
+    std::unordered_map<uint256, uint32_t, SaltedTxidHasher>::const_iterator it = mapRank.find(hash);
+    if (it == mapRank.end())
+        return false;
+    nRank = it->second;
+    return true;
+}
+
+CTxRelayScheduler::CTxRelayScheduler() :
+    snapshot(std::make_shared<CTxRelaySnapshot>()),
+    nLastRebuild(0), fRebuilding(false), nRebuilds(0), nRebuildTime(0), nMempoolLockTime(0),
+    nSendMessages(0), nSendMessagesTime(0), nSendMessagesLockTime(0), nInventoryTime(0), nAnnounced(0)
+{
+}
+
+void CTxRelayScheduler::Queue(const uint256& hash, int64_t nNow)
+{
+    LOCK(cs);
+    while (!vScheduled.empty() && vScheduled.front().first < nNow - TX_RELAY_SCHEDULE_EXPIRY) {
+        vScheduled.pop_front();
+    }
+    vScheduled.push_back(std::make_pair(nNow, hash));
+}
+
+std::shared_ptr<const CTxRelaySnapshot> CTxRelayScheduler::GetSnapshot(const CTxMemPool& pool, int64_t nNow)
+{
+    std::vector<uint256> vHashes;
+    {
+        LOCK(cs);
+        if (fRebuilding || nNow < nLastRebuild + TX_RELAY_SCHEDULE_INTERVAL)
+            return snapshot;
+        while (!vScheduled.empty() && vScheduled.front().first < nNow - TX_RELAY_SCHEDULE_EXPIRY) {
+            vScheduled.pop_front();
+        }
+        if (vScheduled.empty() && snapshot->vInfo.empty())
+            return snapshot;
+        fRebuilding = true;
+        nLastRebuild = nNow;
+        vHashes.reserve(vScheduled.size());
+        for (const auto& scheduled : vScheduled) {
+            vHashes.push_back(scheduled.second);
+        }
+    }
+
+    int64_t nStart = GetTimeMicros();
+    std::shared_ptr<CTxRelaySnapshot> newSnapshot = std::make_shared<CTxRelaySnapshot>();
+    // Transactions that have left the mempool are dropped here
+    newSnapshot->vInfo = pool.infoSorted(vHashes);
+    int64_t nLocked = GetTimeMicros() - nStart;
+    newSnapshot->mapRank.reserve(newSnapshot->vInfo.size());
+    for (size_t i = 0; i < newSnapshot->vInfo.size(); i++) {
+        newSnapshot->mapRank.insert(std::make_pair(newSnapshot->vInfo[i].tx->GetHash(), (uint32_t)i));
+    }
+
+    LOCK(cs);
+    snapshot = newSnapshot;
+    fRebuilding = false;
+    nRebuilds++;
+    nRebuildTime += GetTimeMicros() - nStart;
+    nMempoolLockTime += nLocked;
+    return snapshot;
+}
+
+void CTxRelayScheduler::RecordSendMessages(int64_t nTime, int64_t nLockTime, int64_t nInventory, unsigned int nAnnouncedTx)
+{
+    nSendMessages++;
+    nSendMessagesTime += nTime;
+    nSendMessagesLockTime += nLockTime;
+    nInventoryTime += nInventory;
+    nAnnounced += nAnnouncedTx;
+}
+
+void CTxRelayScheduler::GetStats(CTxRelayStats& stats) const
+{
+    {
+        LOCK(cs);
+        stats.nScheduled = snapshot->vInfo.size();
+        stats.nRebuilds = nRebuilds;
+        stats.nRebuildTime = nRebuildTime;
+        stats.nMempoolLockTime = nMempoolLockTime;
+    }
+    stats.nSendMessages = nSendMessages;
+    stats.nSendMessagesTime = nSendMessagesTime;
+    stats.nSendMessagesLockTime = nSendMessagesLockTime;
+    stats.nInventoryTime = nInventoryTime;
+    stats.nAnnounced = nAnnounced;
+}
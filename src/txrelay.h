@@ -0,0 +1,105 @@
+// Copyright (c) 2017 The Bitcoin Core developers
+// Distributed under the MIT software license, see the accompanying
+// file COPYING or http://www.opensource.org/licenses/mit-license.php.
+
+#ifndef BITCOIN_TXRELAY_H
+#define BITCOIN_TXRELAY_H
+
+#include "coins.h"
+#include "sync.h"
+#include "txmempool.h"
+#include "uint256.h"
+
+#include <atomic>
+#include <deque>
+#include <memory>
+#include <unordered_map>
+#include <utility>
+#include <vector>
+
+/** Minimum time between rebuilds of the shared announcement order (in microseconds) */
+static const int64_t TX_RELAY_SCHEDULE_INTERVAL = 1000000;
+/** How long a relayed transaction keeps its place in the shared announcement order (in microseconds) */
+static const int64_t TX_RELAY_SCHEDULE_EXPIRY = 2 * 60 * 1000000LL;
+
+/**
+ * The order in which recently relayed transactions are announced to peers:
+ * by mempool ancestor count first, so parents go before their children, and
+ * by fee rate after that. It is built once and then shared by every peer's
+ * trickle until the next rebuild.
+ */
+class CTxRelaySnapshot
+{
+public:
+    //! Mempool info on the scheduled transactions, in announcement order
+    std::vector<TxMempoolInfo> vInfo;
+    //! Position of each scheduled transaction in vInfo
+    std::unordered_map<uint256, uint32_t, SaltedTxidHasher> mapRank;
+
+    /** Look up where a transaction is in the order. Returns false if it is not scheduled. */
+    bool Find(const uint256& hash, uint32_t& nRank) const;
+};
+
+struct CTxRelayStats
+{
+    size_t nScheduled;
+    uint64_t nRebuilds;
+    int64_t nRebuildTime;
+    int64_t nMempoolLockTime;
+    uint64_t nSendMessages;
+    int64_t nSendMessagesTime;
+    int64_t nSendMessagesLockTime;
+    int64_t nInventoryTime;
+    uint64_t nAnnounced;
+};
+
+/**
+ * Keeps the announcement order of recently relayed transactions, so that the
+ * mempool is locked and the transactions are sorted once per interval, rather
+ * than once for every peer that is due to be sent an inv. Peers still do their
+ * own filtering (filterInventoryKnown, feefilter, bloom filters). Also collects
+ * timing statistics on SendMessages.
+ */
+class CTxRelayScheduler
+{
+private:
+    mutable CCriticalSection cs;
+    //! Relayed transactions that have not expired yet, oldest first, with the time they were queued
+    std::deque<std::pair<int64_t, uint256> > vScheduled;
+    std::shared_ptr<const CTxRelaySnapshot> snapshot;
+    int64_t nLastRebuild;
+    bool fRebuilding;
+    uint64_t nRebuilds;
+    int64_t nRebuildTime;
+    int64_t nMempoolLockTime;
+
+    std::atomic<uint64_t> nSendMessages;
+    std::atomic<int64_t> nSendMessagesTime;
+    std::atomic<int64_t> nSendMessagesLockTime;
+    std::atomic<int64_t> nInventoryTime;
+    std::atomic<uint64_t> nAnnounced;
+
+public:
+    CTxRelayScheduler();
+
+    /** Schedule a transaction that is being relayed to all peers */
+    void Queue(const uint256& hash, int64_t nNow);
+
+    /**
+     * Get the current announcement order, rebuilding it first if the last
+     * rebuild is more than TX_RELAY_SCHEDULE_INTERVAL ago. Transactions queued
+     * since the last rebuild are not in it yet. Only one caller rebuilds at a
+     * time; the others keep using the previous order meanwhile.
+     */
+    std::shared_ptr<const CTxRelaySnapshot> GetSnapshot(const CTxMemPool& pool, int64_t nNow);
+
+    /**
+     * Account for one SendMessages call: its total duration, how long it held
+     * cs_main and how long it spent on inventory, all in microseconds.
+     */
+    void RecordSendMessages(int64_t nTime, int64_t nLockTime, int64_t nInventory, unsigned int nAnnouncedTx);
+
+    void GetStats(CTxRelayStats& stats) const;
+};
+
+#endif // BITCOIN_TXRELAY_H
@@ -72,6 +72,10 @@
 #include <sys/prctl.h>
 #endif
 
+#ifdef __linux__
+#include <sched.h>
+#endif
+
 #include <boost/algorithm/string/case_conv.hpp> // for to_lower()
 #include <boost/algorithm/string/join.hpp>
 #include <boost/algorithm/string/predicate.hpp> // for startswith() and endswith()
@@ -785,6 +789,38 @@ void RenameThread(const char* name)
 #endif
 }
 
+bool SetThreadAffinity(int nCpu)
+{
+#if defined(CPU_SET)
+    if (nCpu < 0 || nCpu >= CPU_SETSIZE)
+        return false;
+    cpu_set_t set;
+    CPU_ZERO(&set);
+    CPU_SET(nCpu, &set);
+    return sched_setaffinity(0, sizeof(set), &set) == 0;
+#else
+    // Prevent warnings for unused parameters...
+    (void)nCpu;
+    return false;
+#endif
+}
+
+int GetCpuPackage(int nCpu)
+{
+    int nPackage = 0;
+#ifdef __linux__
+    FILE* file = fopen(strprintf("/sys/devices/system/cpu/cpu%d/topology/physical_package_id", nCpu).c_str(), "r");
+    if (file) {
+        if (fscanf(file, "%d", &nPackage) != 1 || nPackage < 0)
+            nPackage = 0;
+        fclose(file);
+    }
+#else
+    (void)nCpu;
+#endif
+    return nPackage;
+}
+
 void SetupEnvironment()
 {
     // On most POSIX systems (e.g. Linux, but not BSD) the environment's locale
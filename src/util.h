@@ -204,6 +204,15 @@ int GetNumCores();
 
 void RenameThread(const char* name);
 
+/**
+ * Restrict the calling thread to one logical CPU.
+ * Returns false if that is not supported on this system, or failed.
+ */
+bool SetThreadAffinity(int nCpu);
+
+/** Return the physical package (socket) of a logical CPU, or 0 if unknown. */
+int GetCpuPackage(int nCpu);
+
 /**
  * .. and a wrapper that just calls func once
  */
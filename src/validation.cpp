@@ -7,6 +7,7 @@
 
 #include "arith_uint256.h"
 #include "chainparams.h"
+#include "blockmap.h"
 #include "checkpoints.h"
 #include "checkqueue.h"
 #include "consensus/consensus.h"
@@ -14,11 +15,13 @@
 #include "consensus/validation.h"
 #include "hash.h"
 #include "init.h"
+#include "key.h"
 #include "policy/fees.h"
 #include "policy/policy.h"
 #include "pow.h"
 #include "primitives/block.h"
 #include "primitives/transaction.h"
+#include "pubkey.h"
 #include "random.h"
 #include "script/script.h"
 #include "script/sigcache.h"
@@ -174,6 +177,7 @@ CBlockIndex* FindForkInGlobalIndex(const CChain& chain, const CBlockLocator& loc
     return chain.Genesis();
 }
 
+CCoinsViewDB *pcoinsdbview = NULL;
 CCoinsViewCache *pcoinsTip = NULL;
 CBlockTreeDB *pblocktree = NULL;
 
@@ -362,15 +366,15 @@ bool CheckSequenceLocks(const CTransaction &tx, int flags, LockPoints* lp, bool
         prevheights.resize(tx.vin.size());
         for (size_t txinIndex = 0; txinIndex < tx.vin.size(); txinIndex++) {
             const CTxIn& txin = tx.vin[txinIndex];
-            CCoins coins;
-            if (!viewMemPool.GetCoins(txin.prevout.hash, coins)) {
+            Coin coin;
+            if (!viewMemPool.GetCoin(txin.prevout, coin)) {
                 return error("%s: Missing input", __func__);
             }
-            if (coins.nHeight == MEMPOOL_HEIGHT) {
+            if (coin.nHeight == MEMPOOL_HEIGHT) {
                 // Assume all mempool transaction confirm in the next block
                 prevheights[txinIndex] = tip->nHeight + 1;
             } else {
-                prevheights[txinIndex] = coins.nHeight;
+                prevheights[txinIndex] = coin.nHeight;
             }
         }
         lockPair = CalculateSequenceLocks(tx, flags, &prevheights, index);
@@ -510,9 +514,9 @@ void LimitMempoolSize(CTxMemPool& pool, size_t limit, unsigned long age) {
     if (expired != 0)
         LogPrint("mempool", "Expired %i transactions from the memory pool\n", expired);
 
-    std::vector<uint256> vNoSpendsRemaining;
+    std::vector<COutPoint> vNoSpendsRemaining;
     pool.TrimToSize(limit, &vNoSpendsRemaining);
-    BOOST_FOREACH(const uint256& removed, vNoSpendsRemaining)
+    BOOST_FOREACH(const COutPoint& removed, vNoSpendsRemaining)
         pcoinsTip->Uncache(removed);
 }
 
@@ -525,9 +529,36 @@ std::string FormatStateMessage(const CValidationState &state)
         state.GetRejectCode());
 }
 
+/** The script verification flags transactions are accepted to the mempool with */
+static unsigned int GetMempoolScriptVerifyFlags()
+{
+    unsigned int scriptVerifyFlags = STANDARD_SCRIPT_VERIFY_FLAGS;
+    if (!Params().RequireStandard()) {
+        scriptVerifyFlags = GetArg("-promiscuousmempoolflags", scriptVerifyFlags);
+    }
+    return scriptVerifyFlags;
+}
+
+/** Verify the scripts of a transaction for the mempool, noting when only its witness may be at fault */
+static bool CheckInputsForMempool(const CTransaction& tx, CValidationState& state, const CCoinsViewCache& view, unsigned int scriptVerifyFlags, PrecomputedTransactionData& txdata)
+{
+    if (!CheckInputs(tx, state, view, true, scriptVerifyFlags, true, txdata)) {
+        // SCRIPT_VERIFY_CLEANSTACK requires SCRIPT_VERIFY_WITNESS, so we
+        // need to turn both off, and compare against just turning off CLEANSTACK
+        // to see if the failure is specifically due to witness validation.
+        if (!tx.HasWitness() && CheckInputs(tx, state, view, true, scriptVerifyFlags & ~(SCRIPT_VERIFY_WITNESS | SCRIPT_VERIFY_CLEANSTACK), true, txdata) &&
+            !CheckInputs(tx, state, view, true, scriptVerifyFlags & ~SCRIPT_VERIFY_CLEANSTACK, true, txdata)) {
+            // Only the witness is missing, so the transaction itself may be fine.
+            state.SetCorruptionPossible();
+        }
+        return false;
+    }
+    return true;
+}
+
 bool AcceptToMemoryPoolWorker(CTxMemPool& pool, CValidationState& state, const CTransaction& tx, bool fLimitFree,
                               bool* pfMissingInputs, int64_t nAcceptTime, bool fOverrideMempoolLimit, const CAmount& nAbsurdFee,
-                              std::vector<uint256>& vHashTxnToUncache)
+                              std::list<CTransactionRef>* plTxnReplaced, std::vector<COutPoint>& coins_to_uncache)
 {
     const uint256 hash = tx.GetHash();
     AssertLockHeld(cs_main);
@@ -618,23 +649,29 @@ bool AcceptToMemoryPoolWorker(CTxMemPool& pool, CValidationState& state, const C
         CCoinsViewMemPool viewMemPool(pcoinsTip, pool);
         view.SetBackend(viewMemPool);
 
-        // do we already have it?
-        bool fHadTxInCache = pcoinsTip->HaveCoinsInCache(hash);
-        if (view.HaveCoins(hash)) {
-            if (!fHadTxInCache)
-                vHashTxnToUncache.push_back(hash);
-            return state.Invalid(false, REJECT_ALREADY_KNOWN, "txn-already-known");
-        }
-
         // do all inputs exist?
-        // Note that this does not check for the presence of actual outputs (see the next check for that),
-        // and only helps with filling in pfMissingInputs (to determine missing vs spent).
+        std::vector<COutPoint> vPrevouts;
+        vPrevouts.reserve(tx.vin.size());
+        BOOST_FOREACH(const CTxIn txin, tx.vin) {
+            if (!pcoinsTip->HaveCoinInCache(txin.prevout)) {
+                coins_to_uncache.push_back(txin.prevout);
+            }
+            vPrevouts.push_back(txin.prevout);
+        }
+        view.FetchCoins(vPrevouts);
         BOOST_FOREACH(const CTxIn txin, tx.vin) {
-            if (!pcoinsTip->HaveCoinsInCache(txin.prevout.hash))
-                vHashTxnToUncache.push_back(txin.prevout.hash);
-            if (!view.HaveCoins(txin.prevout.hash)) {
-                if (pfMissingInputs)
+            if (!view.HaveCoin(txin.prevout)) {
+                // Are inputs missing because we already have the tx?
+                for (size_t out = 0; out < tx.vout.size(); out++) {
+                    // Optimistically just do efficient check of cache for outputs
+                    if (pcoinsTip->HaveCoinInCache(COutPoint(hash, out))) {
+                        return state.Invalid(false, REJECT_ALREADY_KNOWN, "txn-already-known");
+                    }
+                }
+                // Otherwise assume this might be an orphan tx for which we just haven't seen parents yet
+                if (pfMissingInputs) {
                     *pfMissingInputs = true;
+                }
                 return false; // fMissingInputs and !state.IsInvalid() is used to detect this condition, don't set state.Invalid()
             }
         }
@@ -684,8 +721,8 @@ bool AcceptToMemoryPoolWorker(CTxMemPool& pool, CValidationState& state, const C
         // during reorgs to ensure COINBASE_MATURITY is still met.
         bool fSpendsCoinbase = false;
         BOOST_FOREACH(const CTxIn &txin, tx.vin) {
-            const CCoins *coins = view.AccessCoins(txin.prevout.hash);
-            if (coins->IsCoinBase()) {
+            const Coin &coin = view.AccessCoin(txin.prevout);
+            if (coin.IsCoinBase()) {
                 fSpendsCoinbase = true;
                 break;
             }
@@ -893,25 +930,11 @@ bool AcceptToMemoryPoolWorker(CTxMemPool& pool, CValidationState& state, const C
             }
         }
 
-        unsigned int scriptVerifyFlags = STANDARD_SCRIPT_VERIFY_FLAGS;
-        if (!Params().RequireStandard()) {
-            scriptVerifyFlags = GetArg("-promiscuousmempoolflags", scriptVerifyFlags);
-        }
-
         // Check against previous transactions
         // This is done last to help prevent CPU exhaustion denial-of-service attacks.
         PrecomputedTransactionData txdata(tx);
-        if (!CheckInputs(tx, state, view, true, scriptVerifyFlags, true, txdata)) {
-            // SCRIPT_VERIFY_CLEANSTACK requires SCRIPT_VERIFY_WITNESS, so we
-            // need to turn both off, and compare against just turning off CLEANSTACK
-            // to see if the failure is specifically due to witness validation.
-            if (!tx.HasWitness() && CheckInputs(tx, state, view, true, scriptVerifyFlags & ~(SCRIPT_VERIFY_WITNESS | SCRIPT_VERIFY_CLEANSTACK), true, txdata) &&
-                !CheckInputs(tx, state, view, true, scriptVerifyFlags & ~SCRIPT_VERIFY_CLEANSTACK, true, txdata)) {
-                // Only the witness is missing, so the transaction itself may be fine.
-                state.SetCorruptionPossible();
-            }
+        if (!CheckInputsForMempool(tx, state, view, GetMempoolScriptVerifyFlags(), txdata))
             return false;
-        }
 
         // Check again against just the consensus-critical mandatory script
         // verification flags, in case of bugs in the standard flags that cause
@@ -936,6 +959,8 @@ bool AcceptToMemoryPoolWorker(CTxMemPool& pool, CValidationState& state, const C
                     hash.ToString(),
                     FormatMoney(nModifiedFees - nConflictingFees),
                     (int)nSize - (int)nConflictingSize);
+            if (plTxnReplaced)
+                plTxnReplaced->push_back(it->GetSharedTx());
         }
         pool.RemoveStaged(allConflicting, false);
 
@@ -956,12 +981,13 @@ bool AcceptToMemoryPoolWorker(CTxMemPool& pool, CValidationState& state, const C
 }
 
 bool AcceptToMemoryPoolWithTime(CTxMemPool& pool, CValidationState &state, const CTransaction &tx, bool fLimitFree,
-                        bool* pfMissingInputs, int64_t nAcceptTime, bool fOverrideMempoolLimit, const CAmount nAbsurdFee)
+                        bool* pfMissingInputs, int64_t nAcceptTime, bool fOverrideMempoolLimit, const CAmount nAbsurdFee,
+                        std::list<CTransactionRef>* plTxnReplaced)
 {
-    std::vector<uint256> vHashTxToUncache;
-    bool res = AcceptToMemoryPoolWorker(pool, state, tx, fLimitFree, pfMissingInputs, nAcceptTime, fOverrideMempoolLimit, nAbsurdFee, vHashTxToUncache);
+    std::vector<COutPoint> coins_to_uncache;
+    bool res = AcceptToMemoryPoolWorker(pool, state, tx, fLimitFree, pfMissingInputs, nAcceptTime, fOverrideMempoolLimit, nAbsurdFee, plTxnReplaced, coins_to_uncache);
     if (!res) {
-        BOOST_FOREACH(const uint256& hashTx, vHashTxToUncache)
+        BOOST_FOREACH(const COutPoint& hashTx, coins_to_uncache)
             pcoinsTip->Uncache(hashTx);
     }
     // After we've (potentially) uncached entries, ensure our coins cache is still within its size limits
@@ -971,9 +997,105 @@ bool AcceptToMemoryPoolWithTime(CTxMemPool& pool, CValidationState &state, const
 }
 
 bool AcceptToMemoryPool(CTxMemPool& pool, CValidationState &state, const CTransaction &tx, bool fLimitFree,
-                        bool* pfMissingInputs, bool fOverrideMempoolLimit, const CAmount nAbsurdFee)
+                        bool* pfMissingInputs, bool fOverrideMempoolLimit, const CAmount nAbsurdFee,
+                        std::list<CTransactionRef>* plTxnReplaced)
 {
-    return AcceptToMemoryPoolWithTime(pool, state, tx, fLimitFree, pfMissingInputs, GetTime(), fOverrideMempoolLimit, nAbsurdFee);
+    return AcceptToMemoryPoolWithTime(pool, state, tx, fLimitFree, pfMissingInputs, GetTime(), fOverrideMempoolLimit, nAbsurdFee, plTxnReplaced);
+}
+
+static CCheckQueue<CScriptCheck> txscriptcheckqueue(1);
+static CCriticalSection cs_txscriptcheckqueue;
+
+void ThreadTxScriptCheck() {
+    RenameThread("bitcoin-txscrch");
+    txscriptcheckqueue.Thread();
+}
+
+bool PreVerifyTransactionScripts(CTxMemPool& pool, const CTransaction& tx, CValidationState& state)
+{
+    // Everything AcceptToMemoryPool rejects before it gets to the scripts,
+    // short of replacements and the mempool limits, is checked first. A
+    // transaction failing any of it is left to AcceptToMemoryPool to reject,
+    // without spending CPU on it.
+    CValidationState stateDummy;
+    if (tx.IsCoinBase() || !CheckTransaction(tx, stateDummy))
+        return false;
+
+    CCoinsView dummy;
+    CCoinsViewCache view(&dummy);
+    {
+        LOCK2(cs_main, pool.cs);
+        std::string reason;
+        bool witnessEnabled = IsWitnessEnabled(chainActive.Tip(), Params().GetConsensus());
+        if (!GetBoolArg("-prematurewitness", false) && tx.HasWitness() && !witnessEnabled)
+            return false;
+        if (fRequireStandard && !IsStandardTx(tx, reason, witnessEnabled))
+            return false;
+        if (!CheckFinalTx(tx, STANDARD_LOCKTIME_VERIFY_FLAGS) || pool.exists(tx.GetHash()))
+            return false;
+        BOOST_FOREACH(const CTxIn& txin, tx.vin) {
+            if (pool.mapNextTx.count(txin.prevout))
+                return false;
+        }
+
+        // Read the spent outputs without leaving them in the coins cache;
+        // AcceptToMemoryPool decides whether they stay there.
+        CCoinsViewMemPool viewMemPool(pcoinsTip, pool);
+        view.SetBackend(viewMemPool);
+        std::vector<COutPoint> vPrevouts, vUncache;
+        BOOST_FOREACH(const CTxIn& txin, tx.vin) {
+            if (!pcoinsTip->HaveCoinInCache(txin.prevout))
+                vUncache.push_back(txin.prevout);
+            vPrevouts.push_back(txin.prevout);
+        }
+        view.FetchCoins(vPrevouts);
+        bool fHaveInputs = view.HaveInputs(tx);
+        if (fHaveInputs) {
+            view.GetBestBlock();
+            fHaveInputs = CheckSequenceLocks(tx, STANDARD_LOCKTIME_VERIFY_FLAGS);
+        }
+        view.SetBackend(dummy);
+        BOOST_FOREACH(const COutPoint& prevout, vUncache)
+            pcoinsTip->Uncache(prevout);
+        if (!fHaveInputs)
+            return false;
+
+        // Do not spend CPU on transactions the mempool would not take for their fee
+        size_t nSize = GetVirtualTransactionSize(tx);
+        CAmount nModifiedFees = view.GetValueIn(tx) - tx.GetValueOut();
+        double nPriorityDummy = 0;
+        pool.ApplyDeltas(tx.GetHash(), nPriorityDummy, nModifiedFees);
+        if (nModifiedFees < ::minRelayTxFee.GetFee(nSize) ||
+            nModifiedFees < pool.GetMinFee(GetArg("-maxmempool", DEFAULT_MAX_MEMPOOL_SIZE) * 1000000).GetFee(nSize))
+            return false;
+    }
+
+    if (fRequireStandard && !AreInputsStandard(tx, view))
+        return false;
+    if (tx.HasWitness() && fRequireStandard && !IsWitnessStandard(tx, view))
+        return false;
+    if (GetTransactionSigOpCost(tx, view, STANDARD_SCRIPT_VERIFY_FLAGS) > MAX_STANDARD_TX_SIGOPS_COST)
+        return false;
+
+    // Only one thread can wait on the queue at a time; the others verify by
+    // themselves, alongside it.
+    unsigned int scriptVerifyFlags = GetMempoolScriptVerifyFlags();
+    PrecomputedTransactionData txdata(tx);
+    {
+        TRY_LOCK(cs_txscriptcheckqueue, lockQueue);
+        if (lockQueue && nScriptCheckThreads) {
+            std::vector<CScriptCheck> vChecks;
+            CCheckQueueControl<CScriptCheck> control(&txscriptcheckqueue);
+            if (!CheckInputs(tx, state, view, true, scriptVerifyFlags, true, txdata, &vChecks))
+                return false;
+            control.Add(vChecks);
+            if (control.Wait())
+                return true;
+        }
+    }
+    // Without the queue, or to find out which input failed: the inputs that
+    // passed on the queue are in the signature cache by now.
+    return CheckInputsForMempool(tx, state, view, scriptVerifyFlags, txdata);
 }
 
 /** Return transaction in txOut, and if it was found inside a block, its hash is placed in hashBlock */
@@ -1014,10 +1136,9 @@ bool GetTransaction(const uint256 &hash, CTransactionRef &txOut, const Consensus
     if (fAllowSlow) { // use coin database to locate block that contains transaction, and scan it
         int nHeight = -1;
         {
-            const CCoinsViewCache& view = *pcoinsTip;
-            const CCoins* coins = view.AccessCoins(hash);
-            if (coins)
-                nHeight = coins->nHeight;
+            const Coin& coin = AccessByTxid(*pcoinsTip, hash);
+            if (!coin.IsSpent())
+                nHeight = coin.nHeight;
         }
         if (nHeight > 0)
             pindexSlow = chainActive[nHeight];
@@ -1074,17 +1195,29 @@ bool ReadBlockFromDisk(CBlock& block, const CDiskBlockPos& pos, const Consensus:
 {
     block.SetNull();
 
-    // Open history file to read
-    CAutoFile filein(OpenBlockFile(pos, true), SER_DISK, CLIENT_VERSION);
-    if (filein.IsNull())
-        return error("ReadBlockFromDisk: OpenBlockFile failed for %s", pos.ToString());
+    CRawBlock raw;
+    if (blockFileMapper.ReadRawBlock(raw, pos, Params().MessageStart())) {
+        // Read block from the mapped file
+        try {
+            CSpanReader reader(SER_DISK, CLIENT_VERSION, raw.begin(), raw.end());
+            reader >> block;
+        }
+        catch (const std::exception& e) {
+            return error("%s: Deserialize error - %s at %s", __func__, e.what(), pos.ToString());
+        }
+    } else {
+        // Open history file to read
+        CAutoFile filein(OpenBlockFile(pos, true), SER_DISK, CLIENT_VERSION);
+        if (filein.IsNull())
+            return error("ReadBlockFromDisk: OpenBlockFile failed for %s", pos.ToString());
 
-    // Read block
-    try {
-        filein >> block;
-    }
-    catch (const std::exception& e) {
-        return error("%s: Deserialize or I/O error - %s at %s", __func__, e.what(), pos.ToString());
+        // Read block
+        try {
+            filein >> block;
+        }
+        catch (const std::exception& e) {
+            return error("%s: Deserialize or I/O error - %s at %s", __func__, e.what(), pos.ToString());
+        }
     }
 
     // Check the header
@@ -1104,6 +1237,19 @@ bool ReadBlockFromDisk(CBlock& block, const CBlockIndex* pindex, const Consensus
     return true;
 }
 
+bool ReadRawBlockFromDisk(CRawBlock& raw, const CBlockIndex* pindex, const CChainParams& chainparams)
+{
+    if (!blockFileMapper.ReadRawBlock(raw, pindex->GetBlockPos(), chainparams.MessageStart()))
+        return false;
+    // The header comes first, and identifies the block
+    if (Hash(raw.begin(), raw.begin() + 80) != pindex->GetBlockHash()) {
+        raw.SetNull();
+        return error("ReadRawBlockFromDisk: header doesn't match index for %s at %s",
+                pindex->ToString(), pindex->GetBlockPos().ToString());
+    }
+    return true;
+}
+
 CAmount GetBlockSubsidy(int nHeight, const Consensus::Params& consensusParams)
 {
     int halvings = nHeight / consensusParams.nSubsidyHalvingInterval;
@@ -1267,24 +1413,13 @@ void UpdateCoins(const CTransaction& tx, CCoinsViewCache& inputs, CTxUndo &txund
     if (!tx.IsCoinBase()) {
         txundo.vprevout.reserve(tx.vin.size());
         BOOST_FOREACH(const CTxIn &txin, tx.vin) {
-            CCoinsModifier coins = inputs.ModifyCoins(txin.prevout.hash);
-            unsigned nPos = txin.prevout.n;
-
-            if (nPos >= coins->vout.size() || coins->vout[nPos].IsNull())
-                assert(false);
-            // mark an outpoint spent, and construct undo information
-            txundo.vprevout.push_back(CTxInUndo(coins->vout[nPos]));
-            coins->Spend(nPos);
-            if (coins->vout.size() == 0) {
-                CTxInUndo& undo = txundo.vprevout.back();
-                undo.nHeight = coins->nHeight;
-                undo.fCoinBase = coins->fCoinBase;
-                undo.nVersion = coins->nVersion;
-            }
+            txundo.vprevout.emplace_back();
+            inputs.SpendCoin(txin.prevout, &txundo.vprevout.back());
+            assert(!txundo.vprevout.back().IsSpent());
         }
     }
     // add outputs
-    inputs.ModifyNewCoins(tx.GetHash(), tx.IsCoinBase())->FromTx(tx, nHeight);
+    AddCoins(inputs, tx, nHeight);
 }
 
 void UpdateCoins(const CTransaction& tx, CCoinsViewCache& inputs, int nHeight)
@@ -1322,20 +1457,20 @@ bool CheckTxInputs(const CTransaction& tx, CValidationState& state, const CCoins
         for (unsigned int i = 0; i < tx.vin.size(); i++)
         {
             const COutPoint &prevout = tx.vin[i].prevout;
-            const CCoins *coins = inputs.AccessCoins(prevout.hash);
-            assert(coins);
+            const Coin& coin = inputs.AccessCoin(prevout);
+            assert(!coin.IsSpent());
 
             // If prev is coinbase, check that it's matured
-            if (coins->IsCoinBase()) {
-                if (nSpendHeight - coins->nHeight < COINBASE_MATURITY)
+            if (coin.IsCoinBase()) {
+                if (nSpendHeight - coin.nHeight < COINBASE_MATURITY)
                     return state.Invalid(false,
                         REJECT_INVALID, "bad-txns-premature-spend-of-coinbase",
-                        strprintf("tried to spend coinbase at depth %d", nSpendHeight - coins->nHeight));
+                        strprintf("tried to spend coinbase at depth %d", nSpendHeight - coin.nHeight));
             }
 
             // Check for negative or overflow input values
-            nValueIn += coins->vout[prevout.n].nValue;
-            if (!MoneyRange(coins->vout[prevout.n].nValue) || !MoneyRange(nValueIn))
+            nValueIn += coin.out.nValue;
+            if (!MoneyRange(coin.out.nValue) || !MoneyRange(nValueIn))
                 return state.DoS(100, false, REJECT_INVALID, "bad-txns-inputvalues-outofrange");
 
         }
@@ -1378,11 +1513,11 @@ bool CheckInputs(const CTransaction& tx, CValidationState &state, const CCoinsVi
         if (fScriptChecks) {
             for (unsigned int i = 0; i < tx.vin.size(); i++) {
                 const COutPoint &prevout = tx.vin[i].prevout;
-                const CCoins* coins = inputs.AccessCoins(prevout.hash);
-                assert(coins);
+                const Coin& coin = inputs.AccessCoin(prevout);
+                assert(!coin.IsSpent());
 
                 // Verify signature
-                CScriptCheck check(*coins, tx, i, flags, cacheStore, &txdata);
+                CScriptCheck check(coin.out, tx, i, flags, cacheStore, &txdata);
                 if (pvChecks) {
                     pvChecks->push_back(CScriptCheck());
                     check.swap(pvChecks->back());
@@ -1394,7 +1529,7 @@ bool CheckInputs(const CTransaction& tx, CValidationState &state, const CCoinsVi
                         // arguments; if so, don't trigger DoS protection to
                         // avoid splitting the network between upgraded and
                         // non-upgraded nodes.
-                        CScriptCheck check2(*coins, tx, i,
+                        CScriptCheck check2(coin.out, tx, i,
                                 flags & ~STANDARD_NOT_MANDATORY_VERIFY_FLAGS, cacheStore, &txdata);
                         if (check2())
                             return state.Invalid(false, REJECT_NONSTANDARD, strprintf("non-mandatory-script-verify-flag (%s)", ScriptErrorString(check.GetScriptError())));
@@ -1444,6 +1579,8 @@ bool UndoWriteToDisk(const CBlockUndo& blockundo, CDiskBlockPos& pos, const uint
     return true;
 }
 
+} // anon namespace
+
 bool UndoReadFromDisk(CBlockUndo& blockundo, const CDiskBlockPos& pos, const uint256& hashBlock)
 {
     // Open history file to read
@@ -1471,6 +1608,8 @@ bool UndoReadFromDisk(CBlockUndo& blockundo, const CDiskBlockPos& pos, const uin
     return true;
 }
 
+namespace {
+
 /** Abort with a message */
 bool AbortNode(const std::string& strMessage, const std::string& userMessage="")
 {
@@ -1493,33 +1632,30 @@ bool AbortNode(CValidationState& state, const std::string& strMessage, const std
 
 /**
  * Apply the undo operation of a CTxInUndo to the given chain state.
- * @param undo The undo object.
+ * @param undo The Coin to be restored.
  * @param view The coins view to which to apply the changes.
  * @param out The out point that corresponds to the tx input.
  * @return True on success.
  */
-static bool ApplyTxInUndo(const CTxInUndo& undo, CCoinsViewCache& view, const COutPoint& out)
+static bool ApplyTxInUndo(Coin&& undo, CCoinsViewCache& view, const COutPoint& out)
 {
     bool fClean = true;
 
-    CCoinsModifier coins = view.ModifyCoins(out.hash);
-    if (undo.nHeight != 0) {
-        // undo data contains height: this is the last output of the prevout tx being spent
-        if (!coins->IsPruned())
-            fClean = fClean && error("%s: undo data overwriting existing transaction", __func__);
-        coins->Clear();
-        coins->fCoinBase = undo.fCoinBase;
-        coins->nHeight = undo.nHeight;
-        coins->nVersion = undo.nVersion;
-    } else {
-        if (coins->IsPruned())
-            fClean = fClean && error("%s: undo data adding output to missing transaction", __func__);
+    if (view.HaveCoin(out)) fClean = false; // overwriting transaction output
+
+    if (undo.nHeight == 0) {
+        // Missing undo metadata (height and coinbase). Older versions included this
+        // information only in undo records for the last spend of a transactions'
+        // outputs. This implies that it must be present for some other output of the same tx.
+        const Coin& alternate = AccessByTxid(view, out.hash);
+        if (!alternate.IsSpent()) {
+            undo.nHeight = alternate.nHeight;
+            undo.fCoinBase = alternate.fCoinBase;
+        } else {
+            return error("%s: undo data adding output to missing transaction", __func__);
+        }
     }
-    if (coins->IsAvailable(out.n))
-        fClean = fClean && error("%s: undo data overwriting existing output", __func__);
-    if (coins->vout.size() < out.n+1)
-        coins->vout.resize(out.n+1);
-    coins->vout[out.n] = undo.txout;
+    view.AddCoin(out, std::move(undo), undo.fCoinBase);
 
     return fClean;
 }
@@ -1550,32 +1686,25 @@ bool DisconnectBlock(const CBlock& block, CValidationState& state, const CBlockI
 
         // Check that all outputs are available and match the outputs in the block itself
         // exactly.
-        {
-        CCoinsModifier outs = view.ModifyCoins(hash);
-        outs->ClearUnspendable();
-
-        CCoins outsBlock(tx, pindex->nHeight);
-        // The CCoins serialization does not serialize negative numbers.
-        // No network rules currently depend on the version here, so an inconsistency is harmless
-        // but it must be corrected before txout nversion ever influences a network rule.
-        if (outsBlock.nVersion < 0)
-            outs->nVersion = outsBlock.nVersion;
-        if (*outs != outsBlock)
-            fClean = fClean && error("DisconnectBlock(): added transaction mismatch? database corrupted");
-
-        // remove outputs
-        outs->Clear();
+        for (size_t o = 0; o < tx.vout.size(); o++) {
+            if (!tx.vout[o].scriptPubKey.IsUnspendable()) {
+                COutPoint out(hash, o);
+                Coin coin;
+                view.SpendCoin(out, &coin);
+                if (tx.vout[o] != coin.out) {
+                    fClean = fClean && error("DisconnectBlock(): added transaction mismatch? database corrupted");
+                }
+            }
         }
 
         // restore inputs
         if (i > 0) { // not coinbases
-            const CTxUndo &txundo = blockUndo.vtxundo[i-1];
+            CTxUndo &txundo = blockUndo.vtxundo[i-1];
             if (txundo.vprevout.size() != tx.vin.size())
                 return error("DisconnectBlock(): transaction and undo data inconsistent");
             for (unsigned int j = tx.vin.size(); j-- > 0;) {
                 const COutPoint &out = tx.vin[j].prevout;
-                const CTxInUndo &undo = txundo.vprevout[j];
-                if (!ApplyTxInUndo(undo, view, out))
+                if (!ApplyTxInUndo(std::move(txundo.vprevout[j]), view, out))
                     fClean = false;
             }
         }
@@ -1600,8 +1729,11 @@ void static FlushBlockFile(bool fFinalize = false)
 
     FILE *fileOld = OpenBlockFile(posOld);
     if (fileOld) {
-        if (fFinalize)
+        if (fFinalize) {
+            // Mappings must not reach past the end of the file
+            blockFileMapper.Forget(nLastBlockFile);
             TruncateFile(fileOld, vinfoBlockFile[nLastBlockFile].nSize);
+        }
         FileCommit(fileOld);
         fclose(fileOld);
     }
@@ -1617,11 +1749,95 @@ void static FlushBlockFile(bool fFinalize = false)
 
 bool FindUndoPos(CValidationState &state, int nFile, CDiskBlockPos &pos, unsigned int nAddSize);
 
+static_assert(MAX_SCRIPTCHECK_THREADS <= MAX_CHECKQUEUE_THREADS, "script check queue too small for MAX_SCRIPTCHECK_THREADS");
+
 static CCheckQueue<CScriptCheck> scriptcheckqueue(128);
 
-void ThreadScriptCheck() {
+void ThreadScriptCheck(int nCpu) {
     RenameThread("bitcoin-scriptch");
-    scriptcheckqueue.Thread();
+    int nGroup = 0;
+    if (nCpu >= 0) {
+        if (SetThreadAffinity(nCpu))
+            nGroup = GetCpuPackage(nCpu);
+        else
+            LogPrintf("%s: cannot pin thread to CPU %d\n", __func__, nCpu);
+    }
+    scriptcheckqueue.ThreadInGroup(nGroup);
+}
+
+namespace {
+
+/** Verifies a fixed signature, standing in for CScriptCheck while calibrating. */
+class CCalibrationCheck
+{
+private:
+    const CPubKey* pubkey;
+    const uint256* hash;
+    const std::vector<unsigned char>* vchSig;
+
+public:
+    CCalibrationCheck() : pubkey(NULL), hash(NULL), vchSig(NULL) {}
+    CCalibrationCheck(const CPubKey& pubkeyIn, const uint256& hashIn, const std::vector<unsigned char>& vchSigIn) : pubkey(&pubkeyIn), hash(&hashIn), vchSig(&vchSigIn) {}
+
+    bool operator()() { return pubkey->Verify(*hash, *vchSig); }
+
+    void swap(CCalibrationCheck& check) {
+        std::swap(pubkey, check.pubkey);
+        std::swap(hash, check.hash);
+        std::swap(vchSig, check.vchSig);
+    }
+};
+
+} // anon namespace
+
+int CalibrateScriptCheckThreads(int nMaxThreads)
+{
+    CKey key;
+    key.MakeNewKey(true);
+    CPubKey pubkey = key.GetPubKey();
+    uint256 hash = GetRandHash();
+    std::vector<unsigned char> vchSig;
+    if (nMaxThreads <= 1 || !key.Sign(hash, vchSig))
+        return std::max(nMaxThreads, 1);
+
+    // Try 1, 2, 4, ... threads and nMaxThreads, for 50ms each. More threads
+    // have to be at least 5% faster to be worth it; once they are clearly
+    // slower (hyperthreads, other load) there is no point going on.
+    int nBest = 1;
+    double dBestRate = 0;
+    for (int nThreads = 1; nThreads <= nMaxThreads; nThreads = (nThreads < nMaxThreads ? std::min(nThreads * 2, nMaxThreads) : nMaxThreads + 1)) {
+        CCheckQueue<CCalibrationCheck> queue(128);
+        boost::thread_group threadGroup;
+        for (int i = 0; i < nThreads - 1; i++)
+            threadGroup.create_thread(boost::bind(&CCheckQueue<CCalibrationCheck>::Thread, boost::ref(queue)));
+
+        int64_t nChecks = 0;
+        int64_t nTimeStart = GetTimeMicros();
+        int64_t nTimeElapsed;
+        do {
+            CCheckQueueControl<CCalibrationCheck> control(&queue);
+            for (int i = 0; i < 16 * nThreads; i++) {
+                std::vector<CCalibrationCheck> vChecks(1, CCalibrationCheck(pubkey, hash, vchSig));
+                control.Add(vChecks);
+            }
+            control.Wait();
+            nChecks += 16 * nThreads;
+            nTimeElapsed = GetTimeMicros() - nTimeStart;
+        } while (nTimeElapsed < 50000);
+
+        threadGroup.interrupt_all();
+        threadGroup.join_all();
+
+        double dRate = nChecks * 1000000.0 / nTimeElapsed;
+        LogPrint("bench", "%s: %d threads: %.0f signatures/s\n", __func__, nThreads, dRate);
+        if (dRate > dBestRate * 1.05) {
+            nBest = nThreads;
+            dBestRate = dRate;
+        } else if (dRate < dBestRate * 0.9) {
+            break;
+        }
+    }
+    return nBest;
 }
 
 // Protected by cs_main
@@ -1671,6 +1887,7 @@ static ThresholdConditionCache warningcache[VERSIONBITS_NUM_BITS];
 
 static int64_t nTimeCheck = 0;
 static int64_t nTimeForks = 0;
+static int64_t nTimeFetchInputs = 0;
 static int64_t nTimeVerify = 0;
 static int64_t nTimeConnect = 0;
 static int64_t nTimeIndex = 0;
@@ -1740,10 +1957,12 @@ bool ConnectBlock(const CBlock& block, CValidationState& state, CBlockIndex* pin
 
     if (fEnforceBIP30) {
         for (const auto& tx : block.vtx) {
-            const CCoins* coins = view.AccessCoins(tx->GetHash());
-            if (coins && !coins->IsPruned())
-                return state.DoS(100, error("ConnectBlock(): tried to overwrite transaction"),
-                                 REJECT_INVALID, "bad-txns-BIP30");
+            for (size_t o = 0; o < tx->vout.size(); o++) {
+                if (view.HaveCoin(COutPoint(tx->GetHash(), o))) {
+                    return state.DoS(100, error("ConnectBlock(): tried to overwrite transaction"),
+                                     REJECT_INVALID, "bad-txns-BIP30");
+                }
+            }
         }
     }
 
@@ -1793,6 +2012,22 @@ bool ConnectBlock(const CBlock& block, CValidationState& state, CBlockIndex* pin
     blockundo.vtxundo.reserve(block.vtx.size() - 1);
     std::vector<PrecomputedTransactionData> txdata;
     txdata.reserve(block.vtx.size()); // Required so that pointers to individual PrecomputedTransactionData don't get invalidated
+
+    // Look up all coins the block spends at once, rather than one at a time
+    // below. Outputs of the block's own transactions cannot be found yet.
+    std::set<uint256> setBlockTxids;
+    std::vector<COutPoint> vPrevouts;
+    for (unsigned int i = 1; i < block.vtx.size(); i++) {
+        setBlockTxids.insert(block.vtx[i - 1]->GetHash());
+        BOOST_FOREACH(const CTxIn& txin, block.vtx[i]->vin) {
+            if (!setBlockTxids.count(txin.prevout.hash))
+                vPrevouts.push_back(txin.prevout);
+        }
+    }
+    view.FetchCoins(vPrevouts);
+    int64_t nTime2a = GetTimeMicros(); nTimeFetchInputs += nTime2a - nTime2;
+    LogPrint("bench", "      - Fetch %u inputs: %.2fms [%.2fs]\n", (unsigned int)vPrevouts.size(), 0.001 * (nTime2a - nTime2), nTimeFetchInputs * 0.000001);
+
     for (unsigned int i = 0; i < block.vtx.size(); i++)
     {
         const CTransaction &tx = *(block.vtx[i]);
@@ -1810,7 +2045,7 @@ bool ConnectBlock(const CBlock& block, CValidationState& state, CBlockIndex* pin
             // be in ConnectBlock because they require the UTXO set
             prevheights.resize(tx.vin.size());
             for (size_t j = 0; j < tx.vin.size(); j++) {
-                prevheights[j] = view.AccessCoins(tx.vin[j].prevout.hash)->nHeight;
+                prevheights[j] = view.AccessCoin(tx.vin[j].prevout).nHeight;
             }
 
             if (!SequenceLocks(tx, nLockTimeFlags, &prevheights, *pindex)) {
@@ -1989,12 +2224,12 @@ bool static FlushStateToDisk(CValidationState &state, FlushStateMode mode) {
     }
     // Flush best chain related state. This can only be done if the blocks / block index write was also done.
     if (fDoFullFlush) {
-        // Typical CCoins structures on disk are around 128 bytes in size.
+        // Typical Coin structures on disk are around 48 bytes in size.
         // Pushing a new one to the database can cause it to be written
         // twice (once in the log, and once in the tables). This is already
         // an overestimation, as most will delete an existing entry or
         // overwrite one. Still, use a conservative safety factor of 2.
-        if (!CheckDiskSpace(128 * 2 * 2 * pcoinsTip->GetCacheSize()))
+        if (!CheckDiskSpace(48 * 2 * 2 * pcoinsTip->GetCacheSize()))
             return state.Error("out of disk space");
         // Flush the chainstate (which may refer to block index entries).
         if (!pcoinsTip->Flush())
@@ -2212,6 +2447,97 @@ bool static ConnectTip(CValidationState& state, const CChainParams& chainparams,
     return true;
 }
 
+/**
+ * Reads the next block to connect, and the coins it spends, on a background
+ * thread while the current block is being connected. Coins come straight from
+ * the coins database, which only changes when pcoinsTip is flushed; results
+ * are dropped if that happened in the meantime.
+ */
+class CBlockPrefetcher
+{
+private:
+    boost::thread thread;
+    const CBlockIndex* pindex;
+    uint256 hashCoinsBest;
+    std::shared_ptr<CBlock> pblock;
+    std::vector<std::pair<COutPoint, Coin>> vCoins;
+
+    void Run(CDiskBlockPos pos, uint256 hash, const Consensus::Params& consensusParams)
+    {
+        try {
+            std::shared_ptr<CBlock> pblockRead = std::make_shared<CBlock>();
+            if (!ReadBlockFromDisk(*pblockRead, pos, consensusParams) || pblockRead->GetHash() != hash)
+                return;
+            std::vector<COutPoint> vPrevouts;
+            for (size_t i = 1; i < pblockRead->vtx.size(); i++) {
+                BOOST_FOREACH(const CTxIn& txin, pblockRead->vtx[i]->vin)
+                    vPrevouts.push_back(txin.prevout);
+            }
+            // Outputs created earlier in the block are not found, as intended.
+            std::vector<Coin> vPrevCoins;
+            pcoinsdbview->BatchFetch(vPrevouts, vPrevCoins);
+            for (size_t i = 0; i < vPrevouts.size(); i++) {
+                if (!vPrevCoins[i].IsSpent())
+                    vCoins.emplace_back(vPrevouts[i], std::move(vPrevCoins[i]));
+            }
+            pblock = pblockRead;
+        } catch (const std::exception& e) {
+            // ConnectTip reads the block again and reports any problem
+            LogPrint("bench", "%s: %s\n", __func__, e.what());
+            vCoins.clear();
+        }
+    }
+
+    void Join()
+    {
+        if (thread.joinable())
+            thread.join();
+    }
+
+public:
+    CBlockPrefetcher() : pindex(NULL) {}
+    ~CBlockPrefetcher() { Join(); }
+
+    /** Start reading pindexIn's block and inputs, dropping any previous prefetch. */
+    void Start(const CBlockIndex* pindexIn, const Consensus::Params& consensusParams)
+    {
+        AssertLockHeld(cs_main);
+        Join();
+        pblock.reset();
+        vCoins.clear();
+        pindex = pindexIn;
+        if (!(pindexIn->nStatus & BLOCK_HAVE_DATA)) {
+            pindex = NULL;
+            return;
+        }
+        hashCoinsBest = pcoinsdbview->GetBestBlock();
+        thread = boost::thread(&CBlockPrefetcher::Run, this, pindexIn->GetBlockPos(), pindexIn->GetBlockHash(), consensusParams);
+    }
+
+    /**
+     * Wait for the prefetch of pindexIn, load its coins into view and return
+     * the block. Returns an empty pointer if pindexIn was not prefetched.
+     */
+    std::shared_ptr<const CBlock> Take(const CBlockIndex* pindexIn, CCoinsViewCache& view)
+    {
+        AssertLockHeld(cs_main);
+        if (pindex != pindexIn)
+            return std::shared_ptr<const CBlock>();
+        Join();
+        pindex = NULL;
+        if (pblock && pcoinsdbview->GetBestBlock() == hashCoinsBest) {
+            unsigned int nCached = 0;
+            for (auto& entry : vCoins)
+                nCached += view.CacheCoin(entry.first, std::move(entry.second));
+            LogPrint("bench", "  - Prefetched %u of %u inputs\n", nCached, (unsigned int)vCoins.size());
+        }
+        vCoins.clear();
+        std::shared_ptr<const CBlock> pblockRet = pblock;
+        pblock.reset();
+        return pblockRet;
+    }
+};
+
 /**
  * Return the tip of the chain with the most work in it, that isn't
  * known to be invalid (it's however far from certain to be valid).
@@ -2286,7 +2612,7 @@ static void PruneBlockIndexCandidates() {
  * Try to make some progress towards making pindexMostWork the active block.
  * pblock is either NULL or a pointer to a CBlock corresponding to pindexMostWork.
  */
-static bool ActivateBestChainStep(CValidationState& state, const CChainParams& chainparams, CBlockIndex* pindexMostWork, const std::shared_ptr<const CBlock>& pblock, bool& fInvalidFound, ConnectTrace& connectTrace)
+static bool ActivateBestChainStep(CValidationState& state, const CChainParams& chainparams, CBlockIndex* pindexMostWork, const std::shared_ptr<const CBlock>& pblock, bool& fInvalidFound, ConnectTrace& connectTrace, CBlockPrefetcher& prefetcher)
 {
     AssertLockHeld(cs_main);
     const CBlockIndex *pindexOldTip = chainActive.Tip();
@@ -2318,8 +2644,15 @@ static bool ActivateBestChainStep(CValidationState& state, const CChainParams& c
         nHeight = nTargetHeight;
 
         // Connect new blocks.
-        BOOST_REVERSE_FOREACH(CBlockIndex *pindexConnect, vpindexToConnect) {
-            if (!ConnectTip(state, chainparams, pindexConnect, pindexConnect == pindexMostWork ? pblock : std::shared_ptr<const CBlock>(), connectTrace)) {
+        for (std::vector<CBlockIndex*>::reverse_iterator it = vpindexToConnect.rbegin(); it != vpindexToConnect.rend(); ++it) {
+            CBlockIndex *pindexConnect = *it;
+            std::shared_ptr<const CBlock> pblockConnect = prefetcher.Take(pindexConnect, *pcoinsTip);
+            if (pindexConnect == pindexMostWork && pblock)
+                pblockConnect = pblock;
+            // Read the next block and its inputs while this one is connected.
+            if (it + 1 != vpindexToConnect.rend())
+                prefetcher.Start(*(it + 1), chainparams.GetConsensus());
+            if (!ConnectTip(state, chainparams, pindexConnect, pblockConnect, connectTrace)) {
                 if (state.IsInvalid()) {
                     // The block violates a consensus rule.
                     if (!state.CorruptionPossible())
@@ -2389,6 +2722,7 @@ static void NotifyHeaderTip() {
 bool ActivateBestChain(CValidationState &state, const CChainParams& chainparams, std::shared_ptr<const CBlock> pblock) {
     CBlockIndex *pindexMostWork = NULL;
     CBlockIndex *pindexNewTip = NULL;
+    CBlockPrefetcher prefetcher;
     do {
         boost::this_thread::interruption_point();
         if (ShutdownRequested())
@@ -2410,7 +2744,7 @@ bool ActivateBestChain(CValidationState &state, const CChainParams& chainparams,
 
             bool fInvalidFound = false;
             std::shared_ptr<const CBlock> nullBlockPtr;
-            if (!ActivateBestChainStep(state, chainparams, pindexMostWork, pblock && pblock->GetHash() == pindexMostWork->GetBlockHash() ? pblock : nullBlockPtr, fInvalidFound, connectTrace))
+            if (!ActivateBestChainStep(state, chainparams, pindexMostWork, pblock && pblock->GetHash() == pindexMostWork->GetBlockHash() ? pblock : nullBlockPtr, fInvalidFound, connectTrace, prefetcher))
                 return false;
 
             if (fInvalidFound) {
@@ -3091,6 +3425,12 @@ static bool AcceptBlock(const CBlock& block, CValidationState& state, const CCha
         return error("%s: %s", __func__, FormatStateMessage(state));
     }
 
+    // Header is valid/has work, merkle tree and segwit merkle tree are good...
+    // relay now (but if it does not build on our best tip, let the
+    // SendMessages loop relay it)
+    if (!IsInitialBlockDownload() && chainActive.Tip() == pindex->pprev)
+        GetMainSignals().NewPoWValidBlock(pindex, block);
+
     int nHeight = pindex->nHeight;
 
     // Write block to history file
@@ -3219,6 +3559,7 @@ void UnlinkPrunedFiles(std::set<int>& setFilesToPrune)
 {
     for (set<int>::iterator it = setFilesToPrune.begin(); it != setFilesToPrune.end(); ++it) {
         CDiskBlockPos pos(*it, 0);
+        blockFileMapper.Forget(*it);
         boost::filesystem::remove(GetBlockPosFilename(pos, "blk"));
         boost::filesystem::remove(GetBlockPosFilename(pos, "rev"));
         LogPrintf("Prune: %s deleted blk/rev (%05u)\n", __func__, *it);
@@ -3642,6 +3983,7 @@ bool RewindBlockIndex(const CChainParams& params)
 void UnloadBlockIndex()
 {
     LOCK(cs_main);
+    blockFileMapper.Clear();
     setBlockIndexCandidates.clear();
     chainActive.SetTip(NULL);
     pindexBestInvalid = NULL;
@@ -4027,29 +4369,71 @@ int VersionBitsTipStateSinceHeight(const Consensus::Params& params, Consensus::D
     return VersionBitsStateSinceHeight(chainActive.Tip(), params, pos, versionbitscache);
 }
 
-static const uint64_t MEMPOOL_DUMP_VERSION = 1;
+static const uint64_t MEMPOOL_DUMP_VERSION = 2;
+/** Version of mempool.dat that holds only transactions, times and fee deltas */
+static const uint64_t MEMPOOL_DUMP_VERSION_TXONLY = 1;
+/** Number of mempool.dat entries checked or added for each time cs_main is taken */
+static const size_t MEMPOOL_LOAD_BATCH_SIZE = 1000;
 
-bool LoadMempool(void)
+/** A mempool entry as stored in mempool.dat */
+struct CMempoolDumpEntry
 {
-    int64_t nExpiryTimeout = GetArg("-mempoolexpiry", DEFAULT_MEMPOOL_EXPIRY) * 60 * 60;
-    FILE* filestr = fopen((GetDataDir() / "mempool.dat").string().c_str(), "r");
-    CAutoFile file(filestr, SER_DISK, CLIENT_VERSION);
-    if (file.IsNull()) {
-        LogPrintf("Failed to open mempool file from disk. Continuing anyway.\n");
-        return false;
+    CTransactionRef tx;
+    int64_t nTime;
+    CAmount nFee;
+    int64_t nFeeDelta;
+    unsigned int nHeight;
+    int64_t nSigOpCost;
+
+    ADD_SERIALIZE_METHODS;
+
+    template <typename Stream, typename Operation>
+    inline void SerializationOp(Stream& s, Operation ser_action) {
+        READWRITE(tx);
+        READWRITE(nTime);
+        READWRITE(nFee);
+        READWRITE(nFeeDelta);
+        READWRITE(nHeight);
+        READWRITE(nSigOpCost);
+    }
+};
+
+/** What LoadMempool learned about an entry while checking its inputs */
+struct CMempoolLoadEntry
+{
+    const CMempoolDumpEntry* pdump;
+    std::vector<CTxOut> vSpent;
+    double dPriority;
+    CAmount inChainInputValue;
+    bool fSpendsCoinbase;
+    bool fValid;
+};
+
+static void VerifyMempoolLoadScripts(std::vector<CMempoolLoadEntry>& vLoad, std::atomic<size_t>& nNext)
+{
+    for (size_t i = nNext++; i < vLoad.size(); i = nNext++) {
+        CMempoolLoadEntry& load = vLoad[i];
+        const CTransaction& tx = *load.pdump->tx;
+        PrecomputedTransactionData txdata(tx);
+        for (unsigned int j = 0; j < tx.vin.size() && load.fValid; j++) {
+            CScriptCheck check(load.vSpent[j], tx, j, STANDARD_SCRIPT_VERIFY_FLAGS, true, &txdata);
+            load.fValid = check();
+        }
     }
+}
 
+/**
+ * Load a version 1 mempool.dat, which lacks the entries' fees and heights,
+ * through AcceptToMemoryPool, as it was dumped by older versions.
+ */
+static bool LoadMempoolTxOnly(CAutoFile& file, int64_t nExpiryTimeout)
+{
     int64_t count = 0;
     int64_t skipped = 0;
     int64_t failed = 0;
     int64_t nNow = GetTime();
 
     try {
-        uint64_t version;
-        file >> version;
-        if (version != MEMPOOL_DUMP_VERSION) {
-            return false;
-        }
         uint64_t num;
         file >> num;
         double prioritydummy = 0;
@@ -4092,25 +4476,230 @@ bool LoadMempool(void)
     return true;
 }
 
+bool LoadMempool(void)
+{
+    int64_t nExpiryTimeout = GetArg("-mempoolexpiry", DEFAULT_MEMPOOL_EXPIRY) * 60 * 60;
+    FILE* filestr = fopen((GetDataDir() / "mempool.dat").string().c_str(), "rb");
+    CAutoFile file(filestr, SER_DISK, CLIENT_VERSION);
+    if (file.IsNull()) {
+        LogPrintf("Failed to open mempool file from disk. Continuing anyway.\n");
+        return false;
+    }
+
+    int64_t count = 0;
+    int64_t skipped = 0;
+    int64_t failed = 0;
+    int64_t nNow = GetTime();
+    int64_t nStart = GetTimeMicros();
+
+    std::vector<CMempoolDumpEntry> vDump;
+    std::map<uint256, CAmount> mapDeltas;
+    try {
+        uint64_t version;
+        file >> version;
+        if (version == MEMPOOL_DUMP_VERSION_TXONLY)
+            return LoadMempoolTxOnly(file, nExpiryTimeout);
+        if (version != MEMPOOL_DUMP_VERSION) {
+            LogPrintf("Unsupported mempool file version %d. Continuing anyway.\n", version);
+            return false;
+        }
+        uint64_t num;
+        file >> num;
+        while (num--) {
+            vDump.push_back(CMempoolDumpEntry());
+            file >> vDump.back();
+        }
+        file >> mapDeltas;
+    } catch (const std::exception& e) {
+        LogPrintf("Failed to deserialize mempool data on disk: %s. Continuing anyway.\n", e.what());
+        return false;
+    }
+    file.fclose();
+
+    double prioritydummy = 0;
+    for (const CMempoolDumpEntry& dump : vDump) {
+        if (dump.nFeeDelta) {
+            mempool.PrioritiseTransaction(dump.tx->GetHash(), dump.tx->GetHash().ToString(), prioritydummy, dump.nFeeDelta);
+        }
+    }
+    for (const auto& i : mapDeltas) {
+        mempool.PrioritiseTransaction(i.first, i.first.ToString(), prioritydummy, i.second);
+    }
+
+    int64_t nRead = GetTimeMicros();
+
+    // The entries were dumped with parents before children, and were all
+    // acceptable to the mempool then, so they are not run through
+    // AcceptToMemoryPool's policy checks again. What can have changed is
+    // checked: the inputs (against the chain and each other), finality,
+    // and the fee and sigop cost, which must still come out as stored.
+    // cs_main is released between batches of entries, so the outcome is
+    // only good for the tip and mempool the first batch was checked against.
+    std::vector<CMempoolLoadEntry> vLoad;
+    vLoad.reserve(vDump.size());
+    const CBlockIndex* pindexChecked = NULL;
+    unsigned int nUpdatedChecked = 0;
+    CCoinsViewMemPool viewMemPool(pcoinsTip, mempool);
+    CCoinsViewCache view(&viewMemPool);
+    for (size_t nBatch = 0; nBatch < vDump.size(); nBatch += MEMPOOL_LOAD_BATCH_SIZE) {
+        LOCK2(cs_main, mempool.cs);
+        if (nBatch == 0) {
+            pindexChecked = chainActive.Tip();
+            nUpdatedChecked = mempool.GetTransactionsUpdated();
+        }
+        bool witnessEnabled = IsWitnessEnabled(chainActive.Tip(), Params().GetConsensus());
+        for (size_t i = nBatch; i < std::min(nBatch + MEMPOOL_LOAD_BATCH_SIZE, vDump.size()); i++) {
+            const CMempoolDumpEntry& dump = vDump[i];
+            const CTransaction& tx = *dump.tx;
+            CValidationState state;
+            if (dump.nTime + nExpiryTimeout <= nNow) {
+                ++skipped;
+                continue;
+            }
+            if (!CheckTransaction(tx, state) || tx.IsCoinBase() || (tx.HasWitness() && !witnessEnabled) ||
+                !CheckFinalTx(tx, STANDARD_LOCKTIME_VERIFY_FLAGS) || mempool.exists(tx.GetHash())) {
+                ++failed;
+                continue;
+            }
+            std::vector<COutPoint> vPrevouts;
+            bool fConflict = false;
+            BOOST_FOREACH(const CTxIn& txin, tx.vin) {
+                vPrevouts.push_back(txin.prevout);
+                fConflict |= mempool.mapNextTx.count(txin.prevout) > 0;
+            }
+            view.FetchCoins(vPrevouts);
+            if (fConflict || !view.HaveInputs(tx) || !Consensus::CheckTxInputs(tx, state, view, GetSpendHeight(view)) ||
+                view.GetValueIn(tx) - tx.GetValueOut() != dump.nFee ||
+                GetTransactionSigOpCost(tx, view, STANDARD_SCRIPT_VERIFY_FLAGS) != dump.nSigOpCost) {
+                ++failed;
+                continue;
+            }
+
+            CMempoolLoadEntry load;
+            load.pdump = &dump;
+            load.fSpendsCoinbase = false;
+            load.fValid = true;
+            BOOST_FOREACH(const CTxIn& txin, tx.vin) {
+                const Coin& coin = view.AccessCoin(txin.prevout);
+                load.vSpent.push_back(coin.out);
+                load.fSpendsCoinbase |= coin.IsCoinBase();
+            }
+            load.dPriority = view.GetPriority(tx, dump.nHeight, load.inChainInputValue);
+            vLoad.push_back(load);
+            // Later entries may spend its outputs, but not its inputs
+            UpdateCoins(tx, view, MEMPOOL_HEIGHT);
+        }
+    }
+
+    int64_t nChecked = GetTimeMicros();
+
+    // Verify the scripts without holding any locks, on as many threads as
+    // blocks are verified with. The results are kept in the signature cache.
+    {
+        std::atomic<size_t> nNext(0);
+        boost::thread_group threadGroup;
+        for (int i = 1; i < nScriptCheckThreads; i++) {
+            threadGroup.create_thread(boost::bind(&VerifyMempoolLoadScripts, boost::ref(vLoad), boost::ref(nNext)));
+        }
+        VerifyMempoolLoadScripts(vLoad, nNext);
+        threadGroup.join_all();
+    }
+
+    int64_t nVerified = GetTimeMicros();
+
+    // Only if blocks or other transactions arrived since the inputs were
+    // checked do they need to be looked at again. Once that happened, it
+    // applies to all the entries that are left.
+    bool fRecheck = false;
+    std::set<uint256> setDropped;
+    for (size_t nBatch = 0; nBatch < vLoad.size(); nBatch += MEMPOOL_LOAD_BATCH_SIZE) {
+        LOCK2(cs_main, mempool.cs);
+        fRecheck |= chainActive.Tip() != pindexChecked || mempool.GetTransactionsUpdated() != nUpdatedChecked;
+        CCoinsViewMemPool viewMemPoolNow(pcoinsTip, mempool);
+        for (size_t i = nBatch; i < std::min(nBatch + MEMPOOL_LOAD_BATCH_SIZE, vLoad.size()); i++) {
+            const CMempoolLoadEntry& load = vLoad[i];
+            const CTransaction& tx = *load.pdump->tx;
+            bool fValid = load.fValid;
+            BOOST_FOREACH(const CTxIn& txin, tx.vin) {
+                if (!fValid)
+                    break;
+                if (setDropped.count(txin.prevout.hash) ||
+                    (fRecheck && (mempool.mapNextTx.count(txin.prevout) || !viewMemPoolNow.HaveCoin(txin.prevout)))) {
+                    fValid = false;
+                }
+            }
+            LockPoints lp;
+            if (!fValid || (fRecheck && mempool.exists(tx.GetHash())) || !CheckSequenceLocks(tx, STANDARD_LOCKTIME_VERIFY_FLAGS, &lp)) {
+                setDropped.insert(tx.GetHash());
+                ++failed;
+                continue;
+            }
+
+            CTxMemPoolEntry entry(tx, load.pdump->nFee, load.pdump->nTime, load.dPriority, load.pdump->nHeight, mempool.HasNoInputsOf(tx),
+                                  load.inChainInputValue, load.fSpendsCoinbase, load.pdump->nSigOpCost, lp);
+            CTxMemPool::setEntries setAncestors;
+            uint64_t nNoLimit = std::numeric_limits<uint64_t>::max();
+            std::string dummy;
+            mempool.CalculateMemPoolAncestors(entry, setAncestors, nNoLimit, nNoLimit, nNoLimit, nNoLimit, dummy);
+            mempool.addUnchecked(tx.GetHash(), entry, setAncestors, false);
+            GetMainSignals().SyncTransaction(tx, NULL, CMainSignals::SYNC_TRANSACTION_NOT_IN_BLOCK);
+            ++count;
+        }
+        // Our own additions are not a reason to check the next batch again
+        pindexChecked = chainActive.Tip();
+        nUpdatedChecked = mempool.GetTransactionsUpdated();
+    }
+    {
+        LOCK2(cs_main, mempool.cs);
+        LimitMempoolSize(mempool, GetArg("-maxmempool", DEFAULT_MAX_MEMPOOL_SIZE) * 1000000, nExpiryTimeout);
+    }
+
+    int64_t nLast = GetTimeMicros();
+    LogPrintf("Imported mempool transactions from disk: %i successes, %i failed, %i expired\n", count, failed, skipped);
+    LogPrint("bench", "Imported mempool: %.2fms to read, %.2fms to check inputs, %.2fms to verify scripts, %.2fms to add\n",
+        0.001 * (nRead - nStart), 0.001 * (nChecked - nRead), 0.001 * (nVerified - nChecked), 0.001 * (nLast - nVerified));
+    return true;
+}
+
 void DumpMempool(void)
 {
     int64_t start = GetTimeMicros();
 
     std::map<uint256, CAmount> mapDeltas;
-    std::vector<TxMempoolInfo> vinfo;
+    std::vector<CMempoolDumpEntry> vDump;
 
     {
         LOCK(mempool.cs);
         for (const auto &i : mempool.mapDeltas) {
-            mapDeltas[i.first] = i.second.first;
+            mapDeltas[i.first] = i.second.second;
+        }
+        // Parents have fewer in-mempool ancestors than their children, so
+        // this order lets LoadMempool add every entry after its parents.
+        std::vector<CTxMemPool::txiter> vIters;
+        vIters.reserve(mempool.mapTx.size());
+        for (CTxMemPool::txiter it = mempool.mapTx.begin(); it != mempool.mapTx.end(); it++) {
+            vIters.push_back(it);
+        }
+        std::sort(vIters.begin(), vIters.end(), [](CTxMemPool::txiter a, CTxMemPool::txiter b) {
+            return a->GetCountWithAncestors() < b->GetCountWithAncestors();
+        });
+        vDump.reserve(vIters.size());
+        for (CTxMemPool::txiter it : vIters) {
+            CMempoolDumpEntry dump;
+            dump.tx = it->GetSharedTx();
+            dump.nTime = it->GetTime();
+            dump.nFee = it->GetFee();
+            dump.nFeeDelta = it->GetModifiedFee() - it->GetFee();
+            dump.nHeight = it->GetHeight();
+            dump.nSigOpCost = it->GetSigOpCost();
+            vDump.push_back(dump);
         }
-        vinfo = mempool.infoAll();
     }
 
     int64_t mid = GetTimeMicros();
 
     try {
-        FILE* filestr = fopen((GetDataDir() / "mempool.dat.new").string().c_str(), "w");
+        FILE* filestr = fopen((GetDataDir() / "mempool.dat.new").string().c_str(), "wb");
         if (!filestr) {
             return;
         }
@@ -4120,12 +4709,10 @@ void DumpMempool(void)
         uint64_t version = MEMPOOL_DUMP_VERSION;
         file << version;
 
-        file << (uint64_t)vinfo.size();
-        for (const auto& i : vinfo) {
-            file << *(i.tx);
-            file << (int64_t)i.nTime;
-            file << (int64_t)i.nFeeDelta;
-            mapDeltas.erase(i.tx->GetHash());
+        file << (uint64_t)vDump.size();
+        for (const CMempoolDumpEntry& dump : vDump) {
+            file << dump;
+            mapDeltas.erase(dump.tx->GetHash());
         }
 
         file << mapDeltas;
@@ -20,6 +20,7 @@
 
 #include <algorithm>
 #include <exception>
+#include <list>
 #include <map>
 #include <set>
 #include <stdint.h>
@@ -34,7 +35,10 @@
 
 class CBlockIndex;
 class CBlockTreeDB;
+class CBlockUndo;
+class CRawBlock;
 class CBloomFilter;
+class CCoinsViewDB;
 class CChainParams;
 class CInv;
 class CConnman;
@@ -50,6 +54,8 @@ struct LockPoints;
 static const bool DEFAULT_WHITELISTRELAY = true;
 /** Default for DEFAULT_WHITELISTFORCERELAY. */
 static const bool DEFAULT_WHITELISTFORCERELAY = true;
+/** Default for -whitelistfastcmpctrelay. */
+static const bool DEFAULT_WHITELISTFASTCMPCTRELAY = false;
 /** Default for -minrelaytxfee, minimum relay fee for transactions */
 static const unsigned int DEFAULT_MIN_RELAY_TX_FEE = 1000;
 //! -maxtxfee default
@@ -60,6 +66,8 @@ static const CAmount HIGH_TX_FEE_PER_KB = 0.01 * COIN;
 static const CAmount HIGH_MAX_TX_FEE = 100 * HIGH_TX_FEE_PER_KB;
 /** Default for -maxorphantx, maximum number of orphan transactions kept in memory */
 static const unsigned int DEFAULT_MAX_ORPHAN_TRANSACTIONS = 100;
+/** Default for -blockreconstructionextratxn, extra transactions to keep in memory for compact block reconstruction */
+static const unsigned int DEFAULT_BLOCK_RECONSTRUCTION_EXTRA_TXN = 100;
 /** Expiration time for orphan transactions in seconds */
 static const int64_t ORPHAN_TX_EXPIRE_TIME = 20 * 60;
 /** Minimum time between orphan transactions expire time checks in seconds */
@@ -74,6 +82,8 @@ static const unsigned int DEFAULT_DESCENDANT_LIMIT = 25;
 static const unsigned int DEFAULT_DESCENDANT_SIZE_LIMIT = 101;
 /** Default for -mempoolexpiry, expiration time for mempool transactions in hours */
 static const unsigned int DEFAULT_MEMPOOL_EXPIRY = 72;
+/** Default for -mempooldumpinterval, how often the mempool is saved to disk, in minutes */
+static const unsigned int DEFAULT_MEMPOOL_DUMP_INTERVAL = 15;
 /** The maximum size of a blk?????.dat file (since 0.8) */
 static const unsigned int MAX_BLOCKFILE_SIZE = 0x8000000; // 128 MiB
 /** The pre-allocation chunk size for blk?????.dat files (since 0.8) */
@@ -82,9 +92,11 @@ static const unsigned int BLOCKFILE_CHUNK_SIZE = 0x1000000; // 16 MiB
 static const unsigned int UNDOFILE_CHUNK_SIZE = 0x100000; // 1 MiB
 
 /** Maximum number of script-checking threads allowed */
-static const int MAX_SCRIPTCHECK_THREADS = 16;
+static const int MAX_SCRIPTCHECK_THREADS = 256;
 /** -par default (number of script-checking threads, 0 = auto) */
 static const int DEFAULT_SCRIPTCHECK_THREADS = 0;
+/** Default for -parpin, pinning script-checking threads to CPUs */
+static const bool DEFAULT_SCRIPTCHECK_PIN = false;
 /** Number of blocks that can be requested at any given time from a single peer. */
 static const int MAX_BLOCKS_IN_TRANSIT_PER_PEER = 16;
 /** Timeout in seconds during which a peer must stall block download progress before being disconnected. */
@@ -261,8 +273,18 @@ bool InitBlockIndex(const CChainParams& chainparams);
 bool LoadBlockIndex(const CChainParams& chainparams);
 /** Unload database information */
 void UnloadBlockIndex();
-/** Run an instance of the script checking thread */
-void ThreadScriptCheck();
+/**
+ * Run an instance of the script checking thread. With nCpu >= 0 it is
+ * pinned to that CPU, and shares work with threads on the same socket first.
+ */
+void ThreadScriptCheck(int nCpu);
+/** Run an instance of the thread verifying the scripts of relayed transactions for PreVerifyTransactionScripts */
+void ThreadTxScriptCheck();
+/**
+ * Measure signature verification throughput with 1 up to nMaxThreads threads,
+ * and return the number of threads beyond which it stops improving.
+ */
+int CalibrateScriptCheckThreads(int nMaxThreads);
 /** Check whether we are doing an initial block download (synchronizing from disk or network) */
 bool IsInitialBlockDownload();
 /** Format a string that describes several potential problems detected by the core.
@@ -308,13 +330,28 @@ void FlushStateToDisk();
 /** Prune block files and flush state to disk. */
 void PruneAndFlush();
 
-/** (try to) add transaction to memory pool **/
+/** (try to) add transaction to memory pool, adding the transactions it replaced to plTxnReplaced if given **/
 bool AcceptToMemoryPool(CTxMemPool& pool, CValidationState &state, const CTransaction &tx, bool fLimitFree,
-                        bool* pfMissingInputs, bool fOverrideMempoolLimit=false, const CAmount nAbsurdFee=0);
+                        bool* pfMissingInputs, bool fOverrideMempoolLimit=false, const CAmount nAbsurdFee=0,
+                        std::list<CTransactionRef>* plTxnReplaced=NULL);
 
 /** (try to) add transaction to memory pool with a specified acceptance time **/
 bool AcceptToMemoryPoolWithTime(CTxMemPool& pool, CValidationState &state, const CTransaction &tx, bool fLimitFree,
-                        bool* pfMissingInputs, int64_t nAcceptTime, bool fOverrideMempoolLimit=false, const CAmount nAbsurdFee=0);
+                        bool* pfMissingInputs, int64_t nAcceptTime, bool fOverrideMempoolLimit=false, const CAmount nAbsurdFee=0,
+                        std::list<CTransactionRef>* plTxnReplaced=NULL);
+
+/**
+ * Verify the scripts of a transaction relayed to us before it goes to
+ * AcceptToMemoryPool, holding cs_main only to look up the spent outputs, on
+ * the threads started with ThreadTxScriptCheck. Valid signatures end up in
+ * the signature cache, so AcceptToMemoryPool spends little time on them under
+ * cs_main. Only transactions that pass the policy checks AcceptToMemoryPool
+ * does before verifying scripts are verified; for the others it returns false
+ * and leaves state valid. If a script fails, it returns false and fills in
+ * state as AcceptToMemoryPool would, and the transaction is rejected.
+ * Returns whether all scripts were verified.
+ */
+bool PreVerifyTransactionScripts(CTxMemPool& pool, const CTransaction& tx, CValidationState& state);
 
 /** Convert CValidationState to a human-readable message for logging */
 std::string FormatStateMessage(const CValidationState &state);
@@ -434,8 +471,8 @@ private:
 
 public:
     CScriptCheck(): amount(0), ptxTo(0), nIn(0), nFlags(0), cacheStore(false), error(SCRIPT_ERR_UNKNOWN_ERROR) {}
-    CScriptCheck(const CCoins& txFromIn, const CTransaction& txToIn, unsigned int nInIn, unsigned int nFlagsIn, bool cacheIn, PrecomputedTransactionData* txdataIn) :
-        scriptPubKey(txFromIn.vout[txToIn.vin[nInIn].prevout.n].scriptPubKey), amount(txFromIn.vout[txToIn.vin[nInIn].prevout.n].nValue),
+    CScriptCheck(const CTxOut& outIn, const CTransaction& txToIn, unsigned int nInIn, unsigned int nFlagsIn, bool cacheIn, PrecomputedTransactionData* txdataIn) :
+        scriptPubKey(outIn.scriptPubKey), amount(outIn.nValue),
         ptxTo(&txToIn), nIn(nInIn), nFlags(nFlagsIn), cacheStore(cacheIn), error(SCRIPT_ERR_UNKNOWN_ERROR), txdata(txdataIn) { }
 
     bool operator()();
@@ -459,6 +496,13 @@ public:
 bool WriteBlockToDisk(const CBlock& block, CDiskBlockPos& pos, const CMessageHeader::MessageStartChars& messageStart);
 bool ReadBlockFromDisk(CBlock& block, const CDiskBlockPos& pos, const Consensus::Params& consensusParams);
 bool ReadBlockFromDisk(CBlock& block, const CBlockIndex* pindex, const Consensus::Params& consensusParams);
+/** Functions for disk access for undo data; hashBlock is the hash of the previous block, which the checksum commits to */
+bool UndoReadFromDisk(CBlockUndo& blockundo, const CDiskBlockPos& pos, const uint256& hashBlock);
+/**
+ * Find the serialized block of pindex in its memory-mapped block file. Fails
+ * (without logging) if the file cannot be mapped; use ReadBlockFromDisk then.
+ */
+bool ReadRawBlockFromDisk(CRawBlock& raw, const CBlockIndex* pindex, const CChainParams& chainparams);
 
 /** Functions for validating blocks and updating the block tree */
 
@@ -522,6 +566,9 @@ bool ResetBlockFailureFlags(CBlockIndex *pindex);
 /** The currently-connected chain of blocks (protected by cs_main). */
 extern CChain chainActive;
 
+/** Global variable that points to the coins database (protected by cs_main) */
+extern CCoinsViewDB *pcoinsdbview;
+
 /** Global variable that points to the active CCoinsView (protected by cs_main) */
 extern CCoinsViewCache *pcoinsTip;
 
@@ -557,7 +604,12 @@ static const unsigned int REJECT_CONFLICT = 0x102;
 /** Dump the mempool to disk. */
 void DumpMempool();
 
-/** Load the mempool from disk. */
+/**
+ * Load the mempool from disk. Entries whose inputs are still available are
+ * added as they were dumped, after verifying their scripts on
+ * nScriptCheckThreads threads, without applying the mempool policy again.
+ * Files dumped by older versions go through AcceptToMemoryPool instead.
+ */
 bool LoadMempool();
 
 #endif // BITCOIN_VALIDATION_H
@@ -38,6 +38,7 @@ protected:
     virtual void Inventory(const uint256 &hash) {}
     virtual void ResendWalletTransactions(int64_t nBestBlockTime, CConnman* connman) {}
     virtual void BlockChecked(const CBlock&, const CValidationState&) {}
+    virtual void NewPoWValidBlock(const CBlockIndex *pindex, const CBlock& block) {};
     virtual void GetScriptForMining(boost::shared_ptr<CReserveScript>&) {};
     virtual void ResetRequestCount(const uint256 &hash) {};
     friend void ::RegisterValidationInterface(CValidationInterface*);
@@ -62,6 +63,12 @@ struct CMainSignals {
     boost::signals2::signal<void (int64_t nBestBlockTime, CConnman* connman)> Broadcast;
     /** Notifies listeners of a block validation result */
     boost::signals2::signal<void (const CBlock&, const CValidationState&)> BlockChecked;
+    /**
+     * Notifies listeners that a block which builds directly on our tip has
+     * passed CheckBlock, before it is connected (so it can be relayed ahead
+     * of full validation).
+     */
+    boost::signals2::signal<void (const CBlockIndex *, const CBlock&)> NewPoWValidBlock;
     /** Notifies listeners that a key for mining is required (coinbase) */
     boost::signals2::signal<void (boost::shared_ptr<CReserveScript>&)> ScriptForMining;
     /** Notifies listeners that a block has been successfully mined */
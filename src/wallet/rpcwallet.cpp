@@ -2291,6 +2291,13 @@ UniValue getwalletinfo(const JSONRPCRequest& request)
             "  \"unlocked_until\": ttt,        (numeric) the timestamp in seconds since epoch (midnight Jan 1 1970 GMT) that the wallet is unlocked for transfers, or 0 if the wallet is locked\n"
             "  \"paytxfee\": x.xxxx,           (numeric) the transaction fee configuration, set in " + CURRENCY_UNIT + "/kB\n"
             "  \"hdmasterkeyid\": \"<hash160>\", (string) the Hash160 of the HD master pubkey\n"
+            "  \"scanning\":                   (json object) the running rescan, or false if there is none\n"
+            "  {\n"
+            "    \"duration\": xxxx,             (numeric) seconds since the rescan started\n"
+            "    \"height\": xxxx,               (numeric) height of the last block scanned\n"
+            "    \"progress\": x.xxxx,           (numeric) estimated fraction of the rescan done\n"
+            "    \"blocks_per_sec\": x.xx,       (numeric) blocks scanned per second so far\n"
+            "  }\n"
             "}\n"
             "\nExamples:\n"
             + HelpExampleCli("getwalletinfo", "")
@@ -2313,6 +2320,17 @@ UniValue getwalletinfo(const JSONRPCRequest& request)
     CKeyID masterKeyID = pwalletMain->GetHDChain().masterKeyID;
     if (!masterKeyID.IsNull())
          obj.push_back(Pair("hdmasterkeyid", masterKeyID.GetHex()));
+    if (pwalletMain->fScanningWallet) {
+        int64_t nDuration = std::max((int64_t)1, GetTimeMillis() - pwalletMain->nScanStartTime);
+        UniValue scanning(UniValue::VOBJ);
+        scanning.push_back(Pair("duration", nDuration / 1000));
+        scanning.push_back(Pair("height", pwalletMain->nScanHeight.load()));
+        scanning.push_back(Pair("progress", pwalletMain->dScanProgress.load()));
+        scanning.push_back(Pair("blocks_per_sec", pwalletMain->nScannedBlocks * 1000.0 / nDuration));
+        obj.push_back(Pair("scanning", scanning));
+    } else {
+        obj.push_back(Pair("scanning", false));
+    }
     return obj;
 }
 
@@ -4,6 +4,11 @@
 
 #include "wallet/wallet.h"
 
+#include "blockfilter.h"
+#include "script/standard.h"
+#include "undo.h"
+#include "validation.h"
+
 #include <set>
 #include <stdint.h>
 #include <utility>
@@ -351,4 +356,214 @@ BOOST_AUTO_TEST_CASE(ApproximateBestSubset)
     BOOST_CHECK_EQUAL(setCoinsRet.size(), 2U);
 }
 
+BOOST_AUTO_TEST_CASE(scan_filter)
+{
+    CWallet keystore;
+    LOCK(keystore.cs_wallet);
+
+    CKey key, multisigKey, otherKey;
+    key.MakeNewKey(true);
+    multisigKey.MakeNewKey(true);
+    otherKey.MakeNewKey(true);
+    BOOST_CHECK(keystore.AddKey(key));
+    BOOST_CHECK(keystore.AddKey(multisigKey));
+
+    CScript witness = GetScriptForWitness(GetScriptForDestination(key.GetPubKey().GetID()));
+    BOOST_CHECK(keystore.AddCScript(witness));
+    CScript watched = CScript() << OP_RETURN << std::vector<unsigned char>(20, 1);
+    BOOST_CHECK(keystore.AddWatchOnly(watched));
+
+    std::vector<CPubKey> multisigKeys;
+    multisigKeys.push_back(otherKey.GetPubKey());
+    multisigKeys.push_back(multisigKey.GetPubKey());
+    CScript multisig = GetScriptForMultisig(1, multisigKeys);
+    BOOST_CHECK(keystore.AddCScript(multisig));
+
+    CWalletScanFilter filter;
+    keystore.GetScanFilter(filter);
+
+    // Everything IsMine accepts
+    BOOST_CHECK(filter.IsRelevant(GetScriptForRawPubKey(key.GetPubKey())));
+    BOOST_CHECK(filter.IsRelevant(GetScriptForDestination(key.GetPubKey().GetID())));
+    BOOST_CHECK(filter.IsRelevant(witness));
+    BOOST_CHECK(filter.IsRelevant(GetScriptForDestination(CScriptID(witness))));
+    BOOST_CHECK(filter.IsRelevant(watched));
+    BOOST_CHECK(filter.IsRelevant(multisig));
+    BOOST_CHECK(filter.IsRelevant(GetScriptForWitness(multisig)));
+
+    // And not others' scripts
+    BOOST_CHECK(!filter.IsRelevant(GetScriptForRawPubKey(otherKey.GetPubKey())));
+    BOOST_CHECK(!filter.IsRelevant(GetScriptForDestination(otherKey.GetPubKey().GetID())));
+    BOOST_CHECK(!filter.IsRelevant(GetScriptForWitness(GetScriptForDestination(otherKey.GetPubKey().GetID()))));
+    BOOST_CHECK(!filter.IsRelevant(CScript() << OP_RETURN << std::vector<unsigned char>(20, 2)));
+
+    CMutableTransaction tx;
+    tx.vout.resize(2);
+    tx.vout[0].scriptPubKey = GetScriptForDestination(otherKey.GetPubKey().GetID());
+    BOOST_CHECK(!filter.IsRelevant(CTransaction(tx)));
+    tx.vout[1].scriptPubKey = witness;
+    BOOST_CHECK(filter.IsRelevant(CTransaction(tx)));
+
+    // A rebuilt filter picks up keys added since
+    BOOST_CHECK(keystore.AddKey(otherKey));
+    BOOST_CHECK(!filter.IsRelevant(GetScriptForRawPubKey(otherKey.GetPubKey())));
+    keystore.GetScanFilter(filter);
+    BOOST_CHECK(filter.IsRelevant(GetScriptForRawPubKey(otherKey.GetPubKey())));
+}
+
+static CTransactionRef AddCoinTx(CWallet& wallet, const std::vector<COutPoint>& vPrevouts, const std::vector<CTxOut>& vOutputs, bool fConfirmed)
+{
+    CMutableTransaction tx;
+    BOOST_FOREACH(const COutPoint& prevout, vPrevouts)
+        tx.vin.push_back(CTxIn(prevout));
+    tx.vout = vOutputs;
+    CTransactionRef ptx = MakeTransactionRef(std::move(tx));
+    // As if seen in the genesis block, at depth 1, or in no block at all.
+    // SyncTransaction also updates the transactions it spends from.
+    wallet.SyncTransaction(*ptx, fConfirmed ? chainActive.Genesis() : NULL, fConfirmed ? 0 : -1);
+    BOOST_CHECK(wallet.mapWallet.count(ptx->GetHash()));
+    return ptx;
+}
+
+BOOST_AUTO_TEST_CASE(coin_candidates)
+{
+    CWallet& wallet = *pwalletMain;
+    LOCK2(cs_main, wallet.cs_wallet);
+
+    CKey key, otherKey, laterKey;
+    key.MakeNewKey(true);
+    otherKey.MakeNewKey(true);
+    laterKey.MakeNewKey(true);
+    BOOST_CHECK(wallet.AddKey(key));
+    CScript script = GetScriptForDestination(key.GetPubKey().GetID());
+    CScript otherScript = GetScriptForDestination(otherKey.GetPubKey().GetID());
+    CScript laterScript = GetScriptForDestination(laterKey.GetPubKey().GetID());
+
+    std::vector<CTxOut> vOutputs;
+    vOutputs.push_back(CTxOut(1 * COIN, script));
+    vOutputs.push_back(CTxOut(2 * COIN, script));
+    CTransactionRef tx1 = AddCoinTx(wallet, std::vector<COutPoint>(), vOutputs, true);
+
+    std::vector<COutput> vCoins;
+    wallet.AvailableCoins(vCoins);
+    BOOST_CHECK_EQUAL(vCoins.size(), 2U);
+    BOOST_CHECK_EQUAL(wallet.GetBalance(), 3 * COIN);
+
+    // A confirmed spend of the first output, paying someone else
+    CTransactionRef tx2 = AddCoinTx(wallet, std::vector<COutPoint>(1, COutPoint(tx1->GetHash(), 0)),
+                                    std::vector<CTxOut>(1, CTxOut(1 * COIN, otherScript)), true);
+    wallet.AvailableCoins(vCoins);
+    BOOST_CHECK_EQUAL(vCoins.size(), 1U);
+    BOOST_CHECK(vCoins[0].tx->GetHash() == tx1->GetHash() && vCoins[0].i == 1);
+    BOOST_CHECK_EQUAL(wallet.GetBalance(), 2 * COIN);
+
+    // An unconfirmed spend of the second output, not in the mempool
+    CTransactionRef tx3 = AddCoinTx(wallet, std::vector<COutPoint>(1, COutPoint(tx1->GetHash(), 1)),
+                                    std::vector<CTxOut>(1, CTxOut(2 * COIN, laterScript)), false);
+    wallet.AvailableCoins(vCoins);
+    BOOST_CHECK(vCoins.empty());
+    BOOST_CHECK_EQUAL(wallet.GetBalance(), 0);
+
+    // Abandoning it makes the output it spent available again
+    BOOST_CHECK(wallet.AbandonTransaction(tx3->GetHash()));
+    wallet.AvailableCoins(vCoins);
+    BOOST_CHECK_EQUAL(vCoins.size(), 1U);
+    BOOST_CHECK_EQUAL(wallet.GetBalance(), 2 * COIN);
+
+    // Importing a key makes outputs of transactions already in the wallet ours
+    CTransactionRef tx4 = AddCoinTx(wallet, std::vector<COutPoint>(1, COutPoint(tx1->GetHash(), 1)),
+                                    std::vector<CTxOut>(1, CTxOut(2 * COIN, laterScript)), true);
+    wallet.AvailableCoins(vCoins);
+    BOOST_CHECK(vCoins.empty());
+    BOOST_CHECK_EQUAL(wallet.GetBalance(), 0);
+    BOOST_CHECK(wallet.ImportKey(laterKey, laterKey.GetPubKey()));
+    wallet.AvailableCoins(vCoins);
+    BOOST_CHECK_EQUAL(vCoins.size(), 1U);
+    BOOST_CHECK(vCoins[0].tx->GetHash() == tx4->GetHash());
+    BOOST_CHECK_EQUAL(wallet.GetBalance(), 2 * COIN);
+}
+
+BOOST_AUTO_TEST_CASE(coin_candidates_encrypted)
+{
+    CWallet& wallet = *pwalletMain;
+    LOCK2(cs_main, wallet.cs_wallet);
+
+    // Unlocking checks the passphrase against a key, so the wallet needs one
+    wallet.GenerateNewKey();
+    BOOST_CHECK(wallet.EncryptWallet("coin candidates"));
+    BOOST_CHECK(wallet.Unlock("coin candidates"));
+
+    CKey key, laterKey;
+    key.MakeNewKey(true);
+    laterKey.MakeNewKey(true);
+    BOOST_CHECK(wallet.ImportKey(key, key.GetPubKey()));
+    CScript script = GetScriptForDestination(key.GetPubKey().GetID());
+    CScript laterScript = GetScriptForDestination(laterKey.GetPubKey().GetID());
+
+    std::vector<CTxOut> vOutputs;
+    vOutputs.push_back(CTxOut(1 * COIN, script));
+    vOutputs.push_back(CTxOut(2 * COIN, laterScript));
+    CTransactionRef tx1 = AddCoinTx(wallet, std::vector<COutPoint>(), vOutputs, true);
+
+    std::vector<COutput> vCoins;
+    wallet.AvailableCoins(vCoins);
+    BOOST_CHECK_EQUAL(vCoins.size(), 1U);
+    BOOST_CHECK_EQUAL(wallet.GetBalance(), 1 * COIN);
+
+    // Keys added to the keypool of an encrypted wallet go through both
+    // AddKeyPubKey and AddCryptedKey, but are not imports
+    unsigned int nKeyImports = wallet.GetKeyImports();
+    BOOST_CHECK(wallet.TopUpKeyPool(wallet.GetKeyPoolSize() + 10));
+    BOOST_CHECK_EQUAL(wallet.GetKeyImports(), nKeyImports);
+    wallet.AvailableCoins(vCoins);
+    BOOST_CHECK_EQUAL(vCoins.size(), 1U);
+
+    // An imported key still makes the other output ours. The import RPCs
+    // mark the wallet dirty first, so cached credits are recomputed.
+    wallet.MarkDirty();
+    BOOST_CHECK(wallet.ImportKey(laterKey, laterKey.GetPubKey()));
+    BOOST_CHECK_EQUAL(wallet.GetKeyImports(), nKeyImports + 1);
+    wallet.AvailableCoins(vCoins);
+    BOOST_CHECK_EQUAL(vCoins.size(), 2U);
+    BOOST_CHECK_EQUAL(wallet.GetBalance(), 3 * COIN);
+}
+
+BOOST_AUTO_TEST_CASE(scan_filter_bare_multisig)
+{
+    CWallet& wallet = *pwalletMain;
+    LOCK2(cs_main, wallet.cs_wallet);
+
+    CKey key1, key2;
+    key1.MakeNewKey(true);
+    key2.MakeNewKey(true);
+    BOOST_CHECK(wallet.AddKey(key1));
+    BOOST_CHECK(wallet.AddKey(key2));
+    std::vector<CPubKey> keys;
+    keys.push_back(key1.GetPubKey());
+    keys.push_back(key2.GetPubKey());
+    CScript multisig = GetScriptForMultisig(2, keys);
+    BOOST_CHECK(IsMine(wallet, multisig) == ISMINE_SPENDABLE);
+
+    // A block spending a bare multisig output of ours
+    CMutableTransaction spend;
+    spend.vin.resize(1);
+    spend.vout.resize(1);
+    spend.vout[0].scriptPubKey = CScript() << OP_TRUE;
+    CBlock block;
+    block.vtx.push_back(MakeTransactionRef(CMutableTransaction()));
+    block.vtx.push_back(MakeTransactionRef(spend));
+    CBlockUndo blockUndo;
+    blockUndo.vtxundo.resize(1);
+    blockUndo.vtxundo[0].vprevout.push_back(Coin(CTxOut(1 * COIN, multisig), 1, false));
+    BlockFilter blockFilter(BLOCK_FILTER_BASIC, block, blockUndo);
+
+    // Found once the wallet has the transaction paying to it
+    CWalletScanFilter filter;
+    wallet.GetScanFilter(filter);
+    BOOST_CHECK(!filter.MayMatch(blockFilter));
+    AddCoinTx(wallet, std::vector<COutPoint>(), std::vector<CTxOut>(1, CTxOut(1 * COIN, multisig)), true);
+    wallet.GetScanFilter(filter);
+    BOOST_CHECK(filter.MayMatch(blockFilter));
+}
+
 BOOST_AUTO_TEST_SUITE_END()
@@ -6,11 +6,14 @@
 #include "wallet/wallet.h"
 
 #include "base58.h"
+#include "blockfilterindex.h"
 #include "checkpoints.h"
+#include "checkqueue.h"
 #include "chain.h"
 #include "wallet/coincontrol.h"
 #include "consensus/consensus.h"
 #include "consensus/validation.h"
+#include "crypto/ripemd160.h"
 #include "key.h"
 #include "keystore.h"
 #include "validation.h"
@@ -20,6 +23,7 @@
 #include "primitives/transaction.h"
 #include "script/script.h"
 #include "script/sign.h"
+#include "script/standard.h"
 #include "timedata.h"
 #include "txmempool.h"
 #include "util.h"
@@ -29,6 +33,7 @@
 #include <assert.h>
 
 #include <boost/algorithm/string/replace.hpp>
+#include <boost/bind.hpp>
 #include <boost/filesystem.hpp>
 #include <boost/thread.hpp>
 
@@ -166,6 +171,7 @@ bool CWallet::AddKeyPubKey(const CKey& secret, const CPubKey &pubkey)
     AssertLockHeld(cs_wallet); // mapKeyMetadata
     if (!CCryptoKeyStore::AddKeyPubKey(secret, pubkey))
         return false;
+    nKeyStoreUpdates++;
 
     // check if we need to remove from watch-only
     CScript script;
@@ -186,11 +192,21 @@ bool CWallet::AddKeyPubKey(const CKey& secret, const CPubKey &pubkey)
     return true;
 }
 
+bool CWallet::ImportKey(const CKey& secret, const CPubKey &pubkey)
+{
+    AssertLockHeld(cs_wallet); // nKeyImports
+    if (!AddKeyPubKey(secret, pubkey))
+        return false;
+    nKeyImports++;
+    return true;
+}
+
 bool CWallet::AddCryptedKey(const CPubKey &vchPubKey,
                             const vector<unsigned char> &vchCryptedSecret)
 {
     if (!CCryptoKeyStore::AddCryptedKey(vchPubKey, vchCryptedSecret))
         return false;
+    nKeyStoreUpdates++;
     if (!fFileBacked)
         return true;
     {
@@ -226,6 +242,8 @@ bool CWallet::AddCScript(const CScript& redeemScript)
 {
     if (!CCryptoKeyStore::AddCScript(redeemScript))
         return false;
+    nKeyStoreUpdates++;
+    nKeyImports++;
     if (!fFileBacked)
         return true;
     return CWalletDB(strWalletFile).WriteCScript(Hash160(redeemScript), redeemScript);
@@ -251,6 +269,8 @@ bool CWallet::AddWatchOnly(const CScript &dest)
 {
     if (!CCryptoKeyStore::AddWatchOnly(dest))
         return false;
+    nKeyStoreUpdates++;
+    nKeyImports++;
     nTimeFirstKey = 1; // No birthday information for watch-only keys.
     NotifyWatchonlyChanged(true);
     if (!fFileBacked)
@@ -263,6 +283,7 @@ bool CWallet::RemoveWatchOnly(const CScript &dest)
     AssertLockHeld(cs_wallet);
     if (!CCryptoKeyStore::RemoveWatchOnly(dest))
         return false;
+    nWalletUpdates++;
     if (!HaveWatchOnly())
         NotifyWatchonlyChanged(false);
     if (fFileBacked)
@@ -823,6 +844,8 @@ void CWallet::MarkDirty()
         LOCK(cs_wallet);
         BOOST_FOREACH(PAIRTYPE(const uint256, CWalletTx)& item, mapWallet)
             item.second.MarkDirty();
+        fCoinCandidatesValid = false;
+        nWalletUpdates++;
     }
 }
 
@@ -929,6 +952,8 @@ bool CWallet::AddToWallet(const CWalletTx& wtxIn, bool fFlushOnClose)
 
     // Break debit/credit balance caches:
     wtx.MarkDirty();
+    setCoinCandidates.insert(hash);
+    nWalletUpdates++;
 
     // Notify UI of new or updated transaction
     NotifyTransactionChanged(this, hash, fInsertedNew ? CT_NEW : CT_UPDATED);
@@ -954,6 +979,8 @@ bool CWallet::LoadToWallet(const CWalletTx& wtxIn)
     wtx.BindWallet(this);
     wtxOrdered.insert(make_pair(wtx.nOrderPos, TxPair(&wtx, (CAccountingEntry*)0)));
     AddToSpends(hash);
+    setCoinCandidates.insert(hash);
+    nWalletUpdates++;
     BOOST_FOREACH(const CTxIn& txin, wtx.tx->vin) {
         if (mapWallet.count(txin.prevout.hash)) {
             CWalletTx& prevtx = mapWallet[txin.prevout.hash];
@@ -1053,9 +1080,12 @@ bool CWallet::AbandonTransaction(const uint256& hashTx)
             // available of the outputs it spends. So force those to be recomputed
             BOOST_FOREACH(const CTxIn& txin, wtx.tx->vin)
             {
-                if (mapWallet.count(txin.prevout.hash))
+                if (mapWallet.count(txin.prevout.hash)) {
                     mapWallet[txin.prevout.hash].MarkDirty();
+                    setCoinCandidates.insert(txin.prevout.hash);
+                }
             }
+            nWalletUpdates++;
         }
     }
 
@@ -1114,9 +1144,12 @@ void CWallet::MarkConflicted(const uint256& hashBlock, const uint256& hashTx)
             // available of the outputs it spends. So force those to be recomputed
             BOOST_FOREACH(const CTxIn& txin, wtx.tx->vin)
             {
-                if (mapWallet.count(txin.prevout.hash))
+                if (mapWallet.count(txin.prevout.hash)) {
                     mapWallet[txin.prevout.hash].MarkDirty();
+                    setCoinCandidates.insert(txin.prevout.hash);
+                }
             }
+            nWalletUpdates++;
         }
     }
 }
@@ -1458,10 +1491,242 @@ void CWalletTx::GetAccountAmounts(const string& strAccount, CAmount& nReceived,
     }
 }
 
+void CWalletScanFilter::Clear()
+{
+    vIDs.clear();
+    setScripts.clear();
+    setElements.clear();
+}
+
+void CWalletScanFilter::Finalize()
+{
+    std::sort(vIDs.begin(), vIDs.end());
+    vIDs.erase(std::unique(vIDs.begin(), vIDs.end()), vIDs.end());
+}
+
+bool CWalletScanFilter::HaveID(const uint160& id) const
+{
+    return std::binary_search(vIDs.begin(), vIDs.end(), id);
+}
+
+bool CWalletScanFilter::IsRelevant(const CScript& scriptPubKey) const
+{
+    if (setScripts.count(scriptPubKey))
+        return true;
+
+    std::vector<std::vector<unsigned char> > vSolutions;
+    txnouttype whichType;
+    if (!Solver(scriptPubKey, whichType, vSolutions))
+        return false;
+
+    // The same cases as IsMine, without looking into the scripts
+    switch (whichType)
+    {
+    case TX_PUBKEY:
+        return HaveID(CPubKey(vSolutions[0]).GetID());
+    case TX_PUBKEYHASH:
+    case TX_SCRIPTHASH:
+    case TX_WITNESS_V0_KEYHASH:
+        return HaveID(uint160(vSolutions[0]));
+    case TX_WITNESS_V0_SCRIPTHASH:
+    {
+        uint160 hash;
+        CRIPEMD160().Write(&vSolutions[0][0], vSolutions[0].size()).Finalize(hash.begin());
+        return HaveID(hash);
+    }
+    case TX_MULTISIG:
+        for (unsigned int i = 1; i + 1 < vSolutions.size(); i++) {
+            if (HaveID(CPubKey(vSolutions[i]).GetID()))
+                return true;
+        }
+        return false;
+    default:
+        return false;
+    }
+}
+
+bool CWalletScanFilter::IsRelevant(const CTransaction& tx) const
+{
+    BOOST_FOREACH(const CTxOut& txout, tx.vout) {
+        if (IsRelevant(txout.scriptPubKey))
+            return true;
+    }
+    return false;
+}
+
+void CWalletScanFilter::Match(const CBlock& block, std::vector<bool>& vMatch) const
+{
+    vMatch.resize(block.vtx.size());
+    for (unsigned int i = 0; i < block.vtx.size(); i++)
+        vMatch[i] = IsRelevant(*block.vtx[i]);
+}
+
+bool CWalletScanFilter::MayMatch(const BlockFilter& blockFilter) const
+{
+    return blockFilter.GetFilter().MatchAny(setElements);
+}
+
+void CWallet::GetScanFilter(CWalletScanFilter& filter) const
+{
+    AssertLockHeld(cs_wallet); // mapWallet
+    filter.Clear();
+    std::set<CKeyID> setKeys;
+    GetKeys(setKeys);
+    BOOST_FOREACH(const CKeyID& keyid, setKeys) {
+        filter.AddID(keyid);
+        CPubKey pubkey;
+        if (!GetPubKey(keyid, pubkey))
+            continue;
+        filter.AddElement(GetScriptForRawPubKey(pubkey));
+        filter.AddElement(GetScriptForDestination(keyid));
+        if (pubkey.IsCompressed())
+            filter.AddElement(GetScriptForWitness(GetScriptForDestination(keyid)));
+    }
+    {
+        LOCK(cs_KeyStore);
+        for (ScriptMap::const_iterator it = mapScripts.begin(); it != mapScripts.end(); ++it) {
+            filter.AddID(it->first);
+            // Paid to as P2SH, bare, or P2WSH
+            filter.AddElement(GetScriptForDestination(CScriptID(it->second)));
+            filter.AddElement(it->second);
+            filter.AddElement(GetScriptForWitness(it->second));
+        }
+        BOOST_FOREACH(const CScript& script, setWatchOnly) {
+            filter.AddScript(script);
+            filter.AddElement(script);
+        }
+    }
+    // IsMine also accepts bare multisig scripts of which we hold all the keys.
+    // There are too many of those to list, but the ones our transactions pay
+    // to are enough to find where they are spent.
+    for (map<uint256, CWalletTx>::const_iterator it = mapWallet.begin(); it != mapWallet.end(); ++it) {
+        BOOST_FOREACH(const CTxOut& txout, it->second.tx->vout) {
+            std::vector<std::vector<unsigned char> > vSolutions;
+            txnouttype whichType;
+            if (Solver(txout.scriptPubKey, whichType, vSolutions) && whichType == TX_MULTISIG &&
+                ::IsMine(*this, txout.scriptPubKey) != ISMINE_NO)
+                filter.AddElement(txout.scriptPubKey);
+        }
+    }
+    filter.Finalize();
+}
+
+bool CWallet::IsRescanCandidate(const CTransaction& tx) const
+{
+    AssertLockHeld(cs_wallet);
+    if (mapWallet.count(tx.GetHash()))
+        return true;
+    BOOST_FOREACH(const CTxIn& txin, tx.vin) {
+        if (mapWallet.count(txin.prevout.hash) || mapTxSpends.count(txin.prevout))
+            return true;
+    }
+    return false;
+}
+
+namespace {
+
+/** A block on its way through a rescan */
+struct CRescanBlock
+{
+    CBlockIndex* pindex;
+    CDiskBlockPos pos;
+    uint256 hash;
+    bool fRead;
+    //! Not read, as its block filter rules out that it concerns us
+    bool fSkipped;
+    CBlock block;
+    //! Per transaction, whether the scan filter matched one of its outputs
+    std::vector<bool> vMatch;
+
+    CRescanBlock() : pindex(NULL), fRead(false), fSkipped(false) {}
+
+    void Read(const CWalletScanFilter& filter)
+    {
+        fSkipped = false;
+        fRead = ReadBlockFromDisk(block, pos, Params().GetConsensus()) && block.GetHash() == hash;
+        if (fRead)
+            filter.Match(block, vMatch);
+    }
+};
+
+/** Reads a block for a rescan and matches it against the scan filter, without locks */
+class CRescanBlockCheck
+{
+private:
+    CRescanBlock* pblock;
+    const CWalletScanFilter* pfilter;
+
+public:
+    CRescanBlockCheck() : pblock(NULL), pfilter(NULL) {}
+    CRescanBlockCheck(CRescanBlock* pblockIn, const CWalletScanFilter* pfilterIn) : pblock(pblockIn), pfilter(pfilterIn) {}
+
+    bool operator()()
+    {
+        // With -blockfilterindex, most blocks need not be read at all.
+        BlockFilter blockFilter;
+        if (pblockfilterindex && pblockfilterindex->LookupFilter(pblock->hash, blockFilter) &&
+            !pfilter->MayMatch(blockFilter)) {
+            pblock->fRead = false;
+            pblock->fSkipped = true;
+            return true;
+        }
+
+        // Failures are dealt with by the scanning thread, which may have
+        // to stop; the other blocks of the batch are read regardless.
+        pblock->Read(*pfilter);
+        return true;
+    }
+
+    void swap(CRescanBlockCheck& check)
+    {
+        std::swap(pblock, check.pblock);
+        std::swap(pfilter, check.pfilter);
+    }
+};
+
+/** The worker threads of a rescan, stopped when it ends */
+class CRescanThreads
+{
+private:
+    boost::thread_group threadGroup;
+
+public:
+    CRescanThreads(CCheckQueue<CRescanBlockCheck>& queue, int nThreads)
+    {
+        for (int i = 0; i < nThreads; i++)
+            threadGroup.create_thread(boost::bind(&CCheckQueue<CRescanBlockCheck>::Thread, &queue));
+    }
+
+    ~CRescanThreads()
+    {
+        threadGroup.interrupt_all();
+        threadGroup.join_all();
+    }
+};
+
+} // anon namespace
+
 /**
  * Scan the block chain (starting in pindexStart) for transactions
  * from or to us. If fUpdate is true, found transactions that already
  * exist in the wallet will be updated.
+ *
+ * Blocks are taken off the active chain RESCAN_BATCH_SIZE at a time. They
+ * are read from disk and matched against the scan filter on -rescanthreads
+ * threads without holding any lock, and only then are cs_main and
+ * cs_wallet taken to add the transactions of the batch that may concern
+ * us. Blocks that were disconnected in the meantime are skipped, and the
+ * scan continues from the fork on the new chain.
+ *
+ * With -blockfilterindex, blocks whose filter has none of the wallet's
+ * scripts are not read. Such a block can still hold a transaction that
+ * conflicts with one of ours which was not funded by us; like spends of
+ * outputs we do not know to be ours, those are only found by a full rescan
+ * without the index. So are payments to bare multisig scripts of which we
+ * hold all the keys, unless a wallet transaction already pays to the same
+ * script, as the scan filter cannot list every combination of our keys.
+ *
+ * Returns the number of transactions added or updated.
  */
 int CWallet::ScanForWalletTransactions(CBlockIndex* pindexStart, bool fUpdate)
 {
@@ -1469,7 +1734,24 @@ int CWallet::ScanForWalletTransactions(CBlockIndex* pindexStart, bool fUpdate)
     int64_t nNow = GetTime();
     const CChainParams& chainParams = Params();
 
+    // Another rescan would interleave its batches with ours
+    LOCK(cs_rescan);
+
+    int nThreads = GetArg("-rescanthreads", DEFAULT_RESCAN_THREADS);
+    if (nThreads <= 0)
+        nThreads += GetNumCores();
+    nThreads = std::max(1, std::min(nThreads, MAX_RESCAN_THREADS));
+
+    // This thread reads blocks too, while it waits for a batch
+    CCheckQueue<CRescanBlockCheck> queue(1);
+    CRescanThreads threads(queue, nThreads - 1);
+
+    CWalletScanFilter filter;
+    unsigned int nFilterUpdates;
+    std::vector<CRescanBlock> vBlocks(RESCAN_BATCH_SIZE);
+
     CBlockIndex* pindex = pindexStart;
+    double dProgressStart, dProgressTip;
     {
         LOCK2(cs_main, cs_wallet);
 
@@ -1478,30 +1760,101 @@ int CWallet::ScanForWalletTransactions(CBlockIndex* pindexStart, bool fUpdate)
         while (pindex && nTimeFirstKey && (pindex->GetBlockTime() < (nTimeFirstKey - 7200)))
             pindex = chainActive.Next(pindex);
 
-        ShowProgress(_("Rescanning..."), 0); // show rescan progress in GUI as dialog or on splashscreen, if -rescan on startup
-        double dProgressStart = Checkpoints::GuessVerificationProgress(chainParams.Checkpoints(), pindex, false);
-        double dProgressTip = Checkpoints::GuessVerificationProgress(chainParams.Checkpoints(), chainActive.Tip(), false);
-        while (pindex)
+        dProgressStart = Checkpoints::GuessVerificationProgress(chainParams.Checkpoints(), pindex, false);
+        dProgressTip = Checkpoints::GuessVerificationProgress(chainParams.Checkpoints(), chainActive.Tip(), false);
+
+        nFilterUpdates = nKeyStoreUpdates;
+        GetScanFilter(filter);
+    }
+
+    LogPrintf("Rescanning with %d threads\n", nThreads);
+    nScanStartTime = GetTimeMillis();
+    nScannedBlocks = 0;
+    nScanHeight = pindex ? pindex->nHeight - 1 : -1;
+    dScanProgress = 0.0;
+    fScanningWallet = true;
+    ShowProgress(_("Rescanning..."), 0); // show rescan progress in GUI as dialog or on splashscreen, if -rescan on startup
+    while (pindex)
+    {
+        unsigned int nBlocks = 0;
         {
-            if (pindex->nHeight % 100 == 0 && dProgressTip - dProgressStart > 0.0)
-                ShowProgress(_("Rescanning..."), std::max(1, std::min(99, (int)((Checkpoints::GuessVerificationProgress(chainParams.Checkpoints(), pindex, false) - dProgressStart) / (dProgressTip - dProgressStart) * 100))));
+            LOCK(cs_main);
+            if (!chainActive.Contains(pindex))
+                pindex = chainActive.Next(chainActive.FindFork(pindex));
+            for (; pindex && nBlocks < vBlocks.size(); pindex = chainActive.Next(pindex), nBlocks++) {
+                vBlocks[nBlocks].pindex = pindex;
+                vBlocks[nBlocks].pos = pindex->GetBlockPos();
+                vBlocks[nBlocks].hash = pindex->GetBlockHash();
+            }
+        }
+        if (nBlocks == 0)
+            break;
 
-            CBlock block;
-            ReadBlockFromDisk(block, pindex, Params().GetConsensus());
-            int posInBlock;
-            for (posInBlock = 0; posInBlock < (int)block.vtx.size(); posInBlock++)
-            {
-                if (AddToWalletIfInvolvingMe(*block.vtx[posInBlock], pindex, posInBlock, fUpdate))
-                    ret++;
+        std::vector<CRescanBlockCheck> vChecks;
+        vChecks.reserve(nBlocks);
+        for (unsigned int i = 0; i < nBlocks; i++)
+            vChecks.push_back(CRescanBlockCheck(&vBlocks[i], &filter));
+        queue.Add(vChecks);
+        queue.Wait();
+
+        CBlockIndex* pindexLast = NULL;
+        {
+            LOCK2(cs_main, cs_wallet);
+
+            if (nFilterUpdates != nKeyStoreUpdates) {
+                // Keys were added while the batch was being read
+                nFilterUpdates = nKeyStoreUpdates;
+                GetScanFilter(filter);
+                for (unsigned int i = 0; i < nBlocks; i++) {
+                    if (vBlocks[i].fSkipped)
+                        vBlocks[i].Read(filter);
+                    else if (vBlocks[i].fRead)
+                        filter.Match(vBlocks[i].block, vBlocks[i].vMatch);
+                }
             }
-            pindex = chainActive.Next(pindex);
-            if (GetTime() >= nNow + 60) {
-                nNow = GetTime();
-                LogPrintf("Still rescanning. At block %d. Progress=%f\n", pindex->nHeight, Checkpoints::GuessVerificationProgress(chainParams.Checkpoints(), pindex));
+
+            for (unsigned int i = 0; i < nBlocks; i++) {
+                CRescanBlock& rescanBlock = vBlocks[i];
+                if (!chainActive.Contains(rescanBlock.pindex)) {
+                    // Reorganized away since the batch was taken
+                    pindex = chainActive.Next(chainActive.FindFork(rescanBlock.pindex));
+                    break;
+                }
+                pindexLast = rescanBlock.pindex;
+                if (rescanBlock.fSkipped)
+                    continue;
+                if (!rescanBlock.fRead) {
+                    LogPrintf("%s: failed to read block %s at height %d, skipping\n", __func__, rescanBlock.hash.ToString(), rescanBlock.pindex->nHeight);
+                    continue;
+                }
+                const CBlock& block = rescanBlock.block;
+                for (int posInBlock = 0; posInBlock < (int)block.vtx.size(); posInBlock++)
+                {
+                    if (!rescanBlock.vMatch[posInBlock] && !IsRescanCandidate(*block.vtx[posInBlock]))
+                        continue;
+                    if (AddToWalletIfInvolvingMe(*block.vtx[posInBlock], rescanBlock.pindex, posInBlock, fUpdate))
+                        ret++;
+                }
+            }
+
+            if (pindexLast) {
+                nScanHeight = pindexLast->nHeight;
+                if (dProgressTip - dProgressStart > 0.0)
+                    dScanProgress = std::max(0.0, std::min(1.0, (Checkpoints::GuessVerificationProgress(chainParams.Checkpoints(), pindexLast, false) - dProgressStart) / (dProgressTip - dProgressStart)));
             }
         }
-        ShowProgress(_("Rescanning..."), 100); // hide progress dialog in GUI
+        nScannedBlocks += nBlocks;
+        for (unsigned int i = 0; i < nBlocks; i++)
+            vBlocks[i].block.SetNull();
+
+        ShowProgress(_("Rescanning..."), std::max(1, std::min(99, (int)(dScanProgress * 100))));
+        if (GetTime() >= nNow + 60) {
+            nNow = GetTime();
+            LogPrintf("Still rescanning. At block %d. Progress=%f\n", nScanHeight, dScanProgress.load());
+        }
     }
+    fScanningWallet = false;
+    ShowProgress(_("Rescanning..."), 100); // hide progress dialog in GUI
     return ret;
 }
 
@@ -1839,94 +2192,108 @@ void CWallet::ResendWalletTransactions(int64_t nBestBlockTime, CConnman* connman
  */
 
 
-CAmount CWallet::GetBalance() const
+const std::set<uint256>& CWallet::GetCoinCandidates() const
 {
-    CAmount nTotal = 0;
-    {
-        LOCK2(cs_main, cs_wallet);
+    AssertLockHeld(cs_main);
+    AssertLockHeld(cs_wallet);
+
+    // Imported keys and scripts may make old outputs ours
+    if (!fCoinCandidatesValid || nCoinCandidatesKeyImports != nKeyImports) {
+        setCoinCandidates.clear();
         for (map<uint256, CWalletTx>::const_iterator it = mapWallet.begin(); it != mapWallet.end(); ++it)
-        {
-            const CWalletTx* pcoin = &(*it).second;
-            if (pcoin->IsTrusted())
-                nTotal += pcoin->GetAvailableCredit();
+            setCoinCandidates.insert(setCoinCandidates.end(), it->first);
+        nCoinCandidatesKeyImports = nKeyImports;
+        fCoinCandidatesValid = true;
+    }
+
+    std::set<uint256>::iterator it = setCoinCandidates.begin();
+    while (it != setCoinCandidates.end()) {
+        map<uint256, CWalletTx>::const_iterator mi = mapWallet.find(*it);
+        bool fKeep = false;
+        if (mi != mapWallet.end()) {
+            const CWalletTx& wtx = mi->second;
+            // Immature coinbases count towards the immature balance, spent or not
+            fKeep = wtx.IsCoinBase() && wtx.GetBlocksToMaturity() > 0;
+            for (unsigned int i = 0; i < wtx.tx->vout.size() && !fKeep; i++)
+                fKeep = !IsSpent(*it, i) && IsMine(wtx.tx->vout[i]) != ISMINE_NO;
         }
+        if (fKeep)
+            ++it;
+        else
+            setCoinCandidates.erase(it++);
     }
-
-    return nTotal;
+    return setCoinCandidates;
 }
 
-CAmount CWallet::GetUnconfirmedBalance() const
+const CWallet::CBalanceCache& CWallet::GetCachedBalances() const
 {
-    CAmount nTotal = 0;
+    AssertLockHeld(cs_main);
+    AssertLockHeld(cs_wallet);
+
+    // Trust and depth of wallet transactions depend on the chain and the mempool too
+    CBalanceCache& cache = cachedBalances;
+    if (cache.fValid && cache.nWalletUpdates == nWalletUpdates && cache.nKeyImports == nKeyImports &&
+        cache.pindexTip == chainActive.Tip() && cache.nMempoolUpdates == mempool.GetTransactionsUpdated())
+        return cache;
+
+    cache.nBalance = cache.nUnconfirmed = cache.nImmature = 0;
+    cache.nWatchOnly = cache.nUnconfirmedWatchOnly = cache.nImmatureWatchOnly = 0;
+    BOOST_FOREACH(const uint256& hash, GetCoinCandidates())
     {
-        LOCK2(cs_main, cs_wallet);
-        for (map<uint256, CWalletTx>::const_iterator it = mapWallet.begin(); it != mapWallet.end(); ++it)
-        {
-            const CWalletTx* pcoin = &(*it).second;
-            if (!pcoin->IsTrusted() && pcoin->GetDepthInMainChain() == 0 && pcoin->InMempool())
-                nTotal += pcoin->GetAvailableCredit();
+        const CWalletTx* pcoin = &mapWallet.find(hash)->second;
+        if (pcoin->IsTrusted()) {
+            cache.nBalance += pcoin->GetAvailableCredit();
+            cache.nWatchOnly += pcoin->GetAvailableWatchOnlyCredit();
+        } else if (pcoin->GetDepthInMainChain() == 0 && pcoin->InMempool()) {
+            cache.nUnconfirmed += pcoin->GetAvailableCredit();
+            cache.nUnconfirmedWatchOnly += pcoin->GetAvailableWatchOnlyCredit();
         }
+        cache.nImmature += pcoin->GetImmatureCredit();
+        cache.nImmatureWatchOnly += pcoin->GetImmatureWatchOnlyCredit();
     }
-    return nTotal;
+
+    cache.nWalletUpdates = nWalletUpdates;
+    cache.nKeyImports = nKeyImports;
+    cache.pindexTip = chainActive.Tip();
+    cache.nMempoolUpdates = mempool.GetTransactionsUpdated();
+    cache.fValid = true;
+    return cache;
+}
+
+CAmount CWallet::GetBalance() const
+{
+    LOCK2(cs_main, cs_wallet);
+    return GetCachedBalances().nBalance;
+}
+
+CAmount CWallet::GetUnconfirmedBalance() const
+{
+    LOCK2(cs_main, cs_wallet);
+    return GetCachedBalances().nUnconfirmed;
 }
 
 CAmount CWallet::GetImmatureBalance() const
 {
-    CAmount nTotal = 0;
-    {
-        LOCK2(cs_main, cs_wallet);
-        for (map<uint256, CWalletTx>::const_iterator it = mapWallet.begin(); it != mapWallet.end(); ++it)
-        {
-            const CWalletTx* pcoin = &(*it).second;
-            nTotal += pcoin->GetImmatureCredit();
-        }
-    }
-    return nTotal;
+    LOCK2(cs_main, cs_wallet);
+    return GetCachedBalances().nImmature;
 }
 
 CAmount CWallet::GetWatchOnlyBalance() const
 {
-    CAmount nTotal = 0;
-    {
-        LOCK2(cs_main, cs_wallet);
-        for (map<uint256, CWalletTx>::const_iterator it = mapWallet.begin(); it != mapWallet.end(); ++it)
-        {
-            const CWalletTx* pcoin = &(*it).second;
-            if (pcoin->IsTrusted())
-                nTotal += pcoin->GetAvailableWatchOnlyCredit();
-        }
-    }
-
-    return nTotal;
+    LOCK2(cs_main, cs_wallet);
+    return GetCachedBalances().nWatchOnly;
 }
 
 CAmount CWallet::GetUnconfirmedWatchOnlyBalance() const
 {
-    CAmount nTotal = 0;
-    {
-        LOCK2(cs_main, cs_wallet);
-        for (map<uint256, CWalletTx>::const_iterator it = mapWallet.begin(); it != mapWallet.end(); ++it)
-        {
-            const CWalletTx* pcoin = &(*it).second;
-            if (!pcoin->IsTrusted() && pcoin->GetDepthInMainChain() == 0 && pcoin->InMempool())
-                nTotal += pcoin->GetAvailableWatchOnlyCredit();
-        }
-    }
-    return nTotal;
+    LOCK2(cs_main, cs_wallet);
+    return GetCachedBalances().nUnconfirmedWatchOnly;
 }
 
 CAmount CWallet::GetImmatureWatchOnlyBalance() const
 {
-    CAmount nTotal = 0;
-    {
-        LOCK2(cs_main, cs_wallet);
-        for (map<uint256, CWalletTx>::const_iterator it = mapWallet.begin(); it != mapWallet.end(); ++it)
-        {
-            const CWalletTx* pcoin = &(*it).second;
-            nTotal += pcoin->GetImmatureWatchOnlyCredit();
-        }
-    }
-    return nTotal;
+    LOCK2(cs_main, cs_wallet);
+    return GetCachedBalances().nImmatureWatchOnly;
 }
 
 void CWallet::AvailableCoins(vector<COutput>& vCoins, bool fOnlyConfirmed, const CCoinControl *coinControl, bool fIncludeZeroValue) const
@@ -1935,10 +2302,9 @@ void CWallet::AvailableCoins(vector<COutput>& vCoins, bool fOnlyConfirmed, const
 
     {
         LOCK2(cs_main, cs_wallet);
-        for (map<uint256, CWalletTx>::const_iterator it = mapWallet.begin(); it != mapWallet.end(); ++it)
+        BOOST_FOREACH(const uint256& wtxid, GetCoinCandidates())
         {
-            const uint256& wtxid = it->first;
-            const CWalletTx* pcoin = &(*it).second;
+            const CWalletTx* pcoin = &mapWallet.find(wtxid)->second;
 
             if (!CheckFinalTx(*pcoin))
                 continue;
@@ -1961,8 +2327,8 @@ void CWallet::AvailableCoins(vector<COutput>& vCoins, bool fOnlyConfirmed, const
             for (unsigned int i = 0; i < pcoin->tx->vout.size(); i++) {
                 isminetype mine = IsMine(pcoin->tx->vout[i]);
                 if (!(IsSpent(wtxid, i)) && mine != ISMINE_NO &&
-                    !IsLockedCoin((*it).first, i) && (pcoin->tx->vout[i].nValue > 0 || fIncludeZeroValue) &&
-                    (!coinControl || !coinControl->HasSelected() || coinControl->fAllowOtherInputs || coinControl->IsSelected(COutPoint((*it).first, i))))
+                    !IsLockedCoin(wtxid, i) && (pcoin->tx->vout[i].nValue > 0 || fIncludeZeroValue) &&
+                    (!coinControl || !coinControl->HasSelected() || coinControl->fAllowOtherInputs || coinControl->IsSelected(COutPoint(wtxid, i))))
                         vCoins.push_back(COutput(pcoin, i, nDepth,
                                                  ((mine & ISMINE_SPENDABLE) != ISMINE_NO) ||
                                                   (coinControl && coinControl->fAllowWatchOnly && (mine & ISMINE_WATCH_SOLVABLE) != ISMINE_NO),
@@ -2570,6 +2936,7 @@ bool CWallet::CreateTransaction(const vector<CRecipient>& vecSend, CWalletTx& wt
         size_t nLimitDescendants = GetArg("-limitdescendantcount", DEFAULT_DESCENDANT_LIMIT);
         size_t nLimitDescendantSize = GetArg("-limitdescendantsize", DEFAULT_DESCENDANT_SIZE_LIMIT)*1000;
         std::string errString;
+        LOCK(mempool.cs);
         if (!mempool.CalculateMemPoolAncestors(entry, setAncestors, nLimitAncestors, nLimitAncestorSize, nLimitDescendants, nLimitDescendantSize, errString)) {
             strFailReason = _("Transaction has too long of a mempool chain");
             return false;
@@ -3378,6 +3745,7 @@ std::string CWallet::GetWalletHelpString(bool showDebug)
     strUsage += HelpMessageOpt("-paytxfee=<amt>", strprintf(_("Fee (in %s/kB) to add to transactions you send (default: %s)"),
                                                             CURRENCY_UNIT, FormatMoney(payTxFee.GetFeePerK())));
     strUsage += HelpMessageOpt("-rescan", _("Rescan the block chain for missing wallet transactions on startup"));
+    strUsage += HelpMessageOpt("-rescanthreads=<n>", strprintf(_("Set the number of threads reading blocks for wallet rescans (%u to %d, 0 = auto, <0 = leave that many cores free, default: %d)"), 1, MAX_RESCAN_THREADS, DEFAULT_RESCAN_THREADS));
     strUsage += HelpMessageOpt("-salvagewallet", _("Attempt to recover private keys from a corrupt wallet on startup"));
     if (showDebug)
         strUsage += HelpMessageOpt("-sendfreetransactions", strprintf(_("Send transactions as zero-fee transactions if possible (default: %u)"), DEFAULT_SEND_FREE_TRANSACTIONS));
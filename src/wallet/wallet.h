@@ -7,6 +7,7 @@
 #define BITCOIN_WALLET_WALLET_H
 
 #include "amount.h"
+#include "blockfilter.h"
 #include "streams.h"
 #include "tinyformat.h"
 #include "ui_interface.h"
@@ -18,6 +19,7 @@
 #include "wallet/rpcwallet.h"
 
 #include <algorithm>
+#include <atomic>
 #include <map>
 #include <set>
 #include <stdexcept>
@@ -65,6 +67,12 @@ static const bool DEFAULT_WALLETBROADCAST = true;
 static const bool DEFAULT_DISABLE_WALLET = false;
 //! if set, all keys will be derived by using BIP32
 static const bool DEFAULT_USE_HD_WALLET = true;
+//! -rescanthreads default (0 = one per core)
+static const int DEFAULT_RESCAN_THREADS = 0;
+//! Maximum number of threads reading blocks for a rescan
+static const int MAX_RESCAN_THREADS = 16;
+//! Number of blocks read between two acquisitions of cs_main during a rescan
+static const unsigned int RESCAN_BATCH_SIZE = 32;
 
 extern const char * DEFAULT_WALLET_DAT;
 
@@ -551,6 +559,42 @@ private:
 };
 
 
+/**
+ * The key IDs and script IDs of a wallet's keys and scripts, and its
+ * watch-only scripts: enough to tell which outputs may pay to the wallet
+ * without asking the wallet itself. Rescans match the outputs of the blocks
+ * they read against it on several threads, without holding cs_wallet, and
+ * leave only the matches (and spends of wallet outputs) for
+ * AddToWalletIfInvolvingMe. It may match more outputs than IsMine does, but
+ * never fewer.
+ */
+class CWalletScanFilter
+{
+private:
+    //! Sorted and unique after Finalize
+    std::vector<uint160> vIDs;
+    std::set<CScript> setScripts;
+    //! The wallet's scriptPubKeys, to match against block filters
+    GCSFilter::ElementSet setElements;
+
+    bool HaveID(const uint160& id) const;
+
+public:
+    void Clear();
+    void AddID(const uint160& id) { vIDs.push_back(id); }
+    void AddScript(const CScript& script) { setScripts.insert(script); }
+    void AddElement(const CScript& script) { setElements.insert(GCSFilter::Element(script.begin(), script.end())); }
+    //! Prepare for matching, after adding IDs
+    void Finalize();
+
+    bool IsRelevant(const CScript& scriptPubKey) const;
+    bool IsRelevant(const CTransaction& tx) const;
+    //! Set vMatch[i] to whether any output of block.vtx[i] is relevant
+    void Match(const CBlock& block, std::vector<bool>& vMatch) const;
+    //! Whether a block with this BIP 158 filter may create or spend outputs of ours
+    bool MayMatch(const BlockFilter& blockFilter) const;
+};
+
 /** 
  * A CWallet is an extension of a keystore, which also maintains a set of transactions and balances,
  * and provides the ability to create new transactions.
@@ -592,12 +636,66 @@ private:
 
     void SyncMetaData(std::pair<TxSpends::iterator, TxSpends::iterator>);
 
+    /**
+     * Wallet transactions that may still have unspent outputs of ours, so that
+     * AvailableCoins and the balances need not walk all of mapWallet. This is a
+     * superset: transactions are added when they are added to the wallet or
+     * updated, and when a transaction spending them gets conflicted or
+     * abandoned, and are only dropped once all our outputs are spent. The set
+     * is rebuilt when keys or scripts are imported, or transactions removed.
+     */
+    mutable std::set<uint256> setCoinCandidates;
+    mutable bool fCoinCandidatesValid;
+    mutable unsigned int nCoinCandidatesKeyImports;
+    /**
+     * Bumped when keys, scripts or watch-only scripts are imported, which can
+     * make outputs of transactions already in the wallet ours. Keys drawn
+     * from the keypool cannot, and do not count.
+     */
+    unsigned int nKeyImports;
+
+    /** Drop the candidates with nothing left to spend, rebuilding the set first if it is stale. */
+    const std::set<uint256>& GetCoinCandidates() const;
+
+    /** Bumped whenever a wallet transaction or a watch-only script changes, to invalidate cachedBalances. */
+    unsigned int nWalletUpdates;
+
+    /** The balances, computed together in one pass over the coin candidates, and the state they were computed for */
+    struct CBalanceCache
+    {
+        bool fValid;
+        unsigned int nWalletUpdates;
+        unsigned int nKeyImports;
+        const CBlockIndex* pindexTip;
+        unsigned int nMempoolUpdates;
+
+        CAmount nBalance;
+        CAmount nUnconfirmed;
+        CAmount nImmature;
+        CAmount nWatchOnly;
+        CAmount nUnconfirmedWatchOnly;
+        CAmount nImmatureWatchOnly;
+
+        CBalanceCache() : fValid(false) {}
+    };
+    mutable CBalanceCache cachedBalances;
+    const CBalanceCache& GetCachedBalances() const;
+
     /* the HD chain data model (external chain counters) */
     CHDChain hdChain;
 
     bool fFileBacked;
 
     std::set<int64_t> setKeyPool;
+
+    /** Serializes rescans, which release cs_main and cs_wallet between batches of blocks. */
+    CCriticalSection cs_rescan;
+
+    /** Bumped whenever a key, script or watch-only script is added, to refresh rescan filters. */
+    std::atomic<unsigned int> nKeyStoreUpdates;
+
+    /** Whether tx is a wallet transaction or spends an outpoint that a wallet transaction spends or creates. */
+    bool IsRescanCandidate(const CTransaction& tx) const;
 public:
     /*
      * Main wallet lock.
@@ -657,6 +755,16 @@ public:
         nLastResend = 0;
         nTimeFirstKey = 0;
         fBroadcastTransactions = false;
+        nKeyStoreUpdates = 0;
+        fCoinCandidatesValid = false;
+        nCoinCandidatesKeyImports = 0;
+        nKeyImports = 0;
+        nWalletUpdates = 0;
+        fScanningWallet = false;
+        nScanStartTime = 0;
+        nScanHeight = -1;
+        nScannedBlocks = 0;
+        dScanProgress = 0.0;
     }
 
     std::map<uint256, CWalletTx> mapWallet;
@@ -677,6 +785,13 @@ public:
 
     int64_t nTimeFirstKey;
 
+    //! Progress of the running rescan, if fScanningWallet. Readable without locks.
+    std::atomic<bool> fScanningWallet;
+    std::atomic<int64_t> nScanStartTime;
+    std::atomic<int> nScanHeight;
+    std::atomic<int64_t> nScannedBlocks;
+    std::atomic<double> dScanProgress;
+
     const CWalletTx* GetWalletTx(const uint256& hash) const;
 
     //! check whether we are allowed to upgrade (or already support) to the named feature
@@ -711,6 +826,10 @@ public:
     void DeriveNewChildKey(CKeyMetadata& metadata, CKey& secret);
     //! Adds a key to the store, and saves it to disk.
     bool AddKeyPubKey(const CKey& key, const CPubKey &pubkey);
+    //! Adds an imported key, which unlike keypool keys may already be paid by wallet transactions
+    bool ImportKey(const CKey& key, const CPubKey &pubkey);
+    //! The number of keys and scripts imported so far
+    unsigned int GetKeyImports() const { AssertLockHeld(cs_wallet); return nKeyImports; }
     //! Adds a key to the store, without saving it to disk (used by LoadWallet)
     bool LoadKey(const CKey& key, const CPubKey &pubkey) { return CCryptoKeyStore::AddKeyPubKey(key, pubkey); }
     //! Load metadata (used by LoadWallet)
@@ -760,7 +879,16 @@ public:
     bool LoadToWallet(const CWalletTx& wtxIn);
     void SyncTransaction(const CTransaction& tx, const CBlockIndex *pindex, int posInBlock);
     bool AddToWalletIfInvolvingMe(const CTransaction& tx, const CBlockIndex* pIndex, int posInBlock, bool fUpdate);
+    /**
+     * Scan the active chain from pindexStart for wallet transactions. Blocks
+     * are read and their outputs matched against a CWalletScanFilter on
+     * -rescanthreads threads, RESCAN_BATCH_SIZE at a time, with cs_main and
+     * cs_wallet only taken to add the candidates of a batch. Must be called
+     * without holding either lock.
+     */
     int ScanForWalletTransactions(CBlockIndex* pindexStart, bool fUpdate = false);
+    //! Fill filter with the wallet's keys, scripts and watch-only scripts, and the bare multisig scripts it was paid to
+    void GetScanFilter(CWalletScanFilter& filter) const;
     void ReacceptWalletTransactions();
     void ResendWalletTransactions(int64_t nBestBlockTime, CConnman* connman);
     std::vector<uint256> ResendWalletTransactionsBefore(int64_t nTime, CConnman* connman);